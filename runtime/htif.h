@@ -14,9 +14,24 @@
 
 #include <stdint.h>
 
-#define SYS_exit 93
+#define SYS_openat 56
+#define SYS_close 57
+#define SYS_lseek 62
 #define SYS_read 63
 #define SYS_write 64
+#define SYS_fstat 80
+#define SYS_exit 93
+#define SYS_gettimeofday 169
+#define SYS_brk 214
+
+// Hypercalls specific to rvsim.
+#define SYS_rvsim_trace_start 1024
+#define SYS_rvsim_trace_stop 1025
+#define SYS_rvsim_roi_begin 1026
+#define SYS_rvsim_roi_end 1027
+#define SYS_rvsim_stats_reset 1028
+#define SYS_rvsim_stats_dump 1029
+#define SYS_rvsim_checkpoint 1030
 
 uintptr_t syscall(uintptr_t n, uintptr_t a0, uintptr_t a1, uintptr_t a2,
                   uintptr_t a3, uintptr_t a4, uintptr_t a5, uintptr_t a6);
@@ -0,0 +1,34 @@
+// Copyright 2023 lowRISC contributors.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Hypercalls that a program can make to control its own measurement under
+// rvsim. Each is a reserved HTIF system call, and has no other effect.
+
+#include "htif.h"
+
+// Begin and end the region of interest, outside of which the run is not
+// observed when rvsim is given --roi.
+#define RVSIM_ROI_BEGIN() syscall(SYS_rvsim_roi_begin, 0, 0, 0, 0, 0, 0, 0)
+#define RVSIM_ROI_END() syscall(SYS_rvsim_roi_end, 0, 0, 0, 0, 0, 0, 0)
+
+// Discard or write out the statistics and profiles collected so far.
+#define RVSIM_STATS_RESET() syscall(SYS_rvsim_stats_reset, 0, 0, 0, 0, 0, 0, 0)
+#define RVSIM_STATS_DUMP() syscall(SYS_rvsim_stats_dump, 0, 0, 0, 0, 0, 0, 0)
+
+// Start and stop tracing, with --trace-from hypercall.
+#define RVSIM_TRACE_START() syscall(SYS_rvsim_trace_start, 0, 0, 0, 0, 0, 0, 0)
+#define RVSIM_TRACE_STOP() syscall(SYS_rvsim_trace_stop, 0, 0, 0, 0, 0, 0, 0)
+
+// Write a checkpoint and stop, with --checkpoint and no --checkpoint-at.
+#define RVSIM_CHECKPOINT() syscall(SYS_rvsim_checkpoint, 0, 0, 0, 0, 0, 0, 0)
@@ -17,7 +17,7 @@
 
 void *memset(void *s, int c, size_t n) {
     for(size_t i = 0; i < n; ++i) {
-        ((char*)s)[i] = 0;
+        ((char*)s)[i] = c;
     }
     return s;
 }
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "HartState.hpp"
+#include "Plugin.hpp"
+
+namespace rvsim {
+
+/// Collects basic block vectors for SimPoint, as an observer policy of the
+/// executor. A dynamic basic block begins at the target of a branch or jump
+/// and ends at the next one, and is identified by its first address. For
+/// each interval of about a given number of instructions, ending at a block
+/// boundary, the instructions executed in each block are written in the
+/// SimPoint .bb format, as a line "T:id:count :id:count ...", with block ids
+/// numbered from 1 in the order blocks are first seen.
+class BasicBlockVectors : public ObserverPolicy {
+  std::ofstream file;
+  uint64_t interval;
+  uint64_t intervalEnd;
+  uint32_t blockStart;
+  uint64_t blockStartCycle;
+  std::unordered_map<uint32_t, uint32_t> blockIds;
+  // The instructions executed in each block in this interval, by id, and
+  // the ids with non-zero counts.
+  std::vector<uint64_t> counts;
+  std::vector<uint32_t> touched;
+  uint64_t intervalCount;
+  // Whether the run is in the region of interest, and the cycle at which
+  // the region last ended.
+  bool inRoi;
+  uint64_t roiEndCycle;
+
+  void addBlock(uint64_t cycle);
+  void endInterval(uint64_t cycle);
+
+public:
+  static constexpr unsigned HOOKS = HOOK_BRANCH | HOOK_EXIT | HOOK_CONTROL;
+
+  /// Begin collecting from the current state, writing to a file.
+  BasicBlockVectors(const std::string &filename, uint64_t interval, const HartState &state);
+
+  void branch(const HartState &state, uint32_t pc, uint32_t target, bool taken) {
+    // The branch has not yet been counted as a cycle.
+    auto cycle = state.cycleCount + 1;
+    addBlock(cycle);
+    blockStart = state.pc;
+    blockStartCycle = cycle;
+    if (cycle >= intervalEnd) {
+      endInterval(cycle);
+    }
+  }
+
+  void exit(const HartState &state, bool trapped, uint32_t exitCode) {
+    finish(state);
+  }
+
+  /// Leave the cycles outside of the region of interest out of the vectors,
+  /// and end or discard the current interval when requested.
+  void control(const HartState &state, Control request);
+
+  /// Write the last, partial interval. This is done on exit, and must be
+  /// done by the driver if the run stops otherwise.
+  void finish(const HartState &state);
+
+  uint64_t getIntervalCount() const { return intervalCount; }
+  size_t getBlockCount() const { return blockIds.size(); }
+};
+
+} // End namespace rvsim
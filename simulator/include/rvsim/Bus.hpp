@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "Device.hpp"
+#include "Exception.hpp"
+#include "Memory.hpp"
+
+namespace rvsim {
+
+/// The memory-mapped devices that lie outside of RAM. Accesses to RAM are
+/// performed directly on Memory, and only those that miss it are looked up
+/// here.
+class Bus {
+  std::vector<std::unique_ptr<Device>> devices;
+
+public:
+  bool empty() const { return devices.empty(); }
+
+  /// Map a device, which must not overlap RAM or another device.
+  Device *attach(std::unique_ptr<Device> device, Memory &memory) {
+    auto end = static_cast<uint64_t>(device->base) + device->size;
+    auto overlaps = [&](uint64_t base, uint64_t size) {
+      return device->base < base + size && base < end;
+    };
+    if (overlaps(memory.baseAddress, memory.sizeInBytes())) {
+      throw Exception(fmt::format("device {} at {:#x} overlaps memory",
+                                  device->name, device->base));
+    }
+    for (auto &other : devices) {
+      if (overlaps(other->base, other->size)) {
+        throw Exception(fmt::format("device {} at {:#x} overlaps device {}",
+                                    device->name, device->base, other->name));
+      }
+    }
+    devices.push_back(std::move(device));
+    return devices.back().get();
+  }
+
+  /// Return the device that contains a range of addresses, or nullptr if
+  /// there is none.
+  Device *find(uint32_t address, unsigned length) {
+    for (auto &device : devices) {
+      auto offset = address - device->base;
+      if (address >= device->base && offset < device->size &&
+          length <= device->size - offset) {
+        return device.get();
+      }
+    }
+    return nullptr;
+  }
+};
+
+} // End namespace rvsim
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+
+#include "Executor.hpp"
+
+namespace rvsim {
+
+/// Write the architectural state of the hart, the contents of memory, the
+/// HTIF addresses and the program break to a file, so that a run can be
+/// resumed from it later, for example at a simulation point chosen from
+/// basic block vectors. Devices and files other than the console are not
+/// part of a checkpoint, so one cannot be taken with devices attached.
+void saveCheckpoint(const std::string &path, Executor &executor);
+
+/// Restore a checkpoint into an executor whose memory has the same layout,
+/// mapping its memory contents copy-on-write.
+void restoreCheckpoint(const std::string &path, Executor &executor);
+
+} // End namespace rvsim
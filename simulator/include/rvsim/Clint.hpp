@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Device.hpp"
+#include "EventQueue.hpp"
+#include "HartState.hpp"
+
+namespace rvsim {
+
+// The conventional location of the CLINT, as used by Spike and QEMU.
+const uint32_t CLINT_BASE_ADDRESS = 0x02000000;
+const uint32_t CLINT_SIZE         = 0x10000;
+
+/// A core-local interruptor with the SiFive register layout, providing the
+/// software interrupt bit msip and the machine timer. mtime advances by one
+/// for every cycle, and reaching mtimecmp is scheduled as an event rather
+/// than compared on every step.
+class Clint : public Device {
+  HartState &state;
+  EventQueue &events;
+  uint64_t mtimecmp;
+  // The difference between mtime and the cycle count, which changes when
+  // mtime is written.
+  uint64_t mtimeOffset;
+
+  uint64_t mtime() const { return state.cycleCount + mtimeOffset; }
+  void setPending(uint32_t bit, bool pending);
+  void updateTimer();
+
+public:
+  Clint(HartState &state, EventQueue &events,
+        uint32_t base = CLINT_BASE_ADDRESS);
+
+  uint32_t read(uint32_t offset, unsigned length) override;
+  void write(uint32_t offset, unsigned length, uint32_t value) override;
+  bool stableRead(uint32_t offset) const override;
+  void event(uint64_t cycle) override;
+};
+
+} // End namespace rvsim
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "HartState.hpp"
+
+namespace rvsim {
+
+/// An instruction retired by Spike, parsed from a line of its commit log.
+struct CommitRecord {
+  uint32_t pc;
+  uint32_t instruction;
+  // The register written, or -1 for none. Spike does not log writes to x0.
+  int rd;
+  uint32_t rdValue;
+  // The memory written, with a size of zero for none.
+  uint32_t address;
+  uint32_t value;
+  unsigned size;
+};
+
+/// Reads the commit log that Spike writes with --log-commits, either from a
+/// file or from a Spike process spawned to run the same program. Lines that
+/// are not commit records, such as program output, are skipped.
+class CommitLog {
+  FILE *file;
+  pid_t pid;
+  std::string command;
+  char *line;
+  size_t lineCapacity;
+
+  void close();
+
+public:
+  CommitLog();
+  ~CommitLog();
+
+  CommitLog(const CommitLog &) = delete;
+  CommitLog &operator=(const CommitLog &) = delete;
+
+  /// Read a log from a file, or from stdin if the path is "-".
+  void open(const std::string &path);
+
+  /// Run a command, reading the log from its stderr. The process is killed
+  /// when the log is closed.
+  void spawn(const std::vector<std::string> &args);
+
+  /// Read the next record and its text, returning false at the end of the
+  /// log.
+  bool next(CommitRecord &record, std::string &text);
+};
+
+/// Parse one line of a commit log, returning false if it is not a record.
+bool parseCommitRecord(const char *line, CommitRecord &record);
+
+/// Compares every instruction retired by the executor with the next record
+/// of a commit log, stopping with a description of the first difference.
+/// Records before the first instruction executed, such as those from
+/// Spike's boot ROM, are skipped.
+class Cosim {
+  std::deque<std::string> context;
+  bool synchronised;
+  uint64_t count;
+
+public:
+  CommitLog log;
+
+  Cosim() : synchronised(false), count(0) {}
+
+  /// Check an instruction retired from pc, given the state after it has
+  /// executed. Throw an Exception describing any difference.
+  void retire(uint32_t pc, uint32_t instruction, HartState &state);
+
+  /// The number of instructions compared.
+  uint64_t getCount() const { return count; }
+};
+
+} // End namespace rvsim
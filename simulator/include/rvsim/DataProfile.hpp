@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "Executor.hpp"
+#include "Plugin.hpp"
+
+namespace rvsim {
+
+/// Attributes every load and store to the data it accesses, as an observer
+/// policy of the executor, to show which data is hot. An access belongs to
+/// the data object symbol whose extent, from its value and size, contains
+/// its address. Accesses to no object are divided between the stack, from
+/// the stack pointer up to the highest value it has held, the heap, between
+/// the initial and current program break, and other addresses. For each
+/// object and bucket, the reads, writes, bytes and distinct cache lines
+/// accessed are written as CSV when the run finishes, hottest first.
+class DataProfile : public ObserverPolicy {
+  // The accesses to an object or bucket.
+  struct Region {
+    std::string name;
+    uint32_t address;
+    uint32_t size;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t bytesRead;
+    uint64_t bytesWritten;
+    std::unordered_set<uint32_t> lines;
+    uint32_t lastLine;
+  };
+
+  // The extent of an object, in a table sorted by address.
+  struct Extent {
+    uint32_t start;
+    uint32_t end;
+    unsigned region;
+  };
+
+  enum Bucket : unsigned { STACK, HEAP, OTHER, NUM_BUCKETS };
+
+  const Executor &executor;
+  std::ofstream file;
+  bool finished;
+  unsigned lineShift;
+  std::vector<Region> regions;
+  std::vector<Extent> extents;
+  // The extent that contained the last access.
+  Extent lastExtent;
+  uint32_t stackTop;
+
+  unsigned findRegion(uint32_t address, uint32_t sp);
+  void writeProfile();
+
+public:
+  static constexpr unsigned HOOKS = HOOK_MEMORY | HOOK_EXIT | HOOK_CONTROL;
+
+  /// Profile the data accesses of the program loaded into an executor, with
+  /// a line size in bytes, writing the profile to a file.
+  DataProfile(const std::string &filename, uint32_t lineSize, const Executor &executor);
+
+  void memoryAccess(const HartState &state, const MemoryAccess &access) {
+    auto sp = state.registers[Register::x2];
+    stackTop = std::max(stackTop, sp);
+    auto &region = regions[findRegion(access.address, sp)];
+    if (access.store) {
+      region.writes++;
+      region.bytesWritten += access.size;
+    } else {
+      region.reads++;
+      region.bytesRead += access.size;
+    }
+    auto line = access.address >> lineShift;
+    if (line != region.lastLine) {
+      region.lines.insert(line);
+      region.lastLine = line;
+    }
+  }
+
+  void exit(const HartState &state, bool trapped, uint32_t exitCode) {
+    finish();
+  }
+
+  /// Write the profile so far, or clear it, when requested.
+  void control(const HartState &state, Control request);
+
+  /// Write the profile. This is done on exit, and must be done by the driver
+  /// if the run stops otherwise.
+  void finish();
+};
+
+} // End namespace rvsim
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+
+namespace rvsim {
+
+/// A memory-mapped device occupying a range of addresses outside of RAM.
+/// Accesses are naturally aligned and are passed the offset from the base of
+/// the range and their size in bytes. A device can also be called back at a
+/// cycle that it has scheduled on the event queue.
+class Device {
+public:
+  const char *name;
+  uint32_t base;
+  uint32_t size;
+
+  Device(const char *name, uint32_t base, uint32_t size)
+    : name(name), base(base), size(size) {}
+  virtual ~Device() = default;
+
+  virtual uint32_t read(uint32_t offset, unsigned length) = 0;
+  virtual void write(uint32_t offset, unsigned length, uint32_t value) = 0;
+
+  /// Whether the read just made of a register had no side effect, and
+  /// reading it again would return the same value until the next event of
+  /// the device. A busy-wait loop may poll such registers and still be
+  /// skipped.
+  virtual bool stableRead(uint32_t offset) const { return false; }
+
+  /// Handle an event scheduled by the device.
+  virtual void event(uint64_t cycle) {}
+};
+
+/// Extract the bytes of a sub-word access from a 32-bit register value.
+inline uint32_t extractAccess(uint32_t word, uint32_t offset, unsigned length) {
+  auto shift = (offset & 0x3) * 8;
+  auto mask = length == 4 ? ~0U : (1U << (length * 8)) - 1;
+  return (word >> shift) & mask;
+}
+
+/// Merge the bytes of a sub-word access into a 32-bit register value.
+inline uint32_t mergeAccess(uint32_t word, uint32_t offset, unsigned length,
+                            uint32_t value) {
+  auto shift = (offset & 0x3) * 8;
+  auto mask = (length == 4 ? ~0U : (1U << (length * 8)) - 1) << shift;
+  return (word & ~mask) | ((value << shift) & mask);
+}
+
+} // End namespace rvsim
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace rvsim {
+
+/// Return the assembly text of an instruction, in the style of objdump,
+/// generated from the instruction table.
+std::string disassemble(uint32_t value);
+
+} // End namespace rvsim
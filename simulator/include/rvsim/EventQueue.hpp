@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "Device.hpp"
+
+namespace rvsim {
+
+/// A discrete-event queue of device callbacks, ordered by cycle count. The
+/// executor only compares the cycle count against nextCycle() after each
+/// step, so devices cost nothing until one of their events falls due.
+class EventQueue {
+  struct Event {
+    uint64_t cycle;
+    Device *device;
+    bool operator>(const Event &other) const { return cycle > other.cycle; }
+  };
+  // A min-heap of the pending events, kept as a vector so that events can be
+  // cancelled.
+  std::vector<Event> queue;
+  uint64_t next;
+
+public:
+  EventQueue() : next(UINT64_MAX) {}
+
+  /// The earliest cycle at which the executor must service the queue.
+  uint64_t nextCycle() const { return next; }
+
+  /// Call back a device at a future cycle.
+  void schedule(uint64_t cycle, Device *device) {
+    queue.push_back({cycle, device});
+    std::push_heap(queue.begin(), queue.end(), std::greater<Event>());
+    next = std::min(next, cycle);
+  }
+
+  /// Drop the pending events of a device. nextCycle() may still name one of
+  /// them, in which case the executor services the queue early to no effect.
+  void cancel(Device *device) {
+    if (std::erase_if(queue, [&](const Event &event) { return event.device == device; })) {
+      std::make_heap(queue.begin(), queue.end(), std::greater<Event>());
+    }
+  }
+
+  /// The number of pending events.
+  size_t pending() const { return queue.size(); }
+
+  /// Have the executor service the queue at a cycle without calling any
+  /// device, so that it re-evaluates pending interrupts.
+  void wake(uint64_t cycle) {
+    next = std::min(next, cycle);
+  }
+
+  /// Call back every device with an event due at or before a cycle. A device
+  /// scheduling another event must do so at a later cycle.
+  void service(uint64_t cycle) {
+    while (!queue.empty() && queue.front().cycle <= cycle) {
+      std::pop_heap(queue.begin(), queue.end(), std::greater<Event>());
+      auto event = queue.back();
+      queue.pop_back();
+      event.device->event(cycle);
+    }
+    next = queue.empty() ? UINT64_MAX : queue.front().cycle;
+  }
+};
+
+} // End namespace rvsim
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+namespace rvsim {
+
+/// Exception base class.
+struct Exception : std::runtime_error {
+  Exception(std::string message) : std::runtime_error(message) {}
+};
+
+} // End namespace rvsim
@@ -1,56 +1,70 @@
 #pragma once
 
 #include <array>
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <exception>
 #include <stdexcept>
+#include <sys/time.h>
 #include <unistd.h>
 
 #include "bits.hpp"
+#include "Bus.hpp"
+#include "EventQueue.hpp"
+#include "Exception.hpp"
+#include "FileDescriptors.hpp"
+#include "FlightRecorder.hpp"
+#include "Fusion.hpp"
 #include "HartState.hpp"
+#include "IdleLoops.hpp"
+#include "Intrinsics.hpp"
 #include "Memory.hpp"
+#include "Mmu.hpp"
+#include "Plugin.hpp"
 #include "Trace.hpp"
 #include "Instructions.hpp"
 
 namespace rvsim {
 
-enum Opcode {
-  LUI    = 0b0110111,
-  AUIPC  = 0b0010111,
-  JAL    = 0b1101111,
-  JALR   = 0b1100111,
-  BRANCH = 0b1100011,
-  LOAD   = 0b0000011,
-  STORE  = 0b0100011,
-  OP     = 0b0110011,
-  OP_IMM = 0b0010011,
-  FENCE  = 0b0001111,
-  SYS    = 0b1110011
-};
-
 enum Syscall {
-  READ  = 63,
-  WRITE = 64,
-  EXIT  = 93
+  OPENAT       = 56,
+  CLOSE        = 57,
+  LSEEK        = 62,
+  READ         = 63,
+  WRITE        = 64,
+  FSTAT        = 80,
+  EXIT         = 93,
+  GETTIMEOFDAY = 169,
+  BRK          = 214,
+  // Hypercalls specific to rvsim.
+  TRACE_START  = 1024,
+  TRACE_STOP   = 1025,
+  ROI_BEGIN    = 1026,
+  ROI_END      = 1027,
+  STATS_RESET  = 1028,
+  STATS_DUMP   = 1029,
+  CHECKPOINT   = 1030
 };
 
+// The longest path name that the guest can pass to openat.
+const size_t MAX_PATH_LENGTH = 4096;
+
 // Default HTIF memory mapped locations, used when the ELF file does not
 // define the tohost and fromhost symbols.
 const uint32_t HTIF_TOHOST_ADDRESS   = 0x0002000;
 const uint32_t HTIF_FROMHOST_ADDRESS = 0x0002008;
 
-struct ExitException : public std::exception {
-  uint32_t returnValue;
-  ExitException(uint32_t returnValue)
-    : std::exception(), returnValue(returnValue) {}
-};
-
-/// Exception base class.
-struct Exception : std::runtime_error {
-  Exception(std::string message) : std::runtime_error(message) {}
+/// Whether the program is running, has exited through HTIF, or has stopped
+/// on a trap that it does not handle.
+enum class Status {
+  RUNNING,
+  EXITED,
+  TRAPPED
 };
 
 struct UnknownSyscallException : public Exception {
@@ -58,16 +72,6 @@ struct UnknownSyscallException : public Exception {
     : Exception(std::string("unknown syscall: ")+std::to_string(value)) {}
 };
 
-struct UnknownOpcodeException : public Exception {
-  UnknownOpcodeException(std::string name)
-    : Exception(std::string("unknown opcode: "+name)) {}
-};
-
-struct UnknownSysImmException : public Exception {
-  UnknownSysImmException(uint32_t value)
-    : Exception(std::string("unknown sys immediate: ")+std::to_string(value)) {}
-};
-
 #define TRACE(...) \
   do { \
     if (trace) { \
@@ -105,45 +109,64 @@ struct UnknownSysImmException : public Exception {
 
 #define STR(s) #s
 
-class FileDescriptors {
-public:
-  FileDescriptors() {}
-  void add(int fd) {
-    fileDescs.push_back(fd);
-  }
-  int get(size_t index) {
-    if (index >= fileDescs.size()) {
-      throw Exception("invalid file descriptor");
-    } else {
-      return fileDescs[index];
-    }
-  }
-private:
-  std::vector<int> fileDescs;
-};
-
 class Executor {
 public:
     HartState &state;
     Memory &memory;
+    Bus bus;
+    EventQueue events;
     FileDescriptors fileDescs;
+    Intrinsics intrinsics;
+    IdleLoops idleLoops;
+    // Address translation, when satp enables paging below M-mode.
+    Mmu mmu;
+    // The last steps of an untraced run, when enabled.
+    FlightRecorder recorder;
+    // Whether to execute pairs of instructions as fused operations, and the
+    // cycle count that fusion must not step beyond.
+    bool fusion;
+    uint64_t cycleLimit;
+    // Whether to fast-forward through WFI and busy-wait loops to the next
+    // device event.
+    bool idleSkip;
+    // The number of device events serviced and device accesses other than
+    // stable reads, none of which a busy-wait loop may make.
+    uint64_t deviceEffects;
+    // The number of instructions that have trapped rather than retired.
+    uint64_t trapCount;
+    // The number of HTIF system calls made, and the arguments of the last.
+    uint64_t syscallCount;
+    std::array<uint64_t, 8> syscallArgs;
     uint32_t toHostAddress;
     uint32_t fromHostAddress;
+    // The lowest address and current value of the program break.
+    uint32_t initialBreak;
+    uint32_t programBreak;
+    // Requests from the program to start or stop tracing, to begin or end
+    // the region of interest, to reset or dump statistics and to take a
+    // checkpoint, which are consumed by the driver.
+    bool traceStartRequest;
+    bool traceStopRequest;
+    bool roiBeginRequest;
+    bool roiEndRequest;
+    bool statsResetRequest;
+    bool statsDumpRequest;
+    bool checkpointRequest;
+    Status status;
+    uint32_t exitCode;
 
     Executor(HartState &state, Memory &memory)
-        : state(state), memory(memory),
+        : state(state), memory(memory), mmu(state, memory),
+          fusion(true), cycleLimit(UINT64_MAX),
+          idleSkip(true), deviceEffects(0), trapCount(0), syscallCount(0), syscallArgs{},
           toHostAddress(HTIF_TOHOST_ADDRESS),
-          fromHostAddress(HTIF_FROMHOST_ADDRESS) {
-      int stdinFileDesc = dup(0);
-      int stdoutFileDesc = dup(1);
-      int stderrFileDesc = dup(2);
-      if (stdinFileDesc < 0 || stdoutFileDesc < 0 || stderrFileDesc < 0) {
-        throw Exception("could not dup stdin/stdout/stderr");
-      }
-      fileDescs.add(stdinFileDesc);
-      fileDescs.add(stdoutFileDesc);
-      fileDescs.add(stderrFileDesc);
-    }
+          fromHostAddress(HTIF_FROMHOST_ADDRESS),
+          initialBreak(memory.baseAddress + memory.sizeInBytes()),
+          programBreak(initialBreak),
+          traceStartRequest(false), traceStopRequest(false), roiBeginRequest(false),
+          roiEndRequest(false), statsResetRequest(false), statsDumpRequest(false),
+          checkpointRequest(false),
+          status(Status::RUNNING), exitCode(0) {}
 
     /// Set the locations of the HTIF tohost and fromhost words, which vary
     /// with the linker script used to build the program.
@@ -154,105 +177,500 @@ public:
       fromHostAddress = fromHost;
     }
 
+    /// Set the initial program break, which is normally the end of the
+    /// program's static data.
+    void setProgramBreak(uint32_t address) {
+      initialBreak = address;
+      programBreak = address;
+    }
+
     template<bool trace>
     uint32_t syscallExit(uint64_t *htifMem) {
       auto value = htifMem[1];
       TRACE("ECALL EXIT", ArgValue(value));
       TRACE_END();
+      fileDescs.flush();
       return value;
     }
 
+    /// Read directly into the guest buffer.
     template<bool trace>
-    uint32_t syscallRead(uint64_t *htifMem) {
+    int64_t syscallRead(uint64_t *htifMem) {
       auto fd = htifMem[1];
       auto pbuf = htifMem[2];
       auto len = htifMem[3];
-      std::vector<uint8_t> buffer(len);
-      ssize_t ret = read(fileDescs.get(fd), buffer.data(), len);
-      if (ret) {
-        memory.write(pbuf, ret, buffer.data());
-      }
       TRACE("ECALL READ", ArgValue(fd), ArgValue(pbuf), ArgValue(len));
       TRACE_END();
-      return ret;
+      auto *buffer = memory.hostPtr(pbuf, len);
+      if (buffer == nullptr) {
+        return -EFAULT;
+      }
+      return fileDescs.read(fd, buffer, len);
     }
 
+    /// Write directly from the guest buffer.
     template<bool trace>
-    uint32_t syscallWrite(uint64_t *htifMem) {
+    int64_t syscallWrite(uint64_t *htifMem) {
       auto fd = htifMem[1];
       auto pbuf = htifMem[2];
       auto len = htifMem[3];
-      std::vector<uint8_t> buffer(len);
-      memory.read(pbuf, buffer.data(), len);
-      ssize_t ret = write(fileDescs.get(fd), buffer.data(), len);
       TRACE("ECALL WRITE", ArgValue(fd), ArgValue(pbuf), ArgValue(len));
       TRACE_END();
+      auto *buffer = memory.hostPtr(pbuf, len);
+      if (buffer == nullptr) {
+        return -EFAULT;
+      }
+      return fileDescs.write(fd, buffer, len);
+    }
+
+    /// Open a file beneath the sandbox directory. The directory descriptor
+    /// is ignored since the guest cannot hold a descriptor to a directory.
+    template<bool trace>
+    int64_t syscallOpenAt(uint64_t *htifMem) {
+      auto ppath = htifMem[2];
+      auto flags = htifMem[3];
+      auto mode = htifMem[4];
+      TRACE("ECALL OPENAT", ArgValue(ppath), ArgValue(flags), ArgValue(mode));
+      TRACE_END();
+      // The path must be NUL terminated within memory.
+      auto available = memory.baseAddress + memory.sizeInBytes() - ppath;
+      auto *path = reinterpret_cast<const char*>(memory.hostPtr(ppath, 1));
+      if (path == nullptr) {
+        return -EFAULT;
+      }
+      if (std::memchr(path, 0, std::min<size_t>(available, MAX_PATH_LENGTH)) == nullptr) {
+        return available < MAX_PATH_LENGTH ? -EFAULT : -ENAMETOOLONG;
+      }
+      return fileDescs.open(path, flags, mode);
+    }
+
+    template<bool trace>
+    int64_t syscallClose(uint64_t *htifMem) {
+      auto fd = htifMem[1];
+      TRACE("ECALL CLOSE", ArgValue(fd));
+      TRACE_END();
+      return fileDescs.close(fd);
+    }
+
+    template<bool trace>
+    int64_t syscallLseek(uint64_t *htifMem) {
+      auto fd = htifMem[1];
+      auto offset = static_cast<int32_t>(htifMem[2]);
+      auto whence = htifMem[3];
+      TRACE("ECALL LSEEK", ArgValue(fd), ArgValue(offset), ArgValue(whence));
+      TRACE_END();
+      return fileDescs.lseek(fd, offset, whence);
+    }
+
+    template<bool trace>
+    int64_t syscallFstat(uint64_t *htifMem) {
+      auto fd = htifMem[1];
+      auto pstat = htifMem[2];
+      TRACE("ECALL FSTAT", ArgValue(fd), ArgValue(pstat));
+      TRACE_END();
+      auto *buffer = memory.hostPtr(pstat, sizeof(GuestStat));
+      if (buffer == nullptr) {
+        return -EFAULT;
+      }
+      GuestStat stat;
+      auto ret = fileDescs.fstat(fd, stat);
+      if (ret == 0) {
+        std::memcpy(buffer, &stat, sizeof(stat));
+      }
       return ret;
     }
 
+    /// Write the host time of day as a newlib struct timeval, which holds a
+    /// 64-bit seconds field followed by a 32-bit microseconds field.
+    template<bool trace>
+    int64_t syscallGetTimeOfDay(uint64_t *htifMem) {
+      auto ptv = htifMem[1];
+      TRACE("ECALL GETTIMEOFDAY", ArgValue(ptv));
+      TRACE_END();
+      if (ptv == 0) {
+        return 0;
+      }
+      auto *buffer = memory.hostPtr(ptv, 16);
+      if (buffer == nullptr) {
+        return -EFAULT;
+      }
+      struct timeval tv;
+      gettimeofday(&tv, nullptr);
+      int64_t seconds = tv.tv_sec;
+      int32_t microseconds = tv.tv_usec;
+      std::memcpy(buffer, &seconds, sizeof(seconds));
+      std::memcpy(buffer + 8, &microseconds, sizeof(microseconds));
+      return 0;
+    }
+
+    /// Move the program break, returning the new break, or the current one
+    /// if the request is zero or cannot be satisfied.
+    template<bool trace>
+    int64_t syscallBrk(uint64_t *htifMem) {
+      auto address = htifMem[1];
+      TRACE("ECALL BRK", ArgValue(address));
+      TRACE_END();
+      if (address >= initialBreak &&
+          address <= memory.baseAddress + memory.sizeInBytes()) {
+        programBreak = address;
+      }
+      return programBreak;
+    }
+
     template<bool trace>
     void handleSyscall(uint64_t toHostCommand) {
       std::array<uint64_t, 8> htifMem;
-      memory.read(toHostCommand, reinterpret_cast<uint8_t*>(htifMem.data()), sizeof(htifMem));
-      ssize_t ret;
+      auto *args = memory.hostPtr(toHostCommand, sizeof(htifMem));
+      if (args == nullptr) {
+        throw Exception("HTIF argument block out of range");
+      }
+      std::memcpy(htifMem.data(), args, sizeof(htifMem));
+      syscallArgs = htifMem;
+      syscallCount++;
+      int64_t ret;
       switch (htifMem[0]) {
         case Syscall::EXIT:
-          throw ExitException(syscallExit<trace>(htifMem.data()));
-        case Syscall::READ:
-          ret = syscallRead<trace>(htifMem.data());
-          memory.writeMemoryDoubleWord(fromHostAddress, ret);
+          exitCode = syscallExit<trace>(htifMem.data());
+          status = Status::EXITED;
+          return;
+        case Syscall::READ:         ret = syscallRead<trace>(htifMem.data()); break;
+        case Syscall::WRITE:        ret = syscallWrite<trace>(htifMem.data()); break;
+        case Syscall::OPENAT:       ret = syscallOpenAt<trace>(htifMem.data()); break;
+        case Syscall::CLOSE:        ret = syscallClose<trace>(htifMem.data()); break;
+        case Syscall::LSEEK:        ret = syscallLseek<trace>(htifMem.data()); break;
+        case Syscall::FSTAT:        ret = syscallFstat<trace>(htifMem.data()); break;
+        case Syscall::GETTIMEOFDAY: ret = syscallGetTimeOfDay<trace>(htifMem.data()); break;
+        case Syscall::BRK:          ret = syscallBrk<trace>(htifMem.data()); break;
+        case Syscall::TRACE_START:  traceStartRequest = true; ret = 0; break;
+        case Syscall::TRACE_STOP:   traceStopRequest = true; ret = 0; break;
+        case Syscall::ROI_BEGIN:    roiBeginRequest = true; ret = 0; break;
+        case Syscall::ROI_END:      roiEndRequest = true; ret = 0; break;
+        case Syscall::STATS_RESET:  statsResetRequest = true; ret = 0; break;
+        case Syscall::STATS_DUMP:   statsDumpRequest = true; ret = 0; break;
+        case Syscall::CHECKPOINT:   checkpointRequest = true; ret = 0; break;
+        default:
+          throw UnknownSyscallException(htifMem[0]);
+      }
+      // The return value is passed back in the first word of the argument
+      // block, and the guest is signalled through fromhost.
+      uint64_t result = ret;
+      std::memcpy(args, &result, sizeof(result));
+      memory.writeMemoryDoubleWord(fromHostAddress, 1);
+    }
+
+    /// Handle an HTIF command written to tohost.
+    template<bool trace>
+    void checkToHost() {
+      auto toHostCommand = memory.readMemoryDoubleWord(toHostAddress);
+      if (toHostCommand != 0) {
+        handleSyscall<trace>(toHostCommand);
+        // Clear the syscall.
+        memory.writeMemoryDoubleWord(toHostAddress, 0);
+      }
+    }
+
+    /// Perform a call to a guest library function on the host, using the
+    /// arguments in a0 to a2 and returning to the address in ra. Return
+    /// false if the operands do not lie within memory, a store would reach
+    /// tohost, or the cost of the call would carry the cycle count past the
+    /// cycle limit or the next device event, in which case the function is
+    /// simulated normally.
+    template<bool trace>
+    bool callIntrinsic(Intrinsic intrinsic) {
+      auto a0 = state.readReg(Register::x10);
+      auto a1 = state.readReg(Register::x11);
+      auto a2 = state.readReg(Register::x12);
+      auto affordable = [&](uint32_t bytes) {
+        return state.cycleCount + intrinsics.cost(bytes) <=
+               std::min(cycleLimit, events.nextCycle());
+      };
+      auto storesToHost = [&]() {
+        return a0 < toHostAddress + 8 && toHostAddress < a0 + static_cast<uint64_t>(a2);
+      };
+      uint32_t result;
+      uint32_t bytes;
+      switch (intrinsic) {
+        case Intrinsic::MEMCPY:
+        case Intrinsic::MEMMOVE: {
+          auto *dest = memory.hostPtr(a0, a2);
+          auto *src = memory.hostPtr(a1, a2);
+          if (dest == nullptr || src == nullptr || storesToHost() || !affordable(a2)) {
+            return false;
+          }
+          if (intrinsic == Intrinsic::MEMMOVE || dest <= src || dest >= src + a2) {
+            std::memmove(dest, src, a2);
+          } else {
+            // An overlapping memcpy behaves as a forward byte copy.
+            for (uint32_t i = 0; i < a2; i++) {
+              dest[i] = src[i];
+            }
+          }
+          result = a0;
+          bytes = a2;
+          break;
+        }
+        case Intrinsic::MEMSET: {
+          auto *dest = memory.hostPtr(a0, a2);
+          if (dest == nullptr || storesToHost() || !affordable(a2)) {
+            return false;
+          }
+          std::memset(dest, a1 & 0xFF, a2);
+          result = a0;
+          bytes = a2;
           break;
-        case Syscall::WRITE:
-          ret = syscallWrite<trace>(htifMem.data());
-          memory.writeMemoryDoubleWord(fromHostAddress, ret);
+        }
+        case Intrinsic::MEMCMP: {
+          auto *lhs = memory.hostPtr(a0, a2);
+          auto *rhs = memory.hostPtr(a1, a2);
+          if (lhs == nullptr || rhs == nullptr) {
+            return false;
+          }
+          auto mismatch = std::mismatch(lhs, lhs + a2, rhs);
+          result = mismatch.first == lhs + a2 ? 0 : *mismatch.first - *mismatch.second;
+          bytes = mismatch.first - lhs;
+          if (!affordable(bytes)) {
+            return false;
+          }
+          break;
+        }
+        case Intrinsic::STRLEN: {
+          auto *str = memory.hostPtr(a0, 1);
+          if (str == nullptr) {
+            return false;
+          }
+          auto available = memory.baseAddress + memory.sizeInBytes() - a0;
+          auto *end = static_cast<uint8_t*>(std::memchr(str, 0, available));
+          if (end == nullptr) {
+            return false;
+          }
+          result = end - str;
+          bytes = result + 1;
+          if (!affordable(bytes)) {
+            return false;
+          }
           break;
+        }
         default:
-          throw UnknownSyscallException(htifMem[0]);
+          return false;
+      }
+      state.fetchAddress = state.pc;
+      state.writeReg(Register::x10, result);
+      state.pc = state.readReg(Register::x1);
+      TRACE(getIntrinsicName(intrinsic), ArgValue(a0), ArgValue(a1), ArgValue(a2));
+      TRACE_REG_WRITE(Register::x10, result);
+      TRACE_REG_WRITE(Register::pc, state.pc);
+      TRACE_END();
+      if (!trace && recorder.enabled()) {
+        recorder.intrinsic(intrinsic, a0, a1, a2, result, state);
+      }
+      state.cycleCount += intrinsics.cost(bytes);
+      return true;
+    }
+
+    /// Record the value of mtval or stval for a trap and return its cause, so
+    /// that a handler can raise a trap with a single return statement.
+    Trap raise(Trap cause, uint32_t value) {
+      state.trapValue = value;
+      return cause;
+    }
+
+    /// Return the privilege level at which loads and stores are made, which
+    /// is that of MPP while MPRV is set.
+    Privilege dataPrivilege() const {
+      if (state.mstatus & MSTATUS_MPRV) {
+        return static_cast<Privilege>((state.mstatus & MSTATUS_MPP) >> MSTATUS_MPP_SHIFT);
+      }
+      return state.privilege;
+    }
+
+    /// Return true if fetches or data accesses may be translated by the page
+    /// tables. Fusion, accelerated library functions and idle loop skipping
+    /// all read memory at virtual addresses directly, so they are disabled
+    /// while paging.
+    bool paging() const {
+      return (state.satp & SATP_MODE) &&
+             (state.privilege != Privilege::MACHINE || (state.mstatus & MSTATUS_MPRV));
+    }
+
+    /// Translate an access of a type and size, which must be aligned,
+    /// returning the page fault or access fault it raises, if any. Otherwise,
+    /// return its physical address and, if that lies in memory, a host
+    /// pointer to it. Without paging, the physical address is the virtual
+    /// one, and nothing is looked up but the bounds of memory.
+    template<AccessType type>
+    Trap translate(uint32_t address, unsigned size, uint8_t *&host, uint32_t &physical) {
+      if (state.satp & SATP_MODE) {
+        auto privilege = type == AccessType::FETCH ? state.privilege : dataPrivilege();
+        if (privilege != Privilege::MACHINE) {
+          return mmu.translate<type>(address, privilege, host, physical);
+        }
+      }
+      physical = address;
+      host = memory.hostPtr(address, size);
+      return Trap::NONE;
+    }
+
+    /// Return true if an instruction can be fetched from an address at a
+    /// privilege level, without any side effects.
+    bool canFetch(uint32_t address, Privilege privilege) {
+      if ((state.satp & SATP_MODE) && privilege != Privilege::MACHINE) {
+        return mmu.canFetch(address, privilege);
+      }
+      return memory.contains(address, 4);
+    }
+
+    /// Write mstatus, whose MPP field only takes the values of implemented
+    /// privilege levels. Translations cached with the old values of SUM and
+    /// MXR are flushed.
+    void writeStatus(uint32_t value) {
+      const uint32_t writable = MSTATUS_SIE | MSTATUS_MIE | MSTATUS_SPIE | MSTATUS_MPIE |
+                                MSTATUS_SPP | MSTATUS_MPRV | MSTATUS_SUM | MSTATUS_MXR;
+      auto mpp = value & MSTATUS_MPP;
+      if (mpp == (2U << MSTATUS_MPP_SHIFT)) {
+        mpp = state.mstatus & MSTATUS_MPP;
+      }
+      auto mstatus = (value & writable) | mpp;
+      if ((mstatus ^ state.mstatus) & (MSTATUS_SUM | MSTATUS_MXR)) {
+        mmu.flush();
+      }
+      state.mstatus = mstatus;
+      events.wake(state.cycleCount);
+    }
+
+    /// Read a CSR, returning false if it is not implemented.
+    bool readCsr(unsigned csr, uint32_t &value) {
+      switch (csr) {
+        case CSR_SSTATUS:   value = state.mstatus & SSTATUS_MASK; break;
+        // Interrupts are not delegated, so S-mode has none of its own.
+        case CSR_SIE:
+        case CSR_SIP:
+        case CSR_MIDELEG:   value = 0; break;
+        case CSR_STVEC:     value = state.stvec; break;
+        case CSR_SSCRATCH:  value = state.sscratch; break;
+        case CSR_SEPC:      value = state.sepc; break;
+        case CSR_SCAUSE:    value = state.scause; break;
+        case CSR_STVAL:     value = state.stval; break;
+        case CSR_SATP:      value = state.satp; break;
+        case CSR_MSTATUS:   value = state.mstatus; break;
+        case CSR_MISA:      value = MISA_VALUE; break;
+        case CSR_MEDELEG:   value = state.medeleg; break;
+        case CSR_MIE:       value = state.mie; break;
+        case CSR_MTVEC:     value = state.mtvec; break;
+        case CSR_MSCRATCH:  value = state.mscratch; break;
+        case CSR_MEPC:      value = state.mepc; break;
+        case CSR_MCAUSE:    value = state.mcause; break;
+        case CSR_MTVAL:     value = state.mtval; break;
+        case CSR_MIP:       value = state.mip; break;
+        // Every instruction takes one cycle, so the cycle, time and retired
+        // instruction counters are the same.
+        case CSR_MCYCLE:
+        case CSR_MINSTRET:
+        case CSR_CYCLE:
+        case CSR_TIME:
+        case CSR_INSTRET:   value = state.cycleCount; break;
+        case CSR_MCYCLEH:
+        case CSR_MINSTRETH:
+        case CSR_CYCLEH:
+        case CSR_TIMEH:
+        case CSR_INSTRETH:  value = state.cycleCount >> 32; break;
+        case CSR_MVENDORID:
+        case CSR_MARCHID:
+        case CSR_MIMPID:
+        case CSR_MHARTID:   value = 0; break;
+        default:
+          return false;
+      }
+      return true;
+    }
+
+    /// Write a CSR that has already been read successfully. Fields that are
+    /// not implemented are read-only zero, and the counters ignore writes, as
+    /// do the bits of mip, which are set by devices. Enabling an interrupt
+    /// has pending interrupts re-evaluated at the end of the step. Writing
+    /// satp flushes the TLBs.
+    void writeCsr(unsigned csr, uint32_t value) {
+      switch (csr) {
+        case CSR_SSTATUS:
+          writeStatus((state.mstatus & ~SSTATUS_MASK) | (value & SSTATUS_MASK));
+          break;
+        case CSR_STVEC:     state.stvec = value & ~3U; break;
+        case CSR_SSCRATCH:  state.sscratch = value; break;
+        case CSR_SEPC:      state.sepc = value & ~3U; break;
+        case CSR_SCAUSE:    state.scause = value; break;
+        case CSR_STVAL:     state.stval = value; break;
+        case CSR_SATP:
+          state.satp = value & (SATP_MODE | SATP_PPN);
+          mmu.flush();
+          break;
+        case CSR_MSTATUS:   writeStatus(value); break;
+        case CSR_MEDELEG:   state.medeleg = value & MEDELEG_MASK; break;
+        case CSR_MIE:
+          state.mie = value & (MIP_MSIP | MIP_MTIP | MIP_MEIP);
+          events.wake(state.cycleCount);
+          break;
+        // Only direct mode is supported.
+        case CSR_MTVEC:     state.mtvec = value & ~3U; break;
+        case CSR_MSCRATCH:  state.mscratch = value; break;
+        case CSR_MEPC:      state.mepc = value & ~3U; break;
+        case CSR_MCAUSE:    state.mcause = value; break;
+        case CSR_MTVAL:     state.mtval = value; break;
+        default:
+          break;
       }
     }
 
     /// Load upper immediate.
     template <bool trace>
-    void execute_LUI(const InstructionUType &instruction) {
+    Trap execute_LUI(const InstructionUType &instruction) {
       auto result = insertBits(0U, instruction.imm, 12, 20) & ~0xFFF;
       state.writeReg(instruction.rd, result);
       TRACE("LUI", RegDst(instruction.rd), ImmValue(instruction.imm));
       TRACE_REG_WRITE(instruction.rd, result);
       TRACE_END();
+      return Trap::NONE;
     }
 
     /// Add upper immediate to PC.
     template <bool trace>
-    void execute_AUIPC(const InstructionUType &instruction) {
+    Trap execute_AUIPC(const InstructionUType &instruction) {
       auto offset = insertBits(0U, instruction.imm, 12, 20) & ~0xFFF;
       auto result = state.pc + offset;
       state.writeReg(instruction.rd, result);
       TRACE("AUIPC", RegDst(instruction.rd), ImmValue(instruction.imm));
       TRACE_REG_WRITE(instruction.rd, result);
       TRACE_END();
+      return Trap::NONE;
     }
 
     /// Jump and link.
     template <bool trace>
-    void execute_JAL(const InstructionJType &instruction) {
+    Trap execute_JAL(const InstructionJType &instruction) {
       auto imm = signExtend(instruction.imm, 21);
       auto offset = imm;
+      auto targetPC = state.pc + offset;
+      if (targetPC & 0x3) {
+        return raise(Trap::INSTRUCTION_ADDRESS_MISALIGNED, targetPC);
+      }
       auto result = state.pc + 4;
       state.writeReg(instruction.rd, result);
-      state.pc += offset;
+      state.pc = targetPC;
       state.branchTaken = true;
       TRACE("JAL", RegDst(instruction.rd), ImmValue(instruction.imm));
       TRACE_REG_WRITE(instruction.rd, result);
       TRACE_REG_WRITE(Register::pc, state.pc);
       TRACE_END();
+      return Trap::NONE;
     }
 
     /// Jump and link register.
     template <bool trace>
-    void execute_JALR(const InstructionIType &instruction) {
+    Trap execute_JALR(const InstructionIType &instruction) {
       auto base = state.readReg(instruction.rs1);
       auto imm = signExtend(instruction.imm, 12);
       auto targetPC = (base + imm) & ~1U;
+      if (targetPC & 0x3) {
+        return raise(Trap::INSTRUCTION_ADDRESS_MISALIGNED, targetPC);
+      }
       auto result = state.pc + 4;
       state.writeReg(instruction.rd, result);
       state.pc = targetPC;
@@ -261,11 +679,12 @@ public:
       TRACE_REG_WRITE(instruction.rd, result);
       TRACE_REG_WRITE(Register::pc, targetPC);
       TRACE_END();
+      return Trap::NONE;
     }
 
     #define OP_IMM_ITYPE_INSTR(mnemonic, extract_immediate, expression) \
       template <bool trace> \
-      void execute_##mnemonic (const InstructionIType &instruction) { \
+      Trap execute_##mnemonic (const InstructionIType &instruction) { \
         auto rs1 = state.readReg(instruction.rs1); \
         auto imm = extract_immediate; \
         auto result = expression; \
@@ -273,6 +692,7 @@ public:
         state.writeReg(instruction.rd, result); \
         TRACE_REG_WRITE(instruction.rd, result); \
         TRACE_END(); \
+        return Trap::NONE; \
       }
 
     // The 12-bit immediate is sign extended by every OP-IMM instruction,
@@ -286,13 +706,14 @@ public:
 
     #define OP_IMM_SHAMT_INSTR(mnemonic, expression) \
       template <bool trace> \
-      void execute_##mnemonic (const InstructionIShamtType &instruction) { \
+      Trap execute_##mnemonic (const InstructionIShamtType &instruction) { \
         auto rs1 = state.readReg(instruction.rs1); \
         auto result = expression; \
         TRACE(STR(mnemonic), RegDst(instruction.rd), RegSrc(instruction.rs1), ImmValue(instruction.shamt)); \
         state.writeReg(instruction.rd, result); \
         TRACE_REG_WRITE(instruction.rd, result); \
         TRACE_END(); \
+        return Trap::NONE; \
       }
 
     OP_IMM_SHAMT_INSTR(SLLI, rs1 << instruction.shamt)
@@ -301,7 +722,7 @@ public:
 
     #define OP_REG_RTYPE_INSTR(mnemonic, expression) \
       template <bool trace> \
-      void execute_##mnemonic(const InstructionRType &instruction) { \
+      Trap execute_##mnemonic(const InstructionRType &instruction) { \
         auto rs1 = state.readReg(instruction.rs1); \
         auto rs2 = state.readReg(instruction.rs2); \
         auto result = expression; \
@@ -309,6 +730,7 @@ public:
         state.writeReg(instruction.rd, result); \
         TRACE_REG_WRITE(RegDst(instruction.rd), result); \
         TRACE_END(); \
+        return Trap::NONE; \
       }
 
     OP_REG_RTYPE_INSTR(ADD,  rs1 + rs2)
@@ -323,20 +745,29 @@ public:
     OP_REG_RTYPE_INSTR(SLT,  static_cast<int32_t>(rs1) < static_cast<int32_t>(rs2) ? 1 : 0)
     OP_REG_RTYPE_INSTR(SLTU, rs1 < rs2 ? 1 : 0)
 
+    // A taken branch to a misaligned target traps, but one that is not taken
+    // does not.
     #define BRANCH_BTYPE_INSTR(mnemonic, expression) \
       template <bool trace> \
-      void execute_##mnemonic(const InstructionBType &instruction) { \
+      Trap execute_##mnemonic(const InstructionBType &instruction) { \
         auto rs1 = state.readReg(instruction.rs1); \
         auto rs2 = state.readReg(instruction.rs2); \
         auto imm = signExtend(instruction.imm, 13); \
         auto offset = imm; \
-        TRACE(STR(mnemonic), RegSrc(instruction.rs1), RegSrc(instruction.rs2), ImmValue(imm)); \
         if (expression) { \
-          state.pc += offset; \
+          auto targetPC = state.pc + offset; \
+          if (targetPC & 0x3) { \
+            return raise(Trap::INSTRUCTION_ADDRESS_MISALIGNED, targetPC); \
+          } \
+          TRACE(STR(mnemonic), RegSrc(instruction.rs1), RegSrc(instruction.rs2), ImmValue(imm)); \
+          state.pc = targetPC; \
           state.branchTaken = true; \
           TRACE_REG_WRITE(Register::pc, state.pc); \
+        } else { \
+          TRACE(STR(mnemonic), RegSrc(instruction.rs1), RegSrc(instruction.rs2), ImmValue(imm)); \
         } \
         TRACE_END(); \
+        return Trap::NONE; \
       }
 
     BRANCH_BTYPE_INSTR(BEQ,  rs1 == rs2)
@@ -346,183 +777,629 @@ public:
     BRANCH_BTYPE_INSTR(BLTU, rs1 < rs2)
     BRANCH_BTYPE_INSTR(BGEU, rs1 >= rs2)
 
-    #define STORE_STYPE_INSTR(mnemonic, memory_function) \
+    /// Perform a load that misses memory on a device, returning false if
+    /// none is mapped at the physical address.
+    bool loadDevice(uint32_t address, unsigned size, uint32_t &result) {
+      auto *device = bus.find(address, size);
+      if (device == nullptr) {
+        return false;
+      }
+      result = device->read(address - device->base, size);
+      if (!device->stableRead(address - device->base)) {
+        deviceEffects++;
+      }
+      return true;
+    }
+
+    /// Perform a store that misses memory on a device, returning false if
+    /// none is mapped at the physical address.
+    bool storeDevice(uint32_t address, unsigned size, uint32_t value) {
+      auto *device = bus.find(address, size);
+      if (device == nullptr) {
+        return false;
+      }
+      device->write(address - device->base, size, value);
+      deviceEffects++;
+      return true;
+    }
+
+    // Accesses must be naturally aligned, and translate to memory or a
+    // device. A store to tohost issues an HTIF command, so the HTIF is only
+    // checked when it is written rather than on every step.
+    #define STORE_STYPE_INSTR(mnemonic, type) \
       template <bool trace> \
-      void execute_##mnemonic(const InstructionSType &instruction) { \
+      Trap execute_##mnemonic(const InstructionSType &instruction) { \
         auto base = state.readReg(instruction.rs1); \
         auto offset = signExtend(instruction.imm, 12); \
         auto effectiveAddr = base + offset; \
-        memory.memory_function(effectiveAddr, state.readReg(instruction.rs2)); \
+        auto value = state.readReg(instruction.rs2); \
+        if (effectiveAddr & (sizeof(type) - 1)) { \
+          return raise(Trap::STORE_ADDRESS_MISALIGNED, effectiveAddr); \
+        } \
+        uint8_t *host; \
+        uint32_t physical; \
+        if (auto trap = translate<AccessType::STORE>(effectiveAddr, sizeof(type), host, physical); \
+            trap != Trap::NONE) { \
+          return raise(trap, effectiveAddr); \
+        } \
+        if (host) { \
+          type data = value; \
+          std::memcpy(host, &data, sizeof(type)); \
+        } else if (!storeDevice(physical, sizeof(type), value)) { \
+          return raise(Trap::STORE_ACCESS_FAULT, effectiveAddr); \
+        } \
         TRACE(STR(mnemonic), RegSrc(instruction.rs2), RegSrc(instruction.rs1), ImmValue(offset)); \
-        TRACE_MEM_WRITE(effectiveAddr, state.readReg(instruction.rs2)); \
+        TRACE_MEM_WRITE(effectiveAddr, value); \
         TRACE_END(); \
+        if ((physical & ~0x7U) == toHostAddress) { \
+          checkToHost<trace>(); \
+        } \
+        return Trap::NONE; \
       }
 
-    STORE_STYPE_INSTR(SB, writeMemoryByte)
-    STORE_STYPE_INSTR(SH, writeMemoryHalf)
-    STORE_STYPE_INSTR(SW, writeMemoryWord)
+    STORE_STYPE_INSTR(SB, uint8_t)
+    STORE_STYPE_INSTR(SH, uint16_t)
+    STORE_STYPE_INSTR(SW, uint32_t)
 
-    #define LOAD_ITYPE_INSTR(mnemonic, memory_function, result_expression) \
+    #define LOAD_ITYPE_INSTR(mnemonic, type, result_expression) \
       template <bool trace> \
-      void execute_##mnemonic(const InstructionIType &instruction) { \
+      Trap execute_##mnemonic(const InstructionIType &instruction) { \
         auto base = state.readReg(instruction.rs1); \
         auto offset = signExtend(instruction.imm, 12); \
         auto effectiveAddr = base + offset; \
-        auto result = memory.memory_function(effectiveAddr); \
+        if (effectiveAddr & (sizeof(type) - 1)) { \
+          return raise(Trap::LOAD_ADDRESS_MISALIGNED, effectiveAddr); \
+        } \
+        uint8_t *host; \
+        uint32_t physical; \
+        if (auto trap = translate<AccessType::LOAD>(effectiveAddr, sizeof(type), host, physical); \
+            trap != Trap::NONE) { \
+          return raise(trap, effectiveAddr); \
+        } \
+        uint32_t result; \
+        if (host) { \
+          type data; \
+          std::memcpy(&data, host, sizeof(type)); \
+          result = data; \
+        } else if (!loadDevice(physical, sizeof(type), result)) { \
+          return raise(Trap::LOAD_ACCESS_FAULT, effectiveAddr); \
+        } \
         result = result_expression; \
         TRACE(STR(mnemonic), RegDst(instruction.rd), RegSrc(instruction.rs1), ImmValue(offset)); \
         state.writeReg(instruction.rd, result); \
         TRACE_MEM_READ(instruction.rd, effectiveAddr, result); \
         TRACE_END(); \
+        return Trap::NONE; \
       }
 
-    LOAD_ITYPE_INSTR(LB,  readMemoryByte, signExtend(result, 8))
-    LOAD_ITYPE_INSTR(LH,  readMemoryHalf, signExtend(result, 16))
-    LOAD_ITYPE_INSTR(LW,  readMemoryWord, result)
-    LOAD_ITYPE_INSTR(LBU, readMemoryByte, result)
-    LOAD_ITYPE_INSTR(LHU, readMemoryHalf, result)
+    LOAD_ITYPE_INSTR(LB,  uint8_t,  signExtend(result, 8))
+    LOAD_ITYPE_INSTR(LH,  uint16_t, signExtend(result, 16))
+    LOAD_ITYPE_INSTR(LW,  uint32_t, result)
+    LOAD_ITYPE_INSTR(LBU, uint8_t,  result)
+    LOAD_ITYPE_INSTR(LHU, uint16_t, result)
 
-    /// Environment call.
+    /// Memory ordering is a no-op for a single hart without caches.
     template <bool trace>
-    void execute_ECALL(const InstructionIType &instruction) {
-      // Unimplemented.
+    Trap execute_FENCE(const InstructionSysType &instruction) {
+      return Trap::NONE;
+    }
+
+    /// Synchronise the instruction stream, which invalidates the analysis
+    /// of busy-wait loops.
+    template <bool trace>
+    Trap execute_FENCE_I(const InstructionSysType &instruction) {
+      idleLoops.flush();
+      return Trap::NONE;
+    }
+
+    /// Environment call. Programs running under HTIF make system calls
+    /// through tohost, so an ECALL is only handled by the program's own trap
+    /// handler. Its cause gives the privilege level it was made from.
+    template <bool trace>
+    Trap execute_ECALL(const InstructionSysType &instruction) {
+      auto cause = static_cast<uint32_t>(Trap::ECALL_FROM_U) +
+                   static_cast<uint32_t>(state.privilege);
+      return raise(static_cast<Trap>(cause), 0);
     }
 
     /// Environment break.
     template <bool trace>
-    void execute_EBREAK(const InstructionIType &instruction) {
-      // Unimplemented.
+    Trap execute_EBREAK(const InstructionSysType &instruction) {
+      return raise(Trap::BREAKPOINT, state.pc);
+    }
+
+    /// Return from a machine-mode trap handler to the privilege level in
+    /// MPP, which is then set to U-mode. Leaving M-mode clears MPRV.
+    template <bool trace>
+    Trap execute_MRET(const InstructionSysType &instruction) {
+      if (state.privilege != Privilege::MACHINE) {
+        return Trap::ILLEGAL_INSTRUCTION;
+      }
+      auto mpie = (state.mstatus & MSTATUS_MPIE) != 0;
+      state.privilege = static_cast<Privilege>((state.mstatus & MSTATUS_MPP) >> MSTATUS_MPP_SHIFT);
+      state.mstatus = (state.mstatus & ~(MSTATUS_MIE | MSTATUS_MPP)) |
+                      (mpie ? MSTATUS_MIE : 0) | MSTATUS_MPIE;
+      if (state.privilege != Privilege::MACHINE) {
+        state.mstatus &= ~MSTATUS_MPRV;
+      }
+      state.pc = state.mepc;
+      state.branchTaken = true;
+      events.wake(state.cycleCount);
+      TRACE("MRET");
+      TRACE_REG_WRITE(Register::pc, state.pc);
+      TRACE_END();
+      return Trap::NONE;
+    }
+
+    /// Return from a supervisor-mode trap handler to the privilege level in
+    /// SPP, which is then set to U-mode.
+    template <bool trace>
+    Trap execute_SRET(const InstructionSysType &instruction) {
+      if (state.privilege == Privilege::USER) {
+        return Trap::ILLEGAL_INSTRUCTION;
+      }
+      auto spie = (state.mstatus & MSTATUS_SPIE) != 0;
+      state.privilege = (state.mstatus & MSTATUS_SPP) ? Privilege::SUPERVISOR : Privilege::USER;
+      state.mstatus = (state.mstatus & ~(MSTATUS_SIE | MSTATUS_SPP | MSTATUS_MPRV)) |
+                      (spie ? MSTATUS_SIE : 0) | MSTATUS_SPIE;
+      state.pc = state.sepc;
+      state.branchTaken = true;
+      TRACE("SRET");
+      TRACE_REG_WRITE(Register::pc, state.pc);
+      TRACE_END();
+      return Trap::NONE;
+    }
+
+    /// Order page table updates before the accesses that follow. Without
+    /// ASIDs, flushing both TLBs entirely satisfies any address and ASID
+    /// operands.
+    template <bool trace>
+    Trap execute_SFENCE_VMA(const InstructionRType &instruction) {
+      if (state.privilege == Privilege::USER) {
+        return Trap::ILLEGAL_INSTRUCTION;
+      }
+      mmu.flush();
+      TRACE("SFENCE.VMA", RegSrc(instruction.rs1), RegSrc(instruction.rs2));
+      TRACE_END();
+      return Trap::NONE;
+    }
+
+    /// Wait for interrupt. Unless an enabled interrupt is already pending,
+    /// the hart stalls until the next device event, or the cycle limit, and
+    /// the cycle count advances directly to it. Without an event to wait for,
+    /// or with idle skipping disabled, WFI completes immediately. It is
+    /// illegal in U-mode.
+    template <bool trace>
+    Trap execute_WFI(const InstructionSysType &instruction) {
+      if (state.privilege == Privilege::USER) {
+        return Trap::ILLEGAL_INSTRUCTION;
+      }
+      uint64_t stall = 0;
+      if (idleSkip && !(state.mip & state.mie)) {
+        auto wake = std::min(events.nextCycle(), cycleLimit);
+        if (wake != UINT64_MAX && wake > state.cycleCount + 1) {
+          // The instruction's own cycle is counted by step.
+          stall = wake - state.cycleCount - 1;
+        }
+      }
+      TRACE("WFI", ArgValue(stall));
+      TRACE_END();
+      state.cycleCount += stall;
+      return Trap::NONE;
     }
 
-    /// Decode and dispatch the instruction.
-    // clang-format off
+    // Read a CSR into rd and write back a new value. CSRRS and CSRRC do not
+    // write the CSR when the source is x0 or a zero immediate, so that they
+    // can read the read-only CSRs. Reads have no side effects, so CSRRW reads
+    // the CSR even when rd is x0. Bits 9:8 of the address give the lowest
+    // privilege level that can access a CSR, except that the counters can
+    // be read from any level.
+    #define CSR_INSTR(mnemonic, is_write, source_expression, result_expression) \
+      template <bool trace> \
+      Trap execute_##mnemonic(const InstructionCsrType &instruction) { \
+        uint32_t value = 0; \
+        uint32_t source = source_expression; \
+        bool writes = is_write || instruction.rs1 != 0; \
+        bool readOnly = (instruction.csr >> 10) == 0x3; \
+        bool privileged = bitRange<9, 8>(instruction.csr) > static_cast<uint32_t>(state.privilege); \
+        if (!readCsr(instruction.csr, value) || (writes && readOnly) || privileged) { \
+          return Trap::ILLEGAL_INSTRUCTION; \
+        } \
+        TRACE(STR(mnemonic), RegDst(instruction.rd), ImmValue(instruction.csr), ArgValue(source)); \
+        if (writes) { \
+          writeCsr(instruction.csr, result_expression); \
+        } \
+        state.writeReg(instruction.rd, value); \
+        TRACE_REG_WRITE(instruction.rd, value); \
+        TRACE_END(); \
+        return Trap::NONE; \
+      }
+
+    CSR_INSTR(CSRRW,  true,  state.readReg(instruction.rs1), source)
+    CSR_INSTR(CSRRS,  false, state.readReg(instruction.rs1), value | source)
+    CSR_INSTR(CSRRC,  false, state.readReg(instruction.rs1), value & ~source)
+    CSR_INSTR(CSRRWI, true,  instruction.rs1, source)
+    CSR_INSTR(CSRRSI, false, instruction.rs1, value | source)
+    CSR_INSTR(CSRRCI, false, instruction.rs1, value & ~source)
+
+    /// Decode the instruction with the decode table and dispatch it to its
+    /// handler, returning the trap it raises, if any. The value of mtval for
+    /// an illegal instruction is the instruction itself.
     template<bool trace>
-    void dispatchInstruction(uint32_t value) {
-      uint32_t opcode = value & 0x7F;
-      switch (opcode) {
-        case Opcode::LUI:
-          execute_LUI<trace>(InstructionUType(value));
-          break;
-        case Opcode::AUIPC:
-          execute_AUIPC<trace>(InstructionUType(value));
-          break;
-        case Opcode::JAL:
-          execute_JAL<trace>(InstructionJType(value));
-          break;
-        case Opcode::JALR:
-          execute_JALR<trace>(InstructionIType(value));
+    Trap dispatchInstruction(uint32_t value) {
+      Trap trap;
+      switch (decode(value)) {
+        #define DISPATCH_INSTRUCTION(mnemonic, name, format, mask, match, flags) \
+          case Operation::mnemonic: \
+            trap = execute_##mnemonic<trace>(Instruction##format##Type(value)); \
+            break;
+        RVSIM_INSTRUCTIONS(DISPATCH_INSTRUCTION)
+        default:
+          trap = Trap::ILLEGAL_INSTRUCTION;
           break;
-        case Opcode::BRANCH: {
-          auto instr = InstructionBType(value);
-          switch (instr.funct) {
-            case 0b000: execute_BEQ<trace>(instr); break;
-            case 0b001: execute_BNE<trace>(instr); break;
-            case 0b100: execute_BLT<trace>(instr); break;
-            case 0b101: execute_BGE<trace>(instr); break;
-            case 0b110: execute_BLTU<trace>(instr); break;
-            case 0b111: execute_BGEU<trace>(instr); break;
-            default: throw UnknownOpcodeException("BRANCH");
+      }
+      if (trap == Trap::ILLEGAL_INSTRUCTION) {
+        state.trapValue = value;
+      }
+      return trap;
+    }
+
+    /// Enter the trap handler at mtvec, recording the PC in mepc and the
+    /// privilege level in MPP. An exception from below M-mode that medeleg
+    /// delegates enters the handler at stvec in S-mode instead, unless no
+    /// instruction can be fetched from there, in which case it is taken in
+    /// M-mode, so that it is reported if there is no handler at all. If mtvec
+    /// does not point into memory then the program has no handler and
+    /// execution stops.
+    template<bool trace>
+    void enterHandler(uint32_t cause) {
+      bool exception = !(cause & MCAUSE_INTERRUPT);
+      if (exception && state.privilege != Privilege::MACHINE &&
+          ((state.medeleg >> cause) & 1) && canFetch(state.stvec, Privilege::SUPERVISOR)) {
+        state.sepc = state.pc;
+        state.scause = cause;
+        state.stval = state.trapValue;
+        auto sie = (state.mstatus & MSTATUS_SIE) != 0;
+        state.mstatus = (state.mstatus & ~(MSTATUS_SIE | MSTATUS_SPIE | MSTATUS_SPP)) |
+                        (sie ? MSTATUS_SPIE : 0) |
+                        (state.privilege == Privilege::SUPERVISOR ? MSTATUS_SPP : 0);
+        state.privilege = Privilege::SUPERVISOR;
+        state.pc = state.stvec;
+        TRACE_REG_WRITE(Register::pc, state.pc);
+        TRACE_END();
+        return;
+      }
+      state.mepc = state.pc;
+      state.mcause = cause;
+      if (exception) {
+        state.mtval = state.trapValue;
+      }
+      auto mie = (state.mstatus & MSTATUS_MIE) != 0;
+      state.mstatus = (state.mstatus & ~(MSTATUS_MIE | MSTATUS_MPIE | MSTATUS_MPP)) |
+                      (mie ? MSTATUS_MPIE : 0) |
+                      (static_cast<uint32_t>(state.privilege) << MSTATUS_MPP_SHIFT);
+      state.privilege = Privilege::MACHINE;
+      if (!memory.contains(state.mtvec, 4)) {
+        TRACE_END();
+        fileDescs.flush();
+        status = Status::TRAPPED;
+        return;
+      }
+      state.pc = state.mtvec;
+      TRACE_REG_WRITE(Register::pc, state.pc);
+      TRACE_END();
+    }
+
+    /// Take a trap raised by the instruction at the PC.
+    template<bool trace>
+    void takeTrap(Trap cause) {
+      trapCount++;
+      TRACE("TRAP", getTrapName(cause), ArgValue(state.trapValue));
+      enterHandler<trace>(static_cast<uint32_t>(cause));
+    }
+
+    /// Take the highest priority interrupt that is both pending and enabled,
+    /// before the instruction at the PC. Interrupts are all taken in M-mode,
+    /// so below it they are enabled regardless of MIE.
+    template<bool trace>
+    void takeInterrupt() {
+      if (state.privilege == Privilege::MACHINE && !(state.mstatus & MSTATUS_MIE)) {
+        return;
+      }
+      auto pending = state.mip & state.mie;
+      for (auto interrupt : {Interrupt::MACHINE_EXTERNAL,
+                             Interrupt::MACHINE_SOFTWARE,
+                             Interrupt::MACHINE_TIMER}) {
+        if (pending & (1U << static_cast<uint32_t>(interrupt))) {
+          state.fetchAddress = state.pc;
+          TRACE("INTERRUPT", getInterruptName(interrupt));
+          enterHandler<trace>(MCAUSE_INTERRUPT | static_cast<uint32_t>(interrupt));
+          if (!trace && recorder.enabled()) {
+            recorder.interrupt(interrupt, state);
           }
-          break;
+          return;
         }
-        case Opcode::LOAD: {
-          auto instr = InstructionIType(value);
-          switch (instr.funct) {
-            case 0b000: execute_LB<trace>(instr); break;
-            case 0b001: execute_LH<trace>(instr); break;
-            case 0b010: execute_LW<trace>(instr); break;
-            case 0b100: execute_LBU<trace>(instr); break;
-            case 0b101: execute_LHU<trace>(instr); break;
-            default: throw UnknownOpcodeException("LOAD");
-          }
+      }
+    }
+
+    /// Finish a step by servicing device events that have fallen due, which
+    /// may raise an interrupt. Return false once the program has exited or
+    /// stopped on a trap without a handler.
+    template<bool trace>
+    bool endStep() {
+      if (state.cycleCount >= events.nextCycle() && status == Status::RUNNING) {
+        events.service(state.cycleCount);
+        deviceEffects++;
+        takeInterrupt<trace>();
+      }
+      return status == Status::RUNNING;
+    }
+
+    /// Execute a pair of instructions beginning at the PC as one fused
+    /// operation, leaving the same state as executing them separately.
+    /// Return the operation performed, which is NONE if the pair cannot be
+    /// fused, including when the second instruction would trap.
+    FusedOperation stepFused(uint32_t first) {
+      auto *next = memory.hostPtr(state.pc + 4, 4);
+      if (next == nullptr) {
+        return FusedOperation::NONE;
+      }
+      uint32_t second;
+      std::memcpy(&second, next, sizeof(second));
+      auto pc = state.pc;
+      auto fusedOp = fuse(first, second);
+      switch (fusedOp) {
+        case FusedOperation::LUI_ADDI: {
+          auto upper = InstructionUType(first).imm << 12;
+          auto lower = signExtend<12>(InstructionIType(second).imm);
+          state.writeReg(InstructionUType(first).rd, upper + lower);
+          state.pc = pc + 8;
           break;
         }
-        case Opcode::STORE: {
-          auto instr = InstructionSType(value);
-          switch (instr.funct) {
-            case 0b000: execute_SB<trace>(instr); break;
-            case 0b001: execute_SH<trace>(instr); break;
-            case 0b010: execute_SW<trace>(instr); break;
-            default: throw UnknownOpcodeException("STORE");
+        case FusedOperation::AUIPC_JALR: {
+          auto base = pc + (InstructionUType(first).imm << 12);
+          auto jalr = InstructionIType(second);
+          auto targetPC = (base + signExtend<12>(jalr.imm)) & ~1U;
+          if (targetPC & 0x3) {
+            return FusedOperation::NONE;
           }
+          state.writeReg(InstructionUType(first).rd, base);
+          state.writeReg(jalr.rd, pc + 8);
+          state.pc = targetPC;
           break;
         }
-        case Opcode::OP_IMM: {
-          auto immInstr = InstructionIType(value);
-          switch (immInstr.funct) {
-            case 0b000: execute_ADDI<trace>(immInstr); break;
-            case 0b010: execute_SLTI<trace>(immInstr); break;
-            case 0b011: execute_SLTIU<trace>(immInstr); break;
-            case 0b100: execute_XORI<trace>(immInstr); break;
-            case 0b110: execute_ORI<trace>(immInstr); break;
-            case 0b111: execute_ANDI<trace>(immInstr); break;
-            case 0b001:
-            case 0b101: {
-              auto shInstr = InstructionIShamtType(value);
-              switch (shInstr.funct) {
-                case 0b0000000001: execute_SLLI<trace>(shInstr); break;
-                case 0b0000000101: execute_SRLI<trace>(shInstr); break;
-                case 0b0100000101: execute_SRAI<trace>(shInstr); break;
-                default: throw UnknownOpcodeException("OP-IMM shift");
-              }
-              break;
-            }
-            default: throw UnknownOpcodeException("OP-IMM");
+        case FusedOperation::AUIPC_LW: {
+          auto address = pc + (InstructionUType(first).imm << 12) +
+                         signExtend<12>(InstructionIType(second).imm);
+          if ((address & 0x3) || !memory.contains(address, 4)) {
+            return FusedOperation::NONE;
           }
+          state.writeReg(InstructionUType(first).rd, memory.readMemoryWord(address));
+          state.pc = pc + 8;
           break;
         }
-        case Opcode::OP: {
-          auto regInstr = InstructionRType(value);
-          switch (regInstr.funct) {
-            case 0b0000000000: execute_ADD<trace>(regInstr); break;
-            case 0b0100000000: execute_SUB<trace>(regInstr); break;
-            case 0b0000000001: execute_SLL<trace>(regInstr); break;
-            case 0b0000000010: execute_SLT<trace>(regInstr); break;
-            case 0b0000000011: execute_SLTU<trace>(regInstr); break;
-            case 0b0000000100: execute_XOR<trace>(regInstr); break;
-            case 0b0000000101: execute_SRL<trace>(regInstr); break;
-            case 0b0100000101: execute_SRA<trace>(regInstr); break;
-            case 0b0000000110: execute_OR<trace>(regInstr); break;
-            case 0b0000000111: execute_AND<trace>(regInstr); break;
-            default: throw UnknownOpcodeException("OP");
-          }
+        case FusedOperation::SLLI_SRLI: {
+          auto slli = InstructionIShamtType(first);
+          auto rs1 = state.readReg(slli.rs1);
+          state.writeReg(slli.rd, (rs1 << slli.shamt) >> InstructionIShamtType(second).shamt);
+          state.pc = pc + 8;
           break;
         }
-        case Opcode::FENCE:
-          // Unimplemented.
-          break;
-        case Opcode::SYS: {
-          auto instr = InstructionIType(value);
-          switch (instr.imm) {
-            case 0b0: execute_ECALL<trace>(instr); break;
-            case 0b1: execute_EBREAK<trace>(instr); break;
-            default: throw UnknownSysImmException(instr.imm);
+        default:
+          return FusedOperation::NONE;
+      }
+      state.fetchAddress = pc + 4;
+      state.cycleCount += 2;
+      return fusedOp;
+    }
+
+    /// Perform a call to an accelerated library function if the PC is at
+    /// the entry point of one, after a jump or branch, unless paging.
+    template<bool trace>
+    void enterIntrinsic() {
+      if (!intrinsics.empty() && !paging()) {
+        if (auto intrinsic = intrinsics.lookup(state.pc); intrinsic != Intrinsic::NONE) {
+          callIntrinsic<trace>(intrinsic);
+        }
+      }
+    }
+
+    /// Skip whole iterations of a busy-wait loop, from its head, up to the
+    /// next device event or the cycle limit. Any remaining iterations are
+    /// stepped normally, so the state at every cycle is the same as without
+    /// skipping.
+    void skipIdleLoop() {
+      if (paging()) {
+        return;
+      }
+      auto length = idleLoops.check(memory, state.fetchAddress, state.pc,
+                                    state.cycleCount, deviceEffects);
+      if (length == 0) {
+        return;
+      }
+      auto wake = std::min(events.nextCycle(), cycleLimit);
+      if (wake != UINT64_MAX && wake > state.cycleCount) {
+        state.cycleCount += (wake - state.cycleCount) / length * length;
+      }
+    }
+
+    /// Call the per-instruction hooks of an observer for the instruction
+    /// that has retired from pc, given the value of rs1 before it executed
+    /// and the number of system calls made before it.
+    template<typename Observer>
+    void observeRetire(Observer &observer, uint32_t pc, uint32_t instruction,
+                       uint32_t rs1Value, uint64_t syscalls) {
+      auto &spec = getSpec(decode(instruction));
+      if (subscribes(observer, HOOK_RETIRE)) {
+        observer.retire(state, pc, instruction);
+      }
+      if ((spec.flags & (LOAD | STORE)) && subscribes(observer, HOOK_MEMORY)) {
+        MemoryAccess access;
+        access.pc = pc;
+        access.size = (spec.flags & SIZE_1) ? 1 : (spec.flags & SIZE_2) ? 2 : 4;
+        access.store = (spec.flags & STORE) != 0;
+        if (access.store) {
+          access.address = rs1Value + signExtend<12>(InstructionSType(instruction).imm);
+          access.value = state.registers[bitRange<24, 20>(instruction)];
+          if (access.size < 4) {
+            access.value &= (1U << (access.size * 8)) - 1;
           }
-          break;
+        } else {
+          access.address = rs1Value + signExtend<12>(InstructionIType(instruction).imm);
+          access.value = state.registers[bitRange<11, 7>(instruction)];
         }
-        default: throw UnknownOpcodeException(std::to_string(opcode));
+        observer.memoryAccess(state, access);
+      }
+      if ((spec.flags & (BRANCH | JUMP)) && subscribes(observer, HOOK_BRANCH)) {
+        bool taken = (spec.flags & JUMP) || state.pc != pc + 4;
+        auto target = taken ? state.pc
+                            : pc + signExtend<13>(InstructionBType(instruction).imm);
+        observer.branch(state, pc, target, taken);
       }
+      if (syscallCount != syscalls && subscribes(observer, HOOK_SYSCALL)) {
+        observer.syscall(state, syscallArgs.data());
+      }
+    }
+
+    /// Return true if an observer subscribes to any of the given hooks, which
+    /// is a constant for a policy compiled into the executor.
+    template<typename Observer>
+    static bool subscribes(const Observer &observer, unsigned hooks) {
+      return (Observer::HOOKS & hooks) && observer.subscribed(hooks);
     }
-    // clang-format on
 
-    /// Step the execution by one cycle.
+    /// Step the execution by one instruction, or by a pair of instructions
+    /// when they can be fused. Fusion is only used without tracing, so that
+    /// every instruction is traced individually, and never carries the cycle
+    /// count past the cycle limit or the next device event. An instruction
+    /// that traps counts as a cycle. Untraced steps are kept by the flight
+    /// recorder when it is enabled. Return false once the program has exited
+    /// or stopped on a trap without a handler.
     template<bool trace>
-    void step() {
-      auto fetchData = memory.readMemoryWord(state.pc);
+    bool step() {
+      ObserverPolicy none;
+      return step<trace>(none);
+    }
+
+    /// Step the instruction at the PC given its encoding, which the caller
+    /// has fetched, as an untraced and unobserved step that neither fuses
+    /// instructions nor skips idle loops. Code translated ahead of time
+    /// passes constant encodings, so that the decode folds away. Return
+    /// false once the program has exited or stopped on a trap without a
+    /// handler.
+    bool stepDecoded(uint32_t instruction) {
       state.fetchAddress = state.pc;
-      dispatchInstruction<trace>(fetchData);
-      auto toHostCommand = memory.readMemoryDoubleWord(toHostAddress);
-      if (toHostCommand != 0) {
-        handleSyscall<trace>(toHostCommand);
-        // Clear the syscall.
-        memory.writeMemoryDoubleWord(toHostAddress, 0);
+      auto trap = dispatchInstruction<false>(instruction);
+      bool jumped = false;
+      if (trap != Trap::NONE) {
+        takeTrap<false>(trap);
+      } else if (state.branchTaken) {
+        state.branchTaken = false;
+        jumped = true;
+      } else {
+        state.pc += 4;
       }
+      state.cycleCount++;
+      if (jumped) {
+        enterIntrinsic<false>();
+      }
+      return endStep<false>();
+    }
+
+    /// Step the execution, calling the hooks of an observer policy. Without
+    /// any hooks, this compiles to the same code as an unobserved step. With
+    /// per-instruction hooks, instructions are neither fused nor skipped as
+    /// part of an idle loop, so that each one is observed.
+    template<bool trace, typename Observer>
+    bool step(Observer &observer) {
+      bool running = stepInstruction<trace>(observer);
+      if (subscribes(observer, HOOK_EXIT) && !running && status != Status::RUNNING) {
+        observer.exit(state, status == Status::TRAPPED, exitCode);
+      }
+      return running;
+    }
+
+    template<bool trace, typename Observer>
+    bool stepInstruction(Observer &observer) {
+      bool single = subscribes(observer, PER_INSTRUCTION_HOOKS);
+      state.fetchAddress = state.pc;
+      FlightRecord *record = nullptr;
+      uint8_t *host;
+      uint32_t physical;
+      auto fetchTrap = translate<AccessType::FETCH>(state.pc, 4, host, physical);
+      if (fetchTrap == Trap::NONE && host == nullptr) {
+        fetchTrap = Trap::INSTRUCTION_ACCESS_FAULT;
+      }
+      if (fetchTrap != Trap::NONE) {
+        if (!trace && recorder.enabled()) {
+          record = &recorder.start(state, 0);
+        }
+        takeTrap<trace>(raise(fetchTrap, state.pc));
+        if (record) {
+          recorder.trap(*record, fetchTrap, state);
+        }
+        state.cycleCount++;
+        return endStep<trace>();
+      }
+      uint32_t fetchData;
+      std::memcpy(&fetchData, host, sizeof(fetchData));
+      if (!trace && recorder.enabled()) {
+        record = &recorder.start(state, fetchData);
+      }
+      if (!trace && !single && fusion && isFusionCandidate(fetchData) && !paging() &&
+          state.cycleCount + 2 <= cycleLimit &&
+          state.cycleCount + 2 <= events.nextCycle()) {
+        auto fusedOp = stepFused(fetchData);
+        if (fusedOp != FusedOperation::NONE) {
+          if (record) {
+            auto pc = state.fetchAddress - 4;
+            recorder.fused(*record, memory.readMemoryWord(pc + 4),
+                           fusedIntermediate(fetchData, pc, record->rs1Value), state);
+          }
+          if (fusedOp == FusedOperation::AUIPC_JALR) {
+            enterIntrinsic<trace>();
+          }
+          return endStep<trace>();
+        }
+      }
+      uint32_t rs1Value = 0;
+      uint64_t syscalls = 0;
+      if (subscribes(observer, PER_INSTRUCTION_HOOKS | HOOK_SYSCALL)) {
+        rs1Value = state.registers[bitRange<19, 15>(fetchData)];
+        syscalls = syscallCount;
+      }
+      auto trap = dispatchInstruction<trace>(fetchData);
+      if (trap != Trap::NONE) {
+        takeTrap<trace>(trap);
+        if (record) {
+          recorder.trap(*record, trap, state);
+        }
+        state.cycleCount++;
+        return endStep<trace>();
+      }
+      bool jumped = state.branchTaken;
       if (!state.branchTaken) {
         state.pc += 4;
       } else {
         state.branchTaken = false;
       }
+      if (record) {
+        recorder.finish(*record, state);
+      }
+      if (subscribes(observer, PER_INSTRUCTION_HOOKS | HOOK_SYSCALL)) {
+        observeRetire(observer, state.fetchAddress, fetchData, rs1Value, syscalls);
+      }
       state.cycleCount++;
+      // Accelerated library functions are entered by a jump or branch, and a
+      // backward one may close a busy-wait loop. Neither is used when each
+      // instruction and its memory accesses are observed.
+      if (jumped && !single) {
+        enterIntrinsic<trace>();
+        if (!trace && idleSkip && state.pc < state.fetchAddress) {
+          skipIdleLoop();
+        }
+      }
+      return endStep<trace>();
     }
 };
 
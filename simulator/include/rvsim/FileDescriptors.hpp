@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace rvsim {
+
+// Guest file descriptor numbers used by newlib for the standard streams.
+const int GUEST_STDIN  = 0;
+const int GUEST_STDOUT = 1;
+const int GUEST_STDERR = 2;
+
+// Flag values passed to openat by newlib, which differ from the host values.
+const uint32_t GUEST_O_ACCMODE = 0x0003;
+const uint32_t GUEST_O_APPEND  = 0x0008;
+const uint32_t GUEST_O_CREAT   = 0x0200;
+const uint32_t GUEST_O_TRUNC   = 0x0400;
+const uint32_t GUEST_O_EXCL    = 0x0800;
+
+/// The layout of struct kernel_stat from the RV32 newlib port, which is what
+/// the guest passes to fstat.
+struct GuestStat {
+  uint64_t dev;
+  uint64_t ino;
+  uint32_t mode;
+  uint32_t nlink;
+  uint32_t uid;
+  uint32_t gid;
+  uint64_t rdev;
+  uint64_t pad1;
+  int64_t size;
+  int32_t blksize;
+  int32_t pad2;
+  int64_t blocks;
+  int64_t atimeSec;
+  int32_t atimeNsec;
+  int32_t pad3;
+  int64_t mtimeSec;
+  int32_t mtimeNsec;
+  int32_t pad4;
+  int64_t ctimeSec;
+  int32_t ctimeNsec;
+  int32_t pad5;
+  int32_t reserved[2];
+};
+
+static_assert(sizeof(GuestStat) == 128, "unexpected guest stat layout");
+
+/// The table of files open by the guest, indexed by guest file descriptor.
+/// Each entry holds a host file descriptor, or -1 if the slot is free.
+/// Files can only be opened beneath a sandbox directory on the host, and all
+/// operations return a negated errno value on failure, which is the
+/// convention newlib expects from a syscall.
+class FileDescriptors {
+  struct File {
+    int hostFd;
+    bool console;
+  };
+  std::vector<File> files;
+  int sandboxFd;
+  bool bufferConsole;
+  std::vector<uint8_t> consoleBuffer;
+  int consoleBufferFd;
+  // The console streams held in memory instead of the host's, when captured.
+  bool captured;
+  std::string capturedInput;
+  size_t capturedInputOffset;
+  std::string capturedOutput[2];
+
+  File *lookup(int fd);
+
+public:
+  FileDescriptors();
+  ~FileDescriptors();
+
+  FileDescriptors(const FileDescriptors &) = delete;
+  FileDescriptors &operator=(const FileDescriptors &) = delete;
+
+  /// Allow the guest to open files beneath the given host directory.
+  void setSandbox(const std::string &directory);
+
+  /// Buffer writes to stdout and stderr until the buffer fills, the guest
+  /// reads stdin or the program exits.
+  void setBufferConsole(bool enable) { bufferConsole = enable; }
+
+  /// Write out any buffered console output.
+  void flush();
+
+  /// Serve the console from memory rather than the host, so that the guest
+  /// reads stdin from the given input and its writes to stdout and stderr
+  /// are kept until they are taken.
+  void captureConsole(const std::string &input);
+
+  /// Return and clear the output captured from stdout or stderr.
+  std::string takeOutput(int fd);
+
+  /// Return true if a read of stdin would not block.
+  bool inputReady();
+
+  /// Open a file relative to the sandbox, returning a guest descriptor.
+  int open(const char *path, uint32_t guestFlags, uint32_t mode);
+  int close(int fd);
+  ssize_t read(int fd, uint8_t *buffer, size_t length);
+  ssize_t write(int fd, const uint8_t *buffer, size_t length);
+  int64_t lseek(int fd, int64_t offset, int whence);
+  int fstat(int fd, GuestStat &stat);
+};
+
+} // End namespace rvsim
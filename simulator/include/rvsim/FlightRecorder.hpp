@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "bits.hpp"
+#include "HartState.hpp"
+#include "Intrinsics.hpp"
+#include "SymbolInfo.hpp"
+#include "Trap.hpp"
+
+namespace rvsim {
+
+/// What a flight record describes, held in the top bits of its event field
+/// with the trap cause, interrupt or intrinsic in the low bits.
+enum class FlightEvent : uint32_t {
+  RETIRED   = 0,
+  TRAP      = 1U << 28,
+  INTERRUPT = 2U << 28,
+  INTRINSIC = 3U << 28
+};
+
+const uint32_t FLIGHT_EVENT_MASK = 0xFU << 28;
+
+/// A compact record of one step. The source register values are those read
+/// by the instruction, and the destination register value is the one it
+/// wrote, so that the operands and results shown by a trace can be
+/// reconstructed without decoding on the fast path.
+struct FlightRecord {
+  uint64_t cycle;
+  uint32_t pc;
+  // The instruction, or the length argument of an intrinsic.
+  uint32_t instruction;
+  uint32_t rs1Value;
+  uint32_t rs2Value;
+  // The value of rd, or of mtval or stval for a trap, or the result of an
+  // intrinsic.
+  uint32_t rdValue;
+  uint32_t nextPc;
+  uint32_t event;
+};
+
+/// Records the last steps of an untraced run in a preallocated ring, so that
+/// the instructions leading up to a failure can be printed in the format of
+/// Trace without running again with tracing enabled.
+class FlightRecorder {
+  std::vector<FlightRecord> records;
+  // The storage of the ring, or null when recording is disabled.
+  FlightRecord *ring;
+  size_t mask;
+  uint64_t head;
+
+public:
+  FlightRecorder() : ring(nullptr), mask(0), head(0) {}
+
+  /// Allocate space for at least count records, rounded up to a power of
+  /// two, or disable recording if count is zero.
+  void resize(size_t count) {
+    size_t capacity = count == 0 ? 0 : 1;
+    while (capacity < count) {
+      capacity <<= 1;
+    }
+    records.assign(capacity, FlightRecord{});
+    ring = capacity == 0 ? nullptr : records.data();
+    mask = capacity - 1;
+    head = 0;
+  }
+
+  bool enabled() const { return ring != nullptr; }
+
+  /// Begin a record of the instruction at the PC, before it executes.
+  FlightRecord &start(const HartState &state, uint32_t instruction) {
+    auto &record = ring[head++ & mask];
+    record.cycle = state.cycleCount;
+    record.pc = state.pc;
+    record.instruction = instruction;
+    record.rs1Value = state.registers[bitRange<19, 15>(instruction)];
+    record.rs2Value = state.registers[bitRange<24, 20>(instruction)];
+    record.event = static_cast<uint32_t>(FlightEvent::RETIRED);
+    return record;
+  }
+
+  /// Complete a record once its instruction has executed.
+  void finish(FlightRecord &record, const HartState &state) {
+    record.rdValue = state.registers[bitRange<11, 7>(record.instruction)];
+    record.nextPc = state.pc;
+  }
+
+  /// Complete a record whose instruction trapped and entered the handler.
+  void trap(FlightRecord &record, Trap cause, const HartState &state) {
+    record.rdValue = state.trapValue;
+    record.nextPc = state.pc;
+    record.event = static_cast<uint32_t>(FlightEvent::TRAP) | static_cast<uint32_t>(cause);
+  }
+
+  /// Record the second instruction of a fused pair, which reads the value
+  /// written by the first, after the pair has executed.
+  void fused(FlightRecord &first, uint32_t second, uint32_t intermediate,
+             const HartState &state) {
+    first.rdValue = intermediate;
+    first.nextPc = first.pc + 4;
+    auto &record = ring[head++ & mask];
+    record.cycle = first.cycle + 1;
+    record.pc = first.pc + 4;
+    record.instruction = second;
+    record.rs1Value = intermediate;
+    record.rs2Value = state.registers[bitRange<24, 20>(second)];
+    record.event = static_cast<uint32_t>(FlightEvent::RETIRED);
+    finish(record, state);
+  }
+
+  /// Record an interrupt taken before the instruction at the PC.
+  void interrupt(Interrupt interrupt, const HartState &state) {
+    auto &record = ring[head++ & mask];
+    record.cycle = state.cycleCount;
+    record.pc = state.mepc;
+    record.instruction = 0;
+    record.nextPc = state.pc;
+    record.event = static_cast<uint32_t>(FlightEvent::INTERRUPT) |
+                   static_cast<uint32_t>(interrupt);
+  }
+
+  /// Record a call to a library function performed on the host.
+  void intrinsic(Intrinsic intrinsic, uint32_t a0, uint32_t a1, uint32_t a2,
+                 uint32_t result, const HartState &state) {
+    auto &record = ring[head++ & mask];
+    record.cycle = state.cycleCount;
+    record.pc = state.fetchAddress;
+    record.instruction = a2;
+    record.rs1Value = a0;
+    record.rs2Value = a1;
+    record.rdValue = result;
+    record.nextPc = state.pc;
+    record.event = static_cast<uint32_t>(FlightEvent::INTRINSIC) |
+                   static_cast<uint32_t>(intrinsic);
+  }
+
+  /// The number of records held, up to the capacity of the ring.
+  size_t size() const { return head < records.size() ? head : records.size(); }
+
+  /// Print the records, oldest first, in the format of Trace.
+  void dump(std::ostream &out, SymbolInfo &symbolInfo) const;
+};
+
+} // End namespace rvsim
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Executor.hpp"
+#include "Instructions.hpp"
+#include "Plugin.hpp"
+
+namespace rvsim {
+
+/// Tracks the memory footprint of a program, as an observer policy of the
+/// executor: the lowest value of the stack pointer, the deepest stack that
+/// each function's own instructions set, and the pages of memory fetched
+/// from, loaded from or stored to, kept in a bitmap of the memory. When the
+/// program ends, the pages touched in each region of the program are
+/// written to a report, with the regions found from the symbols of the
+/// linker script. The stack pointer is only examined when an instruction
+/// writes it, and it may be checked against a guard address, raising an
+/// error if it moves below it.
+class Footprint : public ObserverPolicy {
+  const Executor &executor;
+  std::ofstream file;
+  bool finished;
+  uint32_t guard;
+  uint32_t stackTop;
+  uint32_t lowestSp;
+  // The deepest stack set by each function, by the address of its symbol.
+  std::map<uint32_t, uint32_t> functionDepths;
+  // A bit for each page of memory that has been accessed.
+  std::vector<uint64_t> pages;
+  uint32_t lastPage;
+
+  void touch(uint32_t address) {
+    auto page = (address - executor.memory.baseAddress) >> 12;
+    if (page != lastPage && page < pages.size() * 64) {
+      pages[page / 64] |= 1ULL << (page % 64);
+      lastPage = page;
+    }
+  }
+
+  void setStackPointer(const HartState &state, uint32_t pc, uint32_t sp);
+  void writeReport();
+
+public:
+  static constexpr unsigned HOOKS = HOOK_RETIRE | HOOK_MEMORY | HOOK_EXIT | HOOK_CONTROL;
+
+  /// Track the footprint of the program loaded into an executor, writing a
+  /// report to a file unless the filename is empty, and raising an error if
+  /// the stack pointer is set below the guard address, unless it is zero.
+  Footprint(const std::string &filename, uint32_t guard, const Executor &executor);
+
+  void retire(const HartState &state, uint32_t pc, uint32_t instruction) {
+    touch(pc);
+    if (bitRange<11, 7>(instruction) == Register::x2 &&
+        (getSpec(decode(instruction)).flags & WRITES_RD)) {
+      setStackPointer(state, pc, state.registers[Register::x2]);
+    }
+  }
+
+  void memoryAccess(const HartState &state, const MemoryAccess &access) {
+    touch(access.address);
+  }
+
+  void exit(const HartState &state, bool trapped, uint32_t exitCode) {
+    finish();
+  }
+
+  /// Write the report so far, or forget the footprint so far, when
+  /// requested.
+  void control(const HartState &state, Control request);
+
+  /// Write the report. This is done on exit, and must be done by the driver
+  /// if the run stops otherwise.
+  void finish();
+
+  uint32_t getLowestStackPointer() const { return lowestSp; }
+  uint32_t getStackTop() const { return stackTop; }
+};
+
+} // End namespace rvsim
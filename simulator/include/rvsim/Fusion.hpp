@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Instructions.hpp"
+
+namespace rvsim {
+
+/// Pairs of adjacent instructions that Executor can perform as one
+/// operation. Each pair is only fused when the intermediate value written by
+/// the first instruction is consumed by the second, so that the fused
+/// operation leaves exactly the same state as executing the pair in turn.
+enum class FusedOperation {
+  NONE,
+  LUI_ADDI,   // lui rd, hi; addi rd, rd, lo: load a 32-bit constant.
+  AUIPC_JALR, // auipc rt, hi; jalr rd, lo(rt): a far call or jump.
+  AUIPC_LW,   // auipc rd, hi; lw rd, lo(rd): a PC-relative load.
+  SLLI_SRLI   // slli rd, rs, n; srli rd, rd, m: a zero extension.
+};
+
+/// Return true if an instruction can begin a fused pair, which is checked
+/// before looking at the following instruction.
+inline constexpr bool isFusionCandidate(uint32_t value) {
+  auto opcode = value & 0x7F;
+  return opcode == 0x37 || opcode == 0x17 ||
+         (value & 0xFE00707F) == getSpec(Operation::SLLI).match;
+}
+
+/// Identify the fused operation performed by a pair of instructions.
+inline constexpr FusedOperation fuse(uint32_t first, uint32_t second) {
+  auto firstOp = decode(first);
+  auto secondOp = decode(second);
+  auto rd = bitRange<11, 7>(first);
+  auto secondRd = bitRange<11, 7>(second);
+  auto secondRs1 = bitRange<19, 15>(second);
+  // A write to x0 is discarded, so the intermediate value must be live.
+  if (rd == 0 || secondRs1 != rd) {
+    return FusedOperation::NONE;
+  }
+  switch (firstOp) {
+  case Operation::LUI:
+    if (secondOp == Operation::ADDI && secondRd == rd) {
+      return FusedOperation::LUI_ADDI;
+    }
+    break;
+  case Operation::AUIPC:
+    if (secondOp == Operation::JALR) {
+      return FusedOperation::AUIPC_JALR;
+    }
+    if (secondOp == Operation::LW && secondRd == rd) {
+      return FusedOperation::AUIPC_LW;
+    }
+    break;
+  case Operation::SLLI:
+    if (secondOp == Operation::SRLI && secondRd == rd) {
+      return FusedOperation::SLLI_SRLI;
+    }
+    break;
+  default:
+    break;
+  }
+  return FusedOperation::NONE;
+}
+
+/// Return the intermediate value written by the first instruction of a
+/// fused pair at pc, given the value of its source register, which is the
+/// value that the second instruction reads.
+inline constexpr uint32_t fusedIntermediate(uint32_t first, uint32_t pc, uint32_t rs1) {
+  switch (first & 0x7F) {
+  case 0x37: return first & ~0xFFFU;
+  case 0x17: return pc + (first & ~0xFFFU);
+  default:   return rs1 << bitRange<24, 20>(first);
+  }
+}
+
+} // End namespace rvsim
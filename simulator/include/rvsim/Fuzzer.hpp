@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "Executor.hpp"
+#include "Plugin.hpp"
+#include "Snapshot.hpp"
+#include "SymbolInfo.hpp"
+
+namespace rvsim {
+
+// The size of an AFL coverage bitmap.
+const size_t FUZZ_MAP_SIZE = 1 << 16;
+
+/// Records edge coverage in an AFL-compatible bitmap, as an observer policy
+/// of the executor. Each retired branch or jump counts the edge from its
+/// address to the next PC, in the byte indexed by a hash of the pair, as
+/// AFL's instrumentation does for the edges between basic blocks. The pages
+/// written by stores and by system calls are marked dirty in a snapshot.
+class EdgeCoverage : public ObserverPolicy {
+  uint8_t *bitmap;
+  Snapshot &snapshot;
+  const Executor &executor;
+  // The address of the argument block last written to tohost.
+  uint32_t command;
+
+  static uint32_t location(uint32_t pc) {
+    return ((pc >> 2) * 0x9E3779B1U) >> 16;
+  }
+
+public:
+  static constexpr unsigned HOOKS = HOOK_MEMORY | HOOK_BRANCH | HOOK_SYSCALL;
+
+  EdgeCoverage(uint8_t *bitmap, Snapshot &snapshot, const Executor &executor)
+    : bitmap(bitmap), snapshot(snapshot), executor(executor), command(0) {}
+
+  void branch(const HartState &state, uint32_t pc, uint32_t target, bool taken) {
+    auto next = taken ? target : pc + 4;
+    bitmap[((location(pc) >> 1) ^ location(next)) % FUZZ_MAP_SIZE]++;
+  }
+
+  void memoryAccess(const HartState &state, const MemoryAccess &access) {
+    if (access.store) {
+      snapshot.markDirty(access.address, access.size);
+      if (access.address == executor.toHostAddress) {
+        command = access.value;
+      }
+    }
+  }
+
+  /// Mark the argument block, fromhost and any buffer that the call fills.
+  void syscall(const HartState &state, const uint64_t *args);
+};
+
+/// The outcome of running one input.
+enum class FuzzOutcome {
+  EXITED,  // The program exited, with Executor::exitCode.
+  TRAPPED, // The program stopped on a trap that it does not handle.
+  BUDGET   // The cycle budget was used up.
+};
+
+/// Runs a program repeatedly on inputs from a fuzzer. The program first runs
+/// until it reaches an entry point, where a snapshot is taken. Each input is
+/// then copied into a buffer in memory, with its length written to a word if
+/// one is given, and the program runs from the snapshot until it exits,
+/// traps or uses up a budget of cycles, recording its edge coverage. The
+/// next run resets the executor to the snapshot, copying back only the
+/// pages that were written. Errors are reported by throwing Exception.
+class FuzzHarness {
+  Executor &executor;
+  uint32_t buffer;
+  uint32_t bufferSize;
+  uint32_t lengthAddress;
+  uint64_t budget;
+  std::unique_ptr<Snapshot> snapshot;
+  std::unique_ptr<EdgeCoverage> coverage;
+
+public:
+  /// Run the program loaded into an executor to the symbol entry and take
+  /// the snapshot. Inputs are copied into the buffer named by the symbol
+  /// input, whose size is given by its symbol unless bufferSize is
+  /// non-zero, and longer inputs are truncated. Their length is written to
+  /// the word named by the symbol length, unless it is empty.
+  FuzzHarness(Executor &executor, SymbolInfo &symbolInfo, const std::string &entry,
+              const std::string &input, uint32_t bufferSize, const std::string &length,
+              uint64_t budget, uint8_t *bitmap);
+
+  /// Run the program on an input from the snapshot, counting its edges in
+  /// the bitmap, which the caller clears. An error in the program, such as
+  /// an unknown system call, stops it as a trap would.
+  FuzzOutcome run(const uint8_t *data, size_t size);
+
+  uint32_t getBufferSize() const { return bufferSize; }
+  const Snapshot &getSnapshot() const { return *snapshot; }
+};
+
+} // End namespace rvsim
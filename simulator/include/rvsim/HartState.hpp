@@ -5,6 +5,7 @@
 #include <cstdint>
 
 #include "SymbolInfo.hpp"
+#include "Trap.hpp"
 
 namespace rvsim {
 
@@ -60,14 +61,38 @@ class HartState {
 public:
   std::array<uint32_t, NUM_REGISTERS> registers;
   uint32_t pc;
+  Privilege privilege;
+  // Machine-mode trap CSRs.
+  uint32_t mstatus;
+  uint32_t mie;
+  uint32_t mip;
+  uint32_t mtvec;
+  uint32_t mscratch;
+  uint32_t mepc;
+  uint32_t mcause;
+  uint32_t mtval;
+  uint32_t medeleg;
+  // Supervisor-mode trap and translation CSRs. The fields of sstatus are
+  // held in mstatus.
+  uint32_t stvec;
+  uint32_t sscratch;
+  uint32_t sepc;
+  uint32_t scause;
+  uint32_t stval;
+  uint32_t satp;
   // Non-architectural.
   SymbolInfo &symbolInfo;
   uint64_t cycleCount;
   uint32_t fetchAddress;
+  // The value of mtval or stval for the trap being raised.
+  uint32_t trapValue;
   bool branchTaken;
 
   HartState(SymbolInfo &symbolInfo)
-    : pc(0), symbolInfo(symbolInfo), cycleCount(0), branchTaken(false) {}
+    : registers{}, pc(0), privilege(Privilege::MACHINE), mstatus(MSTATUS_MPP), mie(0),
+      mip(0), mtvec(0), mscratch(0), mepc(0), mcause(0), mtval(0), medeleg(0), stvec(0),
+      sscratch(0), sepc(0), scause(0), stval(0), satp(0), symbolInfo(symbolInfo),
+      cycleCount(0), trapValue(0), branchTaken(false) {}
 
   /// Read a GP register, with special handling for x0.
   uint32_t readReg(size_t index) {
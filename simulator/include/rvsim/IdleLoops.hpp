@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "bits.hpp"
+#include "Instructions.hpp"
+#include "Memory.hpp"
+
+namespace rvsim {
+
+// The longest loop body, in instructions, that is considered for skipping.
+const uint32_t MAX_IDLE_LOOP_LENGTH = 16;
+
+/// Recognises busy-wait loops, whose iterations repeat without any effect
+/// until an interrupt or device changes the state that they poll. A loop
+/// closed by a backward branch or jump is a candidate when its body contains
+/// no stores, jumps or system instructions, and every register it reads
+/// before writing is not written by it, so that each iteration recomputes
+/// the same values. The loop is confirmed when an iteration runs straight
+/// through, without a taken branch, interrupt, device event or device access
+/// other than a stable read, at which point every further iteration is
+/// identical until the next device event.
+class IdleLoops {
+  struct Entry {
+    uint32_t branch;
+    uint32_t target;
+    uint32_t length;
+  };
+  std::array<Entry, 256> cache;
+  // The loop whose iteration is being checked.
+  uint32_t armedBranch;
+  uint64_t armedCycle;
+  uint64_t armedDeviceEffects;
+
+  static unsigned sourceRegisters(Format format, uint32_t value) {
+    auto rs1 = 1U << bitRange<19, 15>(value);
+    auto rs2 = 1U << bitRange<24, 20>(value);
+    switch (format) {
+      case Format::R:
+      case Format::B:
+      case Format::S:      return rs1 | rs2;
+      case Format::I:
+      case Format::IShamt: return rs1;
+      default:             return 0;
+    }
+  }
+
+  /// Return the number of instructions in a candidate loop, or zero if the
+  /// loop from target to branch is not one.
+  static uint32_t analyse(Memory &memory, uint32_t branch, uint32_t target) {
+    auto length = (branch - target) / 4 + 1;
+    if (length > MAX_IDLE_LOOP_LENGTH || !memory.contains(target, length * 4)) {
+      return 0;
+    }
+    unsigned liveIn = 0;
+    unsigned written = 0;
+    for (uint32_t address = target; address <= branch; address += 4) {
+      auto value = memory.readMemoryWord(address);
+      auto op = decode(value);
+      auto &spec = getSpec(op);
+      bool last = address == branch;
+      if (op == Operation::ILLEGAL || (spec.flags & (STORE | SYSTEM)) ||
+          ((spec.flags & JUMP) && !(last && op == Operation::JAL))) {
+        return 0;
+      }
+      if (last && !(spec.flags & (BRANCH | JUMP))) {
+        return 0;
+      }
+      liveIn |= sourceRegisters(spec.format, value) & ~written;
+      if (spec.flags & WRITES_RD) {
+        written |= 1U << bitRange<11, 7>(value);
+      }
+    }
+    // Writes to x0 are discarded, and it always reads as zero.
+    return (liveIn & written & ~1U) ? 0 : length;
+  }
+
+public:
+  IdleLoops() { flush(); }
+
+  /// Forget the loops that have been analysed, after the code changes.
+  void flush() {
+    cache.fill({1, 0, 0});
+    armedBranch = 1;
+  }
+
+  /// Called after a backward branch or jump from branch to target. Return
+  /// the length of the loop in instructions if it has just completed an
+  /// iteration that will repeat unchanged, or zero otherwise.
+  uint32_t check(Memory &memory, uint32_t branch, uint32_t target,
+                 uint64_t cycle, uint64_t deviceEffects) {
+    auto &entry = cache[(branch >> 2) % cache.size()];
+    if (entry.branch != branch || entry.target != target) {
+      entry = {branch, target, analyse(memory, branch, target)};
+    }
+    if (entry.length == 0) {
+      return 0;
+    }
+    bool confirmed = armedBranch == branch &&
+                     cycle - armedCycle == entry.length &&
+                     deviceEffects == armedDeviceEffects;
+    armedBranch = branch;
+    armedCycle = cycle;
+    armedDeviceEffects = deviceEffects;
+    return confirmed ? entry.length : 0;
+  }
+};
+
+} // End namespace rvsim
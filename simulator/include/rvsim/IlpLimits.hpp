@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "HartState.hpp"
+#include "Instructions.hpp"
+#include "Plugin.hpp"
+
+namespace rvsim {
+
+/// Measures the instruction-level parallelism available to an ideal
+/// machine, as an observer policy of the executor, by scheduling the
+/// dynamic dataflow graph of the run as it retires. Each instruction starts
+/// when the registers it reads have been written and, for a load, when the
+/// last store to the same word has completed, and completes after the
+/// latency of its class. Branches are predicted perfectly and registers and
+/// memory are renamed without limit, so only true dependences remain, but
+/// system instructions wait for all before them and delay all after them.
+///
+/// Each of a set of machines has an instruction window: an instruction can
+/// only start once the one a window before it has retired, in order. A
+/// machine keeps the retire times of a window of instructions and the
+/// stores whose results are still awaited, so that its memory is
+/// proportional to its window; a window of zero is unlimited, and its store
+/// table then grows with the data written. The length of the critical path
+/// and the ideal IPC of each machine are written as CSV when the run
+/// finishes.
+class IlpLimits : public ObserverPolicy {
+  // The classes of instruction, which each have a latency.
+  enum LatencyClass : unsigned {
+    LATENCY_ALU, LATENCY_LOAD, LATENCY_STORE, LATENCY_BRANCH, LATENCY_JUMP, LATENCY_SYSTEM,
+    NUM_LATENCIES
+  };
+
+  struct Machine {
+    uint32_t window;
+    // The retire times of the last window of instructions, by sequence.
+    std::vector<uint64_t> retireTimes;
+    // The time at which each register's value is ready.
+    std::array<uint64_t, 32> ready;
+    // The completion time of the last store to each word.
+    std::unordered_map<uint32_t, uint64_t> stores;
+    uint64_t lastRetire;
+    // The time before which no instruction may start.
+    uint64_t barrier;
+    uint64_t criticalPath;
+    // The instructions and critical path before the measurement began.
+    uint64_t startInstructions;
+    uint64_t startPath;
+  };
+
+  std::ofstream file;
+  bool finished;
+  std::array<uint32_t, NUM_LATENCIES> latencies;
+  std::vector<Machine> machines;
+  uint64_t instructions;
+  // The load or store that has retired, which is scheduled once its
+  // address is known.
+  uint32_t pendingInstruction;
+
+  void schedule(uint32_t instruction, uint32_t address);
+  void writeReport();
+
+public:
+  static constexpr unsigned HOOKS = HOOK_RETIRE | HOOK_MEMORY | HOOK_EXIT | HOOK_CONTROL;
+
+  /// Measure the machines with a comma-separated list of window sizes, and
+  /// a comma-separated list of class=latency pairs overriding the default
+  /// latencies, writing the results to a file.
+  IlpLimits(const std::string &filename, const std::string &windows,
+            const std::string &latencies);
+
+  void retire(const HartState &state, uint32_t pc, uint32_t instruction) {
+    if (getSpec(decode(instruction)).flags & (LOAD | STORE)) {
+      pendingInstruction = instruction;
+    } else {
+      schedule(instruction, 0);
+    }
+  }
+
+  void memoryAccess(const HartState &state, const MemoryAccess &access) {
+    schedule(pendingInstruction, access.address);
+  }
+
+  void exit(const HartState &state, bool trapped, uint32_t exitCode) {
+    finish();
+  }
+
+  /// Write the results so far, or begin measuring again, when requested.
+  void control(const HartState &state, Control request);
+
+  /// Write the results. This is done on exit, and must be done by the
+  /// driver if the run stops otherwise.
+  void finish();
+
+  /// Return the length of the critical path of a machine, by its index in
+  /// the list of windows.
+  uint64_t getCriticalPath(size_t machine) const {
+    return machines[machine].criticalPath - machines[machine].startPath;
+  }
+};
+
+} // End namespace rvsim
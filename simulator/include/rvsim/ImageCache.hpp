@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "Memory.hpp"
+#include "SymbolInfo.hpp"
+
+namespace rvsim {
+
+/// The state of a program immediately after it has been loaded, other than
+/// its memory and symbols.
+struct LoadedImage {
+  uint32_t pc;
+  uint32_t toHostAddress;
+  uint32_t fromHostAddress;
+  uint32_t programBreak;
+};
+
+// The alignment of the memory contents within a file that they are mapped
+// from, which must be a multiple of the host page size.
+const uint64_t IMAGE_MEMORY_ALIGNMENT = 0x10000;
+
+/// Write the contents of memory to a file at an offset, which must be
+/// aligned to IMAGE_MEMORY_ALIGNMENT, leaving pages of zeros as holes.
+/// Return false if the file could not be written.
+bool writeMemoryImage(int fd, uint64_t offset, Memory &memory);
+
+/// Return a hash of the contents of an ELF file, which identifies it in an
+/// image cache.
+uint64_t hashImage(const void *data, size_t size);
+
+/// A directory of programs baked into the form they take once loaded: the
+/// initialised memory, laid out to be mapped directly, the symbol table in a
+/// flat array and the LoadedImage. Images are keyed by the hash of the ELF
+/// file and the memory layout, so loading a cached image avoids parsing the
+/// ELF file and copying its segments, and processes running the same program
+/// share the memory pages that it does not write.
+class ImageCache {
+  std::string directory;
+
+  std::string getPath(uint64_t hash, const Memory &memory) const;
+
+public:
+  ImageCache(const std::string &directory) : directory(directory) {}
+
+  /// Map the image of an ELF file with the given hash into memory and add
+  /// its symbols, returning false if it is not in the cache.
+  bool load(uint64_t hash, Memory &memory, SymbolInfo &symbolInfo,
+            LoadedImage &image) const;
+
+  /// Add the image of a program that has just been loaded, replacing any
+  /// existing entry atomically so that concurrent runs see either none or
+  /// a complete one.
+  void store(uint64_t hash, Memory &memory, const SymbolInfo &symbolInfo,
+             const LoadedImage &image) const;
+};
+
+} // End namespace rvsim
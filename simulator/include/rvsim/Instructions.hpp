@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 
 #include "bits.hpp"
@@ -7,86 +8,243 @@
 
 namespace rvsim {
 
-struct InstructionFormat {};
+// Properties of an instruction, used by the decoder's clients.
+enum InstructionFlags : unsigned {
+  WRITES_RD = 1 << 0,
+  LOAD      = 1 << 1,
+  STORE     = 1 << 2,
+  BRANCH    = 1 << 3,
+  JUMP      = 1 << 4,
+  SYSTEM    = 1 << 5,
+  // The size of a memory access in bytes.
+  SIZE_1    = 1 << 6,
+  SIZE_2    = 1 << 7,
+  SIZE_4    = 1 << 8,
+  // The rs1 field of a CSR instruction is an immediate.
+  CSR_IMM   = 1 << 9,
+};
+
+// The instruction set, as a single table from which the decoder, the
+// dispatch in Executor and the disassembler are generated. Each entry gives
+// the mnemonic, the assembly name, the operand format, the mask and match
+// values that identify the encoding and the instruction's flags. Each
+// mnemonic has a handler Executor::execute_<mnemonic> taking the format's
+// operand struct.
+// clang-format off
+#define RVSIM_INSTRUCTIONS(X) \
+  X(LUI,     "lui",     U,      0x0000007F, 0x00000037, WRITES_RD) \
+  X(AUIPC,   "auipc",   U,      0x0000007F, 0x00000017, WRITES_RD) \
+  X(JAL,     "jal",     J,      0x0000007F, 0x0000006F, WRITES_RD | JUMP) \
+  X(JALR,    "jalr",    I,      0x0000707F, 0x00000067, WRITES_RD | JUMP) \
+  X(BEQ,     "beq",     B,      0x0000707F, 0x00000063, BRANCH) \
+  X(BNE,     "bne",     B,      0x0000707F, 0x00001063, BRANCH) \
+  X(BLT,     "blt",     B,      0x0000707F, 0x00004063, BRANCH) \
+  X(BGE,     "bge",     B,      0x0000707F, 0x00005063, BRANCH) \
+  X(BLTU,    "bltu",    B,      0x0000707F, 0x00006063, BRANCH) \
+  X(BGEU,    "bgeu",    B,      0x0000707F, 0x00007063, BRANCH) \
+  X(LB,      "lb",      I,      0x0000707F, 0x00000003, WRITES_RD | LOAD | SIZE_1) \
+  X(LH,      "lh",      I,      0x0000707F, 0x00001003, WRITES_RD | LOAD | SIZE_2) \
+  X(LW,      "lw",      I,      0x0000707F, 0x00002003, WRITES_RD | LOAD | SIZE_4) \
+  X(LBU,     "lbu",     I,      0x0000707F, 0x00004003, WRITES_RD | LOAD | SIZE_1) \
+  X(LHU,     "lhu",     I,      0x0000707F, 0x00005003, WRITES_RD | LOAD | SIZE_2) \
+  X(SB,      "sb",      S,      0x0000707F, 0x00000023, STORE | SIZE_1) \
+  X(SH,      "sh",      S,      0x0000707F, 0x00001023, STORE | SIZE_2) \
+  X(SW,      "sw",      S,      0x0000707F, 0x00002023, STORE | SIZE_4) \
+  X(ADDI,    "addi",    I,      0x0000707F, 0x00000013, WRITES_RD) \
+  X(SLTI,    "slti",    I,      0x0000707F, 0x00002013, WRITES_RD) \
+  X(SLTIU,   "sltiu",   I,      0x0000707F, 0x00003013, WRITES_RD) \
+  X(XORI,    "xori",    I,      0x0000707F, 0x00004013, WRITES_RD) \
+  X(ORI,     "ori",     I,      0x0000707F, 0x00006013, WRITES_RD) \
+  X(ANDI,    "andi",    I,      0x0000707F, 0x00007013, WRITES_RD) \
+  X(SLLI,    "slli",    IShamt, 0xFE00707F, 0x00001013, WRITES_RD) \
+  X(SRLI,    "srli",    IShamt, 0xFE00707F, 0x00005013, WRITES_RD) \
+  X(SRAI,    "srai",    IShamt, 0xFE00707F, 0x40005013, WRITES_RD) \
+  X(ADD,     "add",     R,      0xFE00707F, 0x00000033, WRITES_RD) \
+  X(SUB,     "sub",     R,      0xFE00707F, 0x40000033, WRITES_RD) \
+  X(SLL,     "sll",     R,      0xFE00707F, 0x00001033, WRITES_RD) \
+  X(SLT,     "slt",     R,      0xFE00707F, 0x00002033, WRITES_RD) \
+  X(SLTU,    "sltu",    R,      0xFE00707F, 0x00003033, WRITES_RD) \
+  X(XOR,     "xor",     R,      0xFE00707F, 0x00004033, WRITES_RD) \
+  X(SRL,     "srl",     R,      0xFE00707F, 0x00005033, WRITES_RD) \
+  X(SRA,     "sra",     R,      0xFE00707F, 0x40005033, WRITES_RD) \
+  X(OR,      "or",      R,      0xFE00707F, 0x00006033, WRITES_RD) \
+  X(AND,     "and",     R,      0xFE00707F, 0x00007033, WRITES_RD) \
+  X(FENCE,   "fence",   Sys,    0x0000707F, 0x0000000F, 0) \
+  X(FENCE_I, "fence.i", Sys,    0x0000707F, 0x0000100F, 0) \
+  X(ECALL,   "ecall",   Sys,    0xFFFFFFFF, 0x00000073, SYSTEM) \
+  X(EBREAK,  "ebreak",  Sys,    0xFFFFFFFF, 0x00100073, SYSTEM) \
+  X(MRET,    "mret",    Sys,    0xFFFFFFFF, 0x30200073, SYSTEM | JUMP) \
+  X(SRET,    "sret",    Sys,    0xFFFFFFFF, 0x10200073, SYSTEM | JUMP) \
+  X(WFI,     "wfi",     Sys,    0xFFFFFFFF, 0x10500073, SYSTEM) \
+  X(SFENCE_VMA, "sfence.vma", R, 0xFE007FFF, 0x12000073, SYSTEM) \
+  X(CSRRW,   "csrrw",   Csr,    0x0000707F, 0x00001073, WRITES_RD | SYSTEM) \
+  X(CSRRS,   "csrrs",   Csr,    0x0000707F, 0x00002073, WRITES_RD | SYSTEM) \
+  X(CSRRC,   "csrrc",   Csr,    0x0000707F, 0x00003073, WRITES_RD | SYSTEM) \
+  X(CSRRWI,  "csrrwi",  Csr,    0x0000707F, 0x00005073, WRITES_RD | SYSTEM | CSR_IMM) \
+  X(CSRRSI,  "csrrsi",  Csr,    0x0000707F, 0x00006073, WRITES_RD | SYSTEM | CSR_IMM) \
+  X(CSRRCI,  "csrrci",  Csr,    0x0000707F, 0x00007073, WRITES_RD | SYSTEM | CSR_IMM)
+// clang-format on
+
+enum class Operation : uint8_t {
+#define RVSIM_OPERATION_ENUM(mnemonic, name, format, mask, match, flags) \
+  mnemonic,
+  RVSIM_INSTRUCTIONS(RVSIM_OPERATION_ENUM)
+  ILLEGAL
+};
+
+enum class Format : uint8_t { R, I, IShamt, B, S, U, J, Csr, Sys };
+
+struct InstructionSpec {
+  const char *name;
+  Format format;
+  uint32_t mask;
+  uint32_t match;
+  unsigned flags;
+};
+
+constexpr InstructionSpec instructionSpecs[] = {
+#define RVSIM_INSTRUCTION_SPEC(mnemonic, name, format, mask, match, flags) \
+  {name, Format::format, mask, match, flags},
+  RVSIM_INSTRUCTIONS(RVSIM_INSTRUCTION_SPEC)
+  {"illegal", Format::Sys, 0, 0, 0}
+};
+
+constexpr size_t NUM_OPERATIONS = static_cast<size_t>(Operation::ILLEGAL);
+
+inline constexpr const InstructionSpec &getSpec(Operation op) {
+  return instructionSpecs[static_cast<size_t>(op)];
+}
+
+/// The decode table. The first level is indexed by the major opcode and
+/// funct3 fields, and gives the range of the second level holding the
+/// operations that share those fields, which are then told apart by their
+/// mask and match values. Most ranges hold a single operation.
+struct DecodeTable {
+  static constexpr unsigned NUM_KEYS = 256;
+  std::array<uint16_t, NUM_KEYS + 1> start{};
+  std::array<Operation, NUM_KEYS * 4> operations{};
+
+  static constexpr unsigned key(uint32_t value) {
+    return bitRange<6, 2>(value) | (bitRange<14, 12>(value) << 5);
+  }
+
+  constexpr DecodeTable() {
+    uint16_t count = 0;
+    for (unsigned k = 0; k < NUM_KEYS; k++) {
+      start[k] = count;
+      // The opcode and funct3 bits represented by this key.
+      uint32_t value = 0x3 | ((k & 0x1F) << 2) | ((k >> 5) << 12);
+      for (size_t i = 0; i < NUM_OPERATIONS; i++) {
+        auto &spec = instructionSpecs[i];
+        if (((value ^ spec.match) & spec.mask & 0x707F) == 0) {
+          operations[count++] = static_cast<Operation>(i);
+        }
+      }
+    }
+    start[NUM_KEYS] = count;
+  }
+};
 
-struct InstructionRType : public InstructionFormat {
+inline constexpr DecodeTable decodeTable{};
+
+/// Decode an instruction to its operation.
+inline constexpr Operation decode(uint32_t value) {
+  if ((value & 0x3) != 0x3) {
+    return Operation::ILLEGAL;
+  }
+  auto key = DecodeTable::key(value);
+  for (unsigned i = decodeTable.start[key]; i < decodeTable.start[key + 1]; i++) {
+    auto op = decodeTable.operations[i];
+    auto &spec = getSpec(op);
+    if ((value & spec.mask) == spec.match) {
+      return op;
+    }
+  }
+  return Operation::ILLEGAL;
+}
+
+//===---------------------------------------------------------------------===//
+// Operand formats. Immediates are held as the raw encoded bits.
+//===---------------------------------------------------------------------===//
+
+struct InstructionRType {
   Register rd, rs1, rs2;
-  unsigned funct;
-  InstructionRType(uint32_t value) :
-    rd(Register(extractBitRange(value, 11, 7))),
-    rs1(Register(extractBitRange(value, 19, 15))),
-    rs2(Register(extractBitRange(value, 24, 20))),
-    funct(insertBits(extractBitRange(value, 14, 12),
-                     extractBitRange(value, 31, 25), 3, 7)) {}
+  constexpr InstructionRType(uint32_t value) :
+    rd(Register(bitRange<11, 7>(value))),
+    rs1(Register(bitRange<19, 15>(value))),
+    rs2(Register(bitRange<24, 20>(value))) {}
 };
 
-struct InstructionIType : public InstructionFormat {
+struct InstructionIType {
   Register rd, rs1;
-  unsigned imm, funct;
-  InstructionIType(uint32_t value) :
-    rd(Register(extractBitRange(value, 11, 7))),
-    rs1(Register(extractBitRange(value, 19, 15))),
-    imm(extractBitRange(value, 31, 20)),
-    funct(extractBitRange(value, 14, 12)) {}
+  unsigned imm;
+  constexpr InstructionIType(uint32_t value) :
+    rd(Register(bitRange<11, 7>(value))),
+    rs1(Register(bitRange<19, 15>(value))),
+    imm(bitRange<31, 20>(value)) {}
 };
 
-struct InstructionIShamtType : public InstructionFormat {
+struct InstructionIShamtType {
   Register rd, rs1;
-  unsigned shamt, funct;
-  InstructionIShamtType(uint32_t value) :
-    rd(Register(extractBitRange(value, 11, 7))),
-    rs1(Register(extractBitRange(value, 19, 15))),
-    shamt(extractBitRange(value, 24, 20)),
-    funct(insertBits(extractBitRange(value, 14, 12),
-                     extractBitRange(value, 31, 25), 3, 7)) {}
+  unsigned shamt;
+  constexpr InstructionIShamtType(uint32_t value) :
+    rd(Register(bitRange<11, 7>(value))),
+    rs1(Register(bitRange<19, 15>(value))),
+    shamt(bitRange<24, 20>(value)) {}
 };
 
-struct InstructionBType : public InstructionFormat {
+struct InstructionBType {
   Register rs1, rs2;
-  unsigned imm, funct;
-  InstructionBType(uint32_t value) :
-      rs1(Register(extractBitRange(value, 19, 15))),
-      rs2(Register(extractBitRange(value, 24, 20))),
-      imm(0U),
-      funct(extractBitRange(value, 14, 12)) {
-    imm = insertBits(imm, extractBit(value, 7), 11, 1);
-    imm = insertBits(imm, extractBitRange(value, 11, 8), 1, 4);
-    imm = insertBits(imm, extractBitRange(value, 30, 25), 5, 6);
-    imm = insertBits(imm, extractBit(value, 31), 12, 1);
-  }
+  unsigned imm;
+  constexpr InstructionBType(uint32_t value) :
+    rs1(Register(bitRange<19, 15>(value))),
+    rs2(Register(bitRange<24, 20>(value))),
+    imm((bitRange<31, 31>(value) << 12) |
+        (bitRange<7, 7>(value) << 11) |
+        (bitRange<30, 25>(value) << 5) |
+        (bitRange<11, 8>(value) << 1)) {}
 };
 
-struct InstructionSType : public InstructionFormat {
+struct InstructionSType {
   Register rs1, rs2;
-  unsigned imm, funct;
-  InstructionSType(uint32_t value) :
-      rs1(Register(extractBitRange(value, 19, 15))),
-      rs2(Register(extractBitRange(value, 24, 20))),
-      imm(0U),
-      funct(extractBitRange(value, 14, 12)) {
-    imm = insertBits(imm, extractBitRange(value, 11, 7), 0, 5);
-    imm = insertBits(imm, extractBitRange(value, 31, 25), 5, 7);
-  }
+  unsigned imm;
+  constexpr InstructionSType(uint32_t value) :
+    rs1(Register(bitRange<19, 15>(value))),
+    rs2(Register(bitRange<24, 20>(value))),
+    imm((bitRange<31, 25>(value) << 5) | bitRange<11, 7>(value)) {}
 };
 
-struct InstructionUType : public InstructionFormat {
+struct InstructionUType {
   Register rd;
   unsigned imm;
-  InstructionUType(uint32_t value) :
-    rd(Register(extractBitRange(value, 11, 7))),
-    imm(extractBitRange(value, 31, 12)) {}
+  constexpr InstructionUType(uint32_t value) :
+    rd(Register(bitRange<11, 7>(value))),
+    imm(bitRange<31, 12>(value)) {}
 };
 
-struct InstructionJType : public InstructionFormat {
+struct InstructionJType {
   Register rd;
   unsigned imm;
-  InstructionJType(uint32_t value) :
-      rd(Register(extractBitRange(value, 11, 7))), imm(0U) {
-    imm = insertBits(imm, extractBit(value, 31), 20, 1);
-    imm = insertBits(imm, extractBitRange(value, 19, 12), 12, 8);
-    imm = insertBits(imm, extractBit(value, 20), 11, 1);
-    imm = insertBits(imm, extractBitRange(value, 30, 21), 1, 10);
-  }
+  constexpr InstructionJType(uint32_t value) :
+    rd(Register(bitRange<11, 7>(value))),
+    imm((bitRange<31, 31>(value) << 20) |
+        (bitRange<19, 12>(value) << 12) |
+        (bitRange<20, 20>(value) << 11) |
+        (bitRange<30, 21>(value) << 1)) {}
+};
+
+struct InstructionCsrType {
+  Register rd, rs1;
+  unsigned csr;
+  constexpr InstructionCsrType(uint32_t value) :
+    rd(Register(bitRange<11, 7>(value))),
+    rs1(Register(bitRange<19, 15>(value))),
+    csr(bitRange<31, 20>(value)) {}
+};
+
+/// Instructions without operands.
+struct InstructionSysType {
+  constexpr InstructionSysType(uint32_t) {}
 };
 
 } // End namespace rvsim.
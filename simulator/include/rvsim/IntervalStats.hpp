@@ -0,0 +1,154 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "HartState.hpp"
+#include "Instructions.hpp"
+#include "Plugin.hpp"
+
+namespace rvsim {
+
+/// The groups of counters that IntervalStats can collect.
+enum StatsCounters : unsigned {
+  STATS_MIX      = 1 << 0, // Instructions retired by class.
+  STATS_MEMORY   = 1 << 1, // Bytes loaded and stored.
+  STATS_BRANCHES = 1 << 2, // Conditional branches and those taken.
+  STATS_SYSCALLS = 1 << 3, // HTIF system calls.
+  STATS_PAGES    = 1 << 4, // Distinct 4 KiB pages of data accessed.
+  STATS_FUNCTION = 1 << 5, // The top-level function executing.
+  STATS_ALL      = (1 << 6) - 1
+};
+
+/// Parse a comma-separated list of counter group names, throwing Exception
+/// for an unknown one.
+unsigned parseStatsCounters(const std::string &list);
+
+/// Takes a snapshot of a set of counters every given number of retired
+/// instructions, as an observer policy of the executor, so that the phases
+/// of a program can be told apart. Each snapshot covers the instructions
+/// since the previous one, and is written as a line of CSV, with a header,
+/// or as a JSON object per line.
+///
+/// The top-level function is the function called from main that has not
+/// yet returned, or main itself, or, in a program without main, the
+/// outermost function called. Calls are the jumps that link to ra or t0, and
+/// a frame is left when execution reaches its return address, so that calls
+/// performed on the host are also left.
+class IntervalStats : public ObserverPolicy {
+  // A function that has been called, and the address it returns to.
+  struct Frame {
+    uint32_t function;
+    uint32_t returnAddress;
+  };
+
+  FILE *file;
+  bool json;
+  unsigned counters;
+  unsigned hooks;
+  uint64_t interval;
+  uint64_t retired;
+  // The instructions retired before the interval began.
+  uint64_t intervalStart;
+  uint64_t intervalCount;
+  uint64_t intervalStartCycle;
+  std::array<uint64_t, 6> mix;
+  uint64_t bytesLoaded;
+  uint64_t bytesStored;
+  uint64_t branches;
+  uint64_t taken;
+  uint64_t syscalls;
+  std::unordered_set<uint32_t> pages;
+  uint32_t lastPage;
+  std::vector<Frame> frames;
+  uint32_t mainAddress;
+  // Lines not yet written to the file.
+  std::string buffer;
+
+  void snapshot(const HartState &state);
+  void resetCounters(const HartState &state);
+  std::string getTopLevelFunction(const HartState &state) const;
+
+public:
+  static constexpr unsigned HOOKS =
+    HOOK_RETIRE | HOOK_MEMORY | HOOK_SYSCALL | HOOK_EXIT | HOOK_CONTROL;
+
+  /// Write snapshots of the given counter groups to a file, or to stderr if
+  /// the filename is empty.
+  IntervalStats(const std::string &filename, bool json, unsigned counters,
+                uint64_t interval, const HartState &state);
+  ~IntervalStats();
+
+  IntervalStats(const IntervalStats &) = delete;
+  IntervalStats &operator=(const IntervalStats &) = delete;
+
+  bool subscribed(unsigned hook) const { return (hooks & hook) != 0; }
+
+  void retire(const HartState &state, uint32_t pc, uint32_t instruction) {
+    // An interval ends when the next instruction retires, once the memory
+    // accesses and system calls of the last one have been counted.
+    if (retired - intervalStart == interval) {
+      snapshot(state);
+    }
+    retired++;
+    auto &spec = getSpec(decode(instruction));
+    if (counters & STATS_MIX) {
+      auto kind = (spec.flags & LOAD)   ? 1 :
+                  (spec.flags & STORE)  ? 2 :
+                  (spec.flags & BRANCH) ? 3 :
+                  (spec.flags & SYSTEM) ? 5 :
+                  (spec.flags & JUMP)   ? 4 : 0;
+      mix[kind]++;
+    }
+    if ((counters & STATS_BRANCHES) && (spec.flags & BRANCH)) {
+      branches++;
+      taken += state.pc != pc + 4;
+    }
+    if (counters & STATS_FUNCTION) {
+      if (!frames.empty() && pc == frames.back().returnAddress) {
+        frames.pop_back();
+      }
+      auto rd = bitRange<11, 7>(instruction);
+      if ((spec.flags & JUMP) && !(spec.flags & SYSTEM) &&
+          (rd == Register::x1 || rd == Register::x5)) {
+        frames.push_back({state.pc, pc + 4});
+      }
+    }
+  }
+
+  void memoryAccess(const HartState &state, const MemoryAccess &access) {
+    (access.store ? bytesStored : bytesLoaded) += access.size;
+    auto page = access.address >> 12;
+    if ((counters & STATS_PAGES) && page != lastPage) {
+      pages.insert(page);
+      lastPage = page;
+    }
+  }
+
+  void syscall(const HartState &state, const uint64_t *args) {
+    syscalls++;
+  }
+
+  void exit(const HartState &state, bool trapped, uint32_t exitCode) {
+    finish(state);
+  }
+
+  /// End the current interval early, or discard it, when requested.
+  void control(const HartState &state, Control request) {
+    if (request == Control::STATS_DUMP && retired != intervalStart) {
+      snapshot(state);
+    } else if (request == Control::STATS_RESET) {
+      resetCounters(state);
+    }
+  }
+
+  /// Write the last, partial interval and flush the output. This is done on
+  /// exit, and must be done by the driver if the run stops otherwise.
+  void finish(const HartState &state);
+};
+
+} // End namespace rvsim
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "SymbolInfo.hpp"
+
+namespace rvsim {
+
+enum class Intrinsic {
+  NONE,
+  MEMCPY,
+  MEMMOVE,
+  MEMSET,
+  MEMCMP,
+  STRLEN
+};
+
+inline const char *getIntrinsicName(Intrinsic intrinsic) {
+  switch (intrinsic) {
+  case Intrinsic::MEMCPY:  return "MEMCPY";
+  case Intrinsic::MEMMOVE: return "MEMMOVE";
+  case Intrinsic::MEMSET:  return "MEMSET";
+  case Intrinsic::MEMCMP:  return "MEMCMP";
+  case Intrinsic::STRLEN:  return "STRLEN";
+  default:                 return "NONE";
+  }
+}
+
+/// The entry points of guest library functions that can be performed by the
+/// host instead of being simulated instruction by instruction. Each call is
+/// charged a fixed number of instructions plus a number per byte processed,
+/// so that the cycle count remains a meaningful measure of work.
+class Intrinsics {
+  std::unordered_map<uint32_t, Intrinsic> entryPoints;
+
+public:
+  uint32_t callCost;
+  uint32_t byteCost;
+
+  Intrinsics() : callCost(4), byteCost(1) {}
+
+  /// Look up the entry points of the supported functions that the program
+  /// defines.
+  void bind(SymbolInfo &symbolInfo) {
+    const std::pair<const char*, Intrinsic> functions[] = {
+      {"memcpy",  Intrinsic::MEMCPY},
+      {"memmove", Intrinsic::MEMMOVE},
+      {"memset",  Intrinsic::MEMSET},
+      {"memcmp",  Intrinsic::MEMCMP},
+      {"strlen",  Intrinsic::STRLEN}
+    };
+    for (auto &function : functions) {
+      if (auto *symbol = symbolInfo.getSymbol(function.first)) {
+        entryPoints[symbol->value] = function.second;
+      }
+    }
+  }
+
+  bool empty() const { return entryPoints.empty(); }
+
+  Intrinsic lookup(uint32_t address) const {
+    auto it = entryPoints.find(address);
+    return it == entryPoints.end() ? Intrinsic::NONE : it->second;
+  }
+
+  uint64_t cost(uint32_t bytes) const {
+    return callCost + static_cast<uint64_t>(byteCost) * bytes;
+  }
+};
+
+} // End namespace rvsim
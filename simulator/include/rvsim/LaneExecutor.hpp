@@ -0,0 +1,190 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "Executor.hpp"
+#include "HartState.hpp"
+#include "Instructions.hpp"
+#include "Memory.hpp"
+#include "Mmu.hpp"
+
+namespace rvsim {
+
+// Lanes are processed in blocks of this many, so that the operations on a
+// block have a fixed trip count and compile to SIMD instructions.
+const size_t LANE_BLOCK = 8;
+
+/// Runs many independent instances of one program together, each in a lane
+/// that continues from the state of an executor. The registers are held as
+/// structure of arrays, with each register's values for every lane stored
+/// contiguously, and each lane's memory is the executor's memory overlaid
+/// with copies of the pages that the lane has written.
+///
+/// The lanes whose PCs agree form a group that steps together, which
+/// decodes each instruction once and performs ALU instructions on every
+/// lane at once, under a mask of the group's lanes. Loads and stores are
+/// made for each lane in turn. When the lanes of a group branch in
+/// different directions, or the group reaches the PC at which other lanes
+/// wait, the lanes are regrouped, and the group with the lowest PC runs
+/// next, so that lanes that took a short path through a branch wait for
+/// those that took a longer one, and the lanes reconverge.
+///
+/// Only the RV32I user-level instructions are stepped in lanes, along with
+/// the HTIF exit system call. A lane that reaches any other instruction,
+/// that would trap or that makes another system call leaves the group, and
+/// continues on an executor of its own, with a copy of its memory and the
+/// console as its only open files, so that every lane behaves exactly as
+/// the program does on its own, except that accelerated library functions
+/// are not called. Lanes cannot be created with devices attached or while
+/// paging.
+class LaneExecutor {
+  // A lane that has left the groups, and runs on an executor of its own.
+  struct ScalarLane {
+    HartState state;
+    Memory memory;
+    Executor executor;
+
+    ScalarLane(const HartState &initial, uint32_t baseAddress, size_t size)
+      : state(initial), memory(baseAddress, size), executor(state, memory) {}
+  };
+
+  Executor &source;
+  Memory &image;
+  size_t count;
+  // The number of lanes rounded up to a whole block. The lanes beyond the
+  // count never run.
+  size_t width;
+  size_t numPages;
+  // The registers, with the values of register r at [r * width].
+  std::vector<uint32_t> registers;
+  std::vector<uint32_t> pcs;
+  std::vector<uint64_t> cycles;
+  std::vector<Status> statuses;
+  std::vector<uint32_t> exitCodes;
+  // The executors of the lanes that have left the groups.
+  std::vector<std::unique_ptr<ScalarLane>> scalars;
+  // The page table of each lane, with the pages of lane l at
+  // [l * numPages], pointing either into the image or to one of the copies.
+  std::vector<uint8_t*> pages;
+  std::vector<std::unique_ptr<uint8_t[]>> copies;
+  // Whether any lane has written each page, in which case the code fetched
+  // from it is compared with each lane's own.
+  std::vector<uint8_t> written;
+  // The group that is stepping: a mask of all ones for its lanes and zero
+  // for the rest, and a list of its lanes. The branch outcome and the next
+  // PC of each lane are kept for when the group diverges.
+  std::vector<uint32_t> mask;
+  std::vector<uint32_t> members;
+  std::vector<uint32_t> taken;
+  std::vector<uint32_t> targets;
+  uint64_t groupSteps;
+
+  uint8_t *imagePage(size_t page) {
+    return reinterpret_cast<uint8_t*>(image.data()) + page * PAGE_SIZE;
+  }
+
+  size_t pageLength(size_t page) const {
+    return std::min<size_t>(PAGE_SIZE, image.sizeInBytes() - page * PAGE_SIZE);
+  }
+
+  const uint32_t *row(unsigned index) const {
+    return &registers[index * width];
+  }
+
+  bool isActive(size_t lane, uint64_t cycleLimit) const {
+    return statuses[lane] == Status::RUNNING && !scalars[lane] && cycles[lane] < cycleLimit;
+  }
+
+  uint8_t *lanePtr(size_t lane, uint32_t address, bool write);
+  bool formGroup(uint64_t cycleLimit, uint32_t &pc, uint64_t &nextPc, uint64_t &budget);
+  void stepGroup(uint32_t pc, uint64_t nextPc, uint64_t budget);
+  void leave(size_t lane, uint32_t pc, uint64_t steps);
+  void updateMembers();
+  bool load(Operation op, uint32_t instruction, uint32_t pc, uint64_t steps);
+  bool store(Operation op, uint32_t instruction, uint32_t pc, uint64_t steps);
+  bool storeToHost(size_t lane, uint32_t address, const uint8_t *data, unsigned size);
+
+  /// Write rd in each lane of the group with a function of the lane index,
+  /// a block of lanes at a time. The results are computed for every lane of
+  /// a block and merged under the mask, so that each step is a fixed number
+  /// of independent operations.
+  template<typename Function>
+  void compute(unsigned rd, Function function) {
+    if (rd == 0) {
+      return;
+    }
+    auto *dest = &registers[rd * width];
+    for (size_t block = 0; block < width; block += LANE_BLOCK) {
+      uint32_t result[LANE_BLOCK];
+      for (size_t j = 0; j < LANE_BLOCK; j++) {
+        result[j] = function(block + j);
+      }
+      uint32_t select[LANE_BLOCK];
+      uint32_t value[LANE_BLOCK];
+      std::memcpy(select, &mask[block], sizeof(select));
+      std::memcpy(value, dest + block, sizeof(value));
+      for (size_t j = 0; j < LANE_BLOCK; j++) {
+        value[j] = (result[j] & select[j]) | (value[j] & ~select[j]);
+      }
+      std::memcpy(dest + block, value, sizeof(value));
+    }
+  }
+
+  /// Evaluate a branch condition in each lane of the group, setting taken
+  /// to all ones where it holds, and return the number of lanes taking it.
+  template<typename Condition>
+  size_t evaluate(Condition condition) {
+    size_t count = 0;
+    for (size_t block = 0; block < width; block += LANE_BLOCK) {
+      uint32_t result[LANE_BLOCK];
+      for (size_t j = 0; j < LANE_BLOCK; j++) {
+        result[j] = (condition(block + j) ? ~0U : 0) & mask[block + j];
+      }
+      for (size_t j = 0; j < LANE_BLOCK; j++) {
+        count += result[j] & 1;
+      }
+      std::memcpy(&taken[block], result, sizeof(result));
+    }
+    return count;
+  }
+
+public:
+  /// Create lanes that each continue from the current state of an
+  /// executor, which must outlive the lanes and not run while they exist.
+  LaneExecutor(Executor &executor, size_t count);
+  ~LaneExecutor();
+
+  LaneExecutor(const LaneExecutor &) = delete;
+  LaneExecutor &operator=(const LaneExecutor &) = delete;
+
+  size_t size() const { return count; }
+
+  uint32_t readReg(size_t lane, unsigned index) const;
+  void writeReg(size_t lane, unsigned index, uint32_t value);
+  uint32_t getPc(size_t lane) const;
+  uint64_t getCycleCount(size_t lane) const;
+  Status getStatus(size_t lane) const;
+  uint32_t getExitCode(size_t lane) const;
+
+  /// Return true if a lane has left the groups to run on its own.
+  bool isScalar(size_t lane) const { return scalars[lane] != nullptr; }
+
+  /// Read or write a lane's memory, throwing Exception if the range does
+  /// not lie within memory.
+  void readMemory(size_t lane, uint32_t address, void *data, size_t length);
+  void writeMemory(size_t lane, uint32_t address, const void *data, size_t length);
+
+  /// Run every lane until it exits, stops on a trap without a handler or
+  /// reaches a cycle count.
+  void run(uint64_t cycleLimit = UINT64_MAX);
+
+  /// Return the number of instructions that groups have stepped, each of
+  /// which was performed for all of a group's lanes.
+  uint64_t getGroupSteps() const { return groupSteps; }
+};
+
+} // End namespace rvsim
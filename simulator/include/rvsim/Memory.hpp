@@ -3,40 +3,96 @@
 #include <array>
 #include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <vector>
 
+#include <sys/mman.h>
+#include <sys/types.h>
+
 #include "bits.hpp"
 
 namespace rvsim {
 
 class Memory {
+  // The allocated storage, which is released when the contents are mapped
+  // from a file instead.
+  std::vector<uint32_t> memory;
+  uint32_t *words;
+  size_t numWords;
+  void *mapping;
+
 public:
   uint32_t baseAddress;
-  std::vector<uint32_t> memory;
 
   Memory(size_t baseAddress, size_t sizeInBytes)
-    : baseAddress(baseAddress), memory(roundUpToMultipleOf4(sizeInBytes/4)) {
+    : memory(roundUpToMultipleOf4(sizeInBytes/4)), words(memory.data()),
+      numWords(memory.size()), mapping(nullptr), baseAddress(baseAddress) {
     assert((baseAddress & 0x2) == 0 && "base address is not word aligned");
   }
 
-  size_t sizeInWords() { return memory.size(); }
-  size_t sizeInBytes() { return memory.size() * 4; }
+  ~Memory() {
+    if (mapping != nullptr) {
+      munmap(mapping, sizeInBytes());
+    }
+  }
+
+  Memory(const Memory &) = delete;
+  Memory &operator=(const Memory &) = delete;
+
+  /// Replace the contents with a private copy-on-write mapping of a file,
+  /// so that processes mapping the same file share the pages they do not
+  /// write. Return false, leaving the contents unchanged, if the file
+  /// cannot be mapped.
+  bool map(int fd, off_t offset) {
+    auto *address = mmap(nullptr, sizeInBytes(), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE, fd, offset);
+    if (address == MAP_FAILED) {
+      return false;
+    }
+    if (mapping != nullptr) {
+      munmap(mapping, sizeInBytes());
+    }
+    mapping = address;
+    words = static_cast<uint32_t*>(address);
+    std::vector<uint32_t>().swap(memory);
+    return true;
+  }
+
+  size_t sizeInWords() const { return numWords; }
+  size_t sizeInBytes() const { return numWords * 4; }
 
   char *data() {
-    return reinterpret_cast<char *>(memory.data());
+    return reinterpret_cast<char *>(words);
   }
 
   inline uint32_t physicalAddr(uint32_t address) {
     return address - baseAddress;
   }
 
+  /// Return true if a range of addresses lies entirely within memory.
+  bool contains(uint32_t address, size_t length) {
+    size_t offset = physicalAddr(address);
+    return address >= baseAddress && offset <= sizeInBytes() &&
+           length <= sizeInBytes() - offset;
+  }
+
+  /// Return a host pointer to a range of memory, or nullptr if any part of
+  /// the range lies outside of memory. This allows syscalls to operate on
+  /// guest buffers in place.
+  uint8_t *hostPtr(uint32_t address, size_t length) {
+    if (!contains(address, length)) {
+      return nullptr;
+    }
+    return reinterpret_cast<uint8_t*>(words) + physicalAddr(address);
+  }
+
   void read(uint32_t address, uint8_t *data, size_t length) {
-		auto memoryPtr =  reinterpret_cast<uint8_t*>(memory.data()) + physicalAddr(address);
+		auto memoryPtr =  reinterpret_cast<uint8_t*>(words) + physicalAddr(address);
     std::memcpy(data, memoryPtr, length);
   }
 
   void write(uint32_t address, size_t length, uint8_t *data) {
-		auto memoryPtr =  reinterpret_cast<uint8_t*>(memory.data()) + physicalAddr(address);
+		auto memoryPtr =  reinterpret_cast<uint8_t*>(words) + physicalAddr(address);
     std::memcpy(memoryPtr, data, length);
   }
 
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "HartState.hpp"
+#include "Memory.hpp"
+#include "Trap.hpp"
+
+namespace rvsim {
+
+/// The kinds of memory access, which are translated separately and raise
+/// different faults.
+enum class AccessType {
+  FETCH,
+  LOAD,
+  STORE
+};
+
+// Fields of an Sv32 page table entry.
+const uint32_t PTE_V = 1 << 0;
+const uint32_t PTE_R = 1 << 1;
+const uint32_t PTE_W = 1 << 2;
+const uint32_t PTE_X = 1 << 3;
+const uint32_t PTE_U = 1 << 4;
+const uint32_t PTE_G = 1 << 5;
+const uint32_t PTE_A = 1 << 6;
+const uint32_t PTE_D = 1 << 7;
+const unsigned PTE_PPN_SHIFT = 10;
+
+const unsigned PAGE_SHIFT = 12;
+const uint32_t PAGE_SIZE = 1U << PAGE_SHIFT;
+
+// The number of entries in each TLB.
+const size_t TLB_ENTRIES = 256;
+
+/// A direct-mapped software TLB, indexed and tagged by virtual page number.
+/// Each entry holds the accesses that its page permits, in S-mode and in
+/// U-mode, its physical page and, when the page lies entirely within
+/// memory, a host pointer to it, so that a hit needs neither the page table
+/// nor the bounds of memory.
+class Tlb {
+public:
+  struct Entry {
+    uint32_t vpn;
+    uint32_t permissions;
+    uint32_t physicalPage;
+    uint8_t *host;
+  };
+
+  // The permissions of an entry for S-mode, which are shifted by
+  // USER_PERMISSIONS for U-mode.
+  static constexpr uint32_t PERMIT_READ = 1 << 0;
+  static constexpr uint32_t PERMIT_WRITE = 1 << 1;
+  static constexpr uint32_t PERMIT_EXECUTE = 1 << 2;
+  static constexpr unsigned USER_PERMISSIONS = 3;
+
+  // A tag that matches no virtual page number.
+  static constexpr uint32_t INVALID_VPN = UINT32_MAX;
+
+  Tlb() { flush(); }
+
+  Entry &lookup(uint32_t vpn) {
+    return entries[vpn % TLB_ENTRIES];
+  }
+
+  void flush() {
+    for (auto &entry : entries) {
+      entry.vpn = INVALID_VPN;
+    }
+  }
+
+  /// Return the permissions an access of a type needs at a privilege level.
+  static constexpr uint32_t required(AccessType type, Privilege privilege) {
+    auto permission = type == AccessType::FETCH ? PERMIT_EXECUTE
+                    : type == AccessType::LOAD  ? PERMIT_READ
+                                                : PERMIT_WRITE;
+    return privilege == Privilege::USER ? permission << USER_PERMISSIONS : permission;
+  }
+
+private:
+  std::array<Entry, TLB_ENTRIES> entries;
+};
+
+/// Translates virtual addresses with the Sv32 page tables rooted at satp,
+/// through separate instruction and data TLBs. A miss walks the page table,
+/// setting the A and D bits of the leaf entry in memory rather than raising
+/// a page fault for them to be set. The TLBs hold permissions computed with
+/// the SUM and MXR fields of mstatus, and must be flushed when those
+/// change, as well as on sfence.vma and when satp is written. ASIDs are not
+/// implemented, so global mappings are not treated specially.
+class Mmu {
+  HartState &state;
+  Memory &memory;
+
+public:
+  Tlb itlb;
+  Tlb dtlb;
+  // The number of page table walks made to fill a TLB.
+  uint64_t walks;
+
+  Mmu(HartState &state, Memory &memory)
+    : state(state), memory(memory), walks(0) {}
+
+  /// Translate an access of a type at a privilege below M-mode, returning
+  /// the trap it raises, if any. Otherwise, return the physical address and,
+  /// if it lies in memory, a host pointer to it. Aligned accesses never
+  /// cross a page, so the pointer is valid for the whole access.
+  template<AccessType type>
+  Trap translate(uint32_t address, Privilege privilege, uint8_t *&host, uint32_t &physical) {
+    auto vpn = address >> PAGE_SHIFT;
+    auto &entry = (type == AccessType::FETCH ? itlb : dtlb).lookup(vpn);
+    if (entry.vpn != vpn || !(entry.permissions & Tlb::required(type, privilege))) {
+      if (auto trap = walk(address, type, privilege, entry, true); trap != Trap::NONE) {
+        return trap;
+      }
+    }
+    auto offset = address & (PAGE_SIZE - 1);
+    host = entry.host ? entry.host + offset : nullptr;
+    physical = entry.physicalPage | offset;
+    return Trap::NONE;
+  }
+
+  /// Return true if an instruction could be fetched from an address at a
+  /// privilege level below M-mode, without changing the page table or the
+  /// TLBs.
+  bool canFetch(uint32_t address, Privilege privilege) {
+    Tlb::Entry entry;
+    return walk(address, AccessType::FETCH, privilege, entry, false) == Trap::NONE &&
+           entry.host != nullptr;
+  }
+
+  /// Walk the page table for an access, returning the page or access fault
+  /// it raises, if any, or filling a TLB entry for its page. Unless update
+  /// is set, the A and D bits are left unchanged.
+  Trap walk(uint32_t address, AccessType type, Privilege privilege, Tlb::Entry &entry,
+            bool update);
+
+  void flush() {
+    itlb.flush();
+    dtlb.flush();
+  }
+};
+
+} // End namespace rvsim
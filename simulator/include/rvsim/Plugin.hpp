@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "HartState.hpp"
+
+namespace rvsim {
+
+/// The events that an observer of the execution can subscribe to.
+enum Hook : unsigned {
+  HOOK_RETIRE  = 1 << 0,
+  HOOK_MEMORY  = 1 << 1,
+  HOOK_BRANCH  = 1 << 2,
+  HOOK_SYSCALL = 1 << 3,
+  HOOK_EXIT    = 1 << 4,
+  HOOK_CONTROL = 1 << 5,
+  HOOK_ALL     = (1 << 6) - 1
+};
+
+// The hooks that are called for every instruction, which require the
+// instructions to be executed one at a time.
+const unsigned PER_INSTRUCTION_HOOKS = HOOK_RETIRE | HOOK_MEMORY | HOOK_BRANCH;
+
+/// A load or store performed by a retired instruction.
+struct MemoryAccess {
+  uint32_t pc;
+  uint32_t address;
+  uint32_t value;
+  unsigned size;
+  bool store;
+};
+
+/// A request from the program to the observers of a run, made through an
+/// rvsim hypercall and passed on by the driver.
+enum class Control {
+  ROI_BEGIN,   // The region of interest begins, after a gap if it ended.
+  ROI_END,     // The region of interest ends, and the run is not observed.
+  STATS_RESET, // Discard what has been counted so far.
+  STATS_DUMP   // Write what has been counted so far.
+};
+
+/// The base of an observer compiled into the executor as a template policy.
+/// A policy declares the hooks it uses in HOOKS and hides the corresponding
+/// methods, which are called directly, so that hooks it does not use, and
+/// every hook of this base, compile to nothing. Executor::step is
+/// instantiated for each policy it is given.
+struct ObserverPolicy {
+  static constexpr unsigned HOOKS = 0;
+
+  /// Whether any of the given hooks is subscribed to at run time, within
+  /// those named by HOOKS.
+  bool subscribed(unsigned hooks) const { return true; }
+
+  /// An instruction at pc has retired, leaving the state after it. An
+  /// instruction that traps does not retire.
+  void retire(const HartState &state, uint32_t pc, uint32_t instruction) {}
+
+  /// A retired instruction has loaded from or stored to memory or a device.
+  void memoryAccess(const HartState &state, const MemoryAccess &access) {}
+
+  /// A branch or jump at pc has retired, with the target it would take.
+  void branch(const HartState &state, uint32_t pc, uint32_t target, bool taken) {}
+
+  /// The program has made an HTIF system call, with its argument block.
+  void syscall(const HartState &state, const uint64_t *args) {}
+
+  /// The program has exited, or stopped on a trap that it does not handle.
+  void exit(const HartState &state, bool trapped, uint32_t exitCode) {}
+
+  /// The program has made a request of the observers.
+  void control(const HartState &state, Control request) {}
+};
+
+/// An observer implemented outside of the simulator and loaded at run time.
+/// The hooks are the same as those of ObserverPolicy, called through
+/// virtual functions, and only those returned by hooks() are called.
+class Plugin {
+public:
+  virtual ~Plugin() = default;
+
+  /// The hooks that the plugin subscribes to.
+  virtual unsigned hooks() const = 0;
+
+  virtual void retire(const HartState &state, uint32_t pc, uint32_t instruction) {}
+  virtual void memoryAccess(const HartState &state, const MemoryAccess &access) {}
+  virtual void branch(const HartState &state, uint32_t pc, uint32_t target, bool taken) {}
+  virtual void syscall(const HartState &state, const uint64_t *args) {}
+  virtual void exit(const HartState &state, bool trapped, uint32_t exitCode) {}
+  virtual void control(const HartState &state, Control request) {}
+};
+
+/// A plugin that forwards the hooks of an observer policy, so that the
+/// policy can observe a run alongside loaded plugins.
+template<typename Policy>
+class PolicyPlugin : public Plugin {
+  Policy &policy;
+
+public:
+  PolicyPlugin(Policy &policy) : policy(policy) {}
+
+  unsigned hooks() const override { return Policy::HOOKS; }
+
+  void retire(const HartState &state, uint32_t pc, uint32_t instruction) override {
+    policy.retire(state, pc, instruction);
+  }
+  void memoryAccess(const HartState &state, const MemoryAccess &access) override {
+    policy.memoryAccess(state, access);
+  }
+  void branch(const HartState &state, uint32_t pc, uint32_t target, bool taken) override {
+    policy.branch(state, pc, target, taken);
+  }
+  void syscall(const HartState &state, const uint64_t *args) override {
+    policy.syscall(state, args);
+  }
+  void exit(const HartState &state, bool trapped, uint32_t exitCode) override {
+    policy.exit(state, trapped, exitCode);
+  }
+  void control(const HartState &state, Control request) override {
+    policy.control(state, request);
+  }
+};
+
+// The version of the plugin interface, which a plugin must be built against.
+const unsigned PLUGIN_API_VERSION = 2;
+
+/// Define the entry points of a plugin shared object for a Plugin subclass,
+/// which is constructed from the argument string given when it is loaded.
+#define RVSIM_PLUGIN(class_name) \
+  extern "C" unsigned rvsimPluginApiVersion() { \
+    return rvsim::PLUGIN_API_VERSION; \
+  } \
+  extern "C" rvsim::Plugin *rvsimCreatePlugin(const char *args) { \
+    return new class_name(args); \
+  }
+
+/// The plugins that have been loaded, acting as an observer policy that
+/// calls each plugin subscribed to a hook. Steps that are not observed by
+/// any plugin do not use this policy, and so pay nothing for it.
+class PluginSet : public ObserverPolicy {
+  std::vector<std::unique_ptr<Plugin>> plugins;
+  std::vector<void*> libraries;
+  std::vector<Plugin*> retirePlugins;
+  std::vector<Plugin*> memoryPlugins;
+  std::vector<Plugin*> branchPlugins;
+  std::vector<Plugin*> syscallPlugins;
+  std::vector<Plugin*> exitPlugins;
+  std::vector<Plugin*> controlPlugins;
+  unsigned mask;
+
+public:
+  static constexpr unsigned HOOKS = HOOK_ALL;
+
+  PluginSet() : mask(0) {}
+  ~PluginSet();
+
+  PluginSet(const PluginSet &) = delete;
+  PluginSet &operator=(const PluginSet &) = delete;
+
+  /// Add a plugin constructed by the caller.
+  void add(std::unique_ptr<Plugin> plugin);
+
+  /// Load a plugin from a shared object, passing it an argument string.
+  void load(const std::string &path, const std::string &args);
+
+  bool empty() const { return plugins.empty(); }
+
+  bool subscribed(unsigned hooks) const { return (mask & hooks) != 0; }
+
+  void retire(const HartState &state, uint32_t pc, uint32_t instruction) {
+    for (auto *plugin : retirePlugins) {
+      plugin->retire(state, pc, instruction);
+    }
+  }
+
+  void memoryAccess(const HartState &state, const MemoryAccess &access) {
+    for (auto *plugin : memoryPlugins) {
+      plugin->memoryAccess(state, access);
+    }
+  }
+
+  void branch(const HartState &state, uint32_t pc, uint32_t target, bool taken) {
+    for (auto *plugin : branchPlugins) {
+      plugin->branch(state, pc, target, taken);
+    }
+  }
+
+  void syscall(const HartState &state, const uint64_t *args) {
+    for (auto *plugin : syscallPlugins) {
+      plugin->syscall(state, args);
+    }
+  }
+
+  void exit(const HartState &state, bool trapped, uint32_t exitCode) {
+    for (auto *plugin : exitPlugins) {
+      plugin->exit(state, trapped, exitCode);
+    }
+  }
+
+  void control(const HartState &state, Control request) {
+    for (auto *plugin : controlPlugins) {
+      plugin->control(state, request);
+    }
+  }
+};
+
+} // End namespace rvsim
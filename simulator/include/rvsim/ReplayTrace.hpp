@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "HartState.hpp"
+#include "Instructions.hpp"
+#include "Plugin.hpp"
+
+namespace rvsim {
+
+/// The kind of a replay record, and whether a branch was taken.
+enum ReplayFlags : uint8_t {
+  REPLAY_LOAD   = 1 << 0,
+  REPLAY_STORE  = 1 << 1,
+  REPLAY_BRANCH = 1 << 2, // A conditional branch.
+  REPLAY_JUMP   = 1 << 3,
+  REPLAY_TAKEN  = 1 << 4
+};
+
+/// A retired instruction, as seen by a timing model: where it was fetched
+/// from, where control went next and the data address it accessed, if it
+/// loaded or stored.
+struct ReplayRecord {
+  uint32_t pc;
+  uint32_t nextPc;
+  uint32_t address;
+  uint8_t flags;
+  uint8_t size;
+  uint16_t reserved;
+};
+
+/// Records every retired instruction to a binary trace file, as an observer
+/// policy of the executor, so that timing models can be driven from the
+/// trace by rvsim-replay without running the program again. The file is a
+/// header followed by an array of ReplayRecord, written in large blocks.
+class TraceRecorder : public ObserverPolicy {
+  int fd;
+  std::string filename;
+  std::vector<ReplayRecord> records;
+  uint64_t recordCount;
+
+  void flush();
+
+public:
+  static constexpr unsigned HOOKS = HOOK_RETIRE | HOOK_MEMORY | HOOK_EXIT;
+
+  /// Create a trace file, replacing any existing one.
+  TraceRecorder(const std::string &filename);
+  ~TraceRecorder();
+
+  TraceRecorder(const TraceRecorder &) = delete;
+  TraceRecorder &operator=(const TraceRecorder &) = delete;
+
+  void retire(const HartState &state, uint32_t pc, uint32_t instruction) {
+    auto &spec = getSpec(decode(instruction));
+    uint8_t flags = 0;
+    if (spec.flags & BRANCH) {
+      flags = REPLAY_BRANCH | (state.pc != pc + 4 ? REPLAY_TAKEN : 0);
+    } else if ((spec.flags & JUMP) && !(spec.flags & SYSTEM)) {
+      flags = REPLAY_JUMP | REPLAY_TAKEN;
+    }
+    if (records.size() == records.capacity()) {
+      flush();
+    }
+    records.push_back({pc, state.pc, 0, flags, 0, 0});
+  }
+
+  void memoryAccess(const HartState &state, const MemoryAccess &access) {
+    // The access follows the retirement of its instruction.
+    auto &record = records.back();
+    record.address = access.address;
+    record.flags |= access.store ? REPLAY_STORE : REPLAY_LOAD;
+    record.size = access.size;
+  }
+
+  void exit(const HartState &state, bool trapped, uint32_t exitCode) {
+    finish();
+  }
+
+  /// Write the remaining records and the header. This is done on exit, and
+  /// must be done by the driver if the run stops otherwise.
+  void finish();
+
+  uint64_t getRecordCount() const { return recordCount + records.size(); }
+};
+
+/// A trace file written by TraceRecorder, mapped read-only into memory so
+/// that any number of threads can read its records without copying them.
+class ReplayTrace {
+  void *mapping;
+  size_t mappingSize;
+  const ReplayRecord *records;
+  size_t count;
+
+public:
+  /// Map a trace file, throwing Exception if it is not valid.
+  ReplayTrace(const std::string &filename);
+  ~ReplayTrace();
+
+  ReplayTrace(const ReplayTrace &) = delete;
+  ReplayTrace &operator=(const ReplayTrace &) = delete;
+
+  const ReplayRecord *data() const { return records; }
+  size_t size() const { return count; }
+};
+
+} // End namespace rvsim
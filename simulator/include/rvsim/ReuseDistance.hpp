@@ -0,0 +1,159 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "HartState.hpp"
+#include "Plugin.hpp"
+
+namespace rvsim {
+
+/// The LRU stack of the lines accessed by a stream of memory accesses, which
+/// gives the reuse distance of each access: the number of distinct other
+/// lines accessed since the last access to the same line. The position in
+/// time of the last access to each line is marked in a Fenwick tree, so that
+/// the distance is found by counting the marks after it in logarithmic
+/// time. Positions are renumbered when they run out, so that the space used
+/// is bounded by the number of distinct lines rather than of accesses.
+class LruStack {
+  std::unordered_map<uint32_t, uint32_t> positions;
+  std::vector<uint32_t> tree;
+  uint32_t time;
+  uint32_t lastLine;
+  // The first position of the current window, and the distinct lines
+  // accessed since it.
+  uint32_t windowStart;
+  uint64_t windowLines;
+
+  void add(uint32_t position, int32_t delta);
+  uint32_t prefix(uint32_t position) const;
+  void compact();
+  uint64_t accessStack(uint32_t line);
+
+public:
+  /// The distance of the first access to a line.
+  static constexpr uint64_t COLD = UINT64_MAX;
+
+  LruStack();
+
+  /// Access a line, returning its reuse distance.
+  uint64_t access(uint32_t line) {
+    // Accesses to the line accessed last, such as the fetches of the rest of
+    // a line of instructions, leave the stack unchanged.
+    if (line == lastLine) {
+      return 0;
+    }
+    return accessStack(line);
+  }
+
+  /// Begin a new window of accesses, returning the number of distinct lines
+  /// accessed in the last one.
+  uint64_t startWindow();
+
+  size_t size() const { return positions.size(); }
+};
+
+/// Measures the reuse distances of instruction fetches and data accesses,
+/// as an observer policy of the executor, for each of a set of line sizes.
+/// The distances are counted in histograms with power of two buckets, in
+/// total and for the function containing the accessing instruction, and
+/// the working set of each stream, the number of distinct lines accessed,
+/// is reported for each window of a given number of retired instructions.
+class ReuseDistance : public ObserverPolicy {
+  // The buckets of the histograms: a distance of zero, then each power of
+  // two up to 2^31, then cold accesses.
+  static constexpr size_t NUM_BUCKETS = 34;
+  using Histogram = std::array<uint64_t, NUM_BUCKETS>;
+
+  // The accesses of one kind with one line size.
+  struct Stream {
+    bool data;
+    unsigned lineShift;
+    LruStack stack;
+    Histogram total;
+    // The histogram of each function, by index.
+    std::vector<Histogram> functions;
+  };
+
+  std::ofstream file;
+  std::ofstream workingSetFile;
+  bool finished;
+  std::vector<Stream> streams;
+  uint64_t window;
+  uint64_t retired;
+  uint64_t windowStart;
+  uint64_t windowCount;
+  uint64_t windowStartCycle;
+  // The functions seen, by index, and the address range of the function
+  // containing the last instruction retired.
+  std::unordered_map<uint32_t, unsigned> functionIds;
+  std::vector<std::string> functionNames;
+  unsigned function;
+  uint32_t functionStart;
+  uint32_t functionEnd;
+
+  void enterFunction(const HartState &state, uint32_t pc);
+  void endWindow(const HartState &state);
+  void writeHistograms();
+
+  void count(Stream &stream, uint32_t address) {
+    auto distance = stream.stack.access(address >> stream.lineShift);
+    auto bucket = distance == LruStack::COLD ? NUM_BUCKETS - 1
+                                             : static_cast<size_t>(std::bit_width(distance));
+    stream.total[bucket]++;
+    stream.functions[function][bucket]++;
+  }
+
+public:
+  static constexpr unsigned HOOKS = HOOK_RETIRE | HOOK_MEMORY | HOOK_EXIT | HOOK_CONTROL;
+
+  /// Measure the reuse distances for a comma-separated list of line sizes
+  /// in bytes, writing the histograms to a file when the run finishes, and
+  /// the working sets of each window to a second file if it is named.
+  ReuseDistance(const std::string &filename, const std::string &workingSetFilename,
+                const std::string &lineSizes, uint64_t window, const HartState &state);
+
+  void retire(const HartState &state, uint32_t pc, uint32_t instruction) {
+    if (window != 0 && retired - windowStart == window) {
+      endWindow(state);
+    }
+    retired++;
+    if (pc < functionStart || pc >= functionEnd) {
+      enterFunction(state, pc);
+    }
+    for (auto &stream : streams) {
+      if (!stream.data) {
+        count(stream, pc);
+      }
+    }
+  }
+
+  void memoryAccess(const HartState &state, const MemoryAccess &access) {
+    // The access is attributed to the function of the instruction that has
+    // just retired.
+    for (auto &stream : streams) {
+      if (stream.data) {
+        count(stream, access.address);
+      }
+    }
+  }
+
+  void exit(const HartState &state, bool trapped, uint32_t exitCode) {
+    finish(state);
+  }
+
+  /// Write the histograms and end the current window, or clear the
+  /// histograms, when requested.
+  void control(const HartState &state, Control request);
+
+  /// Write the histograms and the last, partial window. This is done on
+  /// exit, and must be done by the driver if the run stops otherwise.
+  void finish(const HartState &state);
+};
+
+} // End namespace rvsim
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Executor.hpp"
+#include "HartState.hpp"
+#include "Memory.hpp"
+#include "Plugin.hpp"
+#include "SymbolInfo.hpp"
+
+namespace rvsim {
+
+const size_t DEFAULT_MEMORY_BASE_ADDRESS = 0x10000;
+const size_t DEFAULT_MEMORY_SIZE_BYTES   = 0x10000*4;
+
+/// The configuration of a simulator, applied whenever it is reset.
+struct SimulatorConfig {
+  size_t memBase = DEFAULT_MEMORY_BASE_ADDRESS;
+  size_t memSize = DEFAULT_MEMORY_SIZE_BYTES;
+  bool fusion = true;
+  bool idleSkip = true;
+  bool devices = false;
+  bool bufferOutput = false;
+  bool accelerateLibc = false;
+  uint32_t intrinsicCallCost = 4;
+  uint32_t intrinsicByteCost = 1;
+  // The host directory that the program may open files beneath, or empty.
+  std::string sandboxDirectory;
+  // The directory of an ImageCache to load programs through, or empty.
+  std::string imageCache;
+};
+
+/// Why a call to Simulator::run returned.
+enum class StopReason {
+  EXITED,  // The program exited, with Executor::exitCode.
+  TRAPPED, // The program stopped on a trap that it does not handle.
+  BUDGET   // The instruction budget was used up, and the run can continue.
+};
+
+/// A complete simulated system that can be embedded in another program:
+/// the memory, hart and executor, with a program loaded from an ELF file or
+/// buffer. The program runs in slices of a given number of instructions,
+/// and may be reset to its initial state to run again. Errors are reported
+/// by throwing Exception.
+class Simulator {
+  SimulatorConfig config;
+  // The ELF image of the loaded program, kept to reload it on reset.
+  std::vector<char> image;
+  std::string imageName;
+  uint64_t imageHash;
+  bool consoleCaptured;
+  std::string consoleInput;
+  std::unique_ptr<SymbolInfo> symbolInfo;
+  std::unique_ptr<HartState> state;
+  std::unique_ptr<Memory> memory;
+  std::unique_ptr<Executor> executor;
+
+  void build();
+
+public:
+  /// Observers of every run, which persist across resets.
+  PluginSet plugins;
+
+  Simulator(const SimulatorConfig &config = SimulatorConfig());
+  ~Simulator();
+
+  Simulator(const Simulator &) = delete;
+  Simulator &operator=(const Simulator &) = delete;
+
+  /// Load a program from an ELF file, resetting the system.
+  void loadFile(const std::string &path);
+
+  /// Load a program from an ELF image in memory, resetting the system. The
+  /// name is used in error messages.
+  void loadBuffer(const void *data, size_t size, const std::string &name = "buffer");
+
+  /// Return the system to its state immediately after the program was
+  /// loaded, with empty memory if none has been.
+  void reset();
+
+  /// Serve the program's console from memory: reads of stdin consume the
+  /// given input and writes to stdout and stderr are kept for takeOutput.
+  /// This persists across resets, each of which rewinds the input.
+  void captureConsole(const std::string &input);
+
+  /// Return and clear the output written to stdout (1) or stderr (2) since
+  /// the console was captured.
+  std::string takeOutput(int fd);
+
+  /// Run for at most the given number of instructions, or without limit if
+  /// it is zero. Fused pairs, skipped idle cycles and accelerated library
+  /// calls do not run past the budget, so a run can be divided into slices
+  /// without changing it.
+  StopReason run(uint64_t maxInstructions);
+
+  /// Read or write a general-purpose register, with index 32 naming the PC.
+  uint32_t readRegister(unsigned index) const;
+  void writeRegister(unsigned index, uint32_t value);
+
+  /// Copy to or from memory, throwing Exception if any part of the range
+  /// lies outside of it.
+  void readMemory(uint32_t address, void *data, size_t length);
+  void writeMemory(uint32_t address, const void *data, size_t length);
+
+  /// Write the signature region of the program to a file, as expected by
+  /// RISCOF, with granularity bytes per line.
+  void writeSignature(const std::string &filename, size_t granularity);
+
+  Executor &getExecutor() { return *executor; }
+  HartState &getState() { return *state; }
+  Memory &getMemory() { return *memory; }
+  SymbolInfo &getSymbolInfo() { return *symbolInfo; }
+};
+
+} // End namespace rvsim
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "Executor.hpp"
+#include "HartState.hpp"
+#include "Mmu.hpp"
+
+namespace rvsim {
+
+/// A copy of the state of the hart and the contents of memory, which an
+/// executor can be reset to any number of times. Only the pages that have
+/// been marked dirty since the last reset are copied back, so that a reset
+/// costs in proportion to the memory a run writes rather than to the size
+/// of memory. The driver marks the pages that the program writes, which an
+/// observer of its stores and system calls can do. Page table walks may set
+/// the A and D bits of page table entries without being observed, so after
+/// a run that walked the page table, the whole of memory is copied back.
+/// Devices and files are not part of a snapshot, so one cannot be taken
+/// with devices attached.
+class Snapshot {
+  Executor &executor;
+  HartState state;
+  std::vector<uint8_t> contents;
+  Status status;
+  uint32_t exitCode;
+  uint32_t programBreak;
+  uint64_t walks;
+  // Whether each page has been written since the last reset, and the list
+  // of those that have.
+  std::vector<uint8_t> dirty;
+  std::vector<uint32_t> dirtyPages;
+
+  void markPage(size_t page) {
+    if (!dirty[page]) {
+      dirty[page] = 1;
+      dirtyPages.push_back(page);
+    }
+  }
+
+public:
+  /// Take a snapshot of the current state of an executor.
+  explicit Snapshot(Executor &executor);
+
+  /// Mark the pages holding a range of addresses as written, ignoring any
+  /// part of the range outside of memory.
+  void markDirty(uint32_t address, size_t length) {
+    auto base = executor.memory.baseAddress;
+    uint64_t begin = std::max(address, base);
+    uint64_t end = std::min<uint64_t>(static_cast<uint64_t>(address) + length,
+                                      base + contents.size());
+    if (begin >= end) {
+      return;
+    }
+    for (auto page = (begin - base) >> PAGE_SHIFT; page <= (end - 1 - base) >> PAGE_SHIFT;
+         page++) {
+      markPage(page);
+    }
+  }
+
+  /// Reset the executor to the snapshot.
+  void restore();
+
+  /// Return the number of pages written since the last reset.
+  size_t getDirtyPages() const { return dirtyPages.size(); }
+};
+
+} // End namespace rvsim
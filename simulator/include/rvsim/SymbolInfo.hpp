@@ -1,5 +1,6 @@
 #pragma once
 
+#include <iterator>
 #include <map>
 #include <memory>
 #include <string>
@@ -7,12 +8,20 @@
 
 namespace rvsim {
 
+// The types of symbols naming a data object or a function, in the low bits
+// of their info.
+const char SYMBOL_TYPE_OBJECT = 1;
+const char SYMBOL_TYPE_FUNC = 2;
+const char SYMBOL_TYPE_MASK = 0xf;
+
 struct ElfSymbol {
   std::string name;
   uint32_t value;
   char info;
-  ElfSymbol(const char *name, uint32_t value, char info)
-    : name(name), value(value), info(info) {}
+  // The size in bytes of the object or function, or zero if it is unknown.
+  uint32_t size;
+  ElfSymbol(const char *name, uint32_t value, char info, uint32_t size)
+    : name(name), value(value), info(info), size(size) {}
 };
 
 class SymbolInfo {
@@ -31,13 +40,18 @@ public:
   SymbolInfo() {}
 
   /// Add a symbol.
-  void addSymbol(const char *name, uint32_t value, char info) {
-    symbols.push_back(std::make_unique<ElfSymbol>(name, value, info));
+  void addSymbol(const char *name, uint32_t value, char info, uint32_t size = 0) {
+    symbols.push_back(std::make_unique<ElfSymbol>(name, value, info, size));
     auto *symbol = symbols.back().get();
     addressMap[value] = symbol;
     symbolMap.insert(std::make_pair(symbol->name, symbol));
   }
 
+  /// The symbols in the order they were added.
+  const std::vector<std::unique_ptr<ElfSymbol>> &getSymbols() const {
+    return symbols;
+  }
+
   /// Retrieve a symbol by address. Find the first address map entry that is
   /// less than the specified address, which is really the first element since
   /// the predicate is inverted (greater than, rather than less than).
@@ -50,6 +64,17 @@ public:
     }
   }
 
+  /// Return the lowest symbol address that is greater than the specified
+  /// address, which marks the end of the symbol containing it, or zero if
+  /// there is no such symbol.
+  uint32_t getNextSymbolAddress(uint32_t address) {
+    auto it = addressMap.lower_bound(address);
+    if (it == addressMap.begin()) {
+      return 0;
+    }
+    return std::prev(it)->first;
+  }
+
   /// Retrieve the address of the given symbol, or nullptr if it is not
   /// defined by the ELF file.
   ElfSymbol *getSymbol(const std::string &name) {
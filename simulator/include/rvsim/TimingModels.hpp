@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ReplayTrace.hpp"
+
+namespace rvsim {
+
+/// A model of part of a microarchitecture, driven by the records of a
+/// replay trace. Models are independent of one another, so that many can be
+/// driven by one pass over a trace, on separate threads.
+class TimingModel {
+  std::string name;
+
+public:
+  TimingModel(const std::string &name) : name(name) {}
+  virtual ~TimingModel() = default;
+
+  /// Advance the model over a block of consecutive records.
+  virtual void replay(const ReplayRecord *records, size_t count) = 0;
+
+  /// Describe the results, as "name=value" pairs separated by spaces.
+  virtual std::string report() const = 0;
+
+  /// The specification that the model was created from.
+  const std::string &getName() const { return name; }
+};
+
+/// A set-associative cache with least recently used replacement, which
+/// allocates on both loads and stores. An instruction cache is accessed by
+/// every fetch and a data cache by every load and store.
+class CacheModel : public TimingModel {
+  bool instruction;
+  unsigned ways;
+  unsigned lineShift;
+  uint32_t setMask;
+  // The tag and the time of the last access of each way, by set.
+  std::vector<uint32_t> tags;
+  std::vector<uint64_t> lastUse;
+  uint64_t accesses;
+  uint64_t misses;
+  uint32_t lastLine;
+
+  void access(uint32_t address);
+
+public:
+  /// Create a cache of a given size, number of ways and line size, all in
+  /// bytes and powers of two, throwing Exception otherwise.
+  CacheModel(const std::string &name, bool instruction, uint32_t size, unsigned ways,
+             uint32_t lineSize);
+
+  void replay(const ReplayRecord *records, size_t count) override;
+  std::string report() const override;
+
+  uint64_t getAccesses() const { return accesses; }
+  uint64_t getMisses() const { return misses; }
+};
+
+/// A predictor of the direction of conditional branches, using a table of
+/// two-bit saturating counters indexed by the PC, or, for gshare, by the PC
+/// exclusive-ORed with the history of recent branch outcomes.
+class BranchPredictorModel : public TimingModel {
+  unsigned historyBits;
+  uint32_t indexMask;
+  uint32_t history;
+  std::vector<uint8_t> counters;
+  uint64_t branches;
+  uint64_t mispredictions;
+
+public:
+  /// Create a predictor with a table of 2^indexBits counters, using
+  /// historyBits bits of global history, or none for a bimodal predictor.
+  BranchPredictorModel(const std::string &name, unsigned indexBits, unsigned historyBits);
+
+  void replay(const ReplayRecord *records, size_t count) override;
+  std::string report() const override;
+
+  uint64_t getBranches() const { return branches; }
+  uint64_t getMispredictions() const { return mispredictions; }
+};
+
+/// Create a model from a specification, throwing Exception if it is not
+/// valid. A specification is one of:
+///   icache:SIZE:WAYS:LINE  an instruction cache
+///   dcache:SIZE:WAYS:LINE  a data cache
+///   bimodal:BITS           a bimodal predictor with 2^BITS counters
+///   gshare:BITS            a gshare predictor with BITS bits of history
+/// Sizes may have a suffix of k or m.
+std::unique_ptr<TimingModel> createTimingModel(const std::string &spec);
+
+/// Drive the models over every record of a trace. The models are divided
+/// between the given number of threads, each of which reads the trace once,
+/// in blocks small enough to stay in the host cache while every one of its
+/// models replays them.
+void replayTimingModels(const ReplayTrace &trace,
+                        std::vector<std::unique_ptr<TimingModel>> &models,
+                        unsigned threads);
+
+} // End namespace rvsim
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "Exception.hpp"
+#include "HartState.hpp"
+#include "SymbolInfo.hpp"
+
+namespace rvsim {
+
+/// A condition that starts or stops instruction tracing.
+struct TraceTrigger {
+  enum Kind {
+    NEVER,
+    CYCLE,        // The cycle count reaches a value, once.
+    PC,           // The next instruction is at an address.
+    ENTER_SYMBOL, // The next instruction lies within a symbol.
+    LEAVE_SYMBOL, // The next instruction lies outside a symbol.
+    HYPERCALL     // The program requests it through HTIF.
+  };
+
+  Kind kind;
+  uint64_t cycle;
+  uint32_t begin;
+  uint32_t end;
+  bool fired;
+
+  TraceTrigger(Kind kind = NEVER, uint64_t cycle = 0)
+    : kind(kind), cycle(cycle), begin(0), end(0), fired(false) {}
+
+  /// Parse a trigger specification, which is a cycle count, pc:ADDRESS,
+  /// sym:NAME or hypercall. A symbol trigger starts tracing on entry to the
+  /// symbol and stops it on leaving.
+  static TraceTrigger parse(const std::string &spec, SymbolInfo &symbolInfo,
+                            bool start) {
+    TraceTrigger trigger;
+    if (spec == "hypercall") {
+      trigger.kind = HYPERCALL;
+    } else if (spec.rfind("pc:", 0) == 0) {
+      trigger.kind = PC;
+      trigger.begin = std::stoul(spec.substr(3), nullptr, 0);
+    } else if (spec.rfind("sym:", 0) == 0) {
+      auto name = spec.substr(4);
+      auto *symbol = symbolInfo.getSymbol(name);
+      if (symbol == nullptr) {
+        throw Exception("trace trigger symbol not defined: " + name);
+      }
+      trigger.kind = start ? ENTER_SYMBOL : LEAVE_SYMBOL;
+      trigger.begin = symbol->value;
+      trigger.end = symbolInfo.getNextSymbolAddress(symbol->value);
+      if (trigger.end == 0) {
+        trigger.end = UINT32_MAX;
+      }
+    } else {
+      trigger.kind = CYCLE;
+      trigger.cycle = std::stoull(spec, nullptr, 0);
+    }
+    return trigger;
+  }
+
+  bool matches(const HartState &state, bool hypercall) {
+    switch (kind) {
+    case CYCLE:
+      if (!fired && state.cycleCount >= cycle) {
+        fired = true;
+        return true;
+      }
+      return false;
+    case PC:
+      return state.pc == begin;
+    case ENTER_SYMBOL:
+      return state.pc >= begin && state.pc < end;
+    case LEAVE_SYMBOL:
+      return state.pc < begin || state.pc >= end;
+    case HYPERCALL:
+      return hypercall;
+    default:
+      return false;
+    }
+  }
+};
+
+/// Tracks whether execution lies within a window of tracing, delimited by a
+/// start and a stop trigger. Outside of the window the simulator runs without
+/// tracing, and triggers other than a cycle count re-arm so that the window
+/// can open more than once. A window opened by the program begins with the
+/// instruction after the one that makes the start request, and ends with the
+/// one that makes the stop request.
+class TraceWindow {
+  // The requests made by the program since the last update.
+  bool startRequest;
+  bool stopRequest;
+
+public:
+  TraceTrigger from;
+  TraceTrigger to;
+  bool tracing;
+
+  TraceWindow() : startRequest(false), stopRequest(false), tracing(false) {}
+
+  /// Trace the whole of the execution.
+  void traceAll() {
+    from = TraceTrigger(TraceTrigger::CYCLE, 0);
+    to = TraceTrigger();
+  }
+
+  bool enabled() const { return from.kind != TraceTrigger::NEVER; }
+
+  /// Record whether the program requested tracing to start or stop in the
+  /// last step, to be seen by the next update.
+  void request(bool start, bool stop) {
+    startRequest = startRequest || start;
+    stopRequest = stopRequest || stop;
+  }
+
+  /// Evaluate the triggers before an instruction, consuming the requests of
+  /// the program. Return whether the instruction should be traced.
+  bool update(const HartState &state) {
+    if (!tracing) {
+      tracing = from.matches(state, startRequest);
+    } else {
+      tracing = !to.matches(state, stopRequest);
+    }
+    startRequest = false;
+    stopRequest = false;
+    return tracing;
+  }
+};
+
+} // End namespace rvsim
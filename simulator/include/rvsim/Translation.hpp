@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Executor.hpp"
+#include "Memory.hpp"
+#include "SymbolInfo.hpp"
+
+namespace rvsim {
+
+/// A basic block of code found by following the control flow of a program
+/// from its entry point and function symbols. A block ends at a branch,
+/// jump or system instruction, and may run into another.
+struct CodeBlock {
+  uint32_t pc;
+  std::vector<uint32_t> instructions;
+};
+
+/// Find the basic blocks of the program loaded into a memory, starting from
+/// the entry point, the function symbols and the labels between the _ftext
+/// and _etext symbols, and following branches, direct jumps and the return
+/// addresses of calls. The targets of indirect jumps are not known, and
+/// neither is code only reached through them, such as a trap handler. Blocks
+/// stop short of a fence.i, so that it is always interpreted.
+std::vector<CodeBlock> discoverBlocks(Memory &memory, SymbolInfo &symbolInfo,
+                                      uint32_t entry);
+
+/// Write a C++ translation unit that runs a program with each basic block
+/// compiled to a function, given the ELF image the program was loaded from,
+/// which is embedded in it, and the memory it was loaded into.
+void writeTranslation(std::ostream &out, const std::vector<CodeBlock> &blocks,
+                      SymbolInfo &symbolInfo, const std::vector<char> &image,
+                      const std::string &name, size_t memBase, size_t memSize);
+
+/// A block of code compiled ahead of time, which steps the executor through
+/// the block until it leaves it.
+struct TranslatedBlock {
+  uint32_t pc;
+  void (*function)(Executor &executor);
+};
+
+/// A program translated ahead of time: the ELF image it is loaded from, the
+/// memory it was translated for and its blocks of code.
+struct TranslatedProgram {
+  const char *name;
+  const unsigned char *image;
+  size_t imageSize;
+  size_t memBase;
+  size_t memSize;
+  const TranslatedBlock *blocks;
+  size_t blockCount;
+};
+
+/// Run a translated program with the command-line arguments of rvsim that
+/// apply to it, dispatching on the PC to the block that begins there and
+/// interpreting code that was not translated. Once the program executes a
+/// fence.i its code may have changed, and once it enables paging its code
+/// may be mapped at other addresses, so the rest of the run is
+/// interpreted. Return the exit code of the program, as rvsim does.
+int runTranslated(const TranslatedProgram &program, int argc, const char *argv[]);
+
+} // End namespace rvsim
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstdint>
+
+namespace rvsim {
+
+/// Synchronous exception causes, with their mcause encodings. Instruction
+/// handlers return NONE, or the cause of the trap that the instruction
+/// raised, in which case it has no other effect.
+enum class Trap : uint32_t {
+  INSTRUCTION_ADDRESS_MISALIGNED = 0,
+  INSTRUCTION_ACCESS_FAULT       = 1,
+  ILLEGAL_INSTRUCTION            = 2,
+  BREAKPOINT                     = 3,
+  LOAD_ADDRESS_MISALIGNED        = 4,
+  LOAD_ACCESS_FAULT              = 5,
+  STORE_ADDRESS_MISALIGNED       = 6,
+  STORE_ACCESS_FAULT             = 7,
+  ECALL_FROM_U                   = 8,
+  ECALL_FROM_S                   = 9,
+  ECALL_FROM_M                   = 11,
+  INSTRUCTION_PAGE_FAULT         = 12,
+  LOAD_PAGE_FAULT                = 13,
+  STORE_PAGE_FAULT               = 15,
+  NONE                           = 0xFFFFFFFF
+};
+
+inline const char *getTrapName(Trap trap) {
+  switch (trap) {
+  case Trap::INSTRUCTION_ADDRESS_MISALIGNED: return "instruction address misaligned";
+  case Trap::INSTRUCTION_ACCESS_FAULT:       return "instruction access fault";
+  case Trap::ILLEGAL_INSTRUCTION:            return "illegal instruction";
+  case Trap::BREAKPOINT:                     return "breakpoint";
+  case Trap::LOAD_ADDRESS_MISALIGNED:        return "load address misaligned";
+  case Trap::LOAD_ACCESS_FAULT:              return "load access fault";
+  case Trap::STORE_ADDRESS_MISALIGNED:       return "store address misaligned";
+  case Trap::STORE_ACCESS_FAULT:             return "store access fault";
+  case Trap::ECALL_FROM_U:                   return "environment call from U-mode";
+  case Trap::ECALL_FROM_S:                   return "environment call from S-mode";
+  case Trap::ECALL_FROM_M:                   return "environment call from M-mode";
+  case Trap::INSTRUCTION_PAGE_FAULT:         return "instruction page fault";
+  case Trap::LOAD_PAGE_FAULT:                return "load page fault";
+  case Trap::STORE_PAGE_FAULT:               return "store page fault";
+  default:                                   return "none";
+  }
+}
+
+/// Machine-mode interrupts, with their mcause exception codes, which are
+/// also their bit positions in mip and mie.
+enum class Interrupt : uint32_t {
+  MACHINE_SOFTWARE = 3,
+  MACHINE_TIMER    = 7,
+  MACHINE_EXTERNAL = 11
+};
+
+inline const char *getInterruptName(Interrupt interrupt) {
+  switch (interrupt) {
+  case Interrupt::MACHINE_SOFTWARE: return "machine software interrupt";
+  case Interrupt::MACHINE_TIMER:    return "machine timer interrupt";
+  case Interrupt::MACHINE_EXTERNAL: return "machine external interrupt";
+  default:                          return "unknown interrupt";
+  }
+}
+
+// The bit of mcause that distinguishes an interrupt from an exception.
+const uint32_t MCAUSE_INTERRUPT = 1U << 31;
+
+// Fields of mip and mie.
+const uint32_t MIP_MSIP = 1 << 3;
+const uint32_t MIP_MTIP = 1 << 7;
+const uint32_t MIP_MEIP = 1 << 11;
+
+/// Privilege levels, with their encodings in the MPP and SPP fields of
+/// mstatus.
+enum class Privilege : uint32_t {
+  USER       = 0,
+  SUPERVISOR = 1,
+  MACHINE    = 3
+};
+
+// Supervisor and machine-mode CSR addresses.
+enum Csr : uint32_t {
+  CSR_SSTATUS   = 0x100,
+  CSR_SIE       = 0x104,
+  CSR_STVEC     = 0x105,
+  CSR_SSCRATCH  = 0x140,
+  CSR_SEPC      = 0x141,
+  CSR_SCAUSE    = 0x142,
+  CSR_STVAL     = 0x143,
+  CSR_SIP       = 0x144,
+  CSR_SATP      = 0x180,
+  CSR_MSTATUS   = 0x300,
+  CSR_MISA      = 0x301,
+  CSR_MEDELEG   = 0x302,
+  CSR_MIDELEG   = 0x303,
+  CSR_MIE       = 0x304,
+  CSR_MTVEC     = 0x305,
+  CSR_MSCRATCH  = 0x340,
+  CSR_MEPC      = 0x341,
+  CSR_MCAUSE    = 0x342,
+  CSR_MTVAL     = 0x343,
+  CSR_MIP       = 0x344,
+  CSR_MCYCLE    = 0xB00,
+  CSR_MINSTRET  = 0xB02,
+  CSR_MCYCLEH   = 0xB80,
+  CSR_MINSTRETH = 0xB82,
+  CSR_CYCLE     = 0xC00,
+  CSR_TIME      = 0xC01,
+  CSR_INSTRET   = 0xC02,
+  CSR_CYCLEH    = 0xC80,
+  CSR_TIMEH     = 0xC81,
+  CSR_INSTRETH  = 0xC82,
+  CSR_MVENDORID = 0xF11,
+  CSR_MARCHID   = 0xF12,
+  CSR_MIMPID    = 0xF13,
+  CSR_MHARTID   = 0xF14
+};
+
+// Fields of mstatus. Those visible through sstatus are given by
+// SSTATUS_MASK.
+const uint32_t MSTATUS_SIE  = 1 << 1;
+const uint32_t MSTATUS_MIE  = 1 << 3;
+const uint32_t MSTATUS_SPIE = 1 << 5;
+const uint32_t MSTATUS_MPIE = 1 << 7;
+const uint32_t MSTATUS_SPP  = 1 << 8;
+const uint32_t MSTATUS_MPP  = 3 << 11;
+const uint32_t MSTATUS_MPRV = 1 << 17;
+const uint32_t MSTATUS_SUM  = 1 << 18;
+const uint32_t MSTATUS_MXR  = 1 << 19;
+const uint32_t MSTATUS_MPP_SHIFT = 11;
+const uint32_t SSTATUS_MASK = MSTATUS_SIE | MSTATUS_SPIE | MSTATUS_SPP | MSTATUS_SUM |
+                              MSTATUS_MXR;
+
+// The exceptions that medeleg can delegate to S-mode: all but an ECALL from
+// M-mode, which is never taken in S-mode.
+const uint32_t MEDELEG_MASK = 0xB3FF;
+
+// Fields of satp. The ASID field is not implemented, and reads as zero.
+const uint32_t SATP_MODE = 1U << 31;
+const uint32_t SATP_PPN  = 0x3FFFFF;
+
+// RV32 with the I base, and S and U modes.
+const uint32_t MISA_VALUE = 0x40140100;
+
+} // End namespace rvsim
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Device.hpp"
+#include "EventQueue.hpp"
+#include "FileDescriptors.hpp"
+#include "HartState.hpp"
+
+namespace rvsim {
+
+// The conventional location of the UART, as used by QEMU.
+const uint32_t UART_BASE_ADDRESS = 0x10000000;
+const uint32_t UART_SIZE         = 0x100;
+
+// The number of cycles between checks for input while receive interrupts are
+// enabled.
+const uint64_t UART_POLL_INTERVAL = 10000;
+
+/// A subset of a 16550 UART with byte-wide registers. Transmitted characters
+/// are written to the console immediately, so the transmitter is always
+/// empty, and received characters are read from the host stdin. The receive
+/// and transmit-empty interrupts are signalled as machine external
+/// interrupts. As on a 16550, the transmit-empty interrupt is raised when it
+/// is enabled or a character is sent, and cleared by reading IIR. While
+/// receive interrupts are enabled, or the program polls the line status, the
+/// input is polled by a periodic event.
+class Uart : public Device {
+  HartState &state;
+  EventQueue &events;
+  FileDescriptors &fileDescs;
+  uint8_t ier;
+  uint8_t lcr;
+  uint8_t mcr;
+  uint8_t scr;
+  uint8_t divisor[2];
+  bool dataReady;
+  uint8_t rbr;
+  bool threPending;
+  bool polling;
+
+  bool pollInput();
+  void updateInterrupt();
+
+public:
+  Uart(HartState &state, EventQueue &events, FileDescriptors &fileDescs,
+       uint32_t base = UART_BASE_ADDRESS);
+
+  uint32_t read(uint32_t offset, unsigned length) override;
+  void write(uint32_t offset, unsigned length, uint32_t value) override;
+  bool stableRead(uint32_t offset) const override;
+  void event(uint64_t cycle) override;
+};
+
+} // End namespace rvsim
@@ -35,3 +35,20 @@ inline uint32_t signExtend(uint32_t value, unsigned size) {
   uint32_t mask = (1U << size) - 1;
   return ((value >> (size - 1)) & 1) ? value | ~mask : value;
 }
+
+/// Extract the inclusive bit range [high:low], with the range checked at
+/// compile time so that instruction fields can be decoded without runtime
+/// assertions.
+template <unsigned high, unsigned low>
+constexpr uint32_t bitRange(uint32_t value) {
+  static_assert(high < 32 && low <= high, "invalid bit range");
+  return (value >> low) & static_cast<uint32_t>((1ULL << (1 + high - low)) - 1);
+}
+
+/// Sign extend a value of the given width, checked at compile time.
+template <unsigned size>
+constexpr uint32_t signExtend(uint32_t value) {
+  static_assert(size > 0 && size < 32, "invalid size");
+  uint32_t mask = (1U << size) - 1;
+  return ((value >> (size - 1)) & 1) ? value | ~mask : value & mask;
+}
@@ -0,0 +1,73 @@
+/* A C interface to the simulator for embedding it in other programs and
+ * calling it from other languages. It wraps rvsim::Simulator, and is kept
+ * stable: functions are only ever added. Functions that can fail return
+ * zero on success and -1 on failure, with rvsim_error describing the last
+ * failure. */
+
+#ifndef RVSIM_H
+#define RVSIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The version of this interface. */
+#define RVSIM_API_VERSION 1
+
+/* The index of the PC for the register accessors, after x0 to x31. */
+#define RVSIM_REGISTER_PC 32
+
+/* Why rvsim_run returned, or -1 on an error. */
+enum rvsim_stop_reason {
+  RVSIM_EXITED = 0,  /* The program exited, with rvsim_exit_code. */
+  RVSIM_TRAPPED = 1, /* The program stopped on a trap that it does not handle. */
+  RVSIM_BUDGET = 2   /* The instruction budget was used up. */
+};
+
+typedef struct rvsim_simulator rvsim_simulator;
+
+/* Create a simulator with memory of the given size at the given base
+ * address, or the defaults if they are zero. Return null on failure. */
+rvsim_simulator *rvsim_create(uint32_t mem_base, size_t mem_size);
+void rvsim_destroy(rvsim_simulator *sim);
+
+/* Describe the last failure, or return an empty string. */
+const char *rvsim_error(rvsim_simulator *sim);
+
+/* Load a program from an ELF file or an ELF image in memory. */
+int rvsim_load_file(rvsim_simulator *sim, const char *path);
+int rvsim_load_buffer(rvsim_simulator *sim, const void *data, size_t size);
+
+/* Return to the state immediately after the program was loaded. */
+int rvsim_reset(rvsim_simulator *sim);
+
+/* Run for at most max_instructions, or without limit if it is zero. */
+int rvsim_run(rvsim_simulator *sim, uint64_t max_instructions);
+
+uint32_t rvsim_exit_code(rvsim_simulator *sim);
+uint64_t rvsim_cycle_count(rvsim_simulator *sim);
+
+/* Access x0 to x31, or the PC with RVSIM_REGISTER_PC. */
+int rvsim_read_register(rvsim_simulator *sim, unsigned index, uint32_t *value);
+int rvsim_write_register(rvsim_simulator *sim, unsigned index, uint32_t value);
+
+/* Copy to or from simulated memory. */
+int rvsim_read_memory(rvsim_simulator *sim, uint32_t address, void *data, size_t length);
+int rvsim_write_memory(rvsim_simulator *sim, uint32_t address, const void *data, size_t length);
+
+/* Serve the program's stdin from the given input, and keep what it writes
+ * to stdout and stderr in memory instead of the host's console. */
+int rvsim_capture_console(rvsim_simulator *sim, const void *input, size_t length);
+
+/* Copy up to length bytes of the output captured from fd 1 or 2 into data,
+ * removing them, and return the number copied, or -1 on failure. */
+long rvsim_read_output(rvsim_simulator *sim, int fd, void *data, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RVSIM_H */
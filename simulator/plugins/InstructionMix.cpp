@@ -0,0 +1,69 @@
+#include <array>
+#include <cstdio>
+#include <string>
+
+#include <fmt/core.h>
+
+#include "rvsim/Instructions.hpp"
+#include "rvsim/Plugin.hpp"
+
+/// An example plugin that counts the instructions retired by operation, the
+/// branches taken and the bytes accessed in memory, and reports them when
+/// it is unloaded. The argument string names a file for the report, which
+/// is otherwise written to stderr.
+class InstructionMix : public rvsim::Plugin {
+  std::array<uint64_t, rvsim::NUM_OPERATIONS + 1> counts;
+  uint64_t branches;
+  uint64_t taken;
+  uint64_t bytesLoaded;
+  uint64_t bytesStored;
+  std::string filename;
+
+public:
+  InstructionMix(const char *args)
+    : counts{}, branches(0), taken(0), bytesLoaded(0), bytesStored(0), filename(args) {}
+
+  ~InstructionMix() override {
+    FILE *out = filename.empty() ? stderr : std::fopen(filename.c_str(), "w");
+    if (out == nullptr) {
+      return;
+    }
+    uint64_t total = 0;
+    for (auto count : counts) {
+      total += count;
+    }
+    fmt::print(out, "{:<10} {:>12} {:>7}\n", "operation", "count", "%");
+    for (size_t op = 0; op < counts.size(); op++) {
+      if (counts[op] > 0) {
+        fmt::print(out, "{:<10} {:>12} {:>7.2f}\n",
+                   rvsim::getSpec(static_cast<rvsim::Operation>(op)).name,
+                   counts[op], 100.0 * counts[op] / total);
+      }
+    }
+    fmt::print(out, "Retired {} instructions, {} of {} branches taken\n",
+               total, taken, branches);
+    fmt::print(out, "Loaded {} bytes, stored {} bytes\n", bytesLoaded, bytesStored);
+    if (out != stderr) {
+      std::fclose(out);
+    }
+  }
+
+  unsigned hooks() const override {
+    return rvsim::HOOK_RETIRE | rvsim::HOOK_MEMORY | rvsim::HOOK_BRANCH;
+  }
+
+  void retire(const rvsim::HartState &state, uint32_t pc, uint32_t instruction) override {
+    counts[static_cast<size_t>(rvsim::decode(instruction))]++;
+  }
+
+  void memoryAccess(const rvsim::HartState &state, const rvsim::MemoryAccess &access) override {
+    (access.store ? bytesStored : bytesLoaded) += access.size;
+  }
+
+  void branch(const rvsim::HartState &state, uint32_t pc, uint32_t target, bool isTaken) override {
+    branches++;
+    taken += isTaken;
+  }
+};
+
+RVSIM_PLUGIN(InstructionMix)
@@ -0,0 +1,97 @@
+#include "rvsim/BasicBlockVectors.hpp"
+#include "rvsim/Exception.hpp"
+
+namespace rvsim {
+
+BasicBlockVectors::BasicBlockVectors(const std::string &filename, uint64_t interval,
+                                     const HartState &state)
+    : file(filename), interval(interval), intervalEnd(state.cycleCount + interval),
+      blockStart(state.pc), blockStartCycle(state.cycleCount), intervalCount(0),
+      inRoi(true), roiEndCycle(state.cycleCount) {
+  if (!file) {
+    throw Exception("could not open basic block vector file " + filename);
+  }
+  if (interval == 0) {
+    throw Exception("basic block vector interval must be non zero");
+  }
+}
+
+void BasicBlockVectors::addBlock(uint64_t cycle) {
+  auto inserted = blockIds.emplace(blockStart, blockIds.size() + 1);
+  auto id = inserted.first->second;
+  if (inserted.second) {
+    counts.push_back(0);
+  }
+  if (counts[id - 1] == 0) {
+    touched.push_back(id);
+  }
+  counts[id - 1] += cycle - blockStartCycle;
+}
+
+/// Write the interval ending at a cycle. Intervals end at the first block
+/// boundary at or after each multiple of the interval length from the start,
+/// so that one beginning near a given cycle can be found by fast-forwarding
+/// to it.
+void BasicBlockVectors::endInterval(uint64_t cycle) {
+  file << 'T';
+  for (auto id : touched) {
+    file << ':' << id << ':' << counts[id - 1] << ' ';
+    counts[id - 1] = 0;
+  }
+  file << '\n';
+  touched.clear();
+  while (intervalEnd <= cycle) {
+    intervalEnd += interval;
+  }
+  intervalCount++;
+}
+
+void BasicBlockVectors::control(const HartState &state, Control request) {
+  auto cycle = state.cycleCount;
+  switch (request) {
+  case Control::ROI_END:
+    if (cycle > blockStartCycle) {
+      addBlock(cycle);
+    }
+    blockStartCycle = cycle;
+    inRoi = false;
+    roiEndCycle = cycle;
+    break;
+  case Control::ROI_BEGIN:
+    // Intervals are measured in the cycles within the region.
+    intervalEnd += cycle - roiEndCycle;
+    blockStart = state.pc;
+    blockStartCycle = cycle;
+    inRoi = true;
+    break;
+  case Control::STATS_RESET:
+    for (auto id : touched) {
+      counts[id - 1] = 0;
+    }
+    touched.clear();
+    blockStartCycle = cycle;
+    break;
+  case Control::STATS_DUMP:
+    if (inRoi && cycle > blockStartCycle) {
+      addBlock(cycle);
+      blockStartCycle = cycle;
+    }
+    if (!touched.empty()) {
+      endInterval(cycle);
+    }
+    break;
+  }
+}
+
+void BasicBlockVectors::finish(const HartState &state) {
+  if (inRoi && state.cycleCount > blockStartCycle) {
+    addBlock(state.cycleCount);
+    blockStartCycle = state.cycleCount;
+  }
+  if (!touched.empty()) {
+    endInterval(state.cycleCount);
+  }
+  file.flush();
+}
+
+} // End namespace rvsim
@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <string>
+
+#include "rvsim/Simulator.hpp"
+#include "rvsim/rvsim.h"
+
+struct rvsim_simulator {
+  rvsim::Simulator simulator;
+  std::string error;
+  // Output taken from the simulator but not yet read, for fds 1 and 2.
+  std::string output[2];
+
+  rvsim_simulator(const rvsim::SimulatorConfig &config) : simulator(config) {}
+};
+
+/// Call a function of the simulator, converting an exception into a
+/// failure that is described by rvsim_error.
+template<typename Function>
+static int guard(rvsim_simulator *sim, Function function) {
+  try {
+    sim->error.clear();
+    return function();
+  } catch (std::exception &e) {
+    sim->error = e.what();
+    return -1;
+  }
+}
+
+extern "C" {
+
+rvsim_simulator *rvsim_create(uint32_t mem_base, size_t mem_size) {
+  rvsim::SimulatorConfig config;
+  if (mem_base != 0) {
+    config.memBase = mem_base;
+  }
+  if (mem_size != 0) {
+    config.memSize = mem_size;
+  }
+  try {
+    return new rvsim_simulator(config);
+  } catch (std::exception &) {
+    return nullptr;
+  }
+}
+
+void rvsim_destroy(rvsim_simulator *sim) {
+  delete sim;
+}
+
+const char *rvsim_error(rvsim_simulator *sim) {
+  return sim->error.c_str();
+}
+
+int rvsim_load_file(rvsim_simulator *sim, const char *path) {
+  return guard(sim, [&] { sim->simulator.loadFile(path); return 0; });
+}
+
+int rvsim_load_buffer(rvsim_simulator *sim, const void *data, size_t size) {
+  return guard(sim, [&] { sim->simulator.loadBuffer(data, size); return 0; });
+}
+
+int rvsim_reset(rvsim_simulator *sim) {
+  return guard(sim, [&] { sim->simulator.reset(); return 0; });
+}
+
+int rvsim_run(rvsim_simulator *sim, uint64_t max_instructions) {
+  return guard(sim, [&] {
+    switch (sim->simulator.run(max_instructions)) {
+    case rvsim::StopReason::EXITED:
+      return static_cast<int>(RVSIM_EXITED);
+    case rvsim::StopReason::TRAPPED:
+      return static_cast<int>(RVSIM_TRAPPED);
+    default:
+      return static_cast<int>(RVSIM_BUDGET);
+    }
+  });
+}
+
+uint32_t rvsim_exit_code(rvsim_simulator *sim) {
+  return sim->simulator.getExecutor().exitCode;
+}
+
+uint64_t rvsim_cycle_count(rvsim_simulator *sim) {
+  return sim->simulator.getState().cycleCount;
+}
+
+int rvsim_read_register(rvsim_simulator *sim, unsigned index, uint32_t *value) {
+  return guard(sim, [&] { *value = sim->simulator.readRegister(index); return 0; });
+}
+
+int rvsim_write_register(rvsim_simulator *sim, unsigned index, uint32_t value) {
+  return guard(sim, [&] { sim->simulator.writeRegister(index, value); return 0; });
+}
+
+int rvsim_read_memory(rvsim_simulator *sim, uint32_t address, void *data, size_t length) {
+  return guard(sim, [&] { sim->simulator.readMemory(address, data, length); return 0; });
+}
+
+int rvsim_write_memory(rvsim_simulator *sim, uint32_t address, const void *data,
+                       size_t length) {
+  return guard(sim, [&] { sim->simulator.writeMemory(address, data, length); return 0; });
+}
+
+int rvsim_capture_console(rvsim_simulator *sim, const void *input, size_t length) {
+  return guard(sim, [&] {
+    sim->simulator.captureConsole(std::string(static_cast<const char*>(input), length));
+    return 0;
+  });
+}
+
+long rvsim_read_output(rvsim_simulator *sim, int fd, void *data, size_t length) {
+  if (fd != 1 && fd != 2) {
+    sim->error = "output can only be read from fd 1 or 2";
+    return -1;
+  }
+  auto &output = sim->output[fd - 1];
+  output += sim->simulator.takeOutput(fd);
+  auto count = std::min(length, output.size());
+  std::memcpy(data, output.data(), count);
+  output.erase(0, count);
+  return static_cast<long>(count);
+}
+
+} // extern "C"
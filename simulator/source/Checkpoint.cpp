@@ -0,0 +1,154 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/core.h>
+
+#include "rvsim/Checkpoint.hpp"
+#include "rvsim/Exception.hpp"
+#include "rvsim/ImageCache.hpp"
+
+namespace rvsim {
+
+const char CHECKPOINT_MAGIC[8] = {'R', 'V', 'S', 'I', 'M', 'C', 'K', 'P'};
+const uint32_t CHECKPOINT_VERSION = 2;
+
+/// The header of a checkpoint file, which is followed at memoryOffset by the
+/// contents of memory.
+struct CheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t memoryBase;
+  uint64_t memorySize;
+  uint64_t cycleCount;
+  uint32_t registers[NUM_REGISTERS];
+  uint32_t pc;
+  uint32_t mstatus;
+  uint32_t mie;
+  uint32_t mip;
+  uint32_t mtvec;
+  uint32_t mscratch;
+  uint32_t mepc;
+  uint32_t mcause;
+  uint32_t mtval;
+  uint32_t medeleg;
+  uint32_t privilege;
+  uint32_t stvec;
+  uint32_t sscratch;
+  uint32_t sepc;
+  uint32_t scause;
+  uint32_t stval;
+  uint32_t satp;
+  uint32_t toHostAddress;
+  uint32_t fromHostAddress;
+  uint32_t initialBreak;
+  uint32_t programBreak;
+  uint64_t memoryOffset;
+};
+
+void saveCheckpoint(const std::string &path, Executor &executor) {
+  if (!executor.bus.empty()) {
+    throw Exception("a checkpoint cannot be taken with devices attached");
+  }
+  auto &state = executor.state;
+  auto &memory = executor.memory;
+  CheckpointHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+  header.version = CHECKPOINT_VERSION;
+  header.memoryBase = memory.baseAddress;
+  header.memorySize = memory.sizeInBytes();
+  header.cycleCount = state.cycleCount;
+  std::copy(state.registers.begin(), state.registers.end(), header.registers);
+  header.pc = state.pc;
+  header.mstatus = state.mstatus;
+  header.mie = state.mie;
+  header.mip = state.mip;
+  header.mtvec = state.mtvec;
+  header.mscratch = state.mscratch;
+  header.mepc = state.mepc;
+  header.mcause = state.mcause;
+  header.mtval = state.mtval;
+  header.medeleg = state.medeleg;
+  header.privilege = static_cast<uint32_t>(state.privilege);
+  header.stvec = state.stvec;
+  header.sscratch = state.sscratch;
+  header.sepc = state.sepc;
+  header.scause = state.scause;
+  header.stval = state.stval;
+  header.satp = state.satp;
+  header.toHostAddress = executor.toHostAddress;
+  header.fromHostAddress = executor.fromHostAddress;
+  header.initialBreak = executor.initialBreak;
+  header.programBreak = executor.programBreak;
+  header.memoryOffset = IMAGE_MEMORY_ALIGNMENT;
+  // Console output written before the checkpoint belongs to this run.
+  executor.fileDescs.flush();
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    throw Exception("could not create checkpoint " + path + ": " + std::strerror(errno));
+  }
+  bool written = pwrite(fd, &header, sizeof(header), 0) == sizeof(header) &&
+                 writeMemoryImage(fd, header.memoryOffset, memory);
+  bool closed = close(fd) == 0;
+  if (!written || !closed) {
+    throw Exception("could not write checkpoint " + path + ": " + std::strerror(errno));
+  }
+}
+
+void restoreCheckpoint(const std::string &path, Executor &executor) {
+  auto &state = executor.state;
+  auto &memory = executor.memory;
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw Exception("could not open checkpoint " + path + ": " + std::strerror(errno));
+  }
+  CheckpointHeader header;
+  struct stat status;
+  bool valid = pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+               std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) == 0 &&
+               header.version == CHECKPOINT_VERSION &&
+               fstat(fd, &status) == 0 &&
+               static_cast<uint64_t>(status.st_size) >= header.memoryOffset + header.memorySize;
+  if (valid && (header.memoryBase != memory.baseAddress ||
+                header.memorySize != memory.sizeInBytes())) {
+    close(fd);
+    throw Exception(fmt::format("checkpoint {} has memory of {:#x} bytes at {:#x}",
+                                path, header.memorySize, header.memoryBase));
+  }
+  valid = valid && memory.map(fd, header.memoryOffset);
+  close(fd);
+  if (!valid) {
+    throw Exception(path + " is not a valid checkpoint");
+  }
+  state.cycleCount = header.cycleCount;
+  std::copy(header.registers, header.registers + NUM_REGISTERS, state.registers.begin());
+  state.pc = header.pc;
+  state.mstatus = header.mstatus;
+  state.mie = header.mie;
+  state.mip = header.mip;
+  state.mtvec = header.mtvec;
+  state.mscratch = header.mscratch;
+  state.mepc = header.mepc;
+  state.mcause = header.mcause;
+  state.mtval = header.mtval;
+  state.medeleg = header.medeleg;
+  state.privilege = static_cast<Privilege>(header.privilege);
+  state.stvec = header.stvec;
+  state.sscratch = header.sscratch;
+  state.sepc = header.sepc;
+  state.scause = header.scause;
+  state.stval = header.stval;
+  state.satp = header.satp;
+  // The TLBs hold host pointers into the memory that has been replaced.
+  executor.mmu.flush();
+  executor.setHTIFAddresses(header.toHostAddress, header.fromHostAddress);
+  executor.initialBreak = header.initialBreak;
+  executor.programBreak = header.programBreak;
+}
+
+} // End namespace rvsim
@@ -0,0 +1,92 @@
+#include "rvsim/Clint.hpp"
+
+namespace rvsim {
+
+// Register offsets.
+const uint32_t CLINT_MSIP       = 0x0000;
+const uint32_t CLINT_MTIMECMP   = 0x4000;
+const uint32_t CLINT_MTIMECMP_H = 0x4004;
+const uint32_t CLINT_MTIME      = 0xBFF8;
+const uint32_t CLINT_MTIME_H    = 0xBFFC;
+
+Clint::Clint(HartState &state, EventQueue &events, uint32_t base)
+    : Device("clint", base, CLINT_SIZE), state(state), events(events),
+      mtimecmp(UINT64_MAX), mtimeOffset(0) {}
+
+/// Set or clear a bit of mip, and have the executor re-evaluate interrupts
+/// if it changes.
+void Clint::setPending(uint32_t bit, bool pending) {
+  auto mip = pending ? state.mip | bit : state.mip & ~bit;
+  if (mip != state.mip) {
+    state.mip = mip;
+    events.wake(state.cycleCount);
+  }
+}
+
+/// The timer interrupt is pending while mtime is at least mtimecmp. If it is
+/// not yet, schedule an event for the cycle at which it will be, in place of
+/// any event for an earlier value of mtimecmp or mtime.
+void Clint::updateTimer() {
+  bool expired = mtime() >= mtimecmp;
+  setPending(MIP_MTIP, expired);
+  events.cancel(this);
+  if (!expired) {
+    events.schedule(mtimecmp - mtimeOffset, this);
+  }
+}
+
+uint32_t Clint::read(uint32_t offset, unsigned length) {
+  uint32_t word;
+  switch (offset & ~0x3U) {
+    case CLINT_MSIP:       word = (state.mip & MIP_MSIP) ? 1 : 0; break;
+    case CLINT_MTIMECMP:   word = mtimecmp; break;
+    case CLINT_MTIMECMP_H: word = mtimecmp >> 32; break;
+    case CLINT_MTIME:      word = mtime(); break;
+    case CLINT_MTIME_H:    word = mtime() >> 32; break;
+    default:               word = 0; break;
+  }
+  return extractAccess(word, offset, length);
+}
+
+void Clint::write(uint32_t offset, unsigned length, uint32_t value) {
+  auto word = mergeAccess(read(offset & ~0x3U, 4), offset, length, value);
+  switch (offset & ~0x3U) {
+    case CLINT_MSIP:
+      setPending(MIP_MSIP, word & 1);
+      break;
+    case CLINT_MTIMECMP:
+      mtimecmp = (mtimecmp & 0xFFFFFFFF00000000) | word;
+      updateTimer();
+      break;
+    case CLINT_MTIMECMP_H:
+      mtimecmp = (mtimecmp & 0xFFFFFFFF) | (static_cast<uint64_t>(word) << 32);
+      updateTimer();
+      break;
+    case CLINT_MTIME:
+      mtimeOffset = ((mtime() & 0xFFFFFFFF00000000) | word) - state.cycleCount;
+      updateTimer();
+      break;
+    case CLINT_MTIME_H:
+      mtimeOffset = ((mtime() & 0xFFFFFFFF) | (static_cast<uint64_t>(word) << 32)) -
+                    state.cycleCount;
+      updateTimer();
+      break;
+    default:
+      break;
+  }
+}
+
+/// mtime advances on every cycle, but the other registers only change when
+/// written.
+bool Clint::stableRead(uint32_t offset) const {
+  auto word = offset & ~0x3U;
+  return word != CLINT_MTIME && word != CLINT_MTIME_H;
+}
+
+void Clint::event(uint64_t cycle) {
+  if (mtime() >= mtimecmp) {
+    setPending(MIP_MTIP, true);
+  }
+}
+
+} // End namespace rvsim
@@ -0,0 +1,260 @@
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fmt/core.h>
+
+#include "rvsim/Cosim.hpp"
+#include "rvsim/Exception.hpp"
+#include "rvsim/Instructions.hpp"
+
+namespace rvsim {
+
+// The number of matching records shown before a difference.
+const size_t COSIM_CONTEXT_LINES = 8;
+
+// The size of the buffer used to read the log.
+const size_t COMMIT_LOG_BUFFER_SIZE = 1 << 20;
+
+CommitLog::CommitLog() : file(nullptr), pid(-1), line(nullptr), lineCapacity(0) {}
+
+CommitLog::~CommitLog() {
+  close();
+  std::free(line);
+}
+
+void CommitLog::close() {
+  if (file != nullptr && file != stdin) {
+    std::fclose(file);
+  }
+  file = nullptr;
+  if (pid > 0) {
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+    pid = -1;
+  }
+}
+
+void CommitLog::open(const std::string &path) {
+  close();
+  file = path == "-" ? stdin : std::fopen(path.c_str(), "r");
+  if (file == nullptr) {
+    throw Exception("could not open commit log " + path + ": " +
+                    std::strerror(errno));
+  }
+  setvbuf(file, nullptr, _IOFBF, COMMIT_LOG_BUFFER_SIZE);
+}
+
+void CommitLog::spawn(const std::vector<std::string> &args) {
+  close();
+  command = args.at(0);
+  int fds[2];
+  if (pipe(fds) != 0) {
+    throw Exception(std::string("could not create pipe: ") + std::strerror(errno));
+  }
+  pid = fork();
+  if (pid < 0) {
+    throw Exception(std::string("could not fork: ") + std::strerror(errno));
+  }
+  if (pid == 0) {
+    // The log is written to stderr, and the program's output is discarded.
+    dup2(fds[1], STDERR_FILENO);
+    int null = ::open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    ::close(fds[0]);
+    ::close(fds[1]);
+    std::vector<char*> argv;
+    for (auto &arg : args) {
+      argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    execvp(argv[0], argv.data());
+    _exit(127);
+  }
+  ::close(fds[1]);
+  file = fdopen(fds[0], "r");
+  setvbuf(file, nullptr, _IOFBF, COMMIT_LOG_BUFFER_SIZE);
+}
+
+bool CommitLog::next(CommitRecord &record, std::string &text) {
+  while (file != nullptr) {
+    auto length = getline(&line, &lineCapacity, file);
+    if (length < 0) {
+      // Distinguish a command that could not be run from an empty log.
+      int status;
+      if (pid > 0 && waitpid(pid, &status, 0) == pid) {
+        pid = -1;
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+          throw Exception("could not run " + command);
+        }
+      }
+      return false;
+    }
+    if (parseCommitRecord(line, record)) {
+      if (length > 0 && line[length - 1] == '\n') {
+        length--;
+      }
+      text.assign(line, length);
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Parse a hexadecimal number beginning 0x, advancing the position past it.
+static bool parseHex(const char *&pos, uint32_t &value, unsigned *digits = nullptr) {
+  while (*pos == ' ') {
+    pos++;
+  }
+  if (pos[0] != '0' || pos[1] != 'x') {
+    return false;
+  }
+  char *end;
+  value = std::strtoul(pos + 2, &end, 16);
+  if (digits != nullptr) {
+    *digits = end - (pos + 2);
+  }
+  pos = end;
+  return true;
+}
+
+// A record has the form:
+//   core   0: 3 0x80000004 (0x00a12023) x5  0x00000001 mem 0x80001000 0x01
+// where the privilege level is followed by the PC and the instruction, then
+// any register writes, memory accesses and CSR writes. A load logs its
+// address only, and a store its address and value, with as many digits as
+// the access has bytes.
+bool parseCommitRecord(const char *line, CommitRecord &record) {
+  if (std::strncmp(line, "core", 4) != 0) {
+    return false;
+  }
+  const char *pos = std::strchr(line, ':');
+  if (pos == nullptr) {
+    return false;
+  }
+  pos++;
+  while (*pos == ' ') {
+    pos++;
+  }
+  if (*pos < '0' || *pos > '3') {
+    return false;
+  }
+  pos++;
+  if (!parseHex(pos, record.pc)) {
+    return false;
+  }
+  while (*pos == ' ') {
+    pos++;
+  }
+  if (*pos++ != '(' || !parseHex(pos, record.instruction) || *pos++ != ')') {
+    return false;
+  }
+  record.rd = -1;
+  record.size = 0;
+  while (true) {
+    while (*pos == ' ') {
+      pos++;
+    }
+    if (*pos == '\0' || *pos == '\n') {
+      return true;
+    }
+    if (pos[0] == 'x' && pos[1] >= '0' && pos[1] <= '9') {
+      char *end;
+      record.rd = std::strtoul(pos + 1, &end, 10);
+      pos = end;
+      if (!parseHex(pos, record.rdValue)) {
+        return false;
+      }
+    } else if (std::strncmp(pos, "mem", 3) == 0) {
+      pos += 3;
+      uint32_t address;
+      if (!parseHex(pos, address)) {
+        return false;
+      }
+      unsigned digits;
+      const char *valuePos = pos;
+      if (parseHex(valuePos, record.value, &digits)) {
+        record.address = address;
+        record.size = digits / 2;
+        pos = valuePos;
+      }
+    } else {
+      // Skip a CSR or floating-point write and its value.
+      while (*pos != ' ' && *pos != '\0' && *pos != '\n') {
+        pos++;
+      }
+      uint32_t value;
+      parseHex(pos, value);
+    }
+  }
+}
+
+/// Format a retired instruction in the same way as a commit log record.
+static std::string formatRecord(const CommitRecord &record) {
+  auto text = fmt::format("core   0: 3 {:#010x} ({:#010x})", record.pc, record.instruction);
+  if (record.rd >= 0) {
+    text += fmt::format(" x{:<2} {:#010x}", record.rd, record.rdValue);
+  }
+  if (record.size > 0) {
+    text += fmt::format(" mem {:#010x} 0x{:0{}x}", record.address, record.value,
+                        record.size * 2);
+  }
+  return text;
+}
+
+void Cosim::retire(uint32_t pc, uint32_t instruction, HartState &state) {
+  // Reconstruct the effects of the instruction from its flags.
+  CommitRecord actual = {pc, instruction, -1, 0, 0, 0, 0};
+  auto &spec = getSpec(decode(instruction));
+  auto rd = bitRange<11, 7>(instruction);
+  if ((spec.flags & WRITES_RD) && rd != 0) {
+    actual.rd = rd;
+    actual.rdValue = state.readReg(rd);
+  }
+  if (spec.flags & STORE) {
+    InstructionSType store(instruction);
+    actual.size = (spec.flags & SIZE_1) ? 1 : (spec.flags & SIZE_2) ? 2 : 4;
+    actual.address = state.readReg(store.rs1) + signExtend<12>(store.imm);
+    actual.value = state.readReg(store.rs2);
+    if (actual.size < 4) {
+      actual.value &= (1U << (actual.size * 8)) - 1;
+    }
+  }
+  CommitRecord expected;
+  std::string text;
+  do {
+    if (!log.next(expected, text)) {
+      throw Exception(fmt::format("co-simulation: commit log ended after {} instructions, "
+                                  "at:\n  rvsim: {}", count, formatRecord(actual)));
+    }
+  } while (!synchronised && expected.pc != pc);
+  synchronised = true;
+  bool match = expected.pc == actual.pc &&
+               expected.instruction == actual.instruction &&
+               expected.rd == actual.rd &&
+               (actual.rd < 0 || expected.rdValue == actual.rdValue) &&
+               expected.size == actual.size &&
+               (actual.size == 0 || (expected.address == actual.address &&
+                                     expected.value == actual.value));
+  if (!match) {
+    std::string message = fmt::format("co-simulation: divergence after {} instructions\n", count);
+    for (auto &line : context) {
+      message += "  " + line + "\n";
+    }
+    message += "  spike: " + text + "\n";
+    message += "  rvsim: " + formatRecord(actual);
+    throw Exception(message);
+  }
+  if (context.size() == COSIM_CONTEXT_LINES) {
+    context.pop_front();
+  }
+  context.push_back(std::move(text));
+  count++;
+}
+
+} // End namespace rvsim
@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <bit>
+
+#include <fmt/core.h>
+
+#include "rvsim/DataProfile.hpp"
+#include "rvsim/Exception.hpp"
+
+namespace rvsim {
+
+static const char *bucketNames[] = {"[stack]", "[heap]", "[other]"};
+
+DataProfile::DataProfile(const std::string &filename, uint32_t lineSize,
+                         const Executor &executor)
+    : executor(executor), file(filename), finished(false), lastExtent{1, 0, 0},
+      stackTop(executor.state.registers[Register::x2]) {
+  if (!file) {
+    throw Exception("could not open data profile file " + filename);
+  }
+  if (lineSize < 4 || (lineSize & (lineSize - 1)) != 0) {
+    throw Exception(fmt::format("invalid line size {}", lineSize));
+  }
+  lineShift = std::countr_zero(lineSize);
+  for (auto *name : bucketNames) {
+    regions.push_back({name, 0, 0, 0, 0, 0, 0, {}, UINT32_MAX});
+  }
+  // Index the data objects of a known size. Symbols may name the same
+  // object more than once, and only the first of those is kept.
+  for (auto &symbol : executor.state.symbolInfo.getSymbols()) {
+    if ((symbol->info & SYMBOL_TYPE_MASK) == SYMBOL_TYPE_OBJECT && symbol->size != 0) {
+      extents.push_back({symbol->value, symbol->value + symbol->size,
+                         static_cast<unsigned>(regions.size())});
+      regions.push_back({symbol->name, symbol->value, symbol->size, 0, 0, 0, 0, {}, UINT32_MAX});
+    }
+  }
+  std::stable_sort(extents.begin(), extents.end(),
+                   [](const Extent &a, const Extent &b) { return a.start < b.start; });
+  extents.erase(std::unique(extents.begin(), extents.end(),
+                            [](const Extent &a, const Extent &b) { return a.start == b.start; }),
+                extents.end());
+}
+
+/// Return the index of the region containing an address.
+unsigned DataProfile::findRegion(uint32_t address, uint32_t sp) {
+  if (address >= lastExtent.start && address < lastExtent.end) {
+    return lastExtent.region;
+  }
+  auto next = std::upper_bound(extents.begin(), extents.end(), address,
+                               [](uint32_t a, const Extent &b) { return a < b.start; });
+  if (next != extents.begin() && address < std::prev(next)->end) {
+    lastExtent = *std::prev(next);
+    return lastExtent.region;
+  }
+  if (address >= sp && address < stackTop) {
+    return STACK;
+  } else if (address >= executor.initialBreak && address < executor.programBreak) {
+    return HEAP;
+  }
+  return OTHER;
+}
+
+void DataProfile::writeProfile() {
+  std::vector<const Region*> order;
+  for (auto &region : regions) {
+    if (region.reads + region.writes != 0) {
+      order.push_back(&region);
+    }
+  }
+  std::stable_sort(order.begin(), order.end(), [](const Region *a, const Region *b) {
+    return a->reads + a->writes > b->reads + b->writes;
+  });
+  file << "object,address,size,reads,writes,bytes_read,bytes_written,lines\n";
+  for (auto *region : order) {
+    if (region->size == 0) {
+      file << fmt::format("{},,", region->name);
+    } else {
+      file << fmt::format("{},{:#x},{}", region->name, region->address, region->size);
+    }
+    file << fmt::format(",{},{},{},{},{}\n", region->reads, region->writes, region->bytesRead,
+                        region->bytesWritten, region->lines.size());
+  }
+  file.flush();
+}
+
+void DataProfile::control(const HartState &state, Control request) {
+  if (request == Control::STATS_DUMP) {
+    writeProfile();
+  } else if (request == Control::STATS_RESET) {
+    for (auto &region : regions) {
+      region.reads = 0;
+      region.writes = 0;
+      region.bytesRead = 0;
+      region.bytesWritten = 0;
+      region.lines.clear();
+      region.lastLine = UINT32_MAX;
+    }
+  }
+}
+
+void DataProfile::finish() {
+  if (!finished) {
+    finished = true;
+    writeProfile();
+  }
+}
+
+} // End namespace rvsim
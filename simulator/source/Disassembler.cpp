@@ -0,0 +1,76 @@
+#include <fmt/core.h>
+
+#include "rvsim/Disassembler.hpp"
+#include "rvsim/Instructions.hpp"
+
+namespace rvsim {
+
+std::string disassemble(uint32_t value) {
+  auto op = decode(value);
+  auto &spec = getSpec(op);
+  switch (spec.format) {
+  case Format::R: {
+    InstructionRType instr(value);
+    if (!(spec.flags & WRITES_RD)) {
+      return fmt::format("{} {}, {}", spec.name, getRegisterName(instr.rs1),
+                         getRegisterName(instr.rs2));
+    }
+    return fmt::format("{} {}, {}, {}", spec.name, getRegisterName(instr.rd),
+                       getRegisterName(instr.rs1), getRegisterName(instr.rs2));
+  }
+  case Format::I: {
+    InstructionIType instr(value);
+    int32_t imm = signExtend<12>(instr.imm);
+    if (spec.flags & (LOAD | JUMP)) {
+      return fmt::format("{} {}, {}({})", spec.name, getRegisterName(instr.rd),
+                         imm, getRegisterName(instr.rs1));
+    }
+    return fmt::format("{} {}, {}, {}", spec.name, getRegisterName(instr.rd),
+                       getRegisterName(instr.rs1), imm);
+  }
+  case Format::IShamt: {
+    InstructionIShamtType instr(value);
+    return fmt::format("{} {}, {}, {}", spec.name, getRegisterName(instr.rd),
+                       getRegisterName(instr.rs1), instr.shamt);
+  }
+  case Format::B: {
+    InstructionBType instr(value);
+    return fmt::format("{} {}, {}, {}", spec.name, getRegisterName(instr.rs1),
+                       getRegisterName(instr.rs2),
+                       static_cast<int32_t>(signExtend<13>(instr.imm)));
+  }
+  case Format::S: {
+    InstructionSType instr(value);
+    return fmt::format("{} {}, {}({})", spec.name, getRegisterName(instr.rs2),
+                       static_cast<int32_t>(signExtend<12>(instr.imm)),
+                       getRegisterName(instr.rs1));
+  }
+  case Format::U: {
+    InstructionUType instr(value);
+    return fmt::format("{} {}, {:#x}", spec.name, getRegisterName(instr.rd),
+                       instr.imm);
+  }
+  case Format::J: {
+    InstructionJType instr(value);
+    return fmt::format("{} {}, {}", spec.name, getRegisterName(instr.rd),
+                       static_cast<int32_t>(signExtend<21>(instr.imm)));
+  }
+  case Format::Csr: {
+    InstructionCsrType instr(value);
+    if (spec.flags & CSR_IMM) {
+      return fmt::format("{} {}, {:#x}, {}", spec.name,
+                         getRegisterName(instr.rd), instr.csr,
+                         static_cast<unsigned>(instr.rs1));
+    }
+    return fmt::format("{} {}, {:#x}, {}", spec.name, getRegisterName(instr.rd),
+                       instr.csr, getRegisterName(instr.rs1));
+  }
+  default:
+    if (op == Operation::ILLEGAL) {
+      return fmt::format("illegal {:#010x}", value);
+    }
+    return spec.name;
+  }
+}
+
+} // End namespace rvsim
@@ -0,0 +1,292 @@
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/openat2.h>
+#endif
+
+#include "rvsim/Exception.hpp"
+#include "rvsim/FileDescriptors.hpp"
+
+namespace rvsim {
+
+// The amount of console output held before it is written to the host.
+const size_t CONSOLE_BUFFER_SIZE = 64 * 1024;
+
+FileDescriptors::FileDescriptors()
+    : sandboxFd(-1), bufferConsole(false), consoleBufferFd(-1), captured(false),
+      capturedInputOffset(0) {
+  for (int fd : {GUEST_STDIN, GUEST_STDOUT, GUEST_STDERR}) {
+    int hostFd = dup(fd);
+    if (hostFd < 0) {
+      throw Exception("could not dup stdin/stdout/stderr");
+    }
+    files.push_back({hostFd, true});
+  }
+  consoleBuffer.reserve(CONSOLE_BUFFER_SIZE);
+}
+
+FileDescriptors::~FileDescriptors() {
+  flush();
+  for (auto &file : files) {
+    if (file.hostFd >= 0) {
+      ::close(file.hostFd);
+    }
+  }
+  if (sandboxFd >= 0) {
+    ::close(sandboxFd);
+  }
+}
+
+FileDescriptors::File *FileDescriptors::lookup(int fd) {
+  if (fd < 0 || static_cast<size_t>(fd) >= files.size() ||
+      files[fd].hostFd < 0) {
+    return nullptr;
+  }
+  return &files[fd];
+}
+
+/// Open a path beneath a directory without following any symbolic link or
+/// ".." out of it. The kernel resolves the path with openat2 where it can,
+/// which allows symbolic links that stay beneath the directory. Otherwise
+/// each component is opened in turn without following symbolic links.
+static int openBeneath(int directoryFd, const char *path, int flags, mode_t mode) {
+#if defined(__linux__) && defined(SYS_openat2)
+  struct open_how how = {};
+  how.flags = flags;
+  how.mode = (flags & O_CREAT) ? mode : 0;
+  how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+  int resolved = syscall(SYS_openat2, directoryFd, path, &how, sizeof(how));
+  if (resolved >= 0 || (errno != ENOSYS && errno != EPERM)) {
+    return resolved;
+  }
+#endif
+  int parentFd = directoryFd;
+  const char *component = path;
+  for (const char *next; (next = std::strchr(component, '/')) != nullptr; component = next + 1) {
+    if (next == component) {
+      continue;
+    }
+    std::string name(component, next - component);
+    int fd = ::openat(parentFd, name.c_str(), O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    int error = errno;
+    if (parentFd != directoryFd) {
+      ::close(parentFd);
+    }
+    if (fd < 0) {
+      errno = error;
+      return -1;
+    }
+    parentFd = fd;
+  }
+  int fd = ::openat(parentFd, *component ? component : ".", flags | O_NOFOLLOW, mode);
+  int error = errno;
+  if (parentFd != directoryFd) {
+    ::close(parentFd);
+  }
+  errno = error;
+  return fd;
+}
+
+void FileDescriptors::setSandbox(const std::string &directory) {
+  int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) {
+    throw Exception("could not open sandbox directory " + directory + ": " +
+                    std::strerror(errno));
+  }
+  if (sandboxFd >= 0) {
+    ::close(sandboxFd);
+  }
+  sandboxFd = fd;
+}
+
+void FileDescriptors::flush() {
+  size_t offset = 0;
+  while (offset < consoleBuffer.size()) {
+    ssize_t ret = ::write(consoleBufferFd, consoleBuffer.data() + offset,
+                          consoleBuffer.size() - offset);
+    if (ret <= 0) {
+      break;
+    }
+    offset += ret;
+  }
+  consoleBuffer.clear();
+}
+
+void FileDescriptors::captureConsole(const std::string &input) {
+  flush();
+  captured = true;
+  capturedInput = input;
+  capturedInputOffset = 0;
+}
+
+std::string FileDescriptors::takeOutput(int fd) {
+  if (fd != GUEST_STDOUT && fd != GUEST_STDERR) {
+    return "";
+  }
+  std::string output;
+  output.swap(capturedOutput[fd - GUEST_STDOUT]);
+  return output;
+}
+
+bool FileDescriptors::inputReady() {
+  if (captured) {
+    return capturedInputOffset < capturedInput.size();
+  }
+  struct pollfd fds = {files[GUEST_STDIN].hostFd, POLLIN, 0};
+  return poll(&fds, 1, 0) > 0 && (fds.revents & POLLIN);
+}
+
+int FileDescriptors::open(const char *path, uint32_t guestFlags,
+                          uint32_t mode) {
+  if (sandboxFd < 0) {
+    return -EACCES;
+  }
+  // Resolve absolute paths against the sandbox root and refuse any path that
+  // could climb out of it, whether by ".." or by a symbolic link.
+  while (*path == '/') {
+    path++;
+  }
+  if (*path == '\0') {
+    path = ".";
+  }
+  for (const char *component = path; component != nullptr;) {
+    const char *next = std::strchr(component, '/');
+    size_t length = next ? next - component : std::strlen(component);
+    if (length == 2 && component[0] == '.' && component[1] == '.') {
+      return -EACCES;
+    }
+    component = next ? next + 1 : nullptr;
+  }
+  int flags = 0;
+  switch (guestFlags & GUEST_O_ACCMODE) {
+  case 0: flags = O_RDONLY; break;
+  case 1: flags = O_WRONLY; break;
+  case 2: flags = O_RDWR; break;
+  default: return -EINVAL;
+  }
+  flags |= (guestFlags & GUEST_O_APPEND) ? O_APPEND : 0;
+  flags |= (guestFlags & GUEST_O_CREAT) ? O_CREAT : 0;
+  flags |= (guestFlags & GUEST_O_TRUNC) ? O_TRUNC : 0;
+  flags |= (guestFlags & GUEST_O_EXCL) ? O_EXCL : 0;
+  int hostFd = openBeneath(sandboxFd, path, flags | O_CLOEXEC, mode & 0777);
+  if (hostFd < 0) {
+    return -errno;
+  }
+  // Reuse the lowest free guest descriptor, as POSIX requires.
+  for (size_t i = 0; i < files.size(); i++) {
+    if (files[i].hostFd < 0) {
+      files[i] = {hostFd, false};
+      return i;
+    }
+  }
+  files.push_back({hostFd, false});
+  return files.size() - 1;
+}
+
+int FileDescriptors::close(int fd) {
+  auto *file = lookup(fd);
+  if (file == nullptr) {
+    return -EBADF;
+  }
+  if (file->hostFd == consoleBufferFd) {
+    flush();
+  }
+  int ret = ::close(file->hostFd);
+  file->hostFd = -1;
+  return ret < 0 ? -errno : 0;
+}
+
+ssize_t FileDescriptors::read(int fd, uint8_t *buffer, size_t length) {
+  auto *file = lookup(fd);
+  if (file == nullptr) {
+    return -EBADF;
+  }
+  if (captured && file->console && fd == GUEST_STDIN) {
+    auto count = std::min(length, capturedInput.size() - capturedInputOffset);
+    std::memcpy(buffer, capturedInput.data() + capturedInputOffset, count);
+    capturedInputOffset += count;
+    return count;
+  }
+  // Make sure any prompt has been written before blocking on input.
+  if (file->console) {
+    flush();
+  }
+  ssize_t ret = ::read(file->hostFd, buffer, length);
+  return ret < 0 ? -errno : ret;
+}
+
+ssize_t FileDescriptors::write(int fd, const uint8_t *buffer, size_t length) {
+  auto *file = lookup(fd);
+  if (file == nullptr) {
+    return -EBADF;
+  }
+  if (captured && file->console && (fd == GUEST_STDOUT || fd == GUEST_STDERR)) {
+    capturedOutput[fd - GUEST_STDOUT].append(reinterpret_cast<const char*>(buffer), length);
+    return length;
+  }
+  if (bufferConsole && file->console && fd != GUEST_STDIN) {
+    // Output to stdout and stderr is kept in order by flushing whenever the
+    // destination changes.
+    if (file->hostFd != consoleBufferFd ||
+        consoleBuffer.size() + length > CONSOLE_BUFFER_SIZE) {
+      flush();
+      consoleBufferFd = file->hostFd;
+    }
+    if (length <= CONSOLE_BUFFER_SIZE) {
+      consoleBuffer.insert(consoleBuffer.end(), buffer, buffer + length);
+      return length;
+    }
+  }
+  ssize_t ret = ::write(file->hostFd, buffer, length);
+  return ret < 0 ? -errno : ret;
+}
+
+int64_t FileDescriptors::lseek(int fd, int64_t offset, int whence) {
+  auto *file = lookup(fd);
+  if (file == nullptr) {
+    return -EBADF;
+  }
+  if (whence != SEEK_SET && whence != SEEK_CUR && whence != SEEK_END) {
+    return -EINVAL;
+  }
+  off_t ret = ::lseek(file->hostFd, offset, whence);
+  return ret < 0 ? -errno : ret;
+}
+
+int FileDescriptors::fstat(int fd, GuestStat &stat) {
+  auto *file = lookup(fd);
+  if (file == nullptr) {
+    return -EBADF;
+  }
+  struct stat hostStat;
+  if (::fstat(file->hostFd, &hostStat) < 0) {
+    return -errno;
+  }
+  std::memset(&stat, 0, sizeof(stat));
+  stat.dev = hostStat.st_dev;
+  stat.ino = hostStat.st_ino;
+  stat.mode = hostStat.st_mode;
+  stat.nlink = hostStat.st_nlink;
+  stat.uid = hostStat.st_uid;
+  stat.gid = hostStat.st_gid;
+  stat.rdev = hostStat.st_rdev;
+  stat.size = hostStat.st_size;
+  stat.blksize = hostStat.st_blksize;
+  stat.blocks = hostStat.st_blocks;
+  stat.atimeSec = hostStat.st_atim.tv_sec;
+  stat.atimeNsec = hostStat.st_atim.tv_nsec;
+  stat.mtimeSec = hostStat.st_mtim.tv_sec;
+  stat.mtimeNsec = hostStat.st_mtim.tv_nsec;
+  stat.ctimeSec = hostStat.st_ctim.tv_sec;
+  stat.ctimeNsec = hostStat.st_ctim.tv_nsec;
+  return 0;
+}
+
+} // End namespace rvsim
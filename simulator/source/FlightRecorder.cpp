@@ -0,0 +1,132 @@
+#include "rvsim/FlightRecorder.hpp"
+#include "rvsim/Instructions.hpp"
+#include "rvsim/Trace.hpp"
+
+namespace rvsim {
+
+#define STR(s) #s
+
+// The names that Executor traces each operation with.
+static const char *traceNames[] = {
+#define RVSIM_TRACE_NAME(mnemonic, name, format, mask, match, flags) STR(mnemonic),
+  RVSIM_INSTRUCTIONS(RVSIM_TRACE_NAME)
+  "ILLEGAL"
+};
+
+/// Print one retired instruction with the operands that Executor traces for
+/// its format. The cycle of the following record gives the length of a WFI
+/// stall.
+static void dumpInstruction(Trace &trace, HartState &state, const FlightRecord &record,
+                            const FlightRecord *next) {
+  auto value = record.instruction;
+  auto op = decode(value);
+  auto &spec = getSpec(op);
+  auto *name = traceNames[static_cast<size_t>(op)];
+  auto rd = bitRange<11, 7>(value);
+  auto rs1 = bitRange<19, 15>(value);
+  auto rs2 = bitRange<24, 20>(value);
+  // The rs2 field of an instruction without rs2 may name rs1, so rs1 is set
+  // last.
+  state.registers[rs2] = record.rs2Value;
+  state.registers[rs1] = record.rs1Value;
+  switch (spec.format) {
+  case Format::R:
+    trace.trace(state, name, RegDst(rd), RegSrc(rs1), RegSrc(rs2));
+    break;
+  case Format::I: {
+    auto imm = signExtend<12>(InstructionIType(value).imm);
+    if (spec.flags & JUMP) {
+      trace.trace(state, name, RegDst(rd), ImmValue(imm));
+    } else {
+      trace.trace(state, name, RegDst(rd), RegSrc(rs1), ImmValue(imm));
+    }
+    if (spec.flags & LOAD) {
+      trace.memRead(rd, record.rs1Value + imm, record.rdValue);
+      return;
+    }
+    break;
+  }
+  case Format::IShamt:
+    trace.trace(state, name, RegDst(rd), RegSrc(rs1), ImmValue(rs2));
+    break;
+  case Format::S: {
+    auto offset = signExtend<12>(InstructionSType(value).imm);
+    trace.trace(state, name, RegSrc(rs2), RegSrc(rs1), ImmValue(offset));
+    trace.memWrite(record.rs1Value + offset, record.rs2Value);
+    return;
+  }
+  case Format::B:
+    trace.trace(state, name, RegSrc(rs1), RegSrc(rs2),
+                ImmValue(signExtend<13>(InstructionBType(value).imm)));
+    if (record.nextPc != record.pc + 4) {
+      trace.regWrite(Register::pc, record.nextPc);
+    }
+    return;
+  case Format::U:
+    trace.trace(state, name, RegDst(rd), ImmValue(InstructionUType(value).imm));
+    break;
+  case Format::J:
+    trace.trace(state, name, RegDst(rd), ImmValue(InstructionJType(value).imm));
+    break;
+  case Format::Csr: {
+    auto source = (value & (1U << 14)) ? rs1 : record.rs1Value;
+    trace.trace(state, name, RegDst(rd), ImmValue(bitRange<31, 20>(value)), ArgValue(source));
+    break;
+  }
+  case Format::Sys:
+    trace.start(state);
+    trace.printOperand(name);
+    if (op == Operation::MRET) {
+      trace.regWrite(Register::pc, record.nextPc);
+    } else if (op == Operation::WFI && next != nullptr) {
+      ArgValue stall(next->cycle - record.cycle - 1);
+      trace.printOperand(stall);
+    }
+    return;
+  }
+  // Writes to x0 are traced with the value discarded, which is only known
+  // for the link address of a jump.
+  if (spec.flags & JUMP) {
+    trace.regWrite(rd, record.pc + 4);
+    trace.regWrite(Register::pc, record.nextPc);
+  } else if (spec.flags & WRITES_RD) {
+    trace.regWrite(rd, record.rdValue);
+  }
+}
+
+void FlightRecorder::dump(std::ostream &out, SymbolInfo &symbolInfo) const {
+  Trace trace(out);
+  HartState state(symbolInfo);
+  for (auto index = head - size(); index != head; index++) {
+    auto &record = records[index & mask];
+    auto *next = index + 1 != head ? &records[(index + 1) & mask] : nullptr;
+    state.cycleCount = record.cycle;
+    state.fetchAddress = record.pc;
+    auto cause = record.event & ~FLIGHT_EVENT_MASK;
+    switch (static_cast<FlightEvent>(record.event & FLIGHT_EVENT_MASK)) {
+    case FlightEvent::RETIRED:
+      dumpInstruction(trace, state, record, next);
+      break;
+    case FlightEvent::TRAP:
+      trace.trace(state, "TRAP", getTrapName(static_cast<Trap>(cause)), ArgValue(record.rdValue));
+      if (record.nextPc != record.pc) {
+        trace.regWrite(Register::pc, record.nextPc);
+      }
+      break;
+    case FlightEvent::INTERRUPT:
+      trace.trace(state, "INTERRUPT", getInterruptName(static_cast<Interrupt>(cause)));
+      trace.regWrite(Register::pc, record.nextPc);
+      break;
+    case FlightEvent::INTRINSIC:
+      trace.trace(state, getIntrinsicName(static_cast<Intrinsic>(cause)),
+                  ArgValue(record.rs1Value), ArgValue(record.rs2Value),
+                  ArgValue(record.instruction));
+      trace.regWrite(Register::x10, record.rdValue);
+      trace.regWrite(Register::pc, record.nextPc);
+      break;
+    }
+    trace.end();
+  }
+}
+
+} // End namespace rvsim
@@ -0,0 +1,148 @@
+#include <algorithm>
+
+#include <fmt/core.h>
+
+#include "rvsim/Exception.hpp"
+#include "rvsim/Footprint.hpp"
+
+namespace rvsim {
+
+const uint32_t FOOTPRINT_PAGE_SIZE = 0x1000;
+
+Footprint::Footprint(const std::string &filename, uint32_t guard, const Executor &executor)
+    : executor(executor), finished(false), guard(guard), stackTop(0),
+      lowestSp(UINT32_MAX), pages((executor.memory.sizeInBytes() / FOOTPRINT_PAGE_SIZE + 63) / 64),
+      lastPage(UINT32_MAX) {
+  if (!filename.empty()) {
+    file.open(filename);
+    if (!file) {
+      throw Exception("could not open footprint file " + filename);
+    }
+  }
+  // The runtime places the stack below stack_top. Otherwise the top is the
+  // highest value that the stack pointer is set to.
+  if (auto *symbol = executor.state.symbolInfo.getSymbol("stack_top")) {
+    stackTop = symbol->value;
+  }
+}
+
+void Footprint::setStackPointer(const HartState &state, uint32_t pc, uint32_t sp) {
+  stackTop = std::max(stackTop, sp);
+  lowestSp = std::min(lowestSp, sp);
+  auto *symbol = state.symbolInfo.getSymbol(pc);
+  auto &depth = functionDepths[symbol ? symbol->value : 0];
+  depth = std::max(depth, stackTop - sp);
+  if (sp < guard) {
+    finish();
+    throw Exception(fmt::format("stack pointer {:#010x} is below the guard at {:#010x}, at pc {:#010x}",
+                                sp, guard, pc));
+  }
+}
+
+void Footprint::writeReport() {
+  if (!file.is_open()) {
+    return;
+  }
+  auto &symbolInfo = executor.state.symbolInfo;
+  auto base = executor.memory.baseAddress;
+  uint32_t end = base + executor.memory.sizeInBytes();
+  if (lowestSp == UINT32_MAX) {
+    file << "Stack pointer not set\n";
+  } else {
+    file << fmt::format("Stack top:        {:#010x}\n", stackTop);
+    file << fmt::format("Lowest sp:        {:#010x}\n", lowestSp);
+    file << fmt::format("Peak stack depth: {} bytes\n",
+                        stackTop > lowestSp ? stackTop - lowestSp : 0);
+  }
+  if (guard != 0) {
+    file << fmt::format("Stack guard:      {:#010x}\n", guard);
+  }
+  // The regions of the program, from the symbols of the linker script, which
+  // may overlap: the stack normally lies within bss.
+  struct Region {
+    const char *name;
+    uint32_t start;
+    uint32_t end;
+  };
+  std::vector<Region> regions;
+  auto addRegion = [&](const char *name, const char *startSymbol, const char *endSymbol) {
+    auto *start = symbolInfo.getSymbol(startSymbol);
+    auto *end = symbolInfo.getSymbol(endSymbol);
+    if (start && end && start->value < end->value) {
+      regions.push_back({name, start->value, end->value});
+    }
+  };
+  addRegion("text", "_ftext", "_etext");
+  addRegion("data", "_fdata", "_edata");
+  addRegion("bss", "_bss_start", "_end");
+  if (executor.initialBreak < executor.programBreak) {
+    regions.push_back({"heap", executor.initialBreak, executor.programBreak});
+  }
+  if (lowestSp < stackTop) {
+    regions.push_back({"stack", lowestSp & ~(FOOTPRINT_PAGE_SIZE - 1), stackTop});
+  }
+  regions.push_back({"memory", base, end});
+  file << fmt::format("\n{:<8} {:<10} {:<10} {:>6} {:>8}  {}\n", "Region", "Start", "End",
+                      "Pages", "Touched", "Touched pages");
+  for (auto &region : regions) {
+    auto start = std::max(region.start, base);
+    auto limit = std::min(region.end, end);
+    size_t count = 0;
+    size_t touched = 0;
+    std::string ranges;
+    uint32_t rangeStart = 0;
+    bool inRange = false;
+    for (uint32_t page = start & ~(FOOTPRINT_PAGE_SIZE - 1); page < limit && page >= base;
+         page += FOOTPRINT_PAGE_SIZE) {
+      auto index = (page - base) / FOOTPRINT_PAGE_SIZE;
+      bool accessed = pages[index / 64] & (1ULL << (index % 64));
+      count++;
+      touched += accessed;
+      if (accessed && !inRange) {
+        rangeStart = page;
+      } else if (!accessed && inRange) {
+        ranges += fmt::format(" {:#x}-{:#x}", rangeStart, page - 1);
+      }
+      inRange = accessed;
+    }
+    if (inRange) {
+      auto rangeEnd = (limit + FOOTPRINT_PAGE_SIZE - 1) & ~(FOOTPRINT_PAGE_SIZE - 1);
+      ranges += fmt::format(" {:#x}-{:#x}", rangeStart, rangeEnd - 1);
+    }
+    file << fmt::format("{:<8} {:#010x} {:#010x} {:>6} {:>8} {}\n", region.name, region.start,
+                        region.end, count, touched, ranges);
+  }
+  std::vector<std::pair<uint32_t, uint32_t>> depths(functionDepths.begin(),
+                                                    functionDepths.end());
+  std::stable_sort(depths.begin(), depths.end(),
+                   [](auto &a, auto &b) { return a.second > b.second; });
+  file << fmt::format("\n{:<24} {:>16}\n", "Function", "Peak stack depth");
+  for (auto &depth : depths) {
+    auto *symbol = symbolInfo.getSymbol(depth.first);
+    file << fmt::format("{:<24} {:>16}\n",
+                        symbol && symbol->value == depth.first ? symbol->name
+                                                               : fmt::format("{:#x}", depth.first),
+                        depth.second);
+  }
+  file.flush();
+}
+
+void Footprint::control(const HartState &state, Control request) {
+  if (request == Control::STATS_DUMP) {
+    writeReport();
+  } else if (request == Control::STATS_RESET) {
+    lowestSp = UINT32_MAX;
+    functionDepths.clear();
+    std::fill(pages.begin(), pages.end(), 0);
+    lastPage = UINT32_MAX;
+  }
+}
+
+void Footprint::finish() {
+  if (!finished) {
+    finished = true;
+    writeReport();
+  }
+}
+
+} // End namespace rvsim
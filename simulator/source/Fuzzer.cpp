@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cstring>
+
+#include <fmt/core.h>
+
+#include "rvsim/Exception.hpp"
+#include "rvsim/Fuzzer.hpp"
+
+namespace rvsim {
+
+void EdgeCoverage::syscall(const HartState &state, const uint64_t *args) {
+  snapshot.markDirty(command, 8 * sizeof(uint64_t));
+  snapshot.markDirty(executor.fromHostAddress, sizeof(uint64_t));
+  switch (args[0]) {
+    case Syscall::READ:
+      snapshot.markDirty(args[2], args[3]);
+      break;
+    case Syscall::FSTAT:
+      snapshot.markDirty(args[2], sizeof(GuestStat));
+      break;
+    case Syscall::GETTIMEOFDAY:
+      snapshot.markDirty(args[1], 16);
+      break;
+    default:
+      break;
+  }
+}
+
+static uint32_t findSymbol(SymbolInfo &symbolInfo, const std::string &name,
+                           uint32_t *size = nullptr) {
+  auto *symbol = symbolInfo.getSymbol(name);
+  if (!symbol) {
+    throw Exception(fmt::format("the program has no symbol {}", name));
+  }
+  if (size) {
+    *size = symbol->size;
+  }
+  return symbol->value;
+}
+
+FuzzHarness::FuzzHarness(Executor &executor, SymbolInfo &symbolInfo, const std::string &entry,
+                         const std::string &input, uint32_t bufferSize,
+                         const std::string &length, uint64_t budget, uint8_t *bitmap)
+  : executor(executor), bufferSize(bufferSize), lengthAddress(0), budget(budget) {
+  uint32_t symbolSize;
+  buffer = findSymbol(symbolInfo, input, &symbolSize);
+  if (this->bufferSize == 0) {
+    this->bufferSize = symbolSize;
+  }
+  if (this->bufferSize == 0) {
+    throw Exception(fmt::format("the size of {} is unknown", input));
+  }
+  if (!executor.memory.contains(buffer, this->bufferSize)) {
+    throw Exception(fmt::format("{} does not lie within memory", input));
+  }
+  if (!length.empty()) {
+    lengthAddress = findSymbol(symbolInfo, length);
+    if ((lengthAddress & 0x3) || !executor.memory.contains(lengthAddress, 4)) {
+      throw Exception(fmt::format("{} is not a word in memory", length));
+    }
+  }
+  auto entryPc = findSymbol(symbolInfo, entry);
+  while (executor.state.pc != entryPc) {
+    if (!executor.step<false>()) {
+      throw Exception(fmt::format("the program stopped before reaching {}", entry));
+    }
+  }
+  snapshot = std::make_unique<Snapshot>(executor);
+  coverage = std::make_unique<EdgeCoverage>(bitmap, *snapshot, executor);
+}
+
+FuzzOutcome FuzzHarness::run(const uint8_t *data, size_t size) {
+  snapshot->restore();
+  auto length = static_cast<uint32_t>(std::min<size_t>(size, bufferSize));
+  std::memcpy(executor.memory.hostPtr(buffer, length), data, length);
+  snapshot->markDirty(buffer, length);
+  if (lengthAddress) {
+    executor.memory.writeMemoryWord(lengthAddress, length);
+    snapshot->markDirty(lengthAddress, sizeof(uint32_t));
+  }
+  auto &state = executor.state;
+  auto limit = state.cycleCount + budget;
+  executor.cycleLimit = limit;
+  try {
+    while (state.cycleCount < limit && executor.step<false>(*coverage)) {
+    }
+  } catch (Exception &) {
+    // An unknown system call or an argument block out of range is an error
+    // in the program, found by the input.
+    return FuzzOutcome::TRAPPED;
+  }
+  switch (executor.status) {
+    case Status::EXITED:  return FuzzOutcome::EXITED;
+    case Status::TRAPPED: return FuzzOutcome::TRAPPED;
+    default:              return FuzzOutcome::BUDGET;
+  }
+}
+
+} // End namespace rvsim
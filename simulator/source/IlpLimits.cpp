@@ -0,0 +1,164 @@
+#include <fmt/core.h>
+
+#include "rvsim/Exception.hpp"
+#include "rvsim/IlpLimits.hpp"
+
+namespace rvsim {
+
+static const char *classNames[] = {
+  "alu", "load", "store", "branch", "jump", "system"
+};
+
+// The latency of each class of instruction unless one is given.
+static const uint32_t DEFAULT_LATENCIES[] = {1, 2, 1, 1, 1, 1};
+
+// The number of stores a machine may hold beyond its window before those
+// that can no longer delay an instruction are discarded.
+const size_t MIN_STORE_SLACK = 1024;
+
+IlpLimits::IlpLimits(const std::string &filename, const std::string &windows,
+                     const std::string &latencies)
+    : file(filename), finished(false), instructions(0), pendingInstruction(0) {
+  if (!file) {
+    throw Exception("could not open ILP file " + filename);
+  }
+  std::copy(std::begin(DEFAULT_LATENCIES), std::end(DEFAULT_LATENCIES),
+            this->latencies.begin());
+  size_t start = 0;
+  while (start <= windows.size()) {
+    auto end = std::min(windows.find(',', start), windows.size());
+    auto field = windows.substr(start, end - start);
+    size_t window = 0;
+    size_t length = 0;
+    try {
+      window = std::stoul(field, &length, 0);
+    } catch (std::exception &) {
+    }
+    if (length == 0 || length != field.size() || window > UINT32_MAX) {
+      throw Exception(fmt::format("invalid ILP window {}", field));
+    }
+    machines.push_back({static_cast<uint32_t>(window), std::vector<uint64_t>(window, 0), {},
+                        {}, 0, 0, 0, 0, 0});
+    start = end + 1;
+  }
+  start = 0;
+  while (start < latencies.size()) {
+    auto end = std::min(latencies.find(',', start), latencies.size());
+    auto field = latencies.substr(start, end - start);
+    auto separator = field.find('=');
+    unsigned index = 0;
+    while (index < NUM_LATENCIES && field.substr(0, separator) != classNames[index]) {
+      index++;
+    }
+    if (separator == std::string::npos || index == NUM_LATENCIES) {
+      throw Exception(fmt::format("invalid ILP latency {}", field));
+    }
+    try {
+      this->latencies[index] = std::stoul(field.substr(separator + 1), nullptr, 0);
+    } catch (std::exception &) {
+      throw Exception(fmt::format("invalid ILP latency {}", field));
+    }
+    start = end + 1;
+  }
+}
+
+/// Schedule a retired instruction on every machine, given the address it
+/// accessed if it is a load or store.
+void IlpLimits::schedule(uint32_t instruction, uint32_t address) {
+  auto &spec = getSpec(decode(instruction));
+  unsigned rs1 = 0;
+  unsigned rs2 = 0;
+  switch (spec.format) {
+  case Format::R:
+  case Format::B:
+  case Format::S:
+    rs2 = bitRange<24, 20>(instruction);
+    [[fallthrough]];
+  case Format::I:
+  case Format::IShamt:
+    rs1 = bitRange<19, 15>(instruction);
+    break;
+  case Format::Csr:
+    rs1 = (spec.flags & CSR_IMM) ? 0 : bitRange<19, 15>(instruction);
+    break;
+  default:
+    break;
+  }
+  unsigned rd = (spec.flags & WRITES_RD) ? bitRange<11, 7>(instruction) : 0;
+  auto kind = (spec.flags & LOAD)   ? LATENCY_LOAD :
+              (spec.flags & STORE)  ? LATENCY_STORE :
+              (spec.flags & BRANCH) ? LATENCY_BRANCH :
+              (spec.flags & SYSTEM) ? LATENCY_SYSTEM :
+              (spec.flags & JUMP)   ? LATENCY_JUMP : LATENCY_ALU;
+  auto latency = latencies[kind];
+  auto word = address >> 2;
+  for (auto &machine : machines) {
+    auto *retireTime = machine.window ? &machine.retireTimes[instructions % machine.window]
+                                      : nullptr;
+    // The instruction enters the window when the one a window before it
+    // retires.
+    auto start = std::max({retireTime ? *retireTime : 0, machine.barrier,
+                           machine.ready[rs1], machine.ready[rs2]});
+    if (kind == LATENCY_LOAD) {
+      auto store = machine.stores.find(word);
+      if (store != machine.stores.end()) {
+        start = std::max(start, store->second);
+      }
+    } else if (kind == LATENCY_SYSTEM) {
+      start = std::max(start, machine.criticalPath);
+    }
+    auto complete = start + latency;
+    if (rd != 0) {
+      machine.ready[rd] = complete;
+    }
+    if (kind == LATENCY_STORE) {
+      machine.stores[word] = complete;
+      // A store that completed before the oldest instruction in the window
+      // retired can no longer delay a load.
+      if (machine.window && machine.stores.size() > machine.window + MIN_STORE_SLACK) {
+        auto oldest = *retireTime;
+        std::erase_if(machine.stores, [&](const auto &entry) { return entry.second <= oldest; });
+      }
+    } else if (kind == LATENCY_SYSTEM) {
+      machine.barrier = complete;
+    }
+    machine.criticalPath = std::max(machine.criticalPath, complete);
+    machine.lastRetire = std::max(machine.lastRetire, complete);
+    if (retireTime) {
+      *retireTime = machine.lastRetire;
+    }
+  }
+  instructions++;
+}
+
+void IlpLimits::writeReport() {
+  file << "window,instructions,critical_path,ipc\n";
+  for (auto &machine : machines) {
+    auto count = instructions - machine.startInstructions;
+    auto path = machine.criticalPath - machine.startPath;
+    file << fmt::format("{},{},{},{:.3f}\n",
+                        machine.window ? std::to_string(machine.window) : "unlimited", count,
+                        path, path ? static_cast<double>(count) / path : 0.0);
+  }
+  file.flush();
+}
+
+void IlpLimits::control(const HartState &state, Control request) {
+  if (request == Control::STATS_DUMP) {
+    writeReport();
+  } else if (request == Control::STATS_RESET) {
+    for (auto &machine : machines) {
+      machine.startInstructions = instructions;
+      machine.startPath = machine.criticalPath;
+    }
+  }
+}
+
+void IlpLimits::finish() {
+  if (!finished) {
+    finished = true;
+    writeReport();
+  }
+}
+
+} // End namespace rvsim
@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/core.h>
+
+#include "rvsim/Exception.hpp"
+#include "rvsim/ImageCache.hpp"
+
+namespace rvsim {
+
+const char IMAGE_MAGIC[8] = {'R', 'V', 'S', 'I', 'M', 'I', 'M', 'G'};
+const uint32_t IMAGE_VERSION = 2;
+
+// The granularity at which zero memory is left as a hole in the file.
+const size_t IMAGE_PAGE_SIZE = 0x1000;
+
+/// The header of an image file, which is followed by the symbols, their
+/// names and, at memoryOffset, the contents of memory.
+struct ImageHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t memoryBase;
+  uint64_t memorySize;
+  uint64_t hash;
+  LoadedImage image;
+  uint32_t numSymbols;
+  uint32_t namesSize;
+  uint64_t memoryOffset;
+};
+
+struct ImageSymbol {
+  uint32_t value;
+  uint32_t name;
+  uint32_t info;
+  uint32_t size;
+};
+
+bool writeMemoryImage(int fd, uint64_t offset, Memory &memory) {
+  if (ftruncate(fd, offset + memory.sizeInBytes()) != 0) {
+    return false;
+  }
+  static const char zeros[IMAGE_PAGE_SIZE] = {};
+  for (size_t page = 0; page < memory.sizeInBytes(); page += IMAGE_PAGE_SIZE) {
+    auto length = std::min(IMAGE_PAGE_SIZE, memory.sizeInBytes() - page);
+    auto *data = memory.data() + page;
+    if (std::memcmp(data, zeros, length) != 0 &&
+        pwrite(fd, data, length, offset + page) != static_cast<ssize_t>(length)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// FNV-1a, taken a word at a time.
+uint64_t hashImage(const void *data, size_t size) {
+  auto *bytes = static_cast<const uint8_t*>(data);
+  uint64_t hash = 0xcbf29ce484222325;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, bytes + i, sizeof(word));
+    hash = (hash ^ word) * 0x100000001b3;
+  }
+  for (; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3;
+  }
+  return hash ^ size;
+}
+
+std::string ImageCache::getPath(uint64_t hash, const Memory &memory) const {
+  return fmt::format("{}/{:016x}-{:x}-{:x}.img", directory, hash,
+                     memory.baseAddress, memory.sizeInBytes());
+}
+
+bool ImageCache::load(uint64_t hash, Memory &memory, SymbolInfo &symbolInfo,
+                      LoadedImage &image) const {
+  int fd = ::open(getPath(hash, memory).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  ImageHeader header;
+  struct stat status;
+  bool valid = pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+               std::memcmp(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) == 0 &&
+               header.version == IMAGE_VERSION &&
+               header.hash == hash &&
+               header.memoryBase == memory.baseAddress &&
+               header.memorySize == memory.sizeInBytes() &&
+               fstat(fd, &status) == 0 &&
+               static_cast<uint64_t>(status.st_size) >= header.memoryOffset + header.memorySize;
+  std::vector<ImageSymbol> symbols;
+  std::vector<char> names;
+  if (valid) {
+    symbols.resize(header.numSymbols);
+    names.resize(header.namesSize + 1);
+    auto symbolsSize = symbols.size() * sizeof(ImageSymbol);
+    valid = pread(fd, symbols.data(), symbolsSize, sizeof(header)) ==
+              static_cast<ssize_t>(symbolsSize) &&
+            pread(fd, names.data(), header.namesSize, sizeof(header) + symbolsSize) ==
+              static_cast<ssize_t>(header.namesSize) &&
+            memory.map(fd, header.memoryOffset);
+  }
+  close(fd);
+  if (!valid) {
+    return false;
+  }
+  for (auto &symbol : symbols) {
+    symbolInfo.addSymbol(symbol.name < header.namesSize ? &names[symbol.name] : "",
+                         symbol.value, symbol.info, symbol.size);
+  }
+  image = header.image;
+  return true;
+}
+
+void ImageCache::store(uint64_t hash, Memory &memory, const SymbolInfo &symbolInfo,
+                       const LoadedImage &image) const {
+  std::vector<ImageSymbol> symbols;
+  std::string names;
+  for (auto &symbol : symbolInfo.getSymbols()) {
+    symbols.push_back({symbol->value, static_cast<uint32_t>(names.size()),
+                       static_cast<uint8_t>(symbol->info), symbol->size});
+    names += symbol->name;
+    names += '\0';
+  }
+  ImageHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+  header.version = IMAGE_VERSION;
+  header.memoryBase = memory.baseAddress;
+  header.memorySize = memory.sizeInBytes();
+  header.hash = hash;
+  header.image = image;
+  header.numSymbols = symbols.size();
+  header.namesSize = names.size();
+  auto symbolsSize = symbols.size() * sizeof(ImageSymbol);
+  header.memoryOffset = (sizeof(header) + symbolsSize + names.size() +
+                         IMAGE_MEMORY_ALIGNMENT - 1) & ~(IMAGE_MEMORY_ALIGNMENT - 1);
+  // Write a temporary file and rename it into place.
+  if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+    throw Exception("could not create image cache " + directory + ": " + std::strerror(errno));
+  }
+  auto path = getPath(hash, memory);
+  auto temporary = fmt::format("{}.{}.tmp", path, getpid());
+  int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    throw Exception("could not create " + temporary + ": " + std::strerror(errno));
+  }
+  bool written = pwrite(fd, &header, sizeof(header), 0) == sizeof(header) &&
+                 pwrite(fd, symbols.data(), symbolsSize, sizeof(header)) ==
+                   static_cast<ssize_t>(symbolsSize) &&
+                 pwrite(fd, names.data(), names.size(), sizeof(header) + symbolsSize) ==
+                   static_cast<ssize_t>(names.size()) &&
+                 writeMemoryImage(fd, header.memoryOffset, memory);
+  bool closed = close(fd) == 0;
+  if (!written || !closed || std::rename(temporary.c_str(), path.c_str()) != 0) {
+    auto error = errno;
+    unlink(temporary.c_str());
+    throw Exception("could not write " + path + ": " + std::strerror(error));
+  }
+}
+
+} // End namespace rvsim
@@ -0,0 +1,204 @@
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+
+#include <fmt/core.h>
+
+#include "rvsim/Exception.hpp"
+#include "rvsim/IntervalStats.hpp"
+
+namespace rvsim {
+
+// The size of output to gather before writing it.
+const size_t STATS_BUFFER_SIZE = 1 << 16;
+
+static const char *counterNames[] = {
+  "mix", "memory", "branches", "syscalls", "pages", "function"
+};
+
+static const char *mixNames[] = {
+  "alu", "load", "store", "branch", "jump", "system"
+};
+
+unsigned parseStatsCounters(const std::string &list) {
+  unsigned counters = 0;
+  size_t start = 0;
+  while (start <= list.size()) {
+    auto end = std::min(list.find(',', start), list.size());
+    auto name = list.substr(start, end - start);
+    unsigned index = 0;
+    while (index < std::size(counterNames) && name != counterNames[index]) {
+      index++;
+    }
+    if (name == "all") {
+      counters |= STATS_ALL;
+    } else if (index < std::size(counterNames)) {
+      counters |= 1U << index;
+    } else {
+      throw Exception(fmt::format("unknown statistics counter group {}", name));
+    }
+    start = end + 1;
+  }
+  return counters;
+}
+
+IntervalStats::IntervalStats(const std::string &filename, bool json, unsigned counters,
+                             uint64_t interval, const HartState &state)
+    : file(stderr), json(json), counters(counters),
+      hooks(HOOK_RETIRE | HOOK_EXIT | HOOK_CONTROL),
+      interval(interval), retired(0), intervalStart(0), intervalCount(0),
+      intervalStartCycle(state.cycleCount), mix{}, bytesLoaded(0), bytesStored(0),
+      branches(0), taken(0), syscalls(0), lastPage(UINT32_MAX), mainAddress(0) {
+  if (interval == 0) {
+    throw Exception("statistics interval must be non zero");
+  }
+  if (!filename.empty()) {
+    file = std::fopen(filename.c_str(), "w");
+    if (file == nullptr) {
+      throw Exception("could not open statistics file " + filename + ": " +
+                      std::strerror(errno));
+    }
+  }
+  if (counters & (STATS_MEMORY | STATS_PAGES)) {
+    hooks |= HOOK_MEMORY;
+  }
+  if (counters & STATS_SYSCALLS) {
+    hooks |= HOOK_SYSCALL;
+  }
+  if (auto *main = state.symbolInfo.getSymbol("main")) {
+    mainAddress = main->value;
+  }
+  if (!json) {
+    buffer += "interval,cycle,instructions";
+    if (counters & STATS_MIX) {
+      for (auto *name : mixNames) {
+        fmt::format_to(std::back_inserter(buffer), ",{}", name);
+      }
+    }
+    if (counters & STATS_MEMORY) {
+      buffer += ",bytes_loaded,bytes_stored";
+    }
+    if (counters & STATS_BRANCHES) {
+      buffer += ",branches,taken";
+    }
+    if (counters & STATS_SYSCALLS) {
+      buffer += ",syscalls";
+    }
+    if (counters & STATS_PAGES) {
+      buffer += ",pages";
+    }
+    if (counters & STATS_FUNCTION) {
+      buffer += ",function";
+    }
+    buffer += '\n';
+  }
+}
+
+IntervalStats::~IntervalStats() {
+  std::fwrite(buffer.data(), 1, buffer.size(), file);
+  if (file != stderr) {
+    std::fclose(file);
+  }
+}
+
+std::string IntervalStats::getTopLevelFunction(const HartState &state) const {
+  uint32_t address = 0;
+  if (frames.empty()) {
+    address = state.pc;
+  } else {
+    address = frames.front().function;
+    for (size_t i = 0; i < frames.size(); i++) {
+      if (frames[i].function == mainAddress) {
+        address = i + 1 < frames.size() ? frames[i + 1].function : mainAddress;
+        break;
+      }
+    }
+  }
+  auto *symbol = state.symbolInfo.getSymbol(address);
+  return symbol ? symbol->name : fmt::format("{:#x}", address);
+}
+
+/// Write the counters of the interval that has just ended, and reset them.
+void IntervalStats::snapshot(const HartState &state) {
+  auto out = std::back_inserter(buffer);
+  auto instructions = retired - intervalStart;
+  if (json) {
+    fmt::format_to(out, "{{\"interval\":{},\"cycle\":{},\"instructions\":{}",
+                   intervalCount, intervalStartCycle, instructions);
+    if (counters & STATS_MIX) {
+      for (size_t i = 0; i < mix.size(); i++) {
+        fmt::format_to(out, ",\"{}\":{}", mixNames[i], mix[i]);
+      }
+    }
+    if (counters & STATS_MEMORY) {
+      fmt::format_to(out, ",\"bytes_loaded\":{},\"bytes_stored\":{}", bytesLoaded, bytesStored);
+    }
+    if (counters & STATS_BRANCHES) {
+      fmt::format_to(out, ",\"branches\":{},\"taken\":{}", branches, taken);
+    }
+    if (counters & STATS_SYSCALLS) {
+      fmt::format_to(out, ",\"syscalls\":{}", syscalls);
+    }
+    if (counters & STATS_PAGES) {
+      fmt::format_to(out, ",\"pages\":{}", pages.size());
+    }
+    if (counters & STATS_FUNCTION) {
+      fmt::format_to(out, ",\"function\":\"{}\"", getTopLevelFunction(state));
+    }
+    buffer += "}\n";
+  } else {
+    fmt::format_to(out, "{},{},{}", intervalCount, intervalStartCycle, instructions);
+    if (counters & STATS_MIX) {
+      for (auto count : mix) {
+        fmt::format_to(out, ",{}", count);
+      }
+    }
+    if (counters & STATS_MEMORY) {
+      fmt::format_to(out, ",{},{}", bytesLoaded, bytesStored);
+    }
+    if (counters & STATS_BRANCHES) {
+      fmt::format_to(out, ",{},{}", branches, taken);
+    }
+    if (counters & STATS_SYSCALLS) {
+      fmt::format_to(out, ",{}", syscalls);
+    }
+    if (counters & STATS_PAGES) {
+      fmt::format_to(out, ",{}", pages.size());
+    }
+    if (counters & STATS_FUNCTION) {
+      fmt::format_to(out, ",{}", getTopLevelFunction(state));
+    }
+    buffer += '\n';
+  }
+  if (buffer.size() >= STATS_BUFFER_SIZE) {
+    std::fwrite(buffer.data(), 1, buffer.size(), file);
+    buffer.clear();
+  }
+  intervalCount++;
+  resetCounters(state);
+}
+
+/// Begin a new interval.
+void IntervalStats::resetCounters(const HartState &state) {
+  intervalStartCycle = state.cycleCount;
+  intervalStart = retired;
+  mix.fill(0);
+  bytesLoaded = 0;
+  bytesStored = 0;
+  branches = 0;
+  taken = 0;
+  syscalls = 0;
+  pages.clear();
+  lastPage = UINT32_MAX;
+}
+
+void IntervalStats::finish(const HartState &state) {
+  if (retired != intervalStart) {
+    snapshot(state);
+  }
+  std::fwrite(buffer.data(), 1, buffer.size(), file);
+  buffer.clear();
+  std::fflush(file);
+}
+
+} // End namespace rvsim
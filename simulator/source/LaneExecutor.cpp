@@ -0,0 +1,500 @@
+#include "rvsim/Exception.hpp"
+#include "rvsim/LaneExecutor.hpp"
+
+namespace rvsim {
+
+LaneExecutor::LaneExecutor(Executor &executor, size_t count)
+  : source(executor), image(executor.memory), count(count),
+    width((count + LANE_BLOCK - 1) / LANE_BLOCK * LANE_BLOCK),
+    numPages((image.sizeInBytes() + PAGE_SIZE - 1) / PAGE_SIZE),
+    registers(NUM_REGISTERS * width, 0), pcs(count, executor.state.pc),
+    cycles(count, executor.state.cycleCount), statuses(count, executor.status),
+    exitCodes(count, executor.exitCode), scalars(count), pages(count * numPages),
+    written(numPages, 0), mask(width, 0), taken(width, 0), targets(width, 0),
+    groupSteps(0) {
+  if (!executor.bus.empty()) {
+    throw Exception("Lanes cannot be created with devices attached");
+  }
+  if (executor.paging()) {
+    throw Exception("Lanes cannot be created while paging");
+  }
+  for (unsigned index = 1; index < NUM_REGISTERS; index++) {
+    std::fill_n(&registers[index * width], count, executor.state.registers[index]);
+  }
+  for (size_t lane = 0; lane < count; lane++) {
+    for (size_t page = 0; page < numPages; page++) {
+      pages[lane * numPages + page] = imagePage(page);
+    }
+  }
+}
+
+LaneExecutor::~LaneExecutor() = default;
+
+uint32_t LaneExecutor::readReg(size_t lane, unsigned index) const {
+  if (scalars[lane]) {
+    return scalars[lane]->state.readReg(index);
+  }
+  return registers[index * width + lane];
+}
+
+void LaneExecutor::writeReg(size_t lane, unsigned index, uint32_t value) {
+  if (scalars[lane]) {
+    scalars[lane]->state.writeReg(index, value);
+  } else if (index != 0) {
+    registers[index * width + lane] = value;
+  }
+}
+
+uint32_t LaneExecutor::getPc(size_t lane) const {
+  return scalars[lane] ? scalars[lane]->state.pc : pcs[lane];
+}
+
+uint64_t LaneExecutor::getCycleCount(size_t lane) const {
+  return scalars[lane] ? scalars[lane]->state.cycleCount : cycles[lane];
+}
+
+Status LaneExecutor::getStatus(size_t lane) const {
+  return scalars[lane] ? scalars[lane]->executor.status : statuses[lane];
+}
+
+uint32_t LaneExecutor::getExitCode(size_t lane) const {
+  return scalars[lane] ? scalars[lane]->executor.exitCode : exitCodes[lane];
+}
+
+/// Return a host pointer to an address in a lane's memory, copying the page
+/// from the image first if it is to be written. The address must lie within
+/// memory, and the access must not cross a page.
+uint8_t *LaneExecutor::lanePtr(size_t lane, uint32_t address, bool write) {
+  auto offset = address - image.baseAddress;
+  auto page = offset >> PAGE_SHIFT;
+  auto *&host = pages[lane * numPages + page];
+  if (write && host == imagePage(page)) {
+    copies.push_back(std::make_unique<uint8_t[]>(PAGE_SIZE));
+    std::memcpy(copies.back().get(), host, pageLength(page));
+    host = copies.back().get();
+    written[page] = 1;
+  }
+  return host + (offset & (PAGE_SIZE - 1));
+}
+
+void LaneExecutor::readMemory(size_t lane, uint32_t address, void *data, size_t length) {
+  if (!image.contains(address, length)) {
+    throw Exception("Lane memory access out of range");
+  }
+  if (scalars[lane]) {
+    scalars[lane]->memory.read(address, static_cast<uint8_t*>(data), length);
+    return;
+  }
+  auto *bytes = static_cast<uint8_t*>(data);
+  while (length > 0) {
+    auto offset = address - image.baseAddress;
+    auto chunk = std::min<size_t>(length, PAGE_SIZE - (offset & (PAGE_SIZE - 1)));
+    std::memcpy(bytes, lanePtr(lane, address, false), chunk);
+    address += chunk;
+    bytes += chunk;
+    length -= chunk;
+  }
+}
+
+void LaneExecutor::writeMemory(size_t lane, uint32_t address, const void *data,
+                               size_t length) {
+  if (!image.contains(address, length)) {
+    throw Exception("Lane memory access out of range");
+  }
+  auto *bytes = static_cast<const uint8_t*>(data);
+  if (scalars[lane]) {
+    scalars[lane]->memory.write(address, length, const_cast<uint8_t*>(bytes));
+    return;
+  }
+  while (length > 0) {
+    auto offset = address - image.baseAddress;
+    auto chunk = std::min<size_t>(length, PAGE_SIZE - (offset & (PAGE_SIZE - 1)));
+    std::memcpy(lanePtr(lane, address, true), bytes, chunk);
+    address += chunk;
+    bytes += chunk;
+    length -= chunk;
+  }
+}
+
+/// Remove a lane from the group before it executes the instruction at a PC,
+/// after the steps the group has taken so far, and give it an executor of
+/// its own with a copy of its state and memory.
+void LaneExecutor::leave(size_t lane, uint32_t pc, uint64_t steps) {
+  mask[lane] = 0;
+  auto scalar = std::make_unique<ScalarLane>(source.state, image.baseAddress,
+                                             image.sizeInBytes());
+  for (unsigned index = 0; index < NUM_REGISTERS; index++) {
+    scalar->state.registers[index] = registers[index * width + lane];
+  }
+  scalar->state.pc = pc;
+  scalar->state.cycleCount = cycles[lane] + steps;
+  for (size_t page = 0; page < numPages; page++) {
+    std::memcpy(scalar->memory.data() + page * PAGE_SIZE, pages[lane * numPages + page],
+                pageLength(page));
+  }
+  auto &executor = scalar->executor;
+  executor.setHTIFAddresses(source.toHostAddress, source.fromHostAddress);
+  executor.initialBreak = source.initialBreak;
+  executor.programBreak = source.programBreak;
+  executor.fusion = source.fusion;
+  executor.idleSkip = source.idleSkip;
+  scalars[lane] = std::move(scalar);
+}
+
+void LaneExecutor::updateMembers() {
+  std::erase_if(members, [this](uint32_t lane) { return mask[lane] == 0; });
+}
+
+/// Make the group of the running lanes at the lowest PC, returning false if
+/// none remain. The group may step until it reaches the next PC at which a
+/// lane waits, and for as many steps as its lane nearest the cycle limit
+/// may take.
+bool LaneExecutor::formGroup(uint64_t cycleLimit, uint32_t &pc, uint64_t &nextPc,
+                             uint64_t &budget) {
+  uint64_t lowest = UINT64_MAX;
+  for (size_t lane = 0; lane < count; lane++) {
+    if (isActive(lane, cycleLimit)) {
+      lowest = std::min<uint64_t>(lowest, pcs[lane]);
+    }
+  }
+  if (lowest == UINT64_MAX) {
+    return false;
+  }
+  members.clear();
+  nextPc = UINT64_MAX;
+  uint64_t most = 0;
+  for (size_t lane = 0; lane < count; lane++) {
+    if (!isActive(lane, cycleLimit)) {
+      mask[lane] = 0;
+    } else if (pcs[lane] == lowest) {
+      mask[lane] = ~0U;
+      members.push_back(lane);
+      most = std::max(most, cycles[lane]);
+    } else {
+      mask[lane] = 0;
+      nextPc = std::min<uint64_t>(nextPc, pcs[lane]);
+    }
+  }
+  pc = lowest;
+  budget = cycleLimit - most;
+  return true;
+}
+
+bool LaneExecutor::load(Operation op, uint32_t instruction, uint32_t pc, uint64_t steps) {
+  InstructionIType fields(instruction);
+  auto *base = row(fields.rs1);
+  auto offset = signExtend<12>(fields.imm);
+  auto flags = getSpec(op).flags;
+  unsigned size = (flags & SIZE_1) ? 1 : (flags & SIZE_2) ? 2 : 4;
+  bool left = false;
+  for (auto lane : members) {
+    auto address = base[lane] + offset;
+    if ((address & (size - 1)) || !image.contains(address, size)) {
+      leave(lane, pc, steps);
+      left = true;
+      continue;
+    }
+    auto *host = lanePtr(lane, address, false);
+    uint32_t value = 0;
+    std::memcpy(&value, host, size);
+    switch (op) {
+      case Operation::LB: value = signExtend<8>(value); break;
+      case Operation::LH: value = signExtend<16>(value); break;
+      default: break;
+    }
+    if (fields.rd != 0) {
+      registers[fields.rd * width + lane] = value;
+    }
+  }
+  return left;
+}
+
+/// Perform a store to the tohost word, returning false if it would issue an
+/// HTIF command other than exit, which the lane leaves the group to make.
+bool LaneExecutor::storeToHost(size_t lane, uint32_t address, const uint8_t *data,
+                               unsigned size) {
+  auto toHost = source.toHostAddress;
+  if (!image.contains(toHost, sizeof(uint64_t))) {
+    return false;
+  }
+  uint64_t command;
+  readMemory(lane, toHost, &command, sizeof(command));
+  std::memcpy(reinterpret_cast<uint8_t*>(&command) + (address - toHost), data, size);
+  uint64_t args[2] = {};
+  if (command != 0) {
+    if (command > UINT32_MAX || !image.contains(command, 8 * sizeof(uint64_t))) {
+      return false;
+    }
+    readMemory(lane, command, args, sizeof(args));
+    if (args[0] != Syscall::EXIT) {
+      return false;
+    }
+  }
+  std::memcpy(lanePtr(lane, address, true), data, size);
+  if (command != 0) {
+    uint64_t clear = 0;
+    writeMemory(lane, toHost, &clear, sizeof(clear));
+    statuses[lane] = Status::EXITED;
+    exitCodes[lane] = static_cast<uint32_t>(args[1]);
+  }
+  return true;
+}
+
+bool LaneExecutor::store(Operation op, uint32_t instruction, uint32_t pc, uint64_t steps) {
+  InstructionSType fields(instruction);
+  auto *base = row(fields.rs1);
+  auto *values = row(fields.rs2);
+  auto offset = signExtend<12>(fields.imm);
+  auto flags = getSpec(op).flags;
+  unsigned size = (flags & SIZE_1) ? 1 : (flags & SIZE_2) ? 2 : 4;
+  bool changed = false;
+  for (auto lane : members) {
+    auto address = base[lane] + offset;
+    if ((address & (size - 1)) || !image.contains(address, size)) {
+      leave(lane, pc, steps);
+      changed = true;
+      continue;
+    }
+    uint8_t data[4];
+    std::memcpy(data, &values[lane], size);
+    if ((address & ~0x7U) != source.toHostAddress) {
+      std::memcpy(lanePtr(lane, address, true), data, size);
+    } else if (!storeToHost(lane, address, data, size)) {
+      leave(lane, pc, steps);
+      changed = true;
+    } else if (statuses[lane] != Status::RUNNING) {
+      // The lane has exited, which retires the store.
+      mask[lane] = 0;
+      pcs[lane] = pc + 4;
+      cycles[lane] += steps + 1;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// ALU instructions are performed for every lane of the group at once.
+#define LANE_UTYPE(mnemonic, expression) \
+  case Operation::mnemonic: { \
+    InstructionUType fields(instruction); \
+    uint32_t value = expression; \
+    compute(fields.rd, [=](size_t) { return value; }); \
+    break; \
+  }
+
+#define LANE_ITYPE(mnemonic, expression) \
+  case Operation::mnemonic: { \
+    InstructionIType fields(instruction); \
+    auto *a = row(fields.rs1); \
+    auto imm = signExtend<12>(fields.imm); \
+    compute(fields.rd, [=](size_t l) { return static_cast<uint32_t>(expression); }); \
+    break; \
+  }
+
+#define LANE_ISHAMT(mnemonic, expression) \
+  case Operation::mnemonic: { \
+    InstructionIShamtType fields(instruction); \
+    auto *a = row(fields.rs1); \
+    auto shamt = fields.shamt; \
+    compute(fields.rd, [=](size_t l) { return static_cast<uint32_t>(expression); }); \
+    break; \
+  }
+
+#define LANE_RTYPE(mnemonic, expression) \
+  case Operation::mnemonic: { \
+    InstructionRType fields(instruction); \
+    auto *a = row(fields.rs1); \
+    auto *b = row(fields.rs2); \
+    compute(fields.rd, [=](size_t l) { return static_cast<uint32_t>(expression); }); \
+    break; \
+  }
+
+// A branch either moves the whole group or splits it between the target
+// and the next instruction.
+#define LANE_BRANCH(mnemonic, condition) \
+  case Operation::mnemonic: { \
+    InstructionBType fields(instruction); \
+    auto *a = row(fields.rs1); \
+    auto *b = row(fields.rs2); \
+    auto target = pc + signExtend<13>(fields.imm); \
+    auto count = evaluate([=](size_t l) { return condition; }); \
+    if (count == 0) { \
+      next = pc + 4; \
+    } else if (count == members.size() && !(target & 0x3)) { \
+      next = target; \
+    } else { \
+      for (auto lane : members) { \
+        if (!taken[lane]) { \
+          targets[lane] = pc + 4; \
+        } else if (target & 0x3) { \
+          leave(lane, pc, steps); \
+        } else { \
+          targets[lane] = target; \
+        } \
+      } \
+      updateMembers(); \
+      diverged = true; \
+    } \
+    break; \
+  }
+
+void LaneExecutor::stepGroup(uint32_t pc, uint64_t nextPc, uint64_t budget) {
+  uint64_t steps = 0;
+  while (steps < budget && pc < nextPc && !members.empty()) {
+    auto offset = pc - image.baseAddress;
+    if ((pc & 0x3) || !image.contains(pc, 4)) {
+      for (auto lane : members) {
+        leave(lane, pc, steps);
+      }
+      members.clear();
+      return;
+    }
+    uint32_t instruction;
+    std::memcpy(&instruction, imagePage(offset >> PAGE_SHIFT) + (offset & (PAGE_SIZE - 1)),
+                sizeof(instruction));
+    if (written[offset >> PAGE_SHIFT]) {
+      // The lanes that have changed the instruction leave the group.
+      for (auto lane : members) {
+        uint32_t own;
+        std::memcpy(&own, lanePtr(lane, pc, false), sizeof(own));
+        if (own != instruction) {
+          leave(lane, pc, steps);
+        }
+      }
+      updateMembers();
+      if (members.empty()) {
+        return;
+      }
+    }
+    auto op = decode(instruction);
+    uint32_t next = pc + 4;
+    bool diverged = false;
+    switch (op) {
+      LANE_UTYPE(LUI, fields.imm << 12)
+      LANE_UTYPE(AUIPC, pc + (fields.imm << 12))
+      case Operation::JAL: {
+        InstructionJType fields(instruction);
+        next = pc + signExtend<21>(fields.imm);
+        if (next & 0x3) {
+          for (auto lane : members) {
+            leave(lane, pc, steps);
+          }
+          members.clear();
+          return;
+        }
+        auto link = pc + 4;
+        compute(fields.rd, [=](size_t) { return link; });
+        break;
+      }
+      case Operation::JALR: {
+        InstructionIType fields(instruction);
+        auto *a = row(fields.rs1);
+        auto imm = signExtend<12>(fields.imm);
+        for (auto lane : members) {
+          targets[lane] = (a[lane] + imm) & ~1U;
+          if (targets[lane] & 0x3) {
+            leave(lane, pc, steps);
+          }
+        }
+        updateMembers();
+        if (members.empty()) {
+          return;
+        }
+        auto link = pc + 4;
+        compute(fields.rd, [=](size_t) { return link; });
+        next = targets[members[0]];
+        diverged = std::any_of(members.begin(), members.end(),
+                               [&](uint32_t lane) { return targets[lane] != next; });
+        break;
+      }
+      LANE_BRANCH(BEQ,  a[l] == b[l])
+      LANE_BRANCH(BNE,  a[l] != b[l])
+      LANE_BRANCH(BLT,  static_cast<int32_t>(a[l]) < static_cast<int32_t>(b[l]))
+      LANE_BRANCH(BGE,  static_cast<int32_t>(a[l]) >= static_cast<int32_t>(b[l]))
+      LANE_BRANCH(BLTU, a[l] < b[l])
+      LANE_BRANCH(BGEU, a[l] >= b[l])
+      case Operation::LB:
+      case Operation::LH:
+      case Operation::LW:
+      case Operation::LBU:
+      case Operation::LHU:
+        if (load(op, instruction, pc, steps)) {
+          updateMembers();
+        }
+        break;
+      case Operation::SB:
+      case Operation::SH:
+      case Operation::SW:
+        if (store(op, instruction, pc, steps)) {
+          updateMembers();
+        }
+        break;
+      LANE_ITYPE(ADDI,  a[l] + imm)
+      LANE_ITYPE(SLTI,  static_cast<int32_t>(a[l]) < static_cast<int32_t>(imm))
+      LANE_ITYPE(SLTIU, a[l] < imm)
+      LANE_ITYPE(XORI,  a[l] ^ imm)
+      LANE_ITYPE(ORI,   a[l] | imm)
+      LANE_ITYPE(ANDI,  a[l] & imm)
+      LANE_ISHAMT(SLLI, a[l] << shamt)
+      LANE_ISHAMT(SRLI, a[l] >> shamt)
+      LANE_ISHAMT(SRAI, static_cast<int32_t>(a[l]) >> shamt)
+      LANE_RTYPE(ADD,  a[l] + b[l])
+      LANE_RTYPE(SUB,  a[l] - b[l])
+      LANE_RTYPE(SLL,  a[l] << (b[l] & 0x1F))
+      LANE_RTYPE(SLT,  static_cast<int32_t>(a[l]) < static_cast<int32_t>(b[l]))
+      LANE_RTYPE(SLTU, a[l] < b[l])
+      LANE_RTYPE(XOR,  a[l] ^ b[l])
+      LANE_RTYPE(SRL,  a[l] >> (b[l] & 0x1F))
+      LANE_RTYPE(SRA,  static_cast<int32_t>(a[l]) >> (b[l] & 0x1F))
+      LANE_RTYPE(OR,   a[l] | b[l])
+      LANE_RTYPE(AND,  a[l] & b[l])
+      case Operation::FENCE:
+        break;
+      default:
+        // System instructions, fence.i and illegal instructions are
+        // executed by each lane on its own.
+        for (auto lane : members) {
+          leave(lane, pc, steps);
+        }
+        members.clear();
+        return;
+    }
+    steps++;
+    groupSteps++;
+    if (diverged) {
+      for (auto lane : members) {
+        pcs[lane] = targets[lane];
+        cycles[lane] += steps;
+      }
+      members.clear();
+      return;
+    }
+    pc = next;
+  }
+  for (auto lane : members) {
+    pcs[lane] = pc;
+    cycles[lane] += steps;
+  }
+  members.clear();
+}
+
+void LaneExecutor::run(uint64_t cycleLimit) {
+  uint32_t pc;
+  uint64_t nextPc;
+  uint64_t budget;
+  while (formGroup(cycleLimit, pc, nextPc, budget)) {
+    stepGroup(pc, nextPc, budget);
+  }
+  for (auto &scalar : scalars) {
+    if (!scalar) {
+      continue;
+    }
+    auto &executor = scalar->executor;
+    executor.cycleLimit = cycleLimit;
+    while (executor.status == Status::RUNNING && scalar->state.cycleCount < cycleLimit) {
+      executor.step<false>();
+    }
+  }
+}
+
+} // End namespace rvsim
@@ -0,0 +1,82 @@
+#include "rvsim/Mmu.hpp"
+
+namespace rvsim {
+
+/// Return the accesses that a leaf page table entry permits, in S-mode and
+/// in U-mode. A page can only be written once it is dirty, so that the
+/// first store to it walks the page table to set the D bit.
+static uint32_t getPermissions(uint32_t pte, uint32_t mstatus) {
+  bool readable = (pte & PTE_R) || ((mstatus & MSTATUS_MXR) && (pte & PTE_X));
+  uint32_t permissions = (readable ? Tlb::PERMIT_READ : 0) |
+                         ((pte & PTE_W) && (pte & PTE_D) ? Tlb::PERMIT_WRITE : 0) |
+                         ((pte & PTE_X) ? Tlb::PERMIT_EXECUTE : 0);
+  if (!(pte & PTE_U)) {
+    return permissions;
+  }
+  // S-mode may only read and write user pages with SUM set, and never
+  // executes them.
+  auto supervisor = (mstatus & MSTATUS_SUM) ? permissions & ~Tlb::PERMIT_EXECUTE : 0;
+  return (permissions << Tlb::USER_PERMISSIONS) | supervisor;
+}
+
+Trap Mmu::walk(uint32_t address, AccessType type, Privilege privilege, Tlb::Entry &entry,
+               bool update) {
+  auto pageFault = type == AccessType::FETCH ? Trap::INSTRUCTION_PAGE_FAULT
+                 : type == AccessType::LOAD  ? Trap::LOAD_PAGE_FAULT
+                                             : Trap::STORE_PAGE_FAULT;
+  auto accessFault = type == AccessType::FETCH ? Trap::INSTRUCTION_ACCESS_FAULT
+                   : type == AccessType::LOAD  ? Trap::LOAD_ACCESS_FAULT
+                                               : Trap::STORE_ACCESS_FAULT;
+  uint32_t vpn[2] = {(address >> PAGE_SHIFT) & 0x3FF, address >> 22};
+  // Physical addresses are 34 bits, of which only the low 32 can be in
+  // memory.
+  uint64_t table = static_cast<uint64_t>(state.satp & SATP_PPN) << PAGE_SHIFT;
+  uint32_t pteAddress = 0;
+  uint32_t pte = 0;
+  int level = 1;
+  for (;; level--) {
+    uint64_t pteAddress64 = table + vpn[level] * 4;
+    pteAddress = static_cast<uint32_t>(pteAddress64);
+    if (pteAddress64 > UINT32_MAX || !memory.contains(pteAddress, 4)) {
+      return accessFault;
+    }
+    pte = memory.readMemoryWord(pteAddress);
+    if (!(pte & PTE_V) || ((pte & PTE_W) && !(pte & PTE_R))) {
+      return pageFault;
+    }
+    if (pte & (PTE_R | PTE_X)) {
+      break;
+    }
+    if (level == 0) {
+      return pageFault;
+    }
+    table = static_cast<uint64_t>(pte >> PTE_PPN_SHIFT) << PAGE_SHIFT;
+  }
+  auto ppn = pte >> PTE_PPN_SHIFT;
+  // A megapage must be aligned to its size.
+  if (level == 1 && (ppn & 0x3FF)) {
+    return pageFault;
+  }
+  auto updated = pte | PTE_A | (type == AccessType::STORE ? PTE_D : 0);
+  auto permissions = getPermissions(updated, state.mstatus);
+  if (!(permissions & Tlb::required(type, privilege))) {
+    return pageFault;
+  }
+  uint64_t physicalPage = static_cast<uint64_t>(level == 1 ? ppn | vpn[0] : ppn) << PAGE_SHIFT;
+  if (physicalPage > UINT32_MAX) {
+    return accessFault;
+  }
+  if (update) {
+    walks++;
+    if (updated != pte) {
+      memory.writeMemoryWord(pteAddress, updated);
+    }
+  }
+  entry.vpn = address >> PAGE_SHIFT;
+  entry.permissions = permissions;
+  entry.physicalPage = static_cast<uint32_t>(physicalPage);
+  entry.host = memory.hostPtr(entry.physicalPage, PAGE_SIZE);
+  return Trap::NONE;
+}
+
+} // End namespace rvsim
@@ -0,0 +1,55 @@
+#include <dlfcn.h>
+
+#include <fmt/core.h>
+
+#include "rvsim/Exception.hpp"
+#include "rvsim/Plugin.hpp"
+
+namespace rvsim {
+
+PluginSet::~PluginSet() {
+  // The plugins must be destroyed before their code is unloaded.
+  plugins.clear();
+  for (auto *library : libraries) {
+    dlclose(library);
+  }
+}
+
+void PluginSet::add(std::unique_ptr<Plugin> plugin) {
+  auto hooks = plugin->hooks();
+  std::pair<unsigned, std::vector<Plugin*>*> subscribers[] = {
+    {HOOK_RETIRE,  &retirePlugins},
+    {HOOK_MEMORY,  &memoryPlugins},
+    {HOOK_BRANCH,  &branchPlugins},
+    {HOOK_SYSCALL, &syscallPlugins},
+    {HOOK_EXIT,    &exitPlugins},
+    {HOOK_CONTROL, &controlPlugins}
+  };
+  for (auto &subscriber : subscribers) {
+    if (hooks & subscriber.first) {
+      subscriber.second->push_back(plugin.get());
+    }
+  }
+  mask |= hooks;
+  plugins.push_back(std::move(plugin));
+}
+
+void PluginSet::load(const std::string &path, const std::string &args) {
+  auto *library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (library == nullptr) {
+    throw Exception(fmt::format("could not load plugin {}: {}", path, dlerror()));
+  }
+  libraries.push_back(library);
+  auto version = reinterpret_cast<unsigned (*)()>(dlsym(library, "rvsimPluginApiVersion"));
+  auto create = reinterpret_cast<Plugin *(*)(const char*)>(dlsym(library, "rvsimCreatePlugin"));
+  if (version == nullptr || create == nullptr) {
+    throw Exception(fmt::format("{} is not an rvsim plugin", path));
+  }
+  if (version() != PLUGIN_API_VERSION) {
+    throw Exception(fmt::format("plugin {} was built for interface version {}, not {}",
+                                path, version(), PLUGIN_API_VERSION));
+  }
+  add(std::unique_ptr<Plugin>(create(args.c_str())));
+}
+
+} // End namespace rvsim
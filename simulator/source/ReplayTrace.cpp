@@ -0,0 +1,104 @@
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rvsim/Exception.hpp"
+#include "rvsim/ReplayTrace.hpp"
+
+namespace rvsim {
+
+const char REPLAY_TRACE_MAGIC[8] = {'R', 'V', 'S', 'I', 'M', 'T', 'R', 'C'};
+const uint32_t REPLAY_TRACE_VERSION = 1;
+
+// The number of records gathered before writing them.
+const size_t REPLAY_BUFFER_RECORDS = 1 << 16;
+
+/// The header of a trace file, which is followed by the records.
+struct ReplayTraceHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize;
+  uint64_t recordCount;
+  uint64_t reserved;
+};
+
+TraceRecorder::TraceRecorder(const std::string &filename)
+    : filename(filename), recordCount(0) {
+  fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    throw Exception("could not create trace " + filename + ": " + std::strerror(errno));
+  }
+  records.reserve(REPLAY_BUFFER_RECORDS);
+  // The header is written with the count of records when the trace ends.
+  if (lseek(fd, sizeof(ReplayTraceHeader), SEEK_SET) < 0) {
+    close(fd);
+    throw Exception("could not write trace " + filename + ": " + std::strerror(errno));
+  }
+}
+
+TraceRecorder::~TraceRecorder() {
+  close(fd);
+}
+
+void TraceRecorder::flush() {
+  auto size = records.size() * sizeof(ReplayRecord);
+  if (write(fd, records.data(), size) != static_cast<ssize_t>(size)) {
+    throw Exception("could not write trace " + filename + ": " + std::strerror(errno));
+  }
+  recordCount += records.size();
+  records.clear();
+}
+
+void TraceRecorder::finish() {
+  flush();
+  ReplayTraceHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, REPLAY_TRACE_MAGIC, sizeof(REPLAY_TRACE_MAGIC));
+  header.version = REPLAY_TRACE_VERSION;
+  header.recordSize = sizeof(ReplayRecord);
+  header.recordCount = recordCount;
+  if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+    throw Exception("could not write trace " + filename + ": " + std::strerror(errno));
+  }
+}
+
+ReplayTrace::ReplayTrace(const std::string &filename)
+    : mapping(MAP_FAILED), mappingSize(0), records(nullptr), count(0) {
+  int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw Exception("could not open trace " + filename + ": " + std::strerror(errno));
+  }
+  ReplayTraceHeader header;
+  struct stat status;
+  bool valid = pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+               std::memcmp(header.magic, REPLAY_TRACE_MAGIC, sizeof(REPLAY_TRACE_MAGIC)) == 0 &&
+               header.version == REPLAY_TRACE_VERSION &&
+               header.recordSize == sizeof(ReplayRecord) &&
+               fstat(fd, &status) == 0 &&
+               static_cast<uint64_t>(status.st_size) >=
+                 sizeof(header) + header.recordCount * sizeof(ReplayRecord);
+  if (valid) {
+    mappingSize = sizeof(header) + header.recordCount * sizeof(ReplayRecord);
+    mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+    valid = mapping != MAP_FAILED;
+  }
+  close(fd);
+  if (!valid) {
+    throw Exception(filename + " is not a valid trace");
+  }
+  // The records are read once, in order.
+  madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+  records = reinterpret_cast<const ReplayRecord*>(
+      static_cast<const char*>(mapping) + sizeof(header));
+  count = header.recordCount;
+}
+
+ReplayTrace::~ReplayTrace() {
+  munmap(mapping, mappingSize);
+}
+
+} // End namespace rvsim
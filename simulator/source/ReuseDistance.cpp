@@ -0,0 +1,222 @@
+#include <algorithm>
+
+#include <fmt/core.h>
+
+#include "rvsim/Exception.hpp"
+#include "rvsim/ReuseDistance.hpp"
+
+namespace rvsim {
+
+// The least number of positions in the tree of an LRU stack.
+const uint32_t MIN_STACK_POSITIONS = 1 << 16;
+
+LruStack::LruStack()
+    : tree(MIN_STACK_POSITIONS + 1, 0), time(0), lastLine(UINT32_MAX), windowStart(1),
+      windowLines(0) {}
+
+void LruStack::add(uint32_t position, int32_t delta) {
+  for (; position < tree.size(); position += position & -position) {
+    tree[position] += delta;
+  }
+}
+
+uint32_t LruStack::prefix(uint32_t position) const {
+  uint32_t sum = 0;
+  for (; position > 0; position -= position & -position) {
+    sum += tree[position];
+  }
+  return sum;
+}
+
+/// Renumber the last accesses of the lines from one, in order, leaving at
+/// least as many positions free as there are lines.
+void LruStack::compact() {
+  std::vector<uint32_t*> order;
+  order.reserve(positions.size());
+  for (auto &entry : positions) {
+    order.push_back(&entry.second);
+  }
+  std::sort(order.begin(), order.end(),
+            [](const uint32_t *a, const uint32_t *b) { return *a < *b; });
+  auto inWindow = std::lower_bound(order.begin(), order.end(), windowStart,
+                                   [](const uint32_t *a, uint32_t b) { return *a < b; });
+  windowStart = inWindow - order.begin() + 1;
+  for (size_t i = 0; i < order.size(); i++) {
+    *order[i] = i + 1;
+  }
+  time = order.size();
+  auto capacity = std::max<uint32_t>(MIN_STACK_POSITIONS, time * 2);
+  tree.assign(capacity + 1, 0);
+  for (uint32_t position = 1; position <= capacity; position++) {
+    tree[position] += position <= time;
+    auto parent = position + (position & -position);
+    if (parent <= capacity) {
+      tree[parent] += tree[position];
+    }
+  }
+}
+
+uint64_t LruStack::accessStack(uint32_t line) {
+  lastLine = line;
+  if (time + 1 == tree.size()) {
+    compact();
+  }
+  auto position = ++time;
+  auto inserted = positions.try_emplace(line, position);
+  uint64_t distance = COLD;
+  if (inserted.second) {
+    windowLines++;
+  } else {
+    // The lines accessed since are those marked after the last access.
+    auto last = inserted.first->second;
+    distance = positions.size() - prefix(last);
+    windowLines += last < windowStart;
+    add(last, -1);
+    inserted.first->second = position;
+  }
+  add(position, 1);
+  return distance;
+}
+
+uint64_t LruStack::startWindow() {
+  auto lines = windowLines;
+  windowStart = time + 1;
+  windowLines = 0;
+  lastLine = UINT32_MAX;
+  return lines;
+}
+
+ReuseDistance::ReuseDistance(const std::string &filename, const std::string &workingSetFilename,
+                             const std::string &lineSizes, uint64_t window,
+                             const HartState &state)
+    : file(filename), finished(false), window(0), retired(0), windowStart(0), windowCount(0),
+      windowStartCycle(state.cycleCount), function(0), functionStart(1), functionEnd(0) {
+  if (!file) {
+    throw Exception("could not open reuse distance file " + filename);
+  }
+  size_t start = 0;
+  while (start <= lineSizes.size()) {
+    auto end = std::min(lineSizes.find(',', start), lineSizes.size());
+    auto field = lineSizes.substr(start, end - start);
+    size_t size = 0;
+    try {
+      size = std::stoul(field, nullptr, 0);
+    } catch (std::exception &) {
+    }
+    if (size < 4 || (size & (size - 1)) != 0) {
+      throw Exception(fmt::format("invalid line size {}", field));
+    }
+    for (bool data : {false, true}) {
+      streams.push_back({data, static_cast<unsigned>(std::countr_zero(size)), LruStack(),
+                         Histogram{}, {}});
+    }
+    start = end + 1;
+  }
+  if (!workingSetFilename.empty()) {
+    if (window == 0) {
+      throw Exception("working set window must be non zero");
+    }
+    this->window = window;
+    workingSetFile.open(workingSetFilename);
+    if (!workingSetFile) {
+      throw Exception("could not open working set file " + workingSetFilename);
+    }
+    workingSetFile << "window,cycle,instructions";
+    for (auto &stream : streams) {
+      workingSetFile << fmt::format(",{}_lines_{}", stream.data ? "data" : "instruction",
+                                    1U << stream.lineShift);
+    }
+    workingSetFile << '\n';
+  }
+}
+
+/// Find the function containing an instruction, and the range of addresses
+/// that it covers.
+void ReuseDistance::enterFunction(const HartState &state, uint32_t pc) {
+  auto *symbol = state.symbolInfo.getSymbol(pc);
+  functionStart = symbol ? symbol->value : 0;
+  functionEnd = state.symbolInfo.getNextSymbolAddress(pc);
+  if (functionEnd == 0) {
+    functionEnd = UINT32_MAX;
+  }
+  auto inserted = functionIds.emplace(functionStart, functionNames.size());
+  if (inserted.second) {
+    functionNames.push_back(symbol ? symbol->name : "unknown");
+    for (auto &stream : streams) {
+      stream.functions.push_back(Histogram{});
+    }
+  }
+  function = inserted.first->second;
+}
+
+/// Write the working sets of the window that has just ended.
+void ReuseDistance::endWindow(const HartState &state) {
+  workingSetFile << fmt::format("{},{},{}", windowCount, windowStartCycle, retired - windowStart);
+  for (auto &stream : streams) {
+    workingSetFile << ',' << stream.stack.startWindow();
+  }
+  workingSetFile << '\n';
+  windowCount++;
+  windowStart = retired;
+  windowStartCycle = state.cycleCount;
+}
+
+/// Return the range of distances counted by a bucket.
+static std::string getBucketName(size_t bucket, size_t coldBucket) {
+  if (bucket == coldBucket) {
+    return "cold";
+  } else if (bucket <= 1) {
+    return std::to_string(bucket);
+  }
+  return fmt::format("{}-{}", 1ULL << (bucket - 1), (1ULL << bucket) - 1);
+}
+
+void ReuseDistance::writeHistograms() {
+  file << "kind,line_size,function,distance,count\n";
+  auto writeHistogram = [&](const Stream &stream, const std::string &name,
+                            const Histogram &histogram) {
+    for (size_t bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+      if (histogram[bucket] != 0) {
+        file << fmt::format("{},{},{},{},{}\n", stream.data ? "data" : "instruction",
+                            1U << stream.lineShift, name,
+                            getBucketName(bucket, NUM_BUCKETS - 1), histogram[bucket]);
+      }
+    }
+  };
+  for (auto &stream : streams) {
+    writeHistogram(stream, "all", stream.total);
+    for (size_t i = 0; i < functionNames.size(); i++) {
+      writeHistogram(stream, functionNames[i], stream.functions[i]);
+    }
+  }
+  file.flush();
+}
+
+void ReuseDistance::control(const HartState &state, Control request) {
+  if (request == Control::STATS_DUMP) {
+    if (window != 0 && retired != windowStart) {
+      endWindow(state);
+    }
+    workingSetFile.flush();
+    writeHistograms();
+  } else if (request == Control::STATS_RESET) {
+    for (auto &stream : streams) {
+      stream.total.fill(0);
+      std::fill(stream.functions.begin(), stream.functions.end(), Histogram{});
+    }
+  }
+}
+
+void ReuseDistance::finish(const HartState &state) {
+  if (finished) {
+    return;
+  }
+  finished = true;
+  if (window != 0 && retired != windowStart) {
+    endWindow(state);
+  }
+  workingSetFile.flush();
+  writeHistograms();
+}
+
+} // End namespace rvsim
@@ -0,0 +1,331 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+
+#include "gelf.h"
+#include "libelf.h"
+#include <fmt/core.h>
+
+#include "rvsim/Clint.hpp"
+#include "rvsim/Config.hpp"
+#include "rvsim/Exception.hpp"
+#include "rvsim/ImageCache.hpp"
+#include "rvsim/Simulator.hpp"
+#include "rvsim/Uart.hpp"
+
+#ifndef EM_RISCV
+#define EM_RISCV (243)
+#endif
+
+#define PRINT_INFO(x) \
+  if (rvsim::Config::getInstance().verbose) { \
+    std::cout << x; \
+  }
+
+namespace rvsim {
+
+/// Load an ELF image into memory, populate the symbol table and return the
+/// entry point address recorded in the ELF header.
+static uint32_t loadELF(std::vector<char> &image, const std::string &name,
+                        SymbolInfo &symbolInfo, Memory &memory) {
+
+  // Initialise the library.
+  if (elf_version(EV_CURRENT) == EV_NONE) {
+    throw Exception(fmt::format("ELF library initialisation failed: {}", elf_errmsg(-1)));
+  }
+
+  // Create an ELF data structure.
+  Elf *elf = elf_memory(image.data(), image.size());
+  if (elf == nullptr) {
+    throw Exception(fmt::format("reading ELF file data: {}", elf_errmsg(-1)));
+  }
+  // Release the ELF descriptor however the load ends.
+  std::unique_ptr<Elf, int (*)(Elf*)> elfOwner(elf, elf_end);
+  if (elf_kind(elf) != ELF_K_ELF) {
+    throw Exception(fmt::format("{} is not an ELF object", name));
+  }
+
+  // Obtain ELF header.
+  Elf32_Ehdr *header = elf32_getehdr(elf);
+  if (header == nullptr) {
+    throw Exception(fmt::format("reading ELF header failed: {}", elf_errmsg(-1)));
+  }
+
+  // Check ELF header information.
+  if (!(header->e_ident[EI_MAG0] == 0x7F &&
+        header->e_ident[EI_MAG1] == 'E' &&
+        header->e_ident[EI_MAG2] == 'L' &&
+        header->e_ident[EI_MAG3] == 'F')) {
+    throw Exception("Unexpected ELF header identifier");
+  }
+  if (header->e_ident[EI_CLASS] != ELFCLASS32) {
+    throw Exception("ELF file is not 32 bit");
+  }
+  if (header->e_ident[EI_DATA] != ELFDATA2LSB) {
+    throw Exception("ELF file is not little endian");
+  }
+  if (header->e_type != ET_EXEC) {
+    throw Exception("ELF file is not executable");
+  }
+  if (header->e_machine != EM_RISCV) {
+    throw Exception("ELF file is not for RISC-V");
+  }
+  if (header->e_version != 1) {
+    throw Exception("unexpected ELF version");
+  }
+
+  // Get the number of program headers.
+  size_t numProgramHeaders = header->e_phnum;
+  if (numProgramHeaders == 0) {
+    throw Exception("no ELF program headers");
+  }
+
+  // Load program data via the program headers.
+  for (size_t i = 0; i < numProgramHeaders; i++) {
+    GElf_Phdr programHeader;
+    if (gelf_getphdr(elf, i, &programHeader) == nullptr) {
+      throw Exception(fmt::format("reading program header {} failed: {}", i, elf_errmsg(-1)));
+    }
+    if (programHeader.p_type == PT_LOAD) {
+      if (programHeader.p_offset > image.size() ||
+          programHeader.p_filesz > image.size() - programHeader.p_offset) {
+        throw Exception("invalid ELF program offset");
+      }
+      if (!memory.contains(programHeader.p_paddr, programHeader.p_filesz)) {
+        throw Exception(fmt::format("data from ELF program header {} does not fit in memory", i));
+      }
+      std::memcpy(memory.hostPtr(programHeader.p_paddr, programHeader.p_filesz),
+                  image.data() + programHeader.p_offset, programHeader.p_filesz);
+      PRINT_INFO(fmt::format("Loaded {} bytes into memory\n", programHeader.p_filesz));
+    }
+  }
+
+  // Find the symbol table.
+  Elf_Scn *section = nullptr;
+  GElf_Shdr sectionHeader;
+  while ((section = elf_nextscn(elf, section)) != nullptr) {
+    gelf_getshdr(section, &sectionHeader);
+    if (sectionHeader.sh_type == SHT_SYMTAB) {
+      break;
+    }
+  }
+
+  // Read the symbol data.
+  Elf_Data *data = elf_getdata(section, nullptr);
+  if (data == nullptr) {
+    PRINT_INFO("No ELF symbol data\n");
+  } else {
+    size_t count = sectionHeader.sh_size / sectionHeader.sh_entsize;
+    for (size_t i = 0; i < count; i++) {
+      GElf_Sym symbol;
+      gelf_getsym(data, i, &symbol);
+      const char *name = elf_strptr(elf, sectionHeader.sh_link, symbol.st_name);
+      symbolInfo.addSymbol(name ? name : "", symbol.st_value, symbol.st_info, symbol.st_size);
+    }
+  }
+
+  return header->e_entry;
+}
+
+Simulator::Simulator(const SimulatorConfig &config)
+    : config(config), imageHash(0), consoleCaptured(false) {
+  build();
+}
+
+Simulator::~Simulator() = default;
+
+/// Create the system afresh from the configuration and load the program
+/// image into it, if there is one.
+void Simulator::build() {
+  // The executor refers to the other objects, so it goes first.
+  executor.reset();
+  symbolInfo = std::make_unique<SymbolInfo>();
+  state = std::make_unique<HartState>(*symbolInfo);
+  memory = std::make_unique<Memory>(config.memBase, config.memSize);
+  executor = std::make_unique<Executor>(*state, *memory);
+  if (!image.empty()) {
+    LoadedImage loaded;
+    std::unique_ptr<ImageCache> cache;
+    if (!config.imageCache.empty()) {
+      cache = std::make_unique<ImageCache>(config.imageCache);
+    }
+    if (cache && cache->load(imageHash, *memory, *symbolInfo, loaded)) {
+      PRINT_INFO(fmt::format("Mapped {} from the image cache\n", imageName));
+    } else {
+      auto entryPoint = loadELF(image, imageName, *symbolInfo, *memory);
+      // Begin execution at _start when the program defines it, otherwise
+      // use the entry point from the ELF header. The architectural tests,
+      // for example, enter at rvtest_entry_point.
+      auto *startSymbol = symbolInfo->getSymbol("_start");
+      loaded.pc = startSymbol ? startSymbol->value : entryPoint;
+      // Locate the HTIF words, which are placed differently by each linker
+      // script, falling back on the default addresses when they are not
+      // defined.
+      loaded.toHostAddress = executor->toHostAddress;
+      loaded.fromHostAddress = executor->fromHostAddress;
+      if (auto *toHostSymbol = symbolInfo->getSymbol("tohost")) {
+        auto *fromHostSymbol = symbolInfo->getSymbol("fromhost");
+        loaded.toHostAddress = toHostSymbol->value;
+        loaded.fromHostAddress = fromHostSymbol ? fromHostSymbol->value
+                                                : toHostSymbol->value + 8;
+      }
+      // The heap managed by brk begins at the end of the program's data.
+      auto *endSymbol = symbolInfo->getSymbol("_end");
+      loaded.programBreak = endSymbol ? endSymbol->value : executor->initialBreak;
+      if (cache) {
+        cache->store(imageHash, *memory, *symbolInfo, loaded);
+      }
+    }
+    state->pc = loaded.pc;
+    executor->setHTIFAddresses(loaded.toHostAddress, loaded.fromHostAddress);
+    executor->setProgramBreak(loaded.programBreak);
+  }
+  if (!config.sandboxDirectory.empty()) {
+    executor->fileDescs.setSandbox(config.sandboxDirectory);
+  }
+  executor->fileDescs.setBufferConsole(config.bufferOutput);
+  if (consoleCaptured) {
+    executor->fileDescs.captureConsole(consoleInput);
+  }
+  if (config.devices) {
+    executor->bus.attach(std::make_unique<Clint>(*state, executor->events), *memory);
+    executor->bus.attach(std::make_unique<Uart>(*state, executor->events,
+                                                executor->fileDescs), *memory);
+  }
+  if (config.accelerateLibc) {
+    executor->intrinsics.callCost = config.intrinsicCallCost;
+    executor->intrinsics.byteCost = config.intrinsicByteCost;
+    executor->intrinsics.bind(*symbolInfo);
+  }
+  executor->fusion = config.fusion;
+  executor->idleSkip = config.idleSkip;
+}
+
+void Simulator::loadFile(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw Exception(fmt::format("could not open {}", path));
+  }
+  std::vector<char> contents((std::istreambuf_iterator<char>(file)),
+                             std::istreambuf_iterator<char>());
+  image.swap(contents);
+  imageName = path;
+  imageHash = hashImage(image.data(), image.size());
+  build();
+}
+
+void Simulator::loadBuffer(const void *data, size_t size, const std::string &name) {
+  auto *bytes = static_cast<const char*>(data);
+  image.assign(bytes, bytes + size);
+  imageName = name;
+  imageHash = hashImage(image.data(), image.size());
+  build();
+}
+
+void Simulator::reset() {
+  build();
+}
+
+void Simulator::captureConsole(const std::string &input) {
+  consoleCaptured = true;
+  consoleInput = input;
+  executor->fileDescs.captureConsole(input);
+}
+
+std::string Simulator::takeOutput(int fd) {
+  return executor->fileDescs.takeOutput(fd);
+}
+
+StopReason Simulator::run(uint64_t maxInstructions) {
+  auto limit = maxInstructions == 0 || maxInstructions > UINT64_MAX - state->cycleCount
+                 ? UINT64_MAX : state->cycleCount + maxInstructions;
+  executor->cycleLimit = limit;
+  bool running = executor->status == Status::RUNNING;
+  while (running && state->cycleCount < limit) {
+    running = plugins.empty() ? executor->step<false>() : executor->step<false>(plugins);
+  }
+  switch (executor->status) {
+  case Status::EXITED:
+    return StopReason::EXITED;
+  case Status::TRAPPED:
+    return StopReason::TRAPPED;
+  default:
+    return StopReason::BUDGET;
+  }
+}
+
+uint32_t Simulator::readRegister(unsigned index) const {
+  if (index == static_cast<unsigned>(Register::pc)) {
+    return state->pc;
+  }
+  if (index >= NUM_REGISTERS) {
+    throw Exception(fmt::format("invalid register index {}", index));
+  }
+  return state->readReg(index);
+}
+
+void Simulator::writeRegister(unsigned index, uint32_t value) {
+  if (index == static_cast<unsigned>(Register::pc)) {
+    state->pc = value;
+    return;
+  }
+  if (index >= NUM_REGISTERS) {
+    throw Exception(fmt::format("invalid register index {}", index));
+  }
+  state->writeReg(index, value);
+}
+
+void Simulator::readMemory(uint32_t address, void *data, size_t length) {
+  auto *source = memory->hostPtr(address, length);
+  if (source == nullptr) {
+    throw Exception(fmt::format("memory read of {} bytes at {:#x} is out of range",
+                                length, address));
+  }
+  std::memcpy(data, source, length);
+}
+
+void Simulator::writeMemory(uint32_t address, const void *data, size_t length) {
+  auto *destination = memory->hostPtr(address, length);
+  if (destination == nullptr) {
+    throw Exception(fmt::format("memory write of {} bytes at {:#x} is out of range",
+                                length, address));
+  }
+  std::memcpy(destination, data, length);
+}
+
+/// Each line of the signature holds one granule of bytes, most-significant
+/// byte first, and a trailing partial granule is padded with zeros. This
+/// matches the output of Spike so that the two signatures can be compared
+/// directly.
+void Simulator::writeSignature(const std::string &filename, size_t granularity) {
+  auto *beginSymbol = symbolInfo->getSymbol("begin_signature");
+  auto *endSymbol = symbolInfo->getSymbol("end_signature");
+  if (beginSymbol == nullptr || endSymbol == nullptr) {
+    throw Exception("ELF file does not define begin_signature and end_signature");
+  }
+  if (endSymbol->value < beginSymbol->value) {
+    throw Exception("end_signature precedes begin_signature");
+  }
+  size_t length = endSymbol->value - beginSymbol->value;
+  std::vector<uint8_t> signature(length);
+  readMemory(beginSymbol->value, signature.data(), length);
+  std::ofstream file(filename);
+  if (!file) {
+    throw Exception(fmt::format("could not open signature file {}", filename));
+  }
+  for (size_t i = 0; i < length; i += granularity) {
+    for (size_t j = granularity; j > 0; j--) {
+      if (i + j <= length) {
+        file << fmt::format("{:02x}", signature[i + j - 1]);
+      } else {
+        file << "00";
+      }
+    }
+    file << '\n';
+  }
+  PRINT_INFO(fmt::format("Wrote {} bytes of signature to {}\n", length, filename));
+}
+
+} // End namespace rvsim
@@ -0,0 +1,67 @@
+#include <cstring>
+
+#include "rvsim/Exception.hpp"
+#include "rvsim/Snapshot.hpp"
+
+namespace rvsim {
+
+Snapshot::Snapshot(Executor &executor)
+  : executor(executor), state(executor.state),
+    contents(executor.memory.sizeInBytes()), status(executor.status),
+    exitCode(executor.exitCode), programBreak(executor.programBreak),
+    walks(executor.mmu.walks),
+    dirty((contents.size() + PAGE_SIZE - 1) / PAGE_SIZE, 0) {
+  if (!executor.bus.empty()) {
+    throw Exception("a snapshot cannot be taken with devices attached");
+  }
+  std::memcpy(contents.data(), executor.memory.data(), contents.size());
+}
+
+void Snapshot::restore() {
+  auto *memory = reinterpret_cast<uint8_t*>(executor.memory.data());
+  if (executor.mmu.walks != walks) {
+    std::memcpy(memory, contents.data(), contents.size());
+    std::fill(dirty.begin(), dirty.end(), 0);
+    dirtyPages.clear();
+    walks = executor.mmu.walks;
+  }
+  for (auto page : dirtyPages) {
+    auto offset = static_cast<size_t>(page) * PAGE_SIZE;
+    std::memcpy(memory + offset, contents.data() + offset,
+                std::min<size_t>(PAGE_SIZE, contents.size() - offset));
+    dirty[page] = 0;
+  }
+  dirtyPages.clear();
+  auto &current = executor.state;
+  current.registers = state.registers;
+  current.pc = state.pc;
+  current.privilege = state.privilege;
+  current.mstatus = state.mstatus;
+  current.mie = state.mie;
+  current.mip = state.mip;
+  current.mtvec = state.mtvec;
+  current.mscratch = state.mscratch;
+  current.mepc = state.mepc;
+  current.mcause = state.mcause;
+  current.mtval = state.mtval;
+  current.medeleg = state.medeleg;
+  current.stvec = state.stvec;
+  current.sscratch = state.sscratch;
+  current.sepc = state.sepc;
+  current.scause = state.scause;
+  current.stval = state.stval;
+  current.satp = state.satp;
+  current.cycleCount = state.cycleCount;
+  current.fetchAddress = state.fetchAddress;
+  current.trapValue = state.trapValue;
+  current.branchTaken = state.branchTaken;
+  executor.status = status;
+  executor.exitCode = exitCode;
+  executor.programBreak = programBreak;
+  // The TLBs may hold translations made since the snapshot, and the code of
+  // busy-wait loops may have been overwritten.
+  executor.mmu.flush();
+  executor.idleLoops.flush();
+}
+
+} // End namespace rvsim
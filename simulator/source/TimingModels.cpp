@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <thread>
+
+#include <fmt/core.h>
+
+#include "rvsim/Exception.hpp"
+#include "rvsim/TimingModels.hpp"
+
+namespace rvsim {
+
+// The number of records that each model replays in turn, which together
+// are small enough to stay in the cache of a host core.
+const size_t REPLAY_BLOCK_RECORDS = 4096;
+
+static bool isPowerOfTwo(uint64_t value) {
+  return value != 0 && (value & (value - 1)) == 0;
+}
+
+static unsigned floorLog2(uint64_t value) {
+  unsigned result = 0;
+  while (value >>= 1) {
+    result++;
+  }
+  return result;
+}
+
+CacheModel::CacheModel(const std::string &name, bool instruction, uint32_t size,
+                       unsigned ways, uint32_t lineSize)
+    : TimingModel(name), instruction(instruction), ways(ways), lineShift(floorLog2(lineSize)),
+      accesses(0), misses(0), lastLine(UINT32_MAX) {
+  if (!isPowerOfTwo(size) || !isPowerOfTwo(ways) || !isPowerOfTwo(lineSize) ||
+      lineSize < 4 || static_cast<uint64_t>(ways) * lineSize > size) {
+    throw Exception(fmt::format("invalid cache of {} bytes with {} ways of {} byte lines",
+                                size, ways, lineSize));
+  }
+  uint32_t sets = size / (ways * lineSize);
+  setMask = sets - 1;
+  tags.assign(sets * ways, UINT32_MAX);
+  lastUse.assign(sets * ways, 0);
+}
+
+void CacheModel::access(uint32_t address) {
+  uint32_t line = address >> lineShift;
+  accesses++;
+  // The line accessed last is the most recently used in its set.
+  if (line == lastLine) {
+    return;
+  }
+  lastLine = line;
+  auto base = (line & setMask) * ways;
+  unsigned victim = 0;
+  for (unsigned way = 0; way < ways; way++) {
+    if (tags[base + way] == line) {
+      lastUse[base + way] = accesses;
+      return;
+    }
+    if (lastUse[base + way] < lastUse[base + victim]) {
+      victim = way;
+    }
+  }
+  misses++;
+  tags[base + victim] = line;
+  lastUse[base + victim] = accesses;
+}
+
+void CacheModel::replay(const ReplayRecord *records, size_t count) {
+  if (instruction) {
+    for (size_t i = 0; i < count; i++) {
+      access(records[i].pc);
+    }
+  } else {
+    for (size_t i = 0; i < count; i++) {
+      if (records[i].flags & (REPLAY_LOAD | REPLAY_STORE)) {
+        access(records[i].address);
+      }
+    }
+  }
+}
+
+std::string CacheModel::report() const {
+  return fmt::format("accesses={} misses={} miss_rate={:.4f}", accesses, misses,
+                     accesses == 0 ? 0.0 : static_cast<double>(misses) / accesses);
+}
+
+BranchPredictorModel::BranchPredictorModel(const std::string &name, unsigned indexBits,
+                                           unsigned historyBits)
+    : TimingModel(name), historyBits(historyBits), history(0), branches(0),
+      mispredictions(0) {
+  if (indexBits == 0 || indexBits > 28 || historyBits > indexBits) {
+    throw Exception(fmt::format("invalid branch predictor with {} index bits and {} history bits",
+                                indexBits, historyBits));
+  }
+  indexMask = (1U << indexBits) - 1;
+  // Counters start weakly not taken.
+  counters.assign(1U << indexBits, 1);
+}
+
+void BranchPredictorModel::replay(const ReplayRecord *records, size_t count) {
+  uint32_t historyMask = (1U << historyBits) - 1;
+  for (size_t i = 0; i < count; i++) {
+    auto &record = records[i];
+    if (!(record.flags & REPLAY_BRANCH)) {
+      continue;
+    }
+    bool taken = (record.flags & REPLAY_TAKEN) != 0;
+    auto &counter = counters[((record.pc >> 2) ^ history) & indexMask];
+    branches++;
+    mispredictions += (counter >= 2) != taken;
+    if (taken) {
+      counter += counter < 3;
+    } else {
+      counter -= counter > 0;
+    }
+    history = ((history << 1) | taken) & historyMask;
+  }
+}
+
+std::string BranchPredictorModel::report() const {
+  return fmt::format("branches={} mispredictions={} mispredict_rate={:.4f}", branches,
+                     mispredictions,
+                     branches == 0 ? 0.0 : static_cast<double>(mispredictions) / branches);
+}
+
+/// Parse a size in bytes, with an optional suffix of k or m.
+static uint32_t parseSize(const std::string &spec, const std::string &field) {
+  size_t end = 0;
+  uint64_t value = 0;
+  try {
+    value = std::stoul(field, &end, 0);
+  } catch (std::exception &) {
+    throw Exception("invalid timing model " + spec);
+  }
+  if (end + 1 == field.size() && (field[end] == 'k' || field[end] == 'K')) {
+    value <<= 10;
+  } else if (end + 1 == field.size() && (field[end] == 'm' || field[end] == 'M')) {
+    value <<= 20;
+  } else if (end != field.size()) {
+    throw Exception("invalid timing model " + spec);
+  }
+  if (value > UINT32_MAX) {
+    throw Exception("invalid timing model " + spec);
+  }
+  return value;
+}
+
+std::unique_ptr<TimingModel> createTimingModel(const std::string &spec) {
+  std::vector<std::string> fields;
+  size_t start = 0;
+  while (start <= spec.size()) {
+    auto end = std::min(spec.find(':', start), spec.size());
+    fields.push_back(spec.substr(start, end - start));
+    start = end + 1;
+  }
+  auto &kind = fields[0];
+  if ((kind == "icache" || kind == "dcache") && fields.size() == 4) {
+    return std::make_unique<CacheModel>(spec, kind == "icache", parseSize(spec, fields[1]),
+                                        parseSize(spec, fields[2]), parseSize(spec, fields[3]));
+  } else if (kind == "bimodal" && fields.size() == 2) {
+    return std::make_unique<BranchPredictorModel>(spec, parseSize(spec, fields[1]), 0);
+  } else if (kind == "gshare" && fields.size() == 2) {
+    auto bits = parseSize(spec, fields[1]);
+    return std::make_unique<BranchPredictorModel>(spec, bits, bits);
+  }
+  throw Exception("invalid timing model " + spec);
+}
+
+void replayTimingModels(const ReplayTrace &trace,
+                        std::vector<std::unique_ptr<TimingModel>> &models,
+                        unsigned threads) {
+  threads = std::max(1U, std::min<unsigned>(threads, models.size()));
+  auto replayShard = [&](unsigned shard) {
+    for (size_t start = 0; start < trace.size(); start += REPLAY_BLOCK_RECORDS) {
+      auto count = std::min(REPLAY_BLOCK_RECORDS, trace.size() - start);
+      for (size_t i = shard; i < models.size(); i += threads) {
+        models[i]->replay(trace.data() + start, count);
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for (unsigned shard = 1; shard < threads; shard++) {
+    workers.emplace_back(replayShard, shard);
+  }
+  replayShard(0);
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+} // End namespace rvsim
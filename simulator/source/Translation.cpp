@@ -0,0 +1,253 @@
+#include <cstring>
+#include <iostream>
+#include <map>
+
+#include <fmt/core.h>
+
+#include "rvsim/Config.hpp"
+#include "rvsim/Disassembler.hpp"
+#include "rvsim/Exception.hpp"
+#include "rvsim/Simulator.hpp"
+#include "rvsim/Translation.hpp"
+
+namespace rvsim {
+
+// The most instructions in a block, after which it continues into the next.
+const size_t MAX_BLOCK_INSTRUCTIONS = 256;
+
+std::vector<CodeBlock> discoverBlocks(Memory &memory, SymbolInfo &symbolInfo,
+                                      uint32_t entry) {
+  std::vector<uint32_t> worklist = {entry};
+  auto *textStart = symbolInfo.getSymbol("_ftext");
+  auto *textEnd = symbolInfo.getSymbol("_etext");
+  for (auto &symbol : symbolInfo.getSymbols()) {
+    auto type = symbol->info & SYMBOL_TYPE_MASK;
+    if (type == SYMBOL_TYPE_FUNC ||
+        (type == 0 && textStart && textEnd && symbol->value >= textStart->value &&
+         symbol->value < textEnd->value)) {
+      worklist.push_back(symbol->value);
+    }
+  }
+  std::map<uint32_t, CodeBlock> blocks;
+  while (!worklist.empty()) {
+    auto pc = worklist.back();
+    worklist.pop_back();
+    if ((pc & 0x3) || blocks.count(pc)) {
+      continue;
+    }
+    CodeBlock block{pc, {}};
+    while (memory.contains(pc, 4) && block.instructions.size() < MAX_BLOCK_INSTRUCTIONS) {
+      auto instruction = memory.readMemoryWord(pc);
+      auto op = decode(instruction);
+      if (op == Operation::ILLEGAL || op == Operation::FENCE_I) {
+        break;
+      }
+      block.instructions.push_back(instruction);
+      auto flags = getSpec(op).flags;
+      if (flags & BRANCH) {
+        worklist.push_back(pc + signExtend<13>(InstructionBType(instruction).imm));
+      } else if (op == Operation::JAL) {
+        worklist.push_back(pc + signExtend<21>(InstructionJType(instruction).imm));
+      }
+      pc += 4;
+      // Calls return to the next instruction, and system instructions may
+      // trap to a handler that returns to it.
+      bool call = (flags & JUMP) && InstructionJType(instruction).rd != 0;
+      if ((flags & (BRANCH | SYSTEM)) || call) {
+        worklist.push_back(pc);
+      }
+      if (flags & (BRANCH | JUMP | SYSTEM)) {
+        break;
+      }
+    }
+    if (block.instructions.size() == MAX_BLOCK_INSTRUCTIONS) {
+      worklist.push_back(pc);
+    }
+    if (!block.instructions.empty()) {
+      blocks.emplace(block.pc, std::move(block));
+    }
+  }
+  std::vector<CodeBlock> result;
+  for (auto &entry : blocks) {
+    result.push_back(std::move(entry.second));
+  }
+  return result;
+}
+
+void writeTranslation(std::ostream &out, const std::vector<CodeBlock> &blocks,
+                      SymbolInfo &symbolInfo, const std::vector<char> &image,
+                      const std::string &name, size_t memBase, size_t memSize) {
+  out << fmt::format("// Translated from {} by rvsim-aot.\n", name);
+  out << "#include \"rvsim/Translation.hpp\"\n\n";
+  // Each instruction but the last of a block leaves the block if it does
+  // not continue to the next one, such as when it traps or an interrupt is
+  // taken, or when the cycle limit is reached.
+  out << "#define STEP(address, instruction) \\\n"
+         "  if (!executor.stepDecoded(instruction) || executor.state.pc != (address) + 4 || \\\n"
+         "      executor.state.cycleCount >= executor.cycleLimit) { \\\n"
+         "    return; \\\n"
+         "  }\n";
+  for (auto &block : blocks) {
+    out << '\n';
+    if (auto *symbol = symbolInfo.getSymbol(block.pc); symbol && symbol->value == block.pc) {
+      out << fmt::format("// {}\n", symbol->name);
+    }
+    out << fmt::format("static void block_{:08x}(rvsim::Executor &executor) {{\n", block.pc);
+    auto pc = block.pc;
+    for (size_t i = 0; i < block.instructions.size(); i++, pc += 4) {
+      auto instruction = block.instructions[i];
+      if (i + 1 < block.instructions.size()) {
+        out << fmt::format("  STEP({:#010x}, {:#010x}); // {}\n", pc, instruction,
+                           disassemble(instruction));
+      } else {
+        out << fmt::format("  executor.stepDecoded({:#010x}); // {}\n", instruction,
+                           disassemble(instruction));
+      }
+    }
+    out << "}\n";
+  }
+  if (!blocks.empty()) {
+    out << "\nstatic const rvsim::TranslatedBlock blocks[] = {\n";
+    for (auto &block : blocks) {
+      out << fmt::format("  {{{:#010x}, block_{:08x}}},\n", block.pc, block.pc);
+    }
+    out << "};\n";
+  }
+  out << "\nstatic const unsigned char image[] = {";
+  for (size_t i = 0; i < image.size(); i++) {
+    out << (i % 16 == 0 ? "\n  " : " ")
+        << fmt::format("{:#04x},", static_cast<unsigned char>(image[i]));
+  }
+  out << "\n};\n\n";
+  out << "int main(int argc, const char *argv[]) {\n";
+  out << fmt::format("  rvsim::TranslatedProgram program = {{\"{}\", image, sizeof(image), {:#x}, "
+                     "{:#x},\n                                    {}, {}}};\n",
+                     name, memBase, memSize, blocks.empty() ? "nullptr" : "blocks",
+                     blocks.size());
+  out << "  return rvsim::runTranslated(program, argc, argv);\n";
+  out << "}\n";
+}
+
+static void help(const TranslatedProgram &program, const char *argv[]) {
+  std::cout << fmt::format("{}, translated ahead of time\n", program.name);
+  std::cout << "\n";
+  std::cout << "Usage: " << argv[0] << " [options]\n";
+  std::cout << "\n";
+  std::cout << "Optional arguments:\n";
+  std::cout << "  -h,--help       Display this message\n";
+  std::cout << "  -v,--verbose    Report the code that was interpreted\n";
+  std::cout << "  --max-cycles N  Limit the number of simulation cycles (default: 0)\n";
+  std::cout << "  --signature F   Write the test signature to file F on termination\n";
+  std::cout << "  --signature-granularity N\n";
+  std::cout << "                  Set the signature line size in bytes (default: 4)\n";
+  std::cout << "  --sandbox D     Allow the program to open files beneath host directory D\n";
+  std::cout << "  --buffer-output Buffer console output until the program exits\n";
+  std::cout << "  --devices       Map a CLINT timer and a 16550 UART\n";
+  std::cout << "  --accelerate-libc\n";
+  std::cout << "                  Perform calls to memcpy, memmove, memset, memcmp and strlen on the host\n";
+  std::cout << "  --interpret     Interpret the whole program rather than running the translation\n";
+}
+
+int runTranslated(const TranslatedProgram &program, int argc, const char *argv[]) {
+  try {
+    SimulatorConfig config;
+    config.memBase = program.memBase;
+    config.memSize = program.memSize;
+    size_t maxCycles = 0;
+    const char *signatureFilename = nullptr;
+    size_t signatureGranularity = 4;
+    bool translated = true;
+    for (int i = 1; i < argc; ++i) {
+      if (std::strcmp(argv[i], "--max-cycles") == 0) {
+        maxCycles = std::stoull(argv[++i], nullptr, 0);
+      } else if (std::strcmp(argv[i], "--signature") == 0) {
+        signatureFilename = argv[++i];
+      } else if (std::strcmp(argv[i], "--signature-granularity") == 0) {
+        signatureGranularity = std::stoull(argv[++i], nullptr, 0);
+      } else if (std::strcmp(argv[i], "--sandbox") == 0) {
+        config.sandboxDirectory = argv[++i];
+      } else if (std::strcmp(argv[i], "--buffer-output") == 0) {
+        config.bufferOutput = true;
+      } else if (std::strcmp(argv[i], "--devices") == 0) {
+        config.devices = true;
+      } else if (std::strcmp(argv[i], "--accelerate-libc") == 0) {
+        config.accelerateLibc = true;
+      } else if (std::strcmp(argv[i], "--interpret") == 0) {
+        translated = false;
+      } else if (std::strcmp(argv[i], "-v") == 0 ||
+                 std::strcmp(argv[i], "--verbose") == 0) {
+        Config::getInstance().verbose = true;
+      } else if (std::strcmp(argv[i], "-h") == 0 ||
+                 std::strcmp(argv[i], "--help") == 0) {
+        help(program, argv);
+        return 1;
+      } else {
+        throw std::runtime_error(fmt::format("unknown argument {}", argv[i]));
+      }
+    }
+    Simulator simulator(config);
+    simulator.loadBuffer(program.image, program.imageSize, program.name);
+    auto &state = simulator.getState();
+    auto &memory = simulator.getMemory();
+    auto &executor = simulator.getExecutor();
+    if (maxCycles > 0) {
+      executor.cycleLimit = maxCycles;
+    }
+    // The dispatch table holds the block beginning at each word of the
+    // range of addresses translated.
+    uint32_t base = program.blockCount ? program.blocks[0].pc : 0;
+    uint32_t end = program.blockCount ? program.blocks[program.blockCount - 1].pc + 4 : 0;
+    std::vector<void (*)(Executor &)> table((end - base) / 4, nullptr);
+    for (size_t i = 0; i < program.blockCount; i++) {
+      table[(program.blocks[i].pc - base) / 4] = program.blocks[i].function;
+    }
+    uint64_t interpreted = 0;
+    while (executor.status == Status::RUNNING &&
+           (maxCycles == 0 || state.cycleCount < maxCycles)) {
+      // Once paging is enabled, code may be mapped at any address.
+      translated = translated && !executor.paging();
+      auto index = (state.pc - base) / 4;
+      if (translated && (state.pc & 0x3) == 0 && index < table.size() && table[index]) {
+        table[index](executor);
+        continue;
+      }
+      // Code that was not found statically is interpreted. A fence.i may
+      // follow changes to the code, after which nothing translated is run.
+      if (memory.contains(state.pc, 4) &&
+          decode(memory.readMemoryWord(state.pc)) == Operation::FENCE_I) {
+        translated = false;
+      }
+      executor.step<false>();
+      interpreted++;
+    }
+    if (Config::getInstance().verbose) {
+      std::cout << fmt::format("Interpreted {} steps of {} cycles\n", interpreted,
+                               state.cycleCount);
+    }
+    int exitCode = executor.exitCode;
+    if (executor.status == Status::TRAPPED) {
+      if (state.mcause & MCAUSE_INTERRUPT) {
+        auto interrupt = static_cast<Interrupt>(state.mcause & ~MCAUSE_INTERRUPT);
+        std::cerr << fmt::format("Unhandled {} at pc {:#010x}\n", getInterruptName(interrupt),
+                                 state.mepc);
+      } else {
+        std::cerr << fmt::format("Unhandled trap: {} at pc {:#010x} (mtval {:#010x})\n",
+                                 getTrapName(static_cast<Trap>(state.mcause)), state.mepc,
+                                 state.mtval);
+      }
+      exitCode = 1;
+    }
+    if (signatureFilename) {
+      simulator.writeSignature(signatureFilename, signatureGranularity);
+    }
+    return exitCode;
+  } catch (Exception &e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  } catch (std::exception &e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+}
+
+} // End namespace rvsim
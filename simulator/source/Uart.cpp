@@ -0,0 +1,148 @@
+#include "rvsim/Uart.hpp"
+
+namespace rvsim {
+
+// Register offsets.
+const uint32_t UART_RBR = 0; // Receive buffer (read), or transmit holding (write).
+const uint32_t UART_IER = 1; // Interrupt enable.
+const uint32_t UART_IIR = 2; // Interrupt identification (read), or FIFO control (write).
+const uint32_t UART_LCR = 3; // Line control.
+const uint32_t UART_MCR = 4; // Modem control.
+const uint32_t UART_LSR = 5; // Line status.
+const uint32_t UART_MSR = 6; // Modem status.
+const uint32_t UART_SCR = 7; // Scratch.
+
+const uint8_t IER_RDA  = 1 << 0;
+const uint8_t IER_THRE = 1 << 1;
+const uint8_t IIR_NONE = 0x01;
+const uint8_t IIR_THRE = 0x02;
+const uint8_t IIR_RDA  = 0x04;
+const uint8_t LCR_DLAB = 1 << 7;
+const uint8_t LSR_DR   = 1 << 0;
+const uint8_t LSR_THRE = 1 << 5;
+const uint8_t LSR_TEMT = 1 << 6;
+
+Uart::Uart(HartState &state, EventQueue &events, FileDescriptors &fileDescs,
+           uint32_t base)
+    : Device("uart", base, UART_SIZE), state(state), events(events),
+      fileDescs(fileDescs), ier(0), lcr(0), mcr(0), scr(0), divisor{0, 0},
+      dataReady(false), rbr(0), threPending(false), polling(false) {}
+
+/// Read a character from the host into the receive buffer if one is
+/// available without blocking, returning whether the buffer is full.
+bool Uart::pollInput() {
+  if (!dataReady) {
+    if (fileDescs.inputReady()) {
+      dataReady = fileDescs.read(GUEST_STDIN, &rbr, 1) == 1;
+    }
+  }
+  return dataReady;
+}
+
+void Uart::updateInterrupt() {
+  bool pending = ((ier & IER_RDA) && dataReady) ||
+                 ((ier & IER_THRE) && threPending);
+  auto mip = pending ? state.mip | MIP_MEIP : state.mip & ~MIP_MEIP;
+  if (mip != state.mip) {
+    state.mip = mip;
+    events.wake(state.cycleCount);
+  }
+  // Poll for input only while it would raise an interrupt.
+  if ((ier & IER_RDA) && !dataReady && !polling) {
+    polling = true;
+    events.schedule(state.cycleCount + UART_POLL_INTERVAL, this);
+  }
+}
+
+uint32_t Uart::read(uint32_t offset, unsigned length) {
+  uint8_t value = 0;
+  switch (offset) {
+    case UART_RBR:
+      if (lcr & LCR_DLAB) {
+        value = divisor[0];
+      } else if (pollInput()) {
+        value = rbr;
+        dataReady = false;
+        updateInterrupt();
+      }
+      break;
+    case UART_IER:
+      value = (lcr & LCR_DLAB) ? divisor[1] : ier;
+      break;
+    case UART_IIR:
+      if ((ier & IER_RDA) && dataReady) {
+        value = IIR_RDA;
+      } else if ((ier & IER_THRE) && threPending) {
+        value = IIR_THRE;
+        threPending = false;
+        updateInterrupt();
+      } else {
+        value = IIR_NONE;
+      }
+      break;
+    case UART_LCR: value = lcr; break;
+    case UART_MCR: value = mcr; break;
+    case UART_LSR:
+      value = LSR_THRE | LSR_TEMT | (pollInput() ? LSR_DR : 0);
+      // Until the next read, input is noticed by the poll event, so that a
+      // loop waiting for it can be skipped up to the poll.
+      if (!dataReady && !polling) {
+        polling = true;
+        events.schedule(state.cycleCount + UART_POLL_INTERVAL, this);
+      }
+      break;
+    case UART_MSR: value = 0; break;
+    case UART_SCR: value = scr; break;
+    default: break;
+  }
+  return value;
+}
+
+void Uart::write(uint32_t offset, unsigned length, uint32_t value) {
+  uint8_t byte = value;
+  switch (offset) {
+    case UART_RBR:
+      if (lcr & LCR_DLAB) {
+        divisor[0] = byte;
+      } else {
+        fileDescs.write(GUEST_STDOUT, &byte, 1);
+        threPending = true;
+        updateInterrupt();
+      }
+      break;
+    case UART_IER:
+      if (lcr & LCR_DLAB) {
+        divisor[1] = byte;
+      } else {
+        if ((byte & IER_THRE) && !(ier & IER_THRE)) {
+          threPending = true;
+        }
+        ier = byte & (IER_RDA | IER_THRE);
+        updateInterrupt();
+      }
+      break;
+    case UART_LCR: lcr = byte; break;
+    case UART_MCR: mcr = byte; break;
+    case UART_SCR: scr = byte; break;
+    default: break;
+  }
+}
+
+/// Reading the receive buffer consumes it and reading IIR may clear the
+/// transmit-empty interrupt, while the line status changes only when input
+/// is polled.
+bool Uart::stableRead(uint32_t offset) const {
+  switch (offset) {
+    case UART_RBR: return lcr & LCR_DLAB;
+    case UART_IIR: return false;
+    default:       return true;
+  }
+}
+
+void Uart::event(uint64_t cycle) {
+  polling = false;
+  pollInput();
+  updateInterrupt();
+}
+
+} // End namespace rvsim
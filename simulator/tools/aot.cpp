@@ -0,0 +1,176 @@
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fmt/core.h>
+
+#include "rvsim/Exception.hpp"
+#include "rvsim/Simulator.hpp"
+#include "rvsim/Translation.hpp"
+
+// The host compiler and the flags to compile and link a translation with,
+// which are set by the build. The flags are a list of string literals, one
+// per argument, so that paths containing spaces are passed whole.
+#ifndef RVSIM_AOT_CXX
+#define RVSIM_AOT_CXX "c++"
+#endif
+#ifndef RVSIM_AOT_FLAGS
+#define RVSIM_AOT_FLAGS "-std=c++20", "-O2", "-lrvsimlib", "-lfmt"
+#endif
+
+static void help(const char *argv[]) {
+  std::cout << "Translate a RISC-V (RV32I) program ahead of time into a host executable\n";
+  std::cout << "\n";
+  std::cout << "Usage: " << argv[0] << " [options] file\n";
+  std::cout << "\n";
+  std::cout << "Positional arguments:\n";
+  std::cout << "  file  An ELF file to translate\n";
+  std::cout << "\n";
+  std::cout << "Optional arguments:\n";
+  std::cout << "  -h,--help       Display this message\n";
+  std::cout << "  -o F            Write the executable to file F (default: the ELF file's name\n";
+  std::cout << "                  without its extension)\n";
+  std::cout << "  -S              Write the C++ translation to the output file rather than\n";
+  std::cout << "                  compiling it\n";
+  std::cout << "  --cxx C         Compile with the host compiler command C (default: " << RVSIM_AOT_CXX << ")\n";
+  std::cout << "  --mem-base B    Set the memory base address in bytes (default: " << rvsim::DEFAULT_MEMORY_BASE_ADDRESS << ")\n";
+  std::cout << "  --mem-size B    Set the memory size in bytes (default: " << rvsim::DEFAULT_MEMORY_SIZE_BYTES << ")\n";
+  std::cout << "  -v,--verbose    Report the blocks translated and the compiler command\n";
+}
+
+/// Split a command given on the command line into its words, at whitespace.
+static std::vector<std::string> splitWords(const std::string &text) {
+  std::istringstream stream(text);
+  return {std::istream_iterator<std::string>(stream), std::istream_iterator<std::string>()};
+}
+
+/// Run a command with its arguments, without a shell, so that file names
+/// are passed as they are. Return true if it exits successfully.
+static bool runCommand(const std::vector<std::string> &args) {
+  std::vector<char*> argv;
+  for (auto &arg : args) {
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+  auto pid = fork();
+  if (pid < 0) {
+    throw std::runtime_error(fmt::format("could not fork: {}", std::strerror(errno)));
+  }
+  if (pid == 0) {
+    execvp(argv[0], argv.data());
+    std::cerr << fmt::format("Error: could not run {}: {}\n", args[0], std::strerror(errno));
+    _exit(127);
+  }
+  int status;
+  if (waitpid(pid, &status, 0) != pid) {
+    return false;
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, const char *argv[]) {
+  try {
+    const char *filename = nullptr;
+    std::string outputFilename;
+    bool emitOnly = false;
+    std::vector<std::string> compiler = {RVSIM_AOT_CXX};
+    bool verbose = false;
+    rvsim::SimulatorConfig config;
+    for (int i = 1; i < argc; ++i) {
+      if (std::strcmp(argv[i], "-o") == 0) {
+        outputFilename = argv[++i];
+      } else if (std::strcmp(argv[i], "-S") == 0) {
+        emitOnly = true;
+      } else if (std::strcmp(argv[i], "--cxx") == 0) {
+        compiler = splitWords(argv[++i]);
+      } else if (std::strcmp(argv[i], "--mem-base") == 0) {
+        config.memBase = std::stoul(argv[++i], nullptr, 0);
+      } else if (std::strcmp(argv[i], "--mem-size") == 0) {
+        config.memSize = std::stoul(argv[++i], nullptr, 0);
+      } else if (std::strcmp(argv[i], "-v") == 0 ||
+                 std::strcmp(argv[i], "--verbose") == 0) {
+        verbose = true;
+      } else if (std::strcmp(argv[i], "-h") == 0 ||
+                 std::strcmp(argv[i], "--help") == 0) {
+        help(argv);
+        return 1;
+      } else if (!filename) {
+        filename = argv[i];
+      } else {
+        throw std::runtime_error("cannot specify more than one file");
+      }
+    }
+    if (!filename) {
+      help(argv);
+      return 1;
+    }
+    std::filesystem::path path(filename);
+    if (outputFilename.empty()) {
+      outputFilename = path.stem().string() + (emitOnly ? ".cpp" : "");
+    }
+    // Load the program as rvsim does, and find its code from the entry point.
+    rvsim::Simulator simulator(config);
+    simulator.loadFile(filename);
+    auto blocks = rvsim::discoverBlocks(simulator.getMemory(), simulator.getSymbolInfo(),
+                                        simulator.getState().pc);
+    std::ifstream file(filename, std::ios::binary);
+    std::vector<char> image((std::istreambuf_iterator<char>(file)),
+                            std::istreambuf_iterator<char>());
+    if (verbose) {
+      size_t instructions = 0;
+      for (auto &block : blocks) {
+        instructions += block.instructions.size();
+      }
+      std::cout << fmt::format("Translated {} blocks of {} instructions\n", blocks.size(),
+                               instructions);
+    }
+    auto sourceFilename = emitOnly ? outputFilename : outputFilename + ".cpp";
+    {
+      std::ofstream source(sourceFilename);
+      if (!source) {
+        throw std::runtime_error(fmt::format("could not open {}", sourceFilename));
+      }
+      rvsim::writeTranslation(source, blocks, simulator.getSymbolInfo(), image,
+                              path.filename().string(), config.memBase, config.memSize);
+    }
+    if (emitOnly) {
+      return 0;
+    }
+    // A compiler command given with --cxx may hold several words, but the
+    // file names and each of the flags are single arguments.
+    if (compiler.empty()) {
+      throw std::runtime_error("no compiler command");
+    }
+    auto command = compiler;
+    command.insert(command.end(), {sourceFilename, "-o", outputFilename});
+    const char *const flags[] = {RVSIM_AOT_FLAGS};
+    command.insert(command.end(), std::begin(flags), std::end(flags));
+    if (verbose) {
+      for (auto &word : command) {
+        std::cout << word << (&word == &command.back() ? "\n" : " ");
+      }
+    }
+    if (!runCommand(command)) {
+      throw std::runtime_error(fmt::format("could not compile {}", sourceFilename));
+    }
+    std::filesystem::remove(sourceFilename);
+    return 0;
+  } catch (rvsim::Exception &e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  } catch (std::exception &e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+}
@@ -0,0 +1,340 @@
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fmt/core.h>
+
+#include "rvsim/Exception.hpp"
+#include "rvsim/Fuzzer.hpp"
+#include "rvsim/Simulator.hpp"
+
+// The file descriptors on which afl-fuzz talks to a fork server, the first
+// for its requests and the second for the replies.
+const int FORKSRV_FD = 198;
+
+// Tells afl-fuzz that the fork server keeps each child for many inputs.
+[[gnu::used]] static const char persistentSignature[] = "##SIG_AFL_PERSISTENT##";
+
+static void help(const char *argv[]) {
+  std::cout << "Fuzz a RISC-V (RV32I) program from a snapshot, alone or under afl-fuzz\n";
+  std::cout << "\n";
+  std::cout << "Usage: " << argv[0] << " [options] file [inputs...]\n";
+  std::cout << "\n";
+  std::cout << "Positional arguments:\n";
+  std::cout << "  file    An ELF file to fuzz\n";
+  std::cout << "  inputs  Input files, or directories of them, to start from. Under afl-fuzz,\n";
+  std::cout << "          the one input file, or stdin if there is none\n";
+  std::cout << "\n";
+  std::cout << "Optional arguments:\n";
+  std::cout << "  -h,--help       Display this message\n";
+  std::cout << "  --entry S       Take the snapshot when the program reaches symbol S (default: main)\n";
+  std::cout << "  --input S       Copy each input into the buffer at symbol S (default: fuzz_input)\n";
+  std::cout << "  --input-size N  Set the size of the buffer, when its symbol has no size\n";
+  std::cout << "  --length S      Write the length of each input to the word at symbol S\n";
+  std::cout << "  --max-cycles N  Limit each run to N cycles (default: 1000000)\n";
+  std::cout << "  --runs N        Make N runs on mutated inputs when not under afl-fuzz (default: 0)\n";
+  std::cout << "  --seed N        Seed the mutations (default: 1)\n";
+  std::cout << "  --crashes D     Write the inputs that trap to directory D\n";
+  std::cout << "  --mem-base B    Set the memory base address in bytes (default: " << rvsim::DEFAULT_MEMORY_BASE_ADDRESS << ")\n";
+  std::cout << "  --mem-size B    Set the memory size in bytes (default: " << rvsim::DEFAULT_MEMORY_SIZE_BYTES << ")\n";
+}
+
+static std::vector<uint8_t> readFile(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error(fmt::format("could not open {}", path));
+  }
+  return std::vector<uint8_t>((std::istreambuf_iterator<char>(file)),
+                              std::istreambuf_iterator<char>());
+}
+
+/// Read the input from afl-fuzz, which rewrites the same file for each run,
+/// from its beginning.
+static std::vector<uint8_t> readAflInput(const char *path) {
+  if (path) {
+    return readFile(path);
+  }
+  std::vector<uint8_t> input;
+  lseek(STDIN_FILENO, 0, SEEK_SET);
+  uint8_t chunk[4096];
+  ssize_t count;
+  while ((count = read(STDIN_FILENO, chunk, sizeof(chunk))) > 0) {
+    input.insert(input.end(), chunk, chunk + count);
+  }
+  return input;
+}
+
+/// Run inputs from afl-fuzz until it closes the fork server. Each child
+/// runs inputs from the snapshot in a loop, stopping itself after each one
+/// for the server to report, until an input makes it trap, which it
+/// reports to afl-fuzz as a crash by dying of SIGSEGV.
+static int serveAfl(rvsim::Simulator &simulator, rvsim::FuzzHarness &harness,
+                    const char *path) {
+  auto runChild = [&]() {
+    for (;;) {
+      auto input = readAflInput(path);
+      auto outcome = harness.run(input.data(), input.size());
+      simulator.takeOutput(1);
+      simulator.takeOutput(2);
+      if (outcome == rvsim::FuzzOutcome::TRAPPED) {
+        std::signal(SIGSEGV, SIG_DFL);
+        std::raise(SIGSEGV);
+      }
+      std::raise(SIGSTOP);
+    }
+  };
+  uint32_t hello = 0;
+  if (write(FORKSRV_FD + 1, &hello, sizeof(hello)) != sizeof(hello)) {
+    // Without a fork server, such as under afl-showmap, run the input once.
+    auto input = readAflInput(path);
+    if (harness.run(input.data(), input.size()) == rvsim::FuzzOutcome::TRAPPED) {
+      std::signal(SIGSEGV, SIG_DFL);
+      std::raise(SIGSEGV);
+    }
+    return 0;
+  }
+  pid_t child = -1;
+  bool stopped = false;
+  for (;;) {
+    uint32_t killed;
+    if (read(FORKSRV_FD, &killed, sizeof(killed)) != sizeof(killed)) {
+      if (stopped) {
+        kill(child, SIGKILL);
+        waitpid(child, nullptr, 0);
+      }
+      return 0;
+    }
+    // afl-fuzz kills a child that times out, without resuming it.
+    if (stopped && killed) {
+      waitpid(child, nullptr, 0);
+      stopped = false;
+    }
+    if (stopped) {
+      kill(child, SIGCONT);
+    } else {
+      child = fork();
+      if (child < 0) {
+        throw std::runtime_error("could not fork");
+      }
+      if (child == 0) {
+        close(FORKSRV_FD);
+        close(FORKSRV_FD + 1);
+        runChild();
+      }
+    }
+    int status;
+    if (write(FORKSRV_FD + 1, &child, sizeof(child)) != sizeof(child) ||
+        waitpid(child, &status, WUNTRACED) < 0) {
+      return 1;
+    }
+    stopped = WIFSTOPPED(status);
+    if (write(FORKSRV_FD + 1, &status, sizeof(status)) != sizeof(status)) {
+      return 1;
+    }
+  }
+}
+
+/// Change an input by a few random edits, keeping it within a size.
+static void mutate(std::vector<uint8_t> &input, size_t maxSize, std::mt19937 &random) {
+  static const uint8_t interesting[] = {0x00, 0x01, 0x7F, 0x80, 0xFF};
+  auto edits = 1 + random() % 4;
+  for (unsigned i = 0; i < edits; i++) {
+    auto position = input.empty() ? 0 : random() % input.size();
+    switch (random() % 5) {
+      case 0:
+        if (!input.empty()) {
+          input[position] ^= 1 << (random() % 8);
+        }
+        break;
+      case 1:
+        if (!input.empty()) {
+          input[position] = random();
+        }
+        break;
+      case 2:
+        if (!input.empty()) {
+          input[position] = interesting[random() % std::size(interesting)];
+        }
+        break;
+      case 3:
+        if (input.size() < maxSize) {
+          input.insert(input.begin() + position, random());
+        }
+        break;
+      default:
+        if (!input.empty()) {
+          input.erase(input.begin() + position);
+        }
+        break;
+    }
+  }
+}
+
+int main(int argc, const char *argv[]) {
+  try {
+    const char *filename = nullptr;
+    std::vector<std::string> inputs;
+    std::string entry = "main";
+    std::string inputSymbol = "fuzz_input";
+    uint32_t inputSize = 0;
+    std::string lengthSymbol;
+    uint64_t maxCycles = 1000000;
+    uint64_t runs = 0;
+    unsigned seed = 1;
+    std::string crashDirectory;
+    rvsim::SimulatorConfig config;
+    for (int i = 1; i < argc; ++i) {
+      if (std::strcmp(argv[i], "--entry") == 0) {
+        entry = argv[++i];
+      } else if (std::strcmp(argv[i], "--input") == 0) {
+        inputSymbol = argv[++i];
+      } else if (std::strcmp(argv[i], "--input-size") == 0) {
+        inputSize = std::stoul(argv[++i], nullptr, 0);
+      } else if (std::strcmp(argv[i], "--length") == 0) {
+        lengthSymbol = argv[++i];
+      } else if (std::strcmp(argv[i], "--max-cycles") == 0) {
+        maxCycles = std::stoull(argv[++i], nullptr, 0);
+      } else if (std::strcmp(argv[i], "--runs") == 0) {
+        runs = std::stoull(argv[++i], nullptr, 0);
+      } else if (std::strcmp(argv[i], "--seed") == 0) {
+        seed = std::stoul(argv[++i], nullptr, 0);
+      } else if (std::strcmp(argv[i], "--crashes") == 0) {
+        crashDirectory = argv[++i];
+      } else if (std::strcmp(argv[i], "--mem-base") == 0) {
+        config.memBase = std::stoul(argv[++i], nullptr, 0);
+      } else if (std::strcmp(argv[i], "--mem-size") == 0) {
+        config.memSize = std::stoul(argv[++i], nullptr, 0);
+      } else if (std::strcmp(argv[i], "-h") == 0 ||
+                 std::strcmp(argv[i], "--help") == 0) {
+        help(argv);
+        return 1;
+      } else if (!filename) {
+        filename = argv[i];
+      } else {
+        inputs.push_back(argv[i]);
+      }
+    }
+    if (!filename) {
+      help(argv);
+      return 1;
+    }
+    // Under afl-fuzz, edges are counted in its shared memory.
+    std::vector<uint8_t> localBitmap(rvsim::FUZZ_MAP_SIZE);
+    uint8_t *bitmap = localBitmap.data();
+    const char *shmId = std::getenv("__AFL_SHM_ID");
+    if (shmId) {
+      auto *shared = shmat(std::atoi(shmId), nullptr, 0);
+      if (shared == reinterpret_cast<void*>(-1)) {
+        throw std::runtime_error("could not attach to the AFL bitmap");
+      }
+      bitmap = static_cast<uint8_t*>(shared);
+    }
+    // The program's console is kept in memory and discarded.
+    rvsim::Simulator simulator(config);
+    simulator.captureConsole("");
+    simulator.loadFile(filename);
+    rvsim::FuzzHarness harness(simulator.getExecutor(), simulator.getSymbolInfo(), entry,
+                               inputSymbol, inputSize, lengthSymbol, maxCycles, bitmap);
+    if (shmId) {
+      if (inputs.size() > 1) {
+        throw std::runtime_error("cannot specify more than one input under afl-fuzz");
+      }
+      return serveAfl(simulator, harness, inputs.empty() ? nullptr : inputs[0].c_str());
+    }
+
+    std::vector<std::vector<uint8_t>> corpus;
+    for (auto &input : inputs) {
+      if (std::filesystem::is_directory(input)) {
+        for (auto &file : std::filesystem::directory_iterator(input)) {
+          if (file.is_regular_file()) {
+            corpus.push_back(readFile(file.path().string()));
+          }
+        }
+      } else {
+        corpus.push_back(readFile(input));
+      }
+    }
+    if (corpus.empty()) {
+      corpus.emplace_back();
+    }
+    // An input is kept when it covers an edge that no earlier one has.
+    std::vector<uint8_t> covered(rvsim::FUZZ_MAP_SIZE);
+    size_t edges = 0;
+    uint64_t executions = 0;
+    uint64_t crashes = 0;
+    auto execute = [&](const std::vector<uint8_t> &input, bool &discovered) {
+      std::memset(bitmap, 0, rvsim::FUZZ_MAP_SIZE);
+      auto outcome = harness.run(input.data(), input.size());
+      simulator.takeOutput(1);
+      simulator.takeOutput(2);
+      executions++;
+      // Most of the bitmap is zero, so it is scanned a word at a time.
+      discovered = false;
+      for (size_t i = 0; i < rvsim::FUZZ_MAP_SIZE; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, bitmap + i, sizeof(word));
+        if (word == 0) {
+          continue;
+        }
+        for (size_t j = i; j < i + sizeof(uint64_t); j++) {
+          if (bitmap[j] && !covered[j]) {
+            covered[j] = 1;
+            edges++;
+            discovered = true;
+          }
+        }
+      }
+      if (outcome == rvsim::FuzzOutcome::TRAPPED) {
+        if (!crashDirectory.empty()) {
+          auto path = fmt::format("{}/crash-{:06}", crashDirectory, crashes);
+          std::ofstream(path, std::ios::binary)
+            .write(reinterpret_cast<const char*>(input.data()), input.size());
+        }
+        crashes++;
+      }
+    };
+    if (!crashDirectory.empty()) {
+      std::filesystem::create_directories(crashDirectory);
+    }
+    auto start = std::chrono::steady_clock::now();
+    bool discovered;
+    for (auto &input : corpus) {
+      execute(input, discovered);
+    }
+    std::mt19937 random(seed);
+    for (uint64_t run = 0; run < runs; run++) {
+      auto input = corpus[random() % corpus.size()];
+      mutate(input, harness.getBufferSize(), random);
+      execute(input, discovered);
+      if (discovered) {
+        corpus.push_back(std::move(input));
+      }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << fmt::format("Ran {} inputs in {:.3f}s ({:.0f} per second)\n", executions,
+                             elapsed.count(), executions / elapsed.count());
+    std::cout << fmt::format("Covered {} edges with {} inputs, {} crashes\n", edges,
+                             corpus.size(), crashes);
+    return crashes ? 1 : 0;
+  } catch (rvsim::Exception &e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  } catch (std::exception &e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+}
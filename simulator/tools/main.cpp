@@ -1,5 +1,6 @@
 #include <array>
 #include <cassert>
+#include <csignal>
 #include <cstdarg>
 #include <cstdio>
 #include <cstring>
@@ -8,28 +9,41 @@
 #include <iostream>
 #include <limits>
 #include <map>
+#include <memory>
 #include <stdexcept>
 #include <vector>
 
-#include "gelf.h"
-#include "libelf.h"
 #include <fmt/core.h>
 
 #include "rvsim/bits.hpp"
+#include "rvsim/BasicBlockVectors.hpp"
+#include "rvsim/Checkpoint.hpp"
+#include "rvsim/Clint.hpp"
 #include "rvsim/Config.hpp"
+#include "rvsim/Cosim.hpp"
+#include "rvsim/DataProfile.hpp"
 #include "rvsim/HartState.hpp"
+#include "rvsim/IlpLimits.hpp"
+#include "rvsim/IntervalStats.hpp"
 #include "rvsim/Memory.hpp"
 #include "rvsim/Executor.hpp"
+#include "rvsim/Footprint.hpp"
+#include "rvsim/Plugin.hpp"
+#include "rvsim/ReplayTrace.hpp"
+#include "rvsim/ReuseDistance.hpp"
+#include "rvsim/Simulator.hpp"
 #include "rvsim/Trace.hpp"
+#include "rvsim/TraceWindow.hpp"
 #include "rvsim/SymbolInfo.hpp"
+#include "rvsim/Uart.hpp"
 
-const size_t DEFAULT_MEMORY_BASE_ADDRESS = 0x10000;
-const size_t DEFAULT_MEMORY_SIZE_BYTES   = 0x10000*4; // 1 KB
 const size_t DEFAULT_SIGNATURE_GRANULARITY = 4;
-
-#ifndef EM_RISCV
-#define EM_RISCV (243)
-#endif
+const size_t DEFAULT_BBV_INTERVAL = 100000000;
+const char *DEFAULT_STATS_COUNTERS = "mix,memory,branches,syscalls,pages,function";
+const char *DEFAULT_REUSE_LINE_SIZES = "64";
+const size_t DEFAULT_WORKING_SET_WINDOW = 1000000;
+const size_t DEFAULT_DATA_PROFILE_LINE_SIZE = 64;
+const char *DEFAULT_ILP_WINDOWS = "16,64,256,1024";
 
 #define PRINT_INFO(x) \
   if (rvsim::Config::getInstance().verbose) { \
@@ -48,167 +62,123 @@ static void help(const char *argv[]) {
   std::cout << "Optional arguments:\n";
   std::cout << "  -h,--help       Display this message\n";
   std::cout << "  -t,--trace      Enable instruction tracing\n";
+  std::cout << "  --trace-from T  Start tracing at trigger T\n";
+  std::cout << "  --trace-to T    Stop tracing at trigger T\n";
+  std::cout << "                  A trigger is a cycle count, pc:ADDRESS, sym:NAME (on entering or\n";
+  std::cout << "                  leaving a symbol) or hypercall (requested by the program)\n";
   std::cout << "  --max-cycles N  Limit the number of simulation cycles (default: 0)\n";
-  std::cout << "  --mem-base B    Set the memory base address in bytes (default: " << DEFAULT_MEMORY_BASE_ADDRESS << ")\n";
-  std::cout << "  --mem-size B    Set the memory size in bytes (default: " << DEFAULT_MEMORY_SIZE_BYTES << ")\n";
+  std::cout << "  --no-fusion     Do not execute common instruction pairs as fused operations\n";
+  std::cout << "  --no-idle-skip  Do not fast-forward through WFI and busy-wait loops to the next event\n";
+  std::cout << "  --mem-base B    Set the memory base address in bytes (default: " << rvsim::DEFAULT_MEMORY_BASE_ADDRESS << ")\n";
+  std::cout << "  --mem-size B    Set the memory size in bytes (default: " << rvsim::DEFAULT_MEMORY_SIZE_BYTES << ")\n";
   std::cout << "  --signature F   Write the test signature to file F on termination\n";
   std::cout << "  --signature-granularity N\n";
   std::cout << "                  Set the signature line size in bytes (default: " << DEFAULT_SIGNATURE_GRANULARITY << ")\n";
+  std::cout << "  --sandbox D     Allow the program to open files beneath host directory D\n";
+  std::cout << "  --buffer-output Buffer console output until the program exits\n";
+  std::cout << "  --image-cache D Load the program from a prebaked memory image in directory D,\n";
+  std::cout << "                  baking one there if it is not present\n";
+  std::cout << "  --devices       Map a CLINT timer at " << fmt::format("{:#x}", rvsim::CLINT_BASE_ADDRESS)
+            << " and a 16550 UART at " << fmt::format("{:#x}", rvsim::UART_BASE_ADDRESS) << "\n";
+  std::cout << "  --accelerate-libc\n";
+  std::cout << "                  Perform calls to memcpy, memmove, memset, memcmp and strlen on the host\n";
+  std::cout << "  --cosim F       Compare every retired instruction with the Spike commit log in file F\n";
+  std::cout << "                  (written with --log-commits), or with - read from stdin\n";
+  std::cout << "  --cosim-spike   Compare every retired instruction with the commit log of Spike running\n";
+  std::cout << "                  the same program\n";
+  std::cout << "  --plugin F[,A]   Load the plugin shared object F, passing it the argument string A\n";
+  std::cout << "  --flight-recorder N\n";
+  std::cout << "                  Keep the last N untraced steps and print them as a trace on an error,\n";
+  std::cout << "                  a non-zero exit or SIGINT\n";
+  std::cout << "  --bbv F         Write SimPoint basic block vectors to file F\n";
+  std::cout << "  --bbv-interval N\n";
+  std::cout << "                  Set the basic block vector interval in instructions (default: " << DEFAULT_BBV_INTERVAL << ")\n";
+  std::cout << "  --stats-interval N\n";
+  std::cout << "                  Write a snapshot of the statistics counters every N retired instructions\n";
+  std::cout << "  --stats-file F  Write the snapshots to file F rather than stderr\n";
+  std::cout << "  --stats-format csv|json\n";
+  std::cout << "                  Write the snapshots as CSV (the default) or as JSON lines\n";
+  std::cout << "  --stats-counters LIST\n";
+  std::cout << "                  Set the comma-separated counter groups to snapshot\n";
+  std::cout << "                  (default: " << DEFAULT_STATS_COUNTERS << ")\n";
+  std::cout << "  --reuse F       Write histograms of the reuse distances of instruction fetches and\n";
+  std::cout << "                  data accesses, in total and by function, to file F\n";
+  std::cout << "  --reuse-line-sizes LIST\n";
+  std::cout << "                  Set the comma-separated line sizes in bytes to measure reuse distances\n";
+  std::cout << "                  and working sets of (default: " << DEFAULT_REUSE_LINE_SIZES << ")\n";
+  std::cout << "  --working-set F Write the number of distinct lines accessed in each window to file F,\n";
+  std::cout << "                  with --reuse\n";
+  std::cout << "  --working-set-window N\n";
+  std::cout << "                  Set the working set window in instructions (default: " << DEFAULT_WORKING_SET_WINDOW << ")\n";
+  std::cout << "  --data-profile F\n";
+  std::cout << "                  Write the accesses to each data object, the stack and the heap to file F\n";
+  std::cout << "  --data-profile-line N\n";
+  std::cout << "                  Set the line size in bytes for counting the lines of data accessed\n";
+  std::cout << "                  (default: " << DEFAULT_DATA_PROFILE_LINE_SIZE << ")\n";
+  std::cout << "  --footprint F   Write the lowest stack pointer, the peak stack depth of each function\n";
+  std::cout << "                  and the pages touched in each region of the program to file F\n";
+  std::cout << "  --stack-guard A Stop with an error if the stack pointer is set below address A\n";
+  std::cout << "  --ilp F         Write the critical path and ideal IPC of the dataflow of the run, in\n";
+  std::cout << "                  machines with each instruction window size, to file F\n";
+  std::cout << "  --ilp-windows LIST\n";
+  std::cout << "                  Set the comma-separated window sizes, with 0 for an unlimited window\n";
+  std::cout << "                  (default: " << DEFAULT_ILP_WINDOWS << ")\n";
+  std::cout << "  --ilp-latencies LIST\n";
+  std::cout << "                  Set the latencies of classes of instructions, as a comma-separated list\n";
+  std::cout << "                  of alu, load, store, branch, jump or system=N (default: load=2, others 1)\n";
+  std::cout << "  --record F      Record a trace of the retired instructions to file F, to be replayed\n";
+  std::cout << "                  through timing models by rvsim-replay\n";
+  std::cout << "  --roi           Observe the program only in the region of interest, which begins at\n";
+  std::cout << "                  the program's first ROI begin hypercall\n";
+  std::cout << "  --checkpoint F  Write a checkpoint to file F at the cycle given by --checkpoint-at, or\n";
+  std::cout << "                  otherwise when the program requests one, and stop\n";
+  std::cout << "  --checkpoint-at N\n";
+  std::cout << "                  Set the cycle at which to write the checkpoint\n";
+  std::cout << "  --restore F     Resume the program from the checkpoint in file F\n";
+  std::cout << "  --intrinsic-cost N,M\n";
+  std::cout << "                  Charge N instructions per accelerated call and M per byte (default: 4,1)\n";
 }
 
-/// Write the memory between the begin_signature and end_signature symbols to a
-/// file, in the format expected by RISCOF. Each line holds one granule of
-/// bytes, most-significant byte first, and a trailing partial granule is padded
-/// with zeros. This matches the output of Spike so that the two signatures can
-/// be compared directly.
-void writeSignature(const char *filename, rvsim::SymbolInfo &symbolInfo,
-                    rvsim::Memory &memory, size_t granularity) {
-  auto *beginSymbol = symbolInfo.getSymbol("begin_signature");
-  auto *endSymbol = symbolInfo.getSymbol("end_signature");
-  if (beginSymbol == nullptr || endSymbol == nullptr) {
-    throw std::runtime_error("ELF file does not define begin_signature and end_signature");
-  }
-  if (endSymbol->value < beginSymbol->value) {
-    throw std::runtime_error("end_signature precedes begin_signature");
-  }
-  size_t length = endSymbol->value - beginSymbol->value;
-  std::vector<uint8_t> signature(length);
-  memory.read(beginSymbol->value, signature.data(), length);
-  std::ofstream file(filename);
-  if (!file) {
-    throw std::runtime_error(fmt::format("could not open signature file {}", filename));
-  }
-  for (size_t i = 0; i < length; i += granularity) {
-    for (size_t j = granularity; j > 0; j--) {
-      if (i + j <= length) {
-        file << fmt::format("{:02x}", signature[i + j - 1]);
-      } else {
-        file << "00";
-      }
+/// Step the executor by one instruction, calling the hooks of the observer
+/// if there is one, and, unless it trapped, compare its effects with the next
+/// record of the commit log. The instruction is fetched from the virtual pc
+/// through the MMU, as the step fetches it.
+template<typename... Observer>
+bool cosimStep(rvsim::Executor &executor, rvsim::Cosim &cosim, bool trace,
+               Observer &...observer) {
+  auto &state = executor.state;
+  auto pc = state.pc;
+  uint32_t instruction = 0;
+  if (executor.canFetch(pc, state.privilege)) {
+    uint8_t *host;
+    uint32_t physical;
+    if (executor.translate<rvsim::AccessType::FETCH>(pc, 4, host, physical) == rvsim::Trap::NONE &&
+        host != nullptr) {
+      std::memcpy(&instruction, host, sizeof(instruction));
     }
-    file << '\n';
-  }
-  PRINT_INFO(fmt::format("Wrote {} bytes of signature to {}\n", length, filename));
-}
-
-/// Load an ELF file into memory, populate the symbol table and return the
-/// entry point address recorded in the ELF header.
-uint32_t loadELF(const char *filename, rvsim::SymbolInfo &symbolInfo, rvsim::Memory &memory) {
-
-  // Load the binary file.
-  std::streampos fileSize;
-  std::ifstream file(filename, std::ios::binary);
-
-  // Get length of file.
-  file.seekg(0, std::ios::end);
-  fileSize = file.tellg();
-  file.seekg(0, std::ios::beg);
-
-  // Round up to nearest multiple of 4 bytes.
-  size_t vectorSize = roundUpToMultipleOf4(fileSize);
-
-  // Read the instructions into memory.
-  std::vector<uint32_t> elfContents(vectorSize);
-  auto elfContentsPtr = reinterpret_cast<char*>(elfContents.data());
-  file.read(elfContentsPtr, fileSize);
-
-  // Initialise the library.
-  if (elf_version(EV_CURRENT) == EV_NONE) {
-    throw std::runtime_error(fmt::format("ELF library initialisation failed: {}", elf_errmsg(-1)));
-  }
-
-  // Create an ELF data structure.
-  Elf *elf = elf_memory(elfContentsPtr, fileSize);
-  if (elf == nullptr) {
-    throw std::runtime_error(fmt::format("reading ELF file data: ", elf_errmsg(-1)));
-  }
-  if (elf_kind(elf) != ELF_K_ELF) {
-    throw std::runtime_error(fmt::format("{} is not an ELF object", filename));
-  }
-
-  // Obtain ELF header.
-  Elf32_Ehdr *header = elf32_getehdr(elf);
-  if (header == nullptr) {
-    throw std::runtime_error(fmt::format("reading ELF header failed: {}", elf_errmsg(-1)));
-  }
-
-  // Check ELF header information.
-  if (!(header->e_ident[EI_MAG0] == 0x7F &&
-        header->e_ident[EI_MAG1] == 'E' &&
-        header->e_ident[EI_MAG2] == 'L' &&
-        header->e_ident[EI_MAG3] == 'F')) {
-    throw std::runtime_error("Unexpected ELF header identifier");
-  }
-  if (header->e_ident[EI_CLASS] != ELFCLASS32) {
-    throw std::runtime_error("ELF file is not 32 bit");
-  }
-  if (header->e_ident[EI_DATA] != ELFDATA2LSB) {
-    throw std::runtime_error("ELF file is not little endian");
-  }
-  if (header->e_type != ET_EXEC) {
-    throw std::runtime_error("ELF file is not executable");
   }
-  if (header->e_machine != EM_RISCV) {
-    throw std::runtime_error("ELF file is not for RISC-V");
-  }
-  if (header->e_version != 1) {
-    throw std::runtime_error("unexpected ELF version");
-  }
-
-  // Get the number of program headers.
-  size_t numProgramHeaders = header->e_phnum;
-  if (numProgramHeaders == 0) {
-    throw std::runtime_error("no ELF program headers");
+  auto trapCount = executor.trapCount;
+  bool running = trace ? executor.step<true>(observer...) : executor.step<false>(observer...);
+  if (executor.trapCount == trapCount) {
+    cosim.retire(pc, instruction, state);
   }
+  return running;
+}
 
-  // Load program data via the program headers.
-  for (size_t i = 0; i < numProgramHeaders; i++) {
-    GElf_Phdr programHeader;
-    if (gelf_getphdr(elf, i, &programHeader) == nullptr) {
-      throw std::runtime_error(fmt::format("reading program header {} failed: {}", i, elf_errmsg(-1)));
-    }
-    if (programHeader.p_type == PT_LOAD) {
-      if (programHeader.p_offset > (unsigned long) fileSize) {
-        throw std::runtime_error("invalid ELF program offset");
-      }
-      uint32_t offset = programHeader.p_paddr - memory.baseAddress;
-      if (offset + programHeader.p_filesz > memory.sizeInBytes()) {
-        throw std::runtime_error(fmt::format("data from ELF program header {} does not fit in memory", i));
-      }
-      std::memcpy(memory.data() + offset, elfContentsPtr + programHeader.p_offset, programHeader.p_filesz);
-      PRINT_INFO(fmt::format("Loaded {} bytes into memory\n", programHeader.p_filesz));
-    }
-  }
+/// Set by SIGINT while the flight recorder is enabled, to stop the run.
+static volatile std::sig_atomic_t interrupted = 0;
 
-  // Find the symbol table.
-  Elf_Scn *section = nullptr;
-  GElf_Shdr sectionHeader;
-  while ((section = elf_nextscn(elf, section)) != nullptr) {
-    gelf_getshdr(section, &sectionHeader);
-    if (sectionHeader.sh_type == SHT_SYMTAB) {
-      break;
-    }
-  }
+static void handleInterrupt(int) {
+  interrupted = 1;
+}
 
-  // Read the symbol data.
-  Elf_Data *data = elf_getdata(section, nullptr);
-  if (data == nullptr) {
-    PRINT_INFO("No ELF symbol data\n");
-  } else {
-    size_t count = sectionHeader.sh_size / sectionHeader.sh_entsize;
-    for (size_t i = 0; i < count; i++) {
-      GElf_Sym symbol;
-      gelf_getsym(data, i, &symbol);
-      const char *name = elf_strptr(elf, sectionHeader.sh_link, symbol.st_name);
-      symbolInfo.addSymbol(name ? name : "", symbol.st_value, symbol.st_info);
-    }
+/// Print the steps leading up to a failure, if they have been recorded.
+static void dumpFlightRecord(rvsim::Executor &executor, rvsim::SymbolInfo &symbolInfo) {
+  if (executor.recorder.enabled()) {
+    std::cout.flush();
+    std::cerr << fmt::format("Last {} steps:\n", executor.recorder.size());
+    executor.recorder.dump(std::cerr, symbolInfo);
   }
-
-  uint32_t entryPoint = header->e_entry;
-
-  elf_end(elf);
-
-  return entryPoint;
 }
 
 int main(int argc, const char *argv[]) {
@@ -216,22 +186,57 @@ int main(int argc, const char *argv[]) {
     // Program options.
     const char *filename = nullptr;
     bool trace = false;
+    const char *traceFrom = nullptr;
+    const char *traceTo = nullptr;
     size_t maxCycles = 0;
-    size_t memBase = DEFAULT_MEMORY_BASE_ADDRESS;
-    size_t memSize = DEFAULT_MEMORY_SIZE_BYTES;
+    rvsim::SimulatorConfig config;
     const char *signatureFilename = nullptr;
     size_t signatureGranularity = DEFAULT_SIGNATURE_GRANULARITY;
+    const char *cosimLog = nullptr;
+    bool cosimSpike = false;
+    size_t flightRecords = 0;
+    std::vector<std::string> pluginSpecs;
+    const char *bbvFilename = nullptr;
+    size_t bbvInterval = DEFAULT_BBV_INTERVAL;
+    size_t statsInterval = 0;
+    const char *statsFilename = "";
+    bool statsJson = false;
+    const char *statsCounters = DEFAULT_STATS_COUNTERS;
+    const char *reuseFilename = nullptr;
+    const char *reuseLineSizes = DEFAULT_REUSE_LINE_SIZES;
+    const char *workingSetFilename = "";
+    size_t workingSetWindow = DEFAULT_WORKING_SET_WINDOW;
+    const char *dataProfileFilename = nullptr;
+    size_t dataProfileLineSize = DEFAULT_DATA_PROFILE_LINE_SIZE;
+    const char *footprintFilename = "";
+    const char *ilpFilename = nullptr;
+    const char *ilpWindows = DEFAULT_ILP_WINDOWS;
+    const char *ilpLatencies = "";
+    uint32_t stackGuard = 0;
+    const char *recordFilename = nullptr;
+    bool roi = false;
+    const char *checkpointFilename = nullptr;
+    size_t checkpointAt = 0;
+    const char *restoreFilename = nullptr;
     // Parse the command line.
     for (int i = 1; i < argc; ++i) {
       if (std::strcmp(argv[i], "-t") == 0 ||
           std::strcmp(argv[i], "--trace") == 0) {
         trace = true;
+      } else if (std::strcmp(argv[i], "--trace-from") == 0) {
+        traceFrom = argv[++i];
+      } else if (std::strcmp(argv[i], "--trace-to") == 0) {
+        traceTo = argv[++i];
       } else if (std::strcmp(argv[i], "--max-cycles") == 0) {
         maxCycles = std::stoull(argv[++i], nullptr, 0);
+      } else if (std::strcmp(argv[i], "--no-fusion") == 0) {
+        config.fusion = false;
+      } else if (std::strcmp(argv[i], "--no-idle-skip") == 0) {
+        config.idleSkip = false;
       } else if (std::strcmp(argv[i], "--mem-base") == 0) {
-        memBase = std::stoull(argv[++i], nullptr, 0);
+        config.memBase = std::stoull(argv[++i], nullptr, 0);
       } else if (std::strcmp(argv[i], "--mem-size") == 0) {
-        memSize = std::stoull(argv[++i], nullptr, 0);
+        config.memSize = std::stoull(argv[++i], nullptr, 0);
       } else if (std::strcmp(argv[i], "--signature") == 0) {
         signatureFilename = argv[++i];
       } else if (std::strcmp(argv[i], "--signature-granularity") == 0) {
@@ -239,6 +244,79 @@ int main(int argc, const char *argv[]) {
         if (signatureGranularity == 0) {
           throw std::runtime_error("signature granularity must be non zero");
         }
+      } else if (std::strcmp(argv[i], "--sandbox") == 0) {
+        config.sandboxDirectory = argv[++i];
+      } else if (std::strcmp(argv[i], "--buffer-output") == 0) {
+        config.bufferOutput = true;
+      } else if (std::strcmp(argv[i], "--image-cache") == 0) {
+        config.imageCache = argv[++i];
+      } else if (std::strcmp(argv[i], "--cosim") == 0) {
+        cosimLog = argv[++i];
+      } else if (std::strcmp(argv[i], "--cosim-spike") == 0) {
+        cosimSpike = true;
+      } else if (std::strcmp(argv[i], "--devices") == 0) {
+        config.devices = true;
+      } else if (std::strcmp(argv[i], "--accelerate-libc") == 0) {
+        config.accelerateLibc = true;
+      } else if (std::strcmp(argv[i], "--plugin") == 0) {
+        pluginSpecs.push_back(argv[++i]);
+      } else if (std::strcmp(argv[i], "--flight-recorder") == 0) {
+        flightRecords = std::stoull(argv[++i], nullptr, 0);
+      } else if (std::strcmp(argv[i], "--bbv") == 0) {
+        bbvFilename = argv[++i];
+      } else if (std::strcmp(argv[i], "--bbv-interval") == 0) {
+        bbvInterval = std::stoull(argv[++i], nullptr, 0);
+      } else if (std::strcmp(argv[i], "--stats-interval") == 0) {
+        statsInterval = std::stoull(argv[++i], nullptr, 0);
+      } else if (std::strcmp(argv[i], "--stats-file") == 0) {
+        statsFilename = argv[++i];
+      } else if (std::strcmp(argv[i], "--stats-format") == 0) {
+        std::string format(argv[++i]);
+        if (format != "csv" && format != "json") {
+          throw std::runtime_error("statistics format must be csv or json");
+        }
+        statsJson = format == "json";
+      } else if (std::strcmp(argv[i], "--stats-counters") == 0) {
+        statsCounters = argv[++i];
+      } else if (std::strcmp(argv[i], "--reuse") == 0) {
+        reuseFilename = argv[++i];
+      } else if (std::strcmp(argv[i], "--reuse-line-sizes") == 0) {
+        reuseLineSizes = argv[++i];
+      } else if (std::strcmp(argv[i], "--working-set") == 0) {
+        workingSetFilename = argv[++i];
+      } else if (std::strcmp(argv[i], "--working-set-window") == 0) {
+        workingSetWindow = std::stoull(argv[++i], nullptr, 0);
+      } else if (std::strcmp(argv[i], "--data-profile") == 0) {
+        dataProfileFilename = argv[++i];
+      } else if (std::strcmp(argv[i], "--data-profile-line") == 0) {
+        dataProfileLineSize = std::stoull(argv[++i], nullptr, 0);
+      } else if (std::strcmp(argv[i], "--footprint") == 0) {
+        footprintFilename = argv[++i];
+      } else if (std::strcmp(argv[i], "--stack-guard") == 0) {
+        stackGuard = std::stoul(argv[++i], nullptr, 0);
+      } else if (std::strcmp(argv[i], "--ilp") == 0) {
+        ilpFilename = argv[++i];
+      } else if (std::strcmp(argv[i], "--ilp-windows") == 0) {
+        ilpWindows = argv[++i];
+      } else if (std::strcmp(argv[i], "--ilp-latencies") == 0) {
+        ilpLatencies = argv[++i];
+      } else if (std::strcmp(argv[i], "--record") == 0) {
+        recordFilename = argv[++i];
+      } else if (std::strcmp(argv[i], "--roi") == 0) {
+        roi = true;
+      } else if (std::strcmp(argv[i], "--checkpoint") == 0) {
+        checkpointFilename = argv[++i];
+      } else if (std::strcmp(argv[i], "--checkpoint-at") == 0) {
+        checkpointAt = std::stoull(argv[++i], nullptr, 0);
+      } else if (std::strcmp(argv[i], "--restore") == 0) {
+        restoreFilename = argv[++i];
+      } else if (std::strcmp(argv[i], "--intrinsic-cost") == 0) {
+        size_t separator;
+        std::string costs(argv[++i]);
+        config.intrinsicCallCost = std::stoul(costs, &separator, 0);
+        if (separator < costs.size() && costs[separator] == ',') {
+          config.intrinsicByteCost = std::stoul(costs.substr(separator + 1), nullptr, 0);
+        }
       } else if (std::strcmp(argv[i], "-v") == 0 ||
                  std::strcmp(argv[i], "--verbose") == 0) {
         rvsim::Config::getInstance().verbose = true;
@@ -259,49 +337,304 @@ int main(int argc, const char *argv[]) {
       help(argv);
       return 1;
     }
-    // Instance the state and executor.
-    rvsim::SymbolInfo symbolInfo;
-    rvsim::HartState state(symbolInfo);
-    rvsim::Memory memory(memBase, memSize);
-    rvsim::Executor executor(state, memory);
-    // Load the ELF file.
-    auto entryPoint = loadELF(filename, symbolInfo, memory);
-    // Begin execution at _start when the program defines it, otherwise use the
-    // entry point from the ELF header. The architectural tests, for example,
-    // enter at rvtest_entry_point.
-    if (auto *startSymbol = symbolInfo.getSymbol("_start")) {
-      state.pc = startSymbol->value;
-    } else {
-      state.pc = entryPoint;
-    }
-    // Locate the HTIF words, which are placed differently by each linker
-    // script, falling back on the default addresses when they are not defined.
-    if (auto *toHostSymbol = symbolInfo.getSymbol("tohost")) {
-      auto *fromHostSymbol = symbolInfo.getSymbol("fromhost");
-      executor.setHTIFAddresses(toHostSymbol->value,
-                                fromHostSymbol ? fromHostSymbol->value
-                                               : toHostSymbol->value + 8);
-    }
-    // Step the model.
-    int exitCode = 0;
+    // Co-simulation compares instructions one at a time, so the instructions
+    // must not be fused, skipped or performed on the host.
+    if (cosimLog || cosimSpike) {
+      config.fusion = false;
+      config.idleSkip = false;
+      config.accelerateLibc = false;
+    }
+    // Instance the system and load the ELF file.
+    rvsim::Simulator simulator(config);
+    for (auto &spec : pluginSpecs) {
+      auto separator = spec.find(',');
+      simulator.plugins.load(spec.substr(0, separator),
+                             separator == std::string::npos ? "" : spec.substr(separator + 1));
+    }
+    simulator.loadFile(filename);
+    auto &symbolInfo = simulator.getSymbolInfo();
+    auto &state = simulator.getState();
+    auto &executor = simulator.getExecutor();
+    auto &plugins = simulator.plugins;
+    if (restoreFilename) {
+      rvsim::restoreCheckpoint(restoreFilename, executor);
+      PRINT_INFO(fmt::format("Restored {} at cycle {}\n", restoreFilename, state.cycleCount));
+    }
+    // Stop at the checkpoint, which fusion, idle skipping and accelerated
+    // library calls will not pass.
+    // Without a cycle, the checkpoint is taken when the program requests it.
+    if (checkpointFilename && checkpointAt != 0) {
+      if (checkpointAt <= state.cycleCount) {
+        throw std::runtime_error("--checkpoint requires --checkpoint-at with a later cycle");
+      }
+      if (maxCycles == 0 || checkpointAt < maxCycles) {
+        maxCycles = checkpointAt;
+      }
+    }
+    // Basic block vectors, interval statistics, reuse distances, data
+    // profiles, footprints, ILP limits and replay traces are collected by
+    // observer policies. A single policy is compiled into the step, and
+    // otherwise they are added to the plugins.
+    std::unique_ptr<rvsim::BasicBlockVectors> bbv;
+    if (bbvFilename) {
+      bbv = std::make_unique<rvsim::BasicBlockVectors>(bbvFilename, bbvInterval, state);
+    }
+    std::unique_ptr<rvsim::IntervalStats> stats;
+    if (statsInterval > 0) {
+      stats = std::make_unique<rvsim::IntervalStats>(statsFilename, statsJson,
+                                                     rvsim::parseStatsCounters(statsCounters),
+                                                     statsInterval, state);
+    }
+    std::unique_ptr<rvsim::ReuseDistance> reuse;
+    if (reuseFilename) {
+      reuse = std::make_unique<rvsim::ReuseDistance>(reuseFilename, workingSetFilename,
+                                                     reuseLineSizes, workingSetWindow, state);
+    } else if (*workingSetFilename) {
+      throw std::runtime_error("--working-set requires --reuse");
+    }
+    std::unique_ptr<rvsim::DataProfile> dataProfile;
+    if (dataProfileFilename) {
+      dataProfile = std::make_unique<rvsim::DataProfile>(dataProfileFilename,
+                                                         dataProfileLineSize, executor);
+    }
+    std::unique_ptr<rvsim::Footprint> footprint;
+    if (*footprintFilename || stackGuard != 0) {
+      footprint = std::make_unique<rvsim::Footprint>(footprintFilename, stackGuard, executor);
+    }
+    std::unique_ptr<rvsim::IlpLimits> ilp;
+    if (ilpFilename) {
+      ilp = std::make_unique<rvsim::IlpLimits>(ilpFilename, ilpWindows, ilpLatencies);
+    }
+    std::unique_ptr<rvsim::TraceRecorder> traceRecorder;
+    if (recordFilename) {
+      traceRecorder = std::make_unique<rvsim::TraceRecorder>(recordFilename);
+    }
+    if (!plugins.empty() ||
+        bool(bbv) + bool(stats) + bool(reuse) + bool(dataProfile) + bool(footprint) +
+          bool(ilp) + bool(traceRecorder) > 1) {
+      if (bbv) {
+        plugins.add(std::make_unique<rvsim::PolicyPlugin<rvsim::BasicBlockVectors>>(*bbv));
+      }
+      if (stats) {
+        plugins.add(std::make_unique<rvsim::PolicyPlugin<rvsim::IntervalStats>>(*stats));
+      }
+      if (reuse) {
+        plugins.add(std::make_unique<rvsim::PolicyPlugin<rvsim::ReuseDistance>>(*reuse));
+      }
+      if (dataProfile) {
+        plugins.add(std::make_unique<rvsim::PolicyPlugin<rvsim::DataProfile>>(*dataProfile));
+      }
+      if (footprint) {
+        plugins.add(std::make_unique<rvsim::PolicyPlugin<rvsim::Footprint>>(*footprint));
+      }
+      if (ilp) {
+        plugins.add(std::make_unique<rvsim::PolicyPlugin<rvsim::IlpLimits>>(*ilp));
+      }
+      if (traceRecorder) {
+        plugins.add(std::make_unique<rvsim::PolicyPlugin<rvsim::TraceRecorder>>(*traceRecorder));
+      }
+    }
+    std::unique_ptr<rvsim::Cosim> cosim;
+    if (cosimLog || cosimSpike) {
+      cosim = std::make_unique<rvsim::Cosim>();
+      if (cosimLog) {
+        cosim->log.open(cosimLog);
+      } else {
+        cosim->log.spawn({"spike", "--isa=rv32i_zicsr", "--log-commits",
+                          fmt::format("-m{:#x}:{:#x}", config.memBase, config.memSize),
+                          filename});
+      }
+    }
+    // Set up the window of execution to trace. Without a start trigger,
+    // tracing begins immediately when a stop trigger is given.
+    rvsim::TraceWindow traceWindow;
+    if (trace) {
+      traceWindow.traceAll();
+    }
+    if (traceFrom) {
+      traceWindow.from = rvsim::TraceTrigger::parse(traceFrom, symbolInfo, true);
+      if (!traceTo && traceWindow.from.kind == rvsim::TraceTrigger::HYPERCALL) {
+        traceWindow.to.kind = rvsim::TraceTrigger::HYPERCALL;
+      }
+    }
+    if (traceTo) {
+      if (!traceFrom) {
+        traceWindow.traceAll();
+      }
+      traceWindow.to = rvsim::TraceTrigger::parse(traceTo, symbolInfo, false);
+    }
+    // Fused instruction pairs and skipped idle cycles could step over the
+    // cycle or address that triggers the trace window, so they are only used
+    // when the window is controlled by the program.
+    auto programControlled = [](const rvsim::TraceTrigger &trigger) {
+      return trigger.kind == rvsim::TraceTrigger::NEVER ||
+             trigger.kind == rvsim::TraceTrigger::HYPERCALL;
+    };
+    executor.fusion = config.fusion && programControlled(traceWindow.from) &&
+                      programControlled(traceWindow.to);
+    executor.idleSkip = config.idleSkip && programControlled(traceWindow.from) &&
+                        programControlled(traceWindow.to);
+    if (maxCycles > 0) {
+      executor.cycleLimit = maxCycles;
+    }
+    executor.recorder.resize(flightRecords);
+    if (executor.recorder.enabled()) {
+      std::signal(SIGINT, handleInterrupt);
+    }
+    // Call a function with the observer of the run, if there is one: the
+    // plugins, or else the single observer policy.
+    auto withObserver = [&](auto &&function) {
+      if (!plugins.empty()) {
+        function(plugins);
+      } else if (bbv) {
+        function(*bbv);
+      } else if (stats) {
+        function(*stats);
+      } else if (reuse) {
+        function(*reuse);
+      } else if (dataProfile) {
+        function(*dataProfile);
+      } else if (footprint) {
+        function(*footprint);
+      } else if (ilp) {
+        function(*ilp);
+      } else if (traceRecorder) {
+        function(*traceRecorder);
+      }
+    };
+    auto control = [&](rvsim::Control request) {
+      withObserver([&](auto &observer) { observer.control(state, request); });
+    };
+    // Outside the region of interest the run is not observed, and the fast
+    // step is used.
+    bool roiActive = !roi;
+    if (!roiActive) {
+      control(rvsim::Control::ROI_END);
+    }
+    // Step the model, switching between the traced and untraced steps at the
+    // boundaries of the trace window, until the program exits or stops on a
+    // trap that it does not handle.
+    bool running = true;
+    bool checkpointNow = false;
     try {
-      while (true) {
-        if (trace) {
-          executor.step<true>();
-        } else {
-          executor.step<false>();
+      while (running && !interrupted) {
+        bool traced = traceWindow.enabled() && traceWindow.update(state);
+        bool observed = false;
+        if (roiActive) {
+          withObserver([&](auto &observer) {
+            if (cosim) {
+              running = cosimStep(executor, *cosim, traced, observer);
+            } else {
+              running = traced ? executor.step<true>(observer) : executor.step<false>(observer);
+            }
+            observed = true;
+          });
+        }
+        if (!observed) {
+          if (cosim) {
+            running = cosimStep(executor, *cosim, traced);
+          } else {
+            running = traced ? executor.step<true>() : executor.step<false>();
+          }
+        }
+        // Pass the requests of the program on to the trace window, which
+        // acts on them before the next step, and to the observers.
+        traceWindow.request(executor.traceStartRequest, executor.traceStopRequest);
+        if (roi && executor.roiBeginRequest && !roiActive) {
+          roiActive = true;
+          control(rvsim::Control::ROI_BEGIN);
+        }
+        if (roi && executor.roiEndRequest && roiActive) {
+          roiActive = false;
+          control(rvsim::Control::ROI_END);
         }
-        if (maxCycles > 0 && state.cycleCount == maxCycles) {
+        if (executor.statsResetRequest) {
+          control(rvsim::Control::STATS_RESET);
+        }
+        if (executor.statsDumpRequest) {
+          control(rvsim::Control::STATS_DUMP);
+        }
+        checkpointNow = checkpointFilename &&
+                        (checkpointAt == 0 ? executor.checkpointRequest
+                                           : state.cycleCount >= checkpointAt);
+        executor.traceStartRequest = false;
+        executor.traceStopRequest = false;
+        executor.roiBeginRequest = false;
+        executor.roiEndRequest = false;
+        executor.statsResetRequest = false;
+        executor.statsDumpRequest = false;
+        executor.checkpointRequest = false;
+        if (checkpointNow || (maxCycles > 0 && state.cycleCount >= maxCycles)) {
           break;
         }
       }
-    } catch (rvsim::ExitException &e) {
-      exitCode = e.returnValue;
+    } catch (std::exception &) {
+      dumpFlightRecord(executor, symbolInfo);
+      throw;
+    }
+    if (stats) {
+      stats->finish(state);
+    }
+    if (reuse) {
+      reuse->finish(state);
+    }
+    if (dataProfile) {
+      dataProfile->finish();
+    }
+    if (footprint) {
+      footprint->finish();
+    }
+    if (ilp) {
+      ilp->finish();
+    }
+    if (traceRecorder) {
+      traceRecorder->finish();
+      PRINT_INFO(fmt::format("Recorded {} instructions to {}\n",
+                             traceRecorder->getRecordCount(), recordFilename));
+    }
+    if (bbv) {
+      bbv->finish(state);
+      PRINT_INFO(fmt::format("Wrote {} intervals of {} basic blocks to {}\n",
+                             bbv->getIntervalCount(), bbv->getBlockCount(), bbvFilename));
+    }
+    if (checkpointNow && running) {
+      rvsim::saveCheckpoint(checkpointFilename, executor);
+      PRINT_INFO(fmt::format("Wrote checkpoint {} at cycle {}\n", checkpointFilename,
+                             state.cycleCount));
+      return 0;
+    }
+    int exitCode = executor.exitCode;
+    if (checkpointFilename && executor.status != rvsim::Status::RUNNING) {
+      std::cerr << fmt::format("Program ended at cycle {} before the checkpoint\n",
+                               state.cycleCount);
+      exitCode = 1;
+    }
+    if (cosim) {
+      PRINT_INFO(fmt::format("Co-simulation matched {} instructions\n", cosim->getCount()));
+    }
+    if (executor.status == rvsim::Status::TRAPPED) {
+      if (state.mcause & rvsim::MCAUSE_INTERRUPT) {
+        auto interrupt = static_cast<rvsim::Interrupt>(state.mcause & ~rvsim::MCAUSE_INTERRUPT);
+        std::cerr << fmt::format("Unhandled {} at pc {:#010x}\n",
+                                 rvsim::getInterruptName(interrupt), state.mepc);
+      } else {
+        std::cerr << fmt::format("Unhandled trap: {} at pc {:#010x} (mtval {:#010x})\n",
+                                 rvsim::getTrapName(static_cast<rvsim::Trap>(state.mcause)),
+                                 state.mepc, state.mtval);
+      }
+      exitCode = 1;
+    }
+    if (interrupted) {
+      std::cerr << fmt::format("Interrupted at cycle {}\n", state.cycleCount);
+      exitCode = 128 + SIGINT;
+    }
+    if (exitCode != 0) {
+      dumpFlightRecord(executor, symbolInfo);
     }
     // Report the contents of the signature region, which the architectural
     // tests compare against a reference model.
     if (signatureFilename) {
-      writeSignature(signatureFilename, symbolInfo, memory, signatureGranularity);
+      simulator.writeSignature(signatureFilename, signatureGranularity);
     }
     return exitCode;
   } catch (rvsim::Exception &e) {
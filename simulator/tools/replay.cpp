@@ -0,0 +1,105 @@
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "rvsim/Exception.hpp"
+#include "rvsim/ReplayTrace.hpp"
+#include "rvsim/TimingModels.hpp"
+
+static void help(const char *argv[]) {
+  std::cout << "Replay a trace recorded by rvsim --record through timing models\n";
+  std::cout << "\n";
+  std::cout << "Usage: " << argv[0] << " [options] file\n";
+  std::cout << "\n";
+  std::cout << "Positional arguments:\n";
+  std::cout << "  file  A trace file to replay\n";
+  std::cout << "\n";
+  std::cout << "Optional arguments:\n";
+  std::cout << "  -h,--help       Display this message\n";
+  std::cout << "  -m,--model M    Add the timing model M, one of:\n";
+  std::cout << "                    icache:SIZE:WAYS:LINE  an instruction cache\n";
+  std::cout << "                    dcache:SIZE:WAYS:LINE  a data cache\n";
+  std::cout << "                    bimodal:BITS           a bimodal predictor with 2^BITS counters\n";
+  std::cout << "                    gshare:BITS            a gshare predictor with BITS bits of history\n";
+  std::cout << "                  Sizes are in bytes, with an optional suffix of k or m\n";
+  std::cout << "  --models F      Add the timing models in file F, one per line, ignoring\n";
+  std::cout << "                  blank lines and those beginning with #\n";
+  std::cout << "  --threads N     Divide the models between N threads (default: the number of\n";
+  std::cout << "                  host cores)\n";
+  std::cout << "  -v,--verbose    Report the time taken\n";
+}
+
+int main(int argc, const char *argv[]) {
+  try {
+    const char *filename = nullptr;
+    std::vector<std::string> specs;
+    unsigned threads = std::thread::hardware_concurrency();
+    bool verbose = false;
+    for (int i = 1; i < argc; ++i) {
+      if (std::strcmp(argv[i], "-m") == 0 ||
+          std::strcmp(argv[i], "--model") == 0) {
+        specs.push_back(argv[++i]);
+      } else if (std::strcmp(argv[i], "--models") == 0) {
+        std::ifstream file(argv[++i]);
+        if (!file) {
+          throw std::runtime_error(fmt::format("could not open {}", argv[i]));
+        }
+        std::string line;
+        while (std::getline(file, line)) {
+          auto start = line.find_first_not_of(" \t");
+          if (start != std::string::npos && line[start] != '#') {
+            specs.push_back(line.substr(start, line.find_last_not_of(" \t") + 1 - start));
+          }
+        }
+      } else if (std::strcmp(argv[i], "--threads") == 0) {
+        threads = std::stoul(argv[++i], nullptr, 0);
+      } else if (std::strcmp(argv[i], "-v") == 0 ||
+                 std::strcmp(argv[i], "--verbose") == 0) {
+        verbose = true;
+      } else if (std::strcmp(argv[i], "-h") == 0 ||
+                 std::strcmp(argv[i], "--help") == 0) {
+        help(argv);
+        return 1;
+      } else if (!filename) {
+        filename = argv[i];
+      } else {
+        throw std::runtime_error("cannot specify more than one file");
+      }
+    }
+    if (!filename || specs.empty()) {
+      help(argv);
+      return 1;
+    }
+    std::vector<std::unique_ptr<rvsim::TimingModel>> models;
+    for (auto &spec : specs) {
+      models.push_back(rvsim::createTimingModel(spec));
+    }
+    rvsim::ReplayTrace trace(filename);
+    auto start = std::chrono::steady_clock::now();
+    rvsim::replayTimingModels(trace, models, threads);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    for (auto &model : models) {
+      std::cout << fmt::format("{} {}\n", model->getName(), model->report());
+    }
+    if (verbose) {
+      std::cerr << fmt::format("Replayed {} records through {} models in {:.3f}s\n",
+                               trace.size(), models.size(), elapsed.count());
+    }
+    return 0;
+  } catch (rvsim::Exception &e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  } catch (std::exception &e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+}
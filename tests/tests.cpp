@@ -1,5 +1,1561 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <iterator>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <elf.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
 #include <catch2/catch_test_macros.hpp>
 
+#include "rvsim/BasicBlockVectors.hpp"
+#include "rvsim/Checkpoint.hpp"
+#include "rvsim/Clint.hpp"
+#include "rvsim/Config.hpp"
+#include "rvsim/Cosim.hpp"
+#include "rvsim/DataProfile.hpp"
+#include "rvsim/Disassembler.hpp"
+#include "rvsim/Executor.hpp"
+#include "rvsim/FileDescriptors.hpp"
+#include "rvsim/Footprint.hpp"
+#include "rvsim/Fuzzer.hpp"
+#include "rvsim/IlpLimits.hpp"
+#include "rvsim/ImageCache.hpp"
+#include "rvsim/Instructions.hpp"
+#include "rvsim/IntervalStats.hpp"
+#include "rvsim/LaneExecutor.hpp"
+#include "rvsim/ReplayTrace.hpp"
+#include "rvsim/ReuseDistance.hpp"
+#include "rvsim/Simulator.hpp"
+#include "rvsim/TimingModels.hpp"
+#include "rvsim/Translation.hpp"
+#include "rvsim/Uart.hpp"
+#include "rvsim/rvsim.h"
+
+/// A hart and an executor with memory at 0x10000, for running programs
+/// written into memory by the test.
+template<size_t MEMORY_SIZE = 0x1000>
+struct TestHart {
+  rvsim::SymbolInfo symbolInfo;
+  rvsim::HartState state;
+  rvsim::Memory memory;
+  rvsim::Executor executor;
+
+  TestHart() : state(symbolInfo), memory(0x10000, MEMORY_SIZE), executor(state, memory) {}
+
+  /// Write consecutive words, such as instructions, from an address.
+  void load(uint32_t address, std::initializer_list<uint32_t> words) {
+    for (auto word : words) {
+      memory.writeMemoryWord(address, word);
+      address += 4;
+    }
+  }
+};
+
+/// A directory for the files written by a test, which is removed with them
+/// when it goes out of scope.
+class TempDirectory {
+  std::string path;
+
+public:
+  explicit TempDirectory(const std::string &name) {
+    auto pattern = "/tmp/rvsim-" + name + "-XXXXXX";
+    REQUIRE(mkdtemp(pattern.data()) != nullptr);
+    path = pattern;
+  }
+  ~TempDirectory() { std::filesystem::remove_all(path); }
+
+  TempDirectory(const TempDirectory &) = delete;
+  TempDirectory &operator=(const TempDirectory &) = delete;
+
+  const std::string &getPath() const { return path; }
+
+  /// Return the path of a file in the directory.
+  std::string file(const std::string &name) const { return path + "/" + name; }
+};
+
+/// Require the lines of a file to be exactly those expected.
+static void requireLines(const std::string &path, std::initializer_list<const char*> expected) {
+  std::ifstream file(path);
+  std::string line;
+  for (auto *text : expected) {
+    REQUIRE(std::getline(file, line));
+    REQUIRE(line == text);
+  }
+  REQUIRE(!std::getline(file, line));
+}
+
+/// Write an ELF executable for rvsim that loads words at an address and
+/// starts there. Without symbols, the HTIF words are at their default
+/// addresses, so the driver is run with memory from 0x2000 to hold them.
+static void writeElf(const std::string &path, uint32_t address,
+                     std::initializer_list<uint32_t> words) {
+  Elf32_Ehdr header = {};
+  std::memcpy(header.e_ident, ELFMAG, SELFMAG);
+  header.e_ident[EI_CLASS] = ELFCLASS32;
+  header.e_ident[EI_DATA] = ELFDATA2LSB;
+  header.e_ident[EI_VERSION] = EV_CURRENT;
+  header.e_type = ET_EXEC;
+  header.e_machine = EM_RISCV;
+  header.e_version = EV_CURRENT;
+  header.e_entry = address;
+  header.e_phoff = sizeof(header);
+  header.e_ehsize = sizeof(header);
+  header.e_phentsize = sizeof(Elf32_Phdr);
+  header.e_phnum = 1;
+  Elf32_Phdr segment = {};
+  segment.p_type = PT_LOAD;
+  segment.p_offset = sizeof(header) + sizeof(segment);
+  segment.p_vaddr = address;
+  segment.p_paddr = address;
+  segment.p_filesz = words.size() * sizeof(uint32_t);
+  segment.p_memsz = segment.p_filesz;
+  segment.p_flags = PF_R | PF_W | PF_X;
+  std::ofstream file(path, std::ios::binary);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char*>(&segment), sizeof(segment));
+  file.write(reinterpret_cast<const char*>(std::data(words)), segment.p_filesz);
+}
+
+/// Run the rvsim driver with arguments, returning its exit status and what
+/// it writes to stdout and stderr.
+static int runDriver(const std::string &arguments, std::string &output) {
+  auto command = std::string(RVSIM_DRIVER) + " --mem-base 0x2000 " + arguments + " 2>&1";
+  auto *pipe = popen(command.c_str(), "r");
+  REQUIRE(pipe != nullptr);
+  output.clear();
+  char buffer[4096];
+  for (size_t count; (count = std::fread(buffer, 1, sizeof(buffer), pipe)) > 0;) {
+    output.append(buffer, count);
+  }
+  auto status = pclose(pipe);
+  REQUIRE(WIFEXITED(status));
+  return WEXITSTATUS(status);
+}
+
+/// Return the addresses of the instructions in a trace.
+static std::vector<uint32_t> tracedAddresses(const std::string &trace) {
+  std::vector<uint32_t> addresses;
+  std::istringstream lines(trace);
+  for (std::string line; std::getline(lines, line);) {
+    std::istringstream fields(line);
+    uint64_t cycle;
+    std::string pc;
+    if (fields >> cycle >> pc && pc.rfind("0x", 0) == 0) {
+      addresses.push_back(std::stoul(pc, nullptr, 16));
+    }
+  }
+  return addresses;
+}
+
 TEST_CASE("foo", "[single-file]") {
   REQUIRE(1);
 }
+
+TEST_CASE("decode", "[decode]") {
+  REQUIRE(rvsim::decode(0x02A50513) == rvsim::Operation::ADDI);  // addi a0, a0, 42
+  REQUIRE(rvsim::decode(0x40B50533) == rvsim::Operation::SUB);   // sub a0, a0, a1
+  REQUIRE(rvsim::decode(0x40355513) == rvsim::Operation::SRAI);  // srai a0, a0, 3
+  REQUIRE(rvsim::decode(0x00355513) == rvsim::Operation::SRLI);  // srli a0, a0, 3
+  REQUIRE(rvsim::decode(0x00100073) == rvsim::Operation::EBREAK);
+  REQUIRE(rvsim::decode(0x00000073) == rvsim::Operation::ECALL);
+  REQUIRE(rvsim::decode(0x00000000) == rvsim::Operation::ILLEGAL);
+  REQUIRE(rvsim::decode(0xFFFFFFFF) == rvsim::Operation::ILLEGAL);
+  // A shift with a non-zero funct7 other than SRAI's is illegal.
+  REQUIRE(rvsim::decode(0x02355513) == rvsim::Operation::ILLEGAL);
+}
+
+TEST_CASE("disassemble", "[decode]") {
+  REQUIRE(rvsim::disassemble(0x02A50513) == "addi x10, x10, 42");
+  REQUIRE(rvsim::disassemble(0xFFC52583) == "lw x11, -4(x10)");
+  REQUIRE(rvsim::disassemble(0x00B52223) == "sw x11, 4(x10)");
+  REQUIRE(rvsim::disassemble(0xFE050EE3) == "beq x10, x0, -4");
+  REQUIRE(rvsim::disassemble(0x123452B7) == "lui x5, 0x12345");
+  REQUIRE(rvsim::disassemble(0x00000073) == "ecall");
+}
+
+TEST_CASE("file descriptors", "[syscall]") {
+  TempDirectory directory("sandbox");
+  TempDirectory outside("outside");
+  rvsim::FileDescriptors fileDescs;
+  REQUIRE(fileDescs.open("data", 0, 0) == -EACCES);
+  fileDescs.setSandbox(directory.getPath());
+  // Files are created beneath the sandbox, with absolute paths resolved
+  // against it, and take the lowest free descriptor.
+  const uint32_t create = 2 | rvsim::GUEST_O_CREAT | rvsim::GUEST_O_TRUNC;
+  int fd = fileDescs.open("/data", create, 0644);
+  REQUIRE(fd == 3);
+  const uint8_t text[] = "hello";
+  REQUIRE(fileDescs.write(fd, text, 5) == 5);
+  REQUIRE(fileDescs.lseek(fd, 1, SEEK_SET) == 1);
+  uint8_t buffer[8] = {};
+  REQUIRE(fileDescs.read(fd, buffer, sizeof(buffer)) == 4);
+  REQUIRE(std::string(reinterpret_cast<char*>(buffer), 4) == "ello");
+  REQUIRE(fileDescs.lseek(fd, 0, 7) == -EINVAL);
+  rvsim::GuestStat stat;
+  REQUIRE(fileDescs.fstat(fd, stat) == 0);
+  REQUIRE(stat.size == 5);
+  REQUIRE(S_ISREG(stat.mode));
+  REQUIRE(fileDescs.open("data", 0, 0) == 4);
+  REQUIRE(fileDescs.close(fd) == 0);
+  REQUIRE(fileDescs.close(fd) == -EBADF);
+  REQUIRE(fileDescs.fstat(fd, stat) == -EBADF);
+  REQUIRE(fileDescs.open("data", rvsim::GUEST_O_CREAT | rvsim::GUEST_O_EXCL | 1, 0644) ==
+          -EEXIST);
+  REQUIRE(fileDescs.open("missing", 0, 0) == -ENOENT);
+  fd = fileDescs.open("data", 0, 0);
+  REQUIRE(fd == 3);
+  REQUIRE(fileDescs.write(fd, text, 5) == -EBADF);
+  REQUIRE(fileDescs.close(fd) == 0);
+  // Neither ".." nor a symbolic link leads out of the sandbox.
+  std::ofstream(outside.file("secret")) << "secret";
+  std::filesystem::create_directory(directory.file("sub"));
+  std::filesystem::create_symlink(outside.file("secret"), directory.file("absolute"));
+  std::filesystem::create_symlink("../../" + outside.getPath().substr(5) + "/secret",
+                                  directory.file("sub/relative"));
+  std::filesystem::create_directory_symlink(outside.getPath(), directory.file("linked"));
+  REQUIRE(fileDescs.open("../secret", 0, 0) == -EACCES);
+  REQUIRE(fileDescs.open("sub/../../secret", 0, 0) == -EACCES);
+  REQUIRE(fileDescs.open("absolute", 0, 0) < 0);
+  REQUIRE(fileDescs.open("sub/relative", 0, 0) < 0);
+  REQUIRE(fileDescs.open("linked/secret", 0, 0) < 0);
+  REQUIRE(fileDescs.open("linked/new", create, 0644) < 0);
+  REQUIRE(!std::filesystem::exists(outside.file("new")));
+}
+
+TEST_CASE_METHOD(TestHart<>, "HTIF system calls", "[syscall]") {
+  TempDirectory directory("htif");
+  executor.fileDescs.setSandbox(directory.getPath());
+  executor.setHTIFAddresses(0x10F00, 0x10F08);
+  executor.setProgramBreak(0x10E00);
+  load(0x10000, {0x00A2A023}); // sw x10, 0(x5)
+  std::memcpy(memory.hostPtr(0x10A00, 5), "data", 5);
+  std::memcpy(memory.hostPtr(0x10B00, 5), "hello", 5);
+  // Store the address of an argument block to tohost, and return the result
+  // written over its first word.
+  auto syscall = [&](std::initializer_list<uint64_t> args) {
+    uint32_t address = 0x10800;
+    for (auto arg : args) {
+      memory.writeMemoryDoubleWord(address, arg);
+      address += 8;
+    }
+    memory.writeMemoryDoubleWord(0x10F08, 0);
+    state.pc = 0x10000;
+    state.writeReg(rvsim::Register::x5, 0x10F00);
+    state.writeReg(rvsim::Register::x10, 0x10800);
+    REQUIRE(executor.step<false>());
+    REQUIRE(memory.readMemoryDoubleWord(0x10F00) == 0);
+    REQUIRE(memory.readMemoryDoubleWord(0x10F08) == 1);
+    return static_cast<int64_t>(memory.readMemoryDoubleWord(0x10800));
+  };
+  using rvsim::Syscall;
+  const uint64_t create = 2 | rvsim::GUEST_O_CREAT | rvsim::GUEST_O_TRUNC;
+  REQUIRE(syscall({Syscall::OPENAT, static_cast<uint64_t>(-100), 0x10A00, create, 0644}) == 3);
+  REQUIRE(syscall({Syscall::WRITE, 3, 0x10B00, 5}) == 5);
+  REQUIRE(syscall({Syscall::LSEEK, 3, 1, SEEK_SET}) == 1);
+  // Reads are made into guest memory, and the end of the file is signalled
+  // like any other result.
+  REQUIRE(syscall({Syscall::READ, 3, 0x10C00, 16}) == 4);
+  REQUIRE(std::string(reinterpret_cast<char*>(memory.hostPtr(0x10C00, 4)), 4) == "ello");
+  REQUIRE(syscall({Syscall::READ, 3, 0x10C00, 16}) == 0);
+  REQUIRE(syscall({Syscall::FSTAT, 3, 0x10D00}) == 0);
+  rvsim::GuestStat stat;
+  std::memcpy(&stat, memory.hostPtr(0x10D00, sizeof(stat)), sizeof(stat));
+  REQUIRE(stat.size == 5);
+  // Buffers outside memory are refused.
+  REQUIRE(syscall({Syscall::READ, 3, 0x10FF0, 0x100}) == -EFAULT);
+  REQUIRE(syscall({Syscall::WRITE, 3, 0x20000, 1}) == -EFAULT);
+  REQUIRE(syscall({Syscall::FSTAT, 3, 0x10FF0}) == -EFAULT);
+  REQUIRE(syscall({Syscall::OPENAT, static_cast<uint64_t>(-100), 0x20000, 0, 0}) == -EFAULT);
+  REQUIRE(syscall({Syscall::CLOSE, 3}) == 0);
+  REQUIRE(syscall({Syscall::CLOSE, 3}) == -EBADF);
+  // The break moves within memory.
+  REQUIRE(syscall({Syscall::BRK, 0}) == 0x10E00);
+  REQUIRE(syscall({Syscall::BRK, 0x10E80}) == 0x10E80);
+  REQUIRE(syscall({Syscall::BRK, 0x20000}) == 0x10E80);
+  REQUIRE(syscall({Syscall::GETTIMEOFDAY, 0x10D80}) == 0);
+  REQUIRE(memory.readMemoryDoubleWord(0x10D80) > 0);
+  REQUIRE(syscall({Syscall::GETTIMEOFDAY, 0x10FFC}) == -EFAULT);
+  // An argument block outside memory stops the run.
+  state.pc = 0x10000;
+  state.writeReg(rvsim::Register::x10, 0x20000);
+  REQUIRE_THROWS_AS(executor.step<false>(), rvsim::Exception);
+}
+
+TEST_CASE_METHOD(TestHart<>, "trap", "[trap]") {
+  executor.setHTIFAddresses(0x10800, 0x10808);
+  load(0x10000, {0x00052583}); // lw x11, 0(x10)
+  load(0x10100, {0x30200073}); // mret
+  state.pc = 0x10000;
+  state.mtvec = 0x10100;
+  state.writeReg(rvsim::Register::x10, 0x10002);
+  // A misaligned load enters the handler without writing rd.
+  REQUIRE(executor.step<false>());
+  REQUIRE(state.pc == 0x10100);
+  REQUIRE(state.mepc == 0x10000);
+  REQUIRE(state.mcause == static_cast<uint32_t>(rvsim::Trap::LOAD_ADDRESS_MISALIGNED));
+  REQUIRE(state.mtval == 0x10002);
+  REQUIRE(state.readReg(rvsim::Register::x11) == 0);
+  // Returning re-executes the load, which now faults outside of memory.
+  state.writeReg(rvsim::Register::x10, 0x20000);
+  REQUIRE(executor.step<false>());
+  REQUIRE(state.pc == 0x10000);
+  REQUIRE(executor.step<false>());
+  REQUIRE(state.mcause == static_cast<uint32_t>(rvsim::Trap::LOAD_ACCESS_FAULT));
+  // Without a handler in memory, execution stops.
+  state.mtvec = 0;
+  state.pc = 0x10004;
+  REQUIRE(!executor.step<false>());
+  REQUIRE(executor.status == rvsim::Status::TRAPPED);
+  REQUIRE(state.mcause == static_cast<uint32_t>(rvsim::Trap::ILLEGAL_INSTRUCTION));
+}
+
+TEST_CASE_METHOD(TestHart<>, "flight recorder", "[trace]") {
+  executor.setHTIFAddresses(0x10800, 0x10808);
+  executor.recorder.resize(2);
+  load(0x10000, {
+    0x00150513, // addi x10, x10, 1
+    0x00A5A023, // sw x10, 0(x11)
+    0x00000000, // illegal
+  });
+  state.pc = 0x10000;
+  state.writeReg(rvsim::Register::x11, 0x10400);
+  REQUIRE(executor.step<false>());
+  REQUIRE(executor.step<false>());
+  REQUIRE(!executor.step<false>());
+  // Only the last two steps are kept, in the format of the trace.
+  std::ostringstream out;
+  executor.recorder.dump(out, symbolInfo);
+  REQUIRE(out.str() ==
+          "1        0x10004    SW      x10 (0x1) x11 (0x10400) 0 mem[0x10400]=0x1 \n"
+          "2        0x10008    TRAP    illegal instruction 0 \n");
+}
+
+TEST_CASE("hypercall trace window", "[trace]") {
+  TempDirectory directory("trace");
+  auto path = directory.file("program.elf");
+  writeElf(path, 0x3000, {
+    0x000022B7, // lui x5, 0x2 (tohost)
+    0x00003337, // lui x6, 0x3
+    0x03030513, // addi x10, x6, 0x30
+    0x03830713, // addi x14, x6, 0x38
+    0x00A2A023, // sw x10, 0(x5) (trace start)
+    0x00A585B3, // add x11, x11, x10
+    0x00A60633, // add x12, x12, x10
+    0x00E2A023, // sw x14, 0(x5) (trace stop)
+    0x00A686B3, // add x13, x13, x10
+    0x04030513, // addi x10, x6, 0x40
+    0x00A2A023, // sw x10, 0(x5) (exit)
+    0x00000000,
+    rvsim::Syscall::TRACE_START, 0,
+    rvsim::Syscall::TRACE_STOP, 0,
+    rvsim::Syscall::EXIT, 0,
+  });
+  // The window holds the instructions after the start call, up to and
+  // including the stop call.
+  std::string output;
+  REQUIRE(runDriver("--trace-from hypercall " + path, output) == 0);
+  REQUIRE(tracedAddresses(output) == std::vector<uint32_t>{0x3014, 0x3018, 0x301C});
+  REQUIRE(runDriver("--trace-from 5 --trace-to 7 " + path, output) == 0);
+  REQUIRE(tracedAddresses(output) == std::vector<uint32_t>{0x3014, 0x3018});
+  REQUIRE(runDriver(path, output) == 0);
+  REQUIRE(output.empty());
+}
+
+TEST_CASE("fusion", "[fusion]") {
+  // Run the four fused idioms, ending with a PC-relative load that faults,
+  // up to a cycle limit, with or without fusion.
+  struct Run : TestHart<> {
+    unsigned steps = 0;
+    std::string record;
+
+    Run(bool fusion, uint64_t limit) {
+      load(0x10000, {
+        0x123452B7, // lui x5, 0x12345
+        0x67828293, // addi x5, x5, 0x678
+        0x01049413, // slli x8, x9, 16
+        0x01045413, // srli x8, x8, 16
+        0x00000397, // auipc x7, 0
+        0x1003A383, // lw x7, 0x100(x7)
+        0x00000097, // auipc x1, 0
+        0x00C080E7, // jalr x1, 12(x1)
+        0x00000000, // illegal
+        0x00010397, // auipc x7, 0x10
+        0x0003A383, // lw x7, 0(x7)
+      });
+      memory.writeMemoryWord(0x10110, 0xDEADBEEF);
+      state.pc = 0x10000;
+      state.writeReg(rvsim::Register::x9, 0xABCD1234);
+      executor.fusion = fusion;
+      executor.cycleLimit = limit;
+      executor.recorder.resize(16);
+      for (; state.cycleCount < limit && executor.step<false>(); steps++) {
+      }
+      std::ostringstream out;
+      executor.recorder.dump(out, symbolInfo);
+      record = out.str();
+    }
+  };
+  auto requireSame = [](Run &fused, Run &unfused) {
+    REQUIRE(fused.state.pc == unfused.state.pc);
+    REQUIRE(fused.state.cycleCount == unfused.state.cycleCount);
+    for (unsigned index = 0; index < rvsim::NUM_REGISTERS; index++) {
+      REQUIRE(fused.state.readReg(index) == unfused.state.readReg(index));
+    }
+    REQUIRE(fused.executor.status == unfused.executor.status);
+    REQUIRE(fused.state.mcause == unfused.state.mcause);
+    REQUIRE(fused.state.mepc == unfused.state.mepc);
+    REQUIRE(fused.state.mtval == unfused.state.mtval);
+    REQUIRE(fused.record == unfused.record);
+  };
+  // Every pair is fused, except for the faulting load, which traps as it
+  // would unfused.
+  Run fused(true, UINT64_MAX);
+  Run unfused(false, UINT64_MAX);
+  requireSame(fused, unfused);
+  REQUIRE(unfused.steps == 9);
+  REQUIRE(fused.steps == 5);
+  REQUIRE(fused.executor.status == rvsim::Status::TRAPPED);
+  REQUIRE(fused.state.mcause == static_cast<uint32_t>(rvsim::Trap::LOAD_ACCESS_FAULT));
+  REQUIRE(fused.state.cycleCount == 10);
+  REQUIRE(fused.state.mtval == 0x20024);
+  REQUIRE(fused.state.readReg(rvsim::Register::x5) == 0x12345678);
+  REQUIRE(fused.state.readReg(rvsim::Register::x8) == 0x1234);
+  REQUIRE(fused.state.readReg(rvsim::Register::x1) == 0x10020);
+  REQUIRE(fused.state.readReg(rvsim::Register::x7) == 0x20024);
+  // A cycle limit between the instructions of a pair stops between them.
+  for (uint64_t limit = 1; limit < 10; limit++) {
+    Run limitedFused(true, limit);
+    Run limitedUnfused(false, limit);
+    REQUIRE(limitedFused.state.cycleCount == limit);
+    requireSame(limitedFused, limitedUnfused);
+  }
+}
+
+/// A policy that counts the events it observes.
+struct CountingObserver : rvsim::ObserverPolicy {
+  static constexpr unsigned HOOKS = rvsim::HOOK_RETIRE | rvsim::HOOK_MEMORY |
+                                    rvsim::HOOK_BRANCH | rvsim::HOOK_EXIT;
+  unsigned retired = 0;
+  unsigned stores = 0;
+  unsigned taken = 0;
+  bool exited = false;
+  uint32_t lastStore = 0;
+
+  void retire(const rvsim::HartState &, uint32_t, uint32_t) { retired++; }
+  void memoryAccess(const rvsim::HartState &, const rvsim::MemoryAccess &access) {
+    stores += access.store;
+    lastStore = access.address;
+  }
+  void branch(const rvsim::HartState &, uint32_t, uint32_t, bool isTaken) { taken += isTaken; }
+  void exit(const rvsim::HartState &, bool trapped, uint32_t) { exited = trapped; }
+};
+
+TEST_CASE_METHOD(TestHart<>, "observer policy", "[plugin]") {
+  executor.setHTIFAddresses(0x10800, 0x10808);
+  load(0x10000, {
+    0x123452B7, // lui x5, 0x12345
+    0x67828293, // addi x5, x5, 0x678
+    0x0055A223, // sw x5, 4(x11)
+    0x00000463, // beq x0, x0, 8
+  });
+  load(0x10014, {0x00000000}); // illegal
+  state.pc = 0x10000;
+  state.writeReg(rvsim::Register::x11, 0x10400);
+  CountingObserver observer;
+  while (executor.step<false>(observer)) {}
+  // The fusible pair is observed as two instructions, and the trap does
+  // not retire.
+  REQUIRE(observer.retired == 4);
+  REQUIRE(observer.stores == 1);
+  REQUIRE(observer.lastStore == 0x10404);
+  REQUIRE(observer.taken == 1);
+  REQUIRE(observer.exited);
+}
+
+TEST_CASE_METHOD(TestHart<>, "timer interrupt", "[devices]") {
+  executor.setHTIFAddresses(0x10800, 0x10808);
+  executor.bus.attach(std::make_unique<rvsim::Clint>(state, executor.events), memory);
+  for (uint32_t address = 0x10000; address < 0x10100; address += 4) {
+    memory.writeMemoryWord(address, 0x00000013); // nop
+  }
+  state.pc = 0x10000;
+  state.mtvec = 0x10100;
+  state.mie = rvsim::MIP_MTIP;
+  state.mstatus |= rvsim::MSTATUS_MIE;
+  // Store to mtimecmp, then step up to the cycle it names.
+  state.writeReg(rvsim::Register::x10, rvsim::CLINT_BASE_ADDRESS + 0x4000);
+  state.writeReg(rvsim::Register::x11, 10);
+  load(0x10000, {
+    0x00052223, // sw x0, 4(x10)
+    0x00B52023, // sw x11, 0(x10)
+  });
+  while (state.cycleCount < 9) {
+    REQUIRE(executor.step<false>());
+    REQUIRE(state.pc != 0x10100);
+  }
+  REQUIRE(executor.step<false>());
+  REQUIRE(state.pc == 0x10100);
+  REQUIRE(state.mepc == 0x10028);
+  REQUIRE(state.mcause == (rvsim::MCAUSE_INTERRUPT | 7));
+}
+
+TEST_CASE_METHOD(TestHart<>, "timer reprogramming", "[devices]") {
+  rvsim::Clint clint(state, executor.events);
+  // Moving mtimecmp, as a kernel does on every tick, replaces the pending
+  // event rather than adding to the queue.
+  clint.write(0x4004, 4, 0);
+  for (uint32_t mtimecmp = 1000; mtimecmp > 100; mtimecmp -= 100) {
+    clint.write(0x4000, 4, mtimecmp);
+    REQUIRE(executor.events.pending() == 1);
+  }
+  clint.write(0x4000, 4, 500);
+  REQUIRE(executor.events.pending() == 1);
+  // Writing mtime past mtimecmp raises the interrupt, leaving nothing to wait
+  // for.
+  clint.write(0xBFF8, 4, 600);
+  REQUIRE(executor.events.pending() == 0);
+  REQUIRE(state.mip & rvsim::MIP_MTIP);
+  clint.write(0x4000, 4, 700);
+  REQUIRE_FALSE(state.mip & rvsim::MIP_MTIP);
+  executor.events.service(state.cycleCount);
+  REQUIRE(executor.events.nextCycle() == 100);
+  state.cycleCount = 100;
+  executor.events.service(state.cycleCount);
+  REQUIRE(state.mip & rvsim::MIP_MTIP);
+  REQUIRE(executor.events.pending() == 0);
+}
+
+TEST_CASE_METHOD(TestHart<>, "libc intrinsics", "[intrinsics]") {
+  // Each function returns at once when it is simulated rather than performed
+  // on the host.
+  const std::pair<const char*, uint32_t> functions[] = {
+    {"memcpy", 0x10800}, {"memmove", 0x10810}, {"memset", 0x10820},
+    {"memcmp", 0x10830}, {"strlen", 0x10840},
+  };
+  for (auto &function : functions) {
+    symbolInfo.addSymbol(function.first, function.second, STT_FUNC);
+    load(function.second, {0x00008067}); // ret
+  }
+  executor.intrinsics.callCost = 10;
+  executor.intrinsics.byteCost = 2;
+  executor.intrinsics.bind(symbolInfo);
+  load(0x10000, {0x000280E7}); // jalr x1, 0(x5)
+  auto setString = [&](uint32_t address, const char *text) {
+    std::memcpy(memory.hostPtr(address, std::strlen(text) + 1), text, std::strlen(text) + 1);
+  };
+  auto getString = [&](uint32_t address) {
+    return std::string(reinterpret_cast<char*>(memory.hostPtr(address, 1)));
+  };
+  // Call a function from 0x10000, returning the cycles taken by the call.
+  auto call = [&](uint32_t entry, uint32_t a0, uint32_t a1, uint32_t a2) {
+    state.pc = 0x10000;
+    state.writeReg(rvsim::Register::x5, entry);
+    state.writeReg(rvsim::Register::x10, a0);
+    state.writeReg(rvsim::Register::x11, a1);
+    state.writeReg(rvsim::Register::x12, a2);
+    auto cycle = state.cycleCount;
+    REQUIRE(executor.step<false>());
+    return state.cycleCount - cycle;
+  };
+  auto result = [&]() { return static_cast<int32_t>(state.readReg(rvsim::Register::x10)); };
+
+  // An overlapping memcpy copies forwards a byte at a time, and memmove
+  // copies as if through a temporary buffer. Each is charged the call and
+  // the bytes copied, besides the jump.
+  setString(0x10400, "abcdef");
+  REQUIRE(call(0x10800, 0x10401, 0x10400, 4) == 1 + 10 + 2 * 4);
+  REQUIRE(state.pc == 0x10004);
+  REQUIRE(result() == 0x10401);
+  REQUIRE(getString(0x10400) == "aaaaaf");
+  setString(0x10400, "abcdef");
+  call(0x10810, 0x10401, 0x10400, 4);
+  REQUIRE(getString(0x10400) == "aabcdf");
+  // memset stores the low byte of its value.
+  call(0x10820, 0x10400, 0x1241, 3);
+  REQUIRE(getString(0x10400) == "AAAcdf");
+  // memcmp is charged up to the first difference.
+  setString(0x10400, "abc");
+  setString(0x10410, "abd");
+  REQUIRE(call(0x10830, 0x10400, 0x10410, 3) == 1 + 10 + 2 * 2);
+  REQUIRE(result() < 0);
+  call(0x10830, 0x10410, 0x10400, 3);
+  REQUIRE(result() > 0);
+  call(0x10830, 0x10400, 0x10410, 2);
+  REQUIRE(result() == 0);
+  REQUIRE(call(0x10840, 0x10400, 0, 0) == 1 + 10 + 2 * 4);
+  REQUIRE(result() == 3);
+
+  // Otherwise, the function is entered and simulated.
+  auto requireSimulated = [&](uint32_t entry) {
+    REQUIRE(state.pc == entry);
+    REQUIRE(executor.step<false>());
+    REQUIRE(state.pc == 0x10004);
+  };
+  // An operand out of memory.
+  REQUIRE(call(0x10800, 0x10400, 0x10F00, 0x200) == 1);
+  requireSimulated(0x10800);
+  // A store to tohost.
+  executor.setHTIFAddresses(0x10F00, 0x10F08);
+  call(0x10820, 0x10EF0, 0, 0x20);
+  requireSimulated(0x10820);
+  // A cost beyond the cycle limit or the next device event.
+  executor.cycleLimit = state.cycleCount + 1 + 10 + 2 * 3;
+  call(0x10820, 0x10400, 0, 4);
+  requireSimulated(0x10820);
+  executor.cycleLimit = state.cycleCount + 1 + 10 + 2 * 3;
+  REQUIRE(call(0x10820, 0x10400, 0, 3) == 1 + 10 + 2 * 3);
+  REQUIRE(state.pc == 0x10004);
+  executor.cycleLimit = UINT64_MAX;
+  executor.events.wake(state.cycleCount + 5);
+  call(0x10820, 0x10400, 0, 4);
+  requireSimulated(0x10820);
+  executor.events.service(state.cycleCount);
+  // An observer of every instruction.
+  CountingObserver observer;
+  state.pc = 0x10000;
+  REQUIRE(executor.step<false>(observer));
+  REQUIRE(state.pc == 0x10820);
+}
+
+TEST_CASE("idle skipping", "[devices]") {
+  // Run a program with a CLINT and UART, until it takes the timer interrupt,
+  // with or without skipping idle time.
+  struct Run : TestHart<> {
+    rvsim::FileDescriptors fileDescs;
+    unsigned steps = 0;
+
+    Run(bool idleSkip, std::initializer_list<uint32_t> program) {
+      fileDescs.captureConsole("");
+      executor.bus.attach(std::make_unique<rvsim::Clint>(state, executor.events), memory);
+      executor.bus.attach(std::make_unique<rvsim::Uart>(state, executor.events, fileDescs),
+                          memory);
+      load(0x10000, program);
+      state.pc = 0x10000;
+      state.mtvec = 0x10100;
+      state.mie = rvsim::MIP_MTIP;
+      state.mstatus |= rvsim::MSTATUS_MIE;
+      executor.idleSkip = idleSkip;
+      while (state.pc != 0x10100 && steps < 100000) {
+        REQUIRE(executor.step<false>());
+        steps++;
+      }
+      REQUIRE(state.pc == 0x10100);
+      REQUIRE(state.mcause == (rvsim::MCAUSE_INTERRUPT | 7));
+    }
+  };
+  auto requireSame = [](Run &skipped, Run &stepped) {
+    REQUIRE(skipped.state.cycleCount == stepped.state.cycleCount);
+    REQUIRE(skipped.state.mepc == stepped.state.mepc);
+    for (unsigned index = 0; index < rvsim::NUM_REGISTERS; index++) {
+      REQUIRE(skipped.state.readReg(index) == stepped.state.readReg(index));
+    }
+  };
+
+  SECTION("line status polling") {
+    // Wait for input by polling the UART line status, until the timer
+    // interrupt at cycle 5000.
+    std::initializer_list<uint32_t> program = {
+      0x02004537, // lui x10, 0x2004
+      0x00001337, // lui x6, 1
+      0x38830313, // addi x6, x6, 904
+      0x00052223, // sw x0, 4(x10)
+      0x00652023, // sw x6, 0(x10)
+      0x100005B7, // lui x11, 0x10000
+      0x0055C283, // lbu x5, 5(x11)
+      0x0012F293, // andi x5, x5, 1
+      0xFE028CE3, // beq x5, x0, -8
+    };
+    Run skipped(true, program);
+    Run stepped(false, program);
+    requireSame(skipped, stepped);
+    REQUIRE(stepped.state.cycleCount == 5000);
+    REQUIRE(skipped.steps < 20);
+  }
+
+  SECTION("timer polling and WFI") {
+    // Poll mtime until it reaches 1000, which is stepped, then wait for the
+    // timer interrupt at cycle 4096. Without skipping, the WFI loop reaches
+    // that cycle just after a WFI, as it does with skipping.
+    std::initializer_list<uint32_t> program = {
+      0x02004537, // lui x10, 0x2004
+      0x0200C637, // lui x12, 0x200C
+      0x3E800313, // addi x6, x0, 1000
+      0xFF862283, // lw x5, -8(x12)
+      0xFE62EEE3, // bltu x5, x6, -4
+      0x00000013, // nop
+      0x00001337, // lui x6, 1
+      0x00052223, // sw x0, 4(x10)
+      0x00652023, // sw x6, 0(x10)
+      0x10500073, // wfi
+      0xFFDFF06F, // j -4
+    };
+    Run skipped(true, program);
+    Run stepped(false, program);
+    requireSame(skipped, stepped);
+    REQUIRE(stepped.state.cycleCount == 4096);
+    REQUIRE(stepped.state.readReg(rvsim::Register::x5) >= 1000);
+    REQUIRE(skipped.steps < 1100);
+  }
+}
+
+TEST_CASE("commit log", "[cosim]") {
+  rvsim::CommitRecord record;
+  REQUIRE(rvsim::parseCommitRecord(
+      "core   0: 3 0x80000004 (0x00a12023) mem 0x80001000 0x00000001\n", record));
+  REQUIRE(record.pc == 0x80000004);
+  REQUIRE(record.instruction == 0x00a12023);
+  REQUIRE(record.rd == -1);
+  REQUIRE(record.address == 0x80001000);
+  REQUIRE(record.value == 1);
+  REQUIRE(record.size == 4);
+  // A load logs only its address, and a CSR write is skipped.
+  REQUIRE(rvsim::parseCommitRecord(
+      "core   0: 3 0x80000008 (0x00012503) x10 0x0000002a mem 0x80001000", record));
+  REQUIRE(record.rd == 10);
+  REQUIRE(record.rdValue == 42);
+  REQUIRE(record.size == 0);
+  REQUIRE(rvsim::parseCommitRecord(
+      "core   0: 3 0x8000000c (0x30529073) c773_mtvec 0x80000100", record));
+  REQUIRE(record.rd == -1);
+  REQUIRE(record.size == 0);
+  REQUIRE_FALSE(rvsim::parseCommitRecord("Hello world", record));
+}
+
+TEST_CASE("co-simulation", "[cosim]") {
+  TempDirectory directory("cosim");
+  auto path = directory.file("program.elf");
+  writeElf(path, 0x3000, {
+    0x000022B7, // lui x5, 0x2 (tohost)
+    0x00003337, // lui x6, 0x3
+    0x00700593, // addi x11, x0, 7
+    0x02030513, // addi x10, x6, 0x20
+    0x00A2A023, // sw x10, 0(x5) (exit)
+    0x00000000,
+    0x00000000, 0x00000000,
+    rvsim::Syscall::EXIT, 0,
+  });
+  std::string log =
+      "core   0: 3 0x00003000 (0x000022b7) x5  0x00002000\n"
+      "core   0: 3 0x00003004 (0x00003337) x6  0x00003000\n"
+      "core   0: 3 0x00003008 (0x00700593) x11 0x00000007\n"
+      "core   0: 3 0x0000300c (0x02030513) x10 0x00003020\n"
+      "core   0: 3 0x00003010 (0x00a2a023) mem 0x00002000 0x00003020\n";
+  auto logPath = directory.file("commits.log");
+  std::ofstream(logPath) << log;
+  // Analyses still observe the run.
+  auto footprintPath = directory.file("footprint.txt");
+  std::string output;
+  REQUIRE(runDriver("--cosim " + logPath + " --footprint " + footprintPath + " " + path,
+                    output) == 0);
+  std::ifstream footprint(footprintPath);
+  std::string report((std::istreambuf_iterator<char>(footprint)),
+                     std::istreambuf_iterator<char>());
+  REQUIRE(report.find("0x2000-0x3fff") != std::string::npos);
+  // The first difference stops the run.
+  log.replace(log.find("x11 0x00000007"), 14, "x11 0x00000008");
+  std::ofstream(logPath) << log;
+  REQUIRE(runDriver("--cosim " + logPath + " " + path, output) == 1);
+  REQUIRE(output.find("divergence after 2 instructions") != std::string::npos);
+  REQUIRE(output.find("spike: core   0: 3 0x00003008 (0x00700593) x11 0x00000008") !=
+          std::string::npos);
+  REQUIRE(output.find("rvsim: core   0: 3 0x00003008 (0x00700593) x11 0x00000007") !=
+          std::string::npos);
+}
+
+TEST_CASE("simulator", "[simulator]") {
+  rvsim::SimulatorConfig config;
+  config.memSize = 0x1000;
+  rvsim::Simulator simulator(config);
+  simulator.captureConsole("");
+  simulator.getExecutor().setHTIFAddresses(0x10800, 0x10808);
+  uint32_t program[] = {
+    0x00A5A023, // sw x10, 0(x11)
+    0x00000063  // beq x0, x0, 0
+  };
+  uint64_t write[] = {64, 1, 0x10500, 3};
+  simulator.writeMemory(0x10000, program, sizeof(program));
+  simulator.writeMemory(0x10400, write, sizeof(write));
+  simulator.writeMemory(0x10500, "hi\n", 3);
+  simulator.writeRegister(10, 0x10400);
+  simulator.writeRegister(11, 0x10800);
+  simulator.writeRegister(rvsim::Register::pc, 0x10000);
+  // The loop never ends, so each run uses exactly its budget.
+  REQUIRE(simulator.run(10) == rvsim::StopReason::BUDGET);
+  REQUIRE(simulator.getState().cycleCount == 10);
+  REQUIRE(simulator.run(90) == rvsim::StopReason::BUDGET);
+  REQUIRE(simulator.getState().cycleCount == 100);
+  REQUIRE(simulator.readRegister(rvsim::Register::pc) == 0x10004);
+  REQUIRE(simulator.takeOutput(1) == "hi\n");
+  REQUIRE(simulator.takeOutput(1).empty());
+  REQUIRE_THROWS_AS(simulator.readMemory(0x11000, program, 4), rvsim::Exception);
+  simulator.reset();
+  REQUIRE(simulator.readRegister(rvsim::Register::pc) == 0);
+  REQUIRE(simulator.getState().cycleCount == 0);
+}
+
+TEST_CASE("C interface", "[simulator]") {
+  TempDirectory directory("capi");
+  auto path = directory.file("program.elf");
+  writeElf(path, 0x3000, {
+    0x000022B7, // lui x5, 0x2 (tohost)
+    0x00003337, // lui x6, 0x3
+    0x00A00593, // addi x11, x0, 10
+    0xFFF58593, // addi x11, x11, -1
+    0xFE059EE3, // bne x11, x0, -4
+    0x04030513, // addi x10, x6, 0x40
+    0x00A2A023, // sw x10, 0(x5) (exit)
+    0, 0, 0, 0, 0, 0, 0, 0, 0,
+    rvsim::Syscall::EXIT, 0, 7, 0,
+  });
+  std::ifstream file(path, std::ios::binary);
+  std::vector<char> image((std::istreambuf_iterator<char>(file)),
+                          std::istreambuf_iterator<char>());
+  auto *sim = rvsim_create(0x2000, 0x10000);
+  REQUIRE(sim != nullptr);
+  REQUIRE(rvsim_load_buffer(sim, image.data(), image.size()) == 0);
+  uint32_t value;
+  REQUIRE(rvsim_read_register(sim, RVSIM_REGISTER_PC, &value) == 0);
+  REQUIRE(value == 0x3000);
+  // The program runs for 25 instructions, so it is divided into slices.
+  REQUIRE(rvsim_run(sim, 10) == RVSIM_BUDGET);
+  REQUIRE(rvsim_cycle_count(sim) == 10);
+  REQUIRE(rvsim_read_register(sim, 11, &value) == 0);
+  REQUIRE(value == 6);
+  REQUIRE(rvsim_run(sim, 10) == RVSIM_BUDGET);
+  REQUIRE(rvsim_run(sim, 10) == RVSIM_EXITED);
+  REQUIRE(rvsim_cycle_count(sim) == 25);
+  REQUIRE(rvsim_exit_code(sim) == 7);
+  // After a reset, shorten the loop and replace the exit with an illegal
+  // instruction.
+  REQUIRE(rvsim_reset(sim) == 0);
+  REQUIRE(rvsim_cycle_count(sim) == 0);
+  uint32_t words[] = {0x00200593, 0};
+  REQUIRE(rvsim_write_memory(sim, 0x3008, &words[0], 4) == 0);
+  REQUIRE(rvsim_write_memory(sim, 0x3018, &words[1], 4) == 0);
+  REQUIRE(rvsim_read_memory(sim, 0x3008, &value, 4) == 0);
+  REQUIRE(value == 0x00200593);
+  REQUIRE(rvsim_write_register(sim, 20, 0x1234) == 0);
+  REQUIRE(rvsim_read_register(sim, 20, &value) == 0);
+  REQUIRE(value == 0x1234);
+  REQUIRE(rvsim_run(sim, 0) == RVSIM_TRAPPED);
+  REQUIRE(rvsim_cycle_count(sim) == 3 + 2 * 2 + 2);
+  // Failures are reported rather than thrown.
+  REQUIRE(std::string(rvsim_error(sim)).empty());
+  REQUIRE(rvsim_read_memory(sim, 0x20000, &value, 4) == -1);
+  REQUIRE_FALSE(std::string(rvsim_error(sim)).empty());
+  REQUIRE(rvsim_write_register(sim, 33, 0) == -1);
+  REQUIRE(rvsim_load_buffer(sim, "not an ELF file", 15) == -1);
+  REQUIRE_FALSE(std::string(rvsim_error(sim)).empty());
+  rvsim_destroy(sim);
+}
+
+TEST_CASE("image cache", "[simulator]") {
+  TempDirectory directory("image-cache");
+  rvsim::ImageCache cache(directory.getPath());
+  rvsim::Memory memory(0x10000, 0x4000);
+  rvsim::SymbolInfo symbolInfo;
+  memory.writeMemoryWord(0x10000, 0x00000013);
+  memory.writeMemoryWord(0x13ffc, 0xdeadbeef);
+  symbolInfo.addSymbol("_start", 0x10000, 0);
+  symbolInfo.addSymbol("tohost", 0x13000, 0);
+  rvsim::LoadedImage image = {0x10000, 0x13000, 0x13008, 0x12000};
+  auto hash = rvsim::hashImage("elf", 3);
+  rvsim::LoadedImage loaded;
+  rvsim::Memory other(0x10000, 0x4000);
+  rvsim::SymbolInfo otherSymbols;
+  REQUIRE_FALSE(cache.load(hash, other, otherSymbols, loaded));
+  cache.store(hash, memory, symbolInfo, image);
+  REQUIRE(cache.load(hash, other, otherSymbols, loaded));
+  REQUIRE(loaded.pc == 0x10000);
+  REQUIRE(loaded.fromHostAddress == 0x13008);
+  REQUIRE(loaded.programBreak == 0x12000);
+  REQUIRE(other.readMemoryWord(0x10000) == 0x00000013);
+  REQUIRE(other.readMemoryWord(0x12000) == 0);
+  REQUIRE(other.readMemoryWord(0x13ffc) == 0xdeadbeef);
+  REQUIRE(otherSymbols.getSymbol("tohost")->value == 0x13000);
+  // Writes to the mapped memory are private to it.
+  other.writeMemoryWord(0x10000, 1);
+  rvsim::Memory third(0x10000, 0x4000);
+  REQUIRE(cache.load(hash, third, otherSymbols, loaded));
+  REQUIRE(third.readMemoryWord(0x10000) == 0x00000013);
+  // A different memory layout is a different entry.
+  rvsim::Memory larger(0x10000, 0x8000);
+  REQUIRE_FALSE(cache.load(hash, larger, otherSymbols, loaded));
+}
+
+TEST_CASE_METHOD(TestHart<>, "basic block vectors", "[simpoint]") {
+  TempDirectory directory("bbv");
+  auto bbvPath = directory.file("test.bb");
+  auto checkpointPath = directory.file("test.ckp");
+  executor.setHTIFAddresses(0x10800, 0x10808);
+  load(0x10000, {
+    0x00128293, // addi x5, x5, 1
+    0xFE000EE3, // beq x0, x0, -4
+  });
+  state.pc = 0x10000;
+  {
+    // Blocks of two instructions, starting at the addi, in intervals of
+    // about five instructions.
+    rvsim::BasicBlockVectors bbv(bbvPath, 5, state);
+    while (state.cycleCount < 12) {
+      REQUIRE(executor.step<false>(bbv));
+    }
+    bbv.finish(state);
+    REQUIRE(bbv.getIntervalCount() == 3);
+  }
+  // Intervals end at the first block boundary after each multiple of five,
+  // and the last is partial.
+  requireLines(bbvPath, {"T:1:6 ", "T:1:4 ", "T:1:2 "});
+  // A checkpoint resumes with the same state and memory.
+  rvsim::saveCheckpoint(checkpointPath, executor);
+  TestHart<> restored;
+  rvsim::restoreCheckpoint(checkpointPath, restored.executor);
+  REQUIRE(restored.state.cycleCount == 12);
+  REQUIRE(restored.state.pc == state.pc);
+  REQUIRE(restored.state.readReg(rvsim::Register::x5) == 6);
+  REQUIRE(restored.executor.toHostAddress == 0x10800);
+  REQUIRE(restored.memory.readMemoryWord(0x10004) == 0xFE000EE3);
+  rvsim::Memory smaller(0x10000, 0x800);
+  rvsim::Executor mismatched(restored.state, smaller);
+  REQUIRE_THROWS_AS(rvsim::restoreCheckpoint(checkpointPath, mismatched), rvsim::Exception);
+}
+
+TEST_CASE_METHOD(TestHart<>, "interval statistics", "[stats]") {
+  REQUIRE(rvsim::parseStatsCounters("mix,pages") == (rvsim::STATS_MIX | rvsim::STATS_PAGES));
+  REQUIRE(rvsim::parseStatsCounters("all") == rvsim::STATS_ALL);
+  REQUIRE_THROWS_AS(rvsim::parseStatsCounters("mix,bogus"), rvsim::Exception);
+  TempDirectory directory("stats");
+  auto path = directory.file("stats.csv");
+  symbolInfo.addSymbol("main", 0x10000, 0);
+  symbolInfo.addSymbol("work", 0x10100, 0);
+  load(0x10000, {
+    0x00010113, // addi x2, x2, 0
+    0x0FC000EF, // jal x1, work
+  });
+  load(0x10100, {
+    0x00012503, // lw x10, 0(x2)
+    0xFE000EE3, // beq x0, x0, -4
+  });
+  state.pc = 0x10000;
+  state.writeReg(rvsim::Register::x2, 0x10800);
+  {
+    rvsim::IntervalStats stats(path, false, rvsim::parseStatsCounters("mix,function"), 4, state);
+    while (state.cycleCount < 10) {
+      REQUIRE(executor.step<false>(stats));
+    }
+    stats.finish(state);
+  }
+  requireLines(path, {"interval,cycle,instructions,alu,load,store,branch,jump,system,function",
+                      "0,0,4,1,1,0,1,1,0,work",
+                      "1,4,4,0,2,0,2,0,0,work",
+                      "2,8,2,0,1,0,1,0,0,work"});
+}
+
+TEST_CASE_METHOD(TestHart<>, "trace replay", "[replay]") {
+  REQUIRE_THROWS_AS(rvsim::createTimingModel("dcache:4k:3:64"), rvsim::Exception);
+  REQUIRE_THROWS_AS(rvsim::createTimingModel("tage:12"), rvsim::Exception);
+  TempDirectory directory("replay");
+  auto path = directory.file("program.trace");
+  load(0x10000, {
+    0x00010113, // addi x2, x2, 0
+    0x0FC000EF, // jal x1, 0x10100
+  });
+  load(0x10100, {
+    0x00012503, // lw x10, 0(x2)
+    0xFE000EE3, // beq x0, x0, -4
+  });
+  state.pc = 0x10000;
+  state.writeReg(rvsim::Register::x2, 0x10800);
+  {
+    rvsim::TraceRecorder recorder(path);
+    while (state.cycleCount < 10) {
+      REQUIRE(executor.step<false>(recorder));
+    }
+    recorder.finish();
+  }
+  rvsim::ReplayTrace trace(path);
+  REQUIRE(trace.size() == 10);
+  REQUIRE(trace.data()[1].flags == (rvsim::REPLAY_JUMP | rvsim::REPLAY_TAKEN));
+  REQUIRE(trace.data()[1].nextPc == 0x10100);
+  REQUIRE(trace.data()[2].flags == rvsim::REPLAY_LOAD);
+  REQUIRE(trace.data()[2].address == 0x10800);
+  REQUIRE(trace.data()[3].flags == (rvsim::REPLAY_BRANCH | rvsim::REPLAY_TAKEN));
+  std::vector<std::unique_ptr<rvsim::TimingModel>> models;
+  for (auto spec : {"icache:64:1:16", "dcache:1k:2:32", "bimodal:4", "gshare:4"}) {
+    models.push_back(rvsim::createTimingModel(spec));
+  }
+  rvsim::replayTimingModels(trace, models, 2);
+  auto &icache = static_cast<rvsim::CacheModel&>(*models[0]);
+  REQUIRE(icache.getAccesses() == 10);
+  REQUIRE(icache.getMisses() == 2);
+  auto &dcache = static_cast<rvsim::CacheModel&>(*models[1]);
+  REQUIRE(dcache.getAccesses() == 4);
+  REQUIRE(dcache.getMisses() == 1);
+  auto &bimodal = static_cast<rvsim::BranchPredictorModel&>(*models[2]);
+  REQUIRE(bimodal.getBranches() == 4);
+  REQUIRE(bimodal.getMispredictions() == 1);
+}
+
+TEST_CASE_METHOD(TestHart<>, "reuse distance", "[reuse]") {
+  rvsim::LruStack stack;
+  for (auto [line, distance] : std::vector<std::pair<uint32_t, uint64_t>>{
+         {1, rvsim::LruStack::COLD}, {2, rvsim::LruStack::COLD}, {3, rvsim::LruStack::COLD},
+         {3, 0}, {1, 2}, {2, 2}, {1, 1}}) {
+    REQUIRE(stack.access(line) == distance);
+  }
+  REQUIRE(stack.startWindow() == 3);
+  TempDirectory directory("reuse");
+  auto path = directory.file("reuse.csv");
+  auto workingSetPath = directory.file("working-set.csv");
+  symbolInfo.addSymbol("main", 0x10000, 0);
+  symbolInfo.addSymbol("work", 0x10100, 0);
+  load(0x10000, {
+    0x00010113, // addi x2, x2, 0
+    0x0FC000EF, // jal x1, work
+  });
+  load(0x10100, {
+    0x00012503, // lw x10, 0(x2)
+    0xFE000EE3, // beq x0, x0, -4
+  });
+  state.pc = 0x10000;
+  state.writeReg(rvsim::Register::x2, 0x10800);
+  REQUIRE_THROWS_AS(rvsim::ReuseDistance(path, "", "4,48", 0, state), rvsim::Exception);
+  {
+    rvsim::ReuseDistance reuse(path, workingSetPath, "4", 4, state);
+    while (state.cycleCount < 10) {
+      REQUIRE(executor.step<false>(reuse));
+    }
+    reuse.finish(state);
+  }
+  requireLines(path, {"kind,line_size,function,distance,count",
+                      "instruction,4,all,1,6",
+                      "instruction,4,all,cold,4",
+                      "instruction,4,main,cold,2",
+                      "instruction,4,work,1,6",
+                      "instruction,4,work,cold,2",
+                      "data,4,all,0,3",
+                      "data,4,all,cold,1",
+                      "data,4,work,0,3",
+                      "data,4,work,cold,1"});
+  requireLines(workingSetPath, {"window,cycle,instructions,instruction_lines_4,data_lines_4",
+                                "0,0,4,4,1",
+                                "1,4,4,2,1",
+                                "2,8,2,2,1"});
+}
+
+TEST_CASE_METHOD(TestHart<>, "data profile", "[profile]") {
+  TempDirectory directory("profile");
+  auto path = directory.file("profile.csv");
+  symbolInfo.addSymbol("table", 0x10800, rvsim::SYMBOL_TYPE_OBJECT, 16);
+  symbolInfo.addSymbol("table_alias", 0x10800, rvsim::SYMBOL_TYPE_OBJECT, 16);
+  symbolInfo.addSymbol("marker", 0x10e00, rvsim::SYMBOL_TYPE_OBJECT, 0);
+  load(0x10000, {
+    0x0001A503, // lw x10, 0(x3)
+    0x00A1A223, // sw x10, 4(x3)
+    0xFF010113, // addi x2, x2, -16
+    0x00A12023, // sw x10, 0(x2)
+    0x00120583, // lb x11, 1(x4)
+    0x0202A603, // lw x12, 32(x5)
+    0x0081A683, // lw x13, 8(x3)
+  });
+  state.pc = 0x10000;
+  state.writeReg(rvsim::Register::x2, 0x10a00);
+  state.writeReg(rvsim::Register::x3, 0x10800);
+  state.writeReg(rvsim::Register::x4, 0x10c00);
+  state.writeReg(rvsim::Register::x5, 0x10e00);
+  executor.initialBreak = 0x10c00;
+  executor.programBreak = 0x10d00;
+  REQUIRE_THROWS_AS(rvsim::DataProfile(path, 24, executor), rvsim::Exception);
+  {
+    rvsim::DataProfile profile(path, 4, executor);
+    while (state.cycleCount < 7) {
+      REQUIRE(executor.step<false>(profile));
+    }
+    profile.finish();
+  }
+  requireLines(path, {"object,address,size,reads,writes,bytes_read,bytes_written,lines",
+                      "table,0x10800,16,2,1,8,4,3",
+                      "[stack],,,0,1,0,4,1",
+                      "[heap],,,1,0,1,0,1",
+                      "[other],,,1,0,4,0,1"});
+}
+
+TEST_CASE_METHOD(TestHart<0x2000>, "footprint", "[footprint]") {
+  TempDirectory directory("footprint");
+  auto path = directory.file("footprint.txt");
+  symbolInfo.addSymbol("main", 0x10000, 0);
+  symbolInfo.addSymbol("work", 0x10100, 0);
+  symbolInfo.addSymbol("stack_top", 0x10a00, 0);
+  load(0x10000, {
+    0xFF010113, // addi x2, x2, -16
+    0x00A12023, // sw x10, 0(x2)
+    0x0F8000EF, // jal x1, work
+  });
+  load(0x10100, {
+    0xFE010113, // addi x2, x2, -32
+    0x0001A503, // lw x10, 0(x3)
+  });
+  state.pc = 0x10000;
+  state.writeReg(rvsim::Register::x2, 0x10a00);
+  state.writeReg(rvsim::Register::x3, 0x11800);
+  {
+    rvsim::Footprint footprint(path, 0x109d8, executor);
+    for (int i = 0; i < 3; i++) {
+      REQUIRE(executor.step<false>(footprint));
+    }
+    REQUIRE_THROWS_AS(executor.step<false>(footprint), rvsim::Exception);
+    REQUIRE(footprint.getStackTop() == 0x10a00);
+    REQUIRE(footprint.getLowestStackPointer() == 0x109d0);
+  }
+  std::ifstream file(path);
+  std::vector<std::string> lines;
+  for (std::string line; std::getline(file, line);) {
+    lines.push_back(line);
+  }
+  REQUIRE(lines.size() == 12);
+  REQUIRE(lines[1] == "Lowest sp:        0x000109d0");
+  REQUIRE(lines[2] == "Peak stack depth: 48 bytes");
+  REQUIRE(lines[6] == "stack    0x00010000 0x00010a00      1        1  0x10000-0x10fff");
+  REQUIRE(lines[7] == "memory   0x00010000 0x00012000      2        1  0x10000-0x10fff");
+  REQUIRE(lines[10] == "work                                   48");
+  REQUIRE(lines[11] == "main                                   16");
+}
+
+TEST_CASE_METHOD(TestHart<>, "region of interest", "[roi]") {
+  TempDirectory directory("roi");
+  auto bbvPath = directory.file("test.bb");
+  load(0x10000, {
+    0x00128293, // addi x5, x5, 1
+    0xFE000EE3, // beq x0, x0, -4
+  });
+  state.pc = 0x10000;
+  {
+    rvsim::BasicBlockVectors bbv(bbvPath, 5, state);
+    auto stepUntil = [&](uint64_t cycle, bool observed) {
+      while (state.cycleCount < cycle) {
+        REQUIRE((observed ? executor.step<false>(bbv) : executor.step<false>()));
+      }
+    };
+    // The cycles outside of the region are not counted towards an interval.
+    stepUntil(4, true);
+    bbv.control(state, rvsim::Control::ROI_END);
+    stepUntil(10, false);
+    bbv.control(state, rvsim::Control::ROI_BEGIN);
+    stepUntil(14, true);
+    // A dump ends the interval early, and a reset discards the cycles so far.
+    bbv.control(state, rvsim::Control::STATS_DUMP);
+    stepUntil(15, true);
+    bbv.control(state, rvsim::Control::STATS_RESET);
+    stepUntil(16, true);
+    bbv.finish(state);
+    REQUIRE(bbv.getIntervalCount() == 3);
+  }
+  requireLines(bbvPath, {"T:1:6 ", "T:1:2 ", "T:1:1 "});
+}
+
+TEST_CASE("region of interest hypercalls", "[roi]") {
+  TempDirectory directory("roi-hypercalls");
+  auto path = directory.file("program.elf");
+  writeElf(path, 0x3000, {
+    0x000022B7, // lui x5, 0x2 (tohost)
+    0x00003337, // lui x6, 0x3
+    0x08030513, // addi x10, x6, 0x80
+    0x00A2A023, // sw x10, 0(x5) (ROI begin)
+    0x08830513, // addi x10, x6, 0x88
+    0x00A2A023, // sw x10, 0(x5) (trace start)
+    0x00A585B3, // add x11, x11, x10
+    0x09030513, // addi x10, x6, 0x90
+    0x00A2A023, // sw x10, 0(x5) (trace stop)
+    0x09830513, // addi x10, x6, 0x98
+    0x00A2A023, // sw x10, 0(x5) (ROI end)
+    0x00A60633, // add x12, x12, x10
+    0x0A030513, // addi x10, x6, 0xA0
+    0x00A2A023, // sw x10, 0(x5) (exit)
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    rvsim::Syscall::ROI_BEGIN, 0,
+    rvsim::Syscall::TRACE_START, 0,
+    rvsim::Syscall::TRACE_STOP, 0,
+    rvsim::Syscall::ROI_END, 0,
+    rvsim::Syscall::EXIT, 0,
+  });
+  // The trace holds the instructions after the start call up to the stop
+  // call, and the basic block vector the seven after the ROI begin call up
+  // to the ROI end call.
+  auto bbvPath = directory.file("program.bb");
+  std::string output;
+  REQUIRE(runDriver("--trace-from hypercall --roi --bbv " + bbvPath + " --bbv-interval 100 " +
+                    path, output) == 0);
+  REQUIRE(tracedAddresses(output) == std::vector<uint32_t>{0x3018, 0x301C, 0x3020});
+  requireLines(bbvPath, {"T:1:7 "});
+}
+
+TEST_CASE_METHOD(TestHart<>, "ILP limits", "[ilp]") {
+  TempDirectory directory("ilp");
+  auto path = directory.file("ilp.csv");
+  REQUIRE_THROWS_AS(rvsim::IlpLimits(path, "16,x", ""), rvsim::Exception);
+  REQUIRE_THROWS_AS(rvsim::IlpLimits(path, "16", "mul=3"), rvsim::Exception);
+  load(0x10000, {
+    0x00100293, // addi x5, x0, 1
+    0x00128313, // addi x6, x5, 1
+    0x00200393, // addi x7, x0, 2
+    0x00612023, // sw x6, 0(x2)
+    0x00012403, // lw x8, 0(x2)
+    0x007404B3, // add x9, x8, x7
+  });
+  state.pc = 0x10000;
+  state.writeReg(rvsim::Register::x2, 0x10800);
+  {
+    rvsim::IlpLimits ilp(path, "1,2,0", "load=2");
+    for (int i = 0; i < 6; i++) {
+      REQUIRE(executor.step<false>(ilp));
+    }
+    // In order, one at a time, the load takes two cycles. With a window of
+    // two, the independent addi overlaps the chain through memory.
+    REQUIRE(ilp.getCriticalPath(0) == 7);
+    REQUIRE(ilp.getCriticalPath(1) == 6);
+    REQUIRE(ilp.getCriticalPath(2) == 6);
+    ilp.finish();
+  }
+  requireLines(path, {"window,instructions,critical_path,ipc",
+                      "1,6,7,0.857",
+                      "2,6,6,1.000",
+                      "unlimited,6,6,1.000"});
+}
+
+TEST_CASE_METHOD(TestHart<>, "ahead of time translation", "[aot]") {
+  load(0x10000, {
+    0x00128293, // addi x5, x5, 1
+    0xFE000EE3, // beq x0, x0, -4
+    0x008000EF, // jal x1, 8
+    0x00000000, // illegal
+    0x00008067, // jalr x0, 0(x1)
+  });
+  // The loop, the block after it and the call's target are found, but not
+  // the illegal instruction at the return address.
+  auto blocks = rvsim::discoverBlocks(memory, symbolInfo, 0x10000);
+  REQUIRE(blocks.size() == 3);
+  REQUIRE(blocks[0].pc == 0x10000);
+  REQUIRE(blocks[0].instructions.size() == 2);
+  REQUIRE(blocks[1].pc == 0x10008);
+  REQUIRE(blocks[2].pc == 0x10010);
+  // Stepping a decoded instruction matches the interpreter.
+  rvsim::HartState otherState(symbolInfo);
+  rvsim::Executor other(otherState, memory);
+  state.pc = 0x10000;
+  otherState.pc = 0x10000;
+  for (int i = 0; i < 7; i++) {
+    REQUIRE(executor.stepDecoded(memory.readMemoryWord(state.pc)));
+    REQUIRE(other.step<false>());
+    REQUIRE(state.pc == otherState.pc);
+    REQUIRE(state.cycleCount == otherState.cycleCount);
+    REQUIRE(state.readReg(rvsim::Register::x5) == otherState.readReg(rvsim::Register::x5));
+  }
+}
+
+// The step of an instruction within a translated block, as written by
+// writeTranslation.
+#define STEP(address, instruction) \
+  if (!executor.stepDecoded(instruction) || executor.state.pc != (address) + 4 || \
+      executor.state.cycleCount >= executor.cycleLimit) { \
+    return; \
+  }
+
+TEST_CASE("translated program", "[aot]") {
+  TempDirectory directory("translated");
+  auto path = directory.file("program.elf");
+  writeElf(path, 0x3000, {
+    0x000022B7, // lui x5, 0x2 (tohost)
+    0x00003337, // lui x6, 0x3
+    0x00500593, // addi x11, x0, 5
+    0x00360613, // addi x12, x12, 3
+    0xFFF58593, // addi x11, x11, -1
+    0xFE059CE3, // bne x11, x0, -8
+    0x0000100F, // fence.i
+    0x00160693, // addi x13, x12, 1
+    0x04D32423, // sw x13, 0x48(x6) (exit code)
+    0x04030513, // addi x10, x6, 0x40
+    0x00A2A023, // sw x10, 0(x5) (exit)
+    0, 0, 0, 0, 0,
+    rvsim::Syscall::EXIT, 0, 0, 0,
+  });
+  std::ifstream file(path, std::ios::binary);
+  std::vector<unsigned char> image((std::istreambuf_iterator<char>(file)),
+                                   std::istreambuf_iterator<char>());
+  // The translation of the loop leaves the block when an instruction does
+  // not continue to the next, and stops short of the fence.i.
+  rvsim::SimulatorConfig config;
+  config.memBase = 0x2000;
+  rvsim::Simulator simulator(config);
+  simulator.loadBuffer(image.data(), image.size(), "program");
+  auto blocks = rvsim::discoverBlocks(simulator.getMemory(), simulator.getSymbolInfo(), 0x3000);
+  REQUIRE(blocks.size() == 2);
+  REQUIRE(blocks[0].pc == 0x3000);
+  REQUIRE(blocks[0].instructions.size() == 6);
+  REQUIRE(blocks[1].pc == 0x300C);
+  std::ostringstream source;
+  rvsim::writeTranslation(source, blocks, simulator.getSymbolInfo(),
+                          std::vector<char>(image.begin(), image.end()), "program", 0x2000,
+                          0x10000);
+  REQUIRE(source.str().find("executor.state.cycleCount >= executor.cycleLimit") !=
+          std::string::npos);
+  REQUIRE(source.str().find("static void block_0000300c(rvsim::Executor &executor) {\n"
+                            "  STEP(0x0000300c, 0x00360613); // addi x12, x12, 3\n"
+                            "  STEP(0x00003010, 0xfff58593); // addi x11, x11, -1\n"
+                            "  executor.stepDecoded(0xfe059ce3); // bne x11, x0, -8\n"
+                            "}\n") != std::string::npos);
+
+  // The same blocks, compiled into the test, and one after the fence.i that
+  // is never reached through the translation.
+  static unsigned calls[3];
+  calls[0] = calls[1] = calls[2] = 0;
+  static const rvsim::TranslatedBlock translated[] = {
+    {0x3000, [](rvsim::Executor &executor) {
+      calls[0]++;
+      STEP(0x3000, 0x000022B7);
+      STEP(0x3004, 0x00003337);
+      STEP(0x3008, 0x00500593);
+      STEP(0x300C, 0x00360613);
+      STEP(0x3010, 0xFFF58593);
+      executor.stepDecoded(0xFE059CE3);
+    }},
+    {0x300C, [](rvsim::Executor &executor) {
+      calls[1]++;
+      STEP(0x300C, 0x00360613);
+      STEP(0x3010, 0xFFF58593);
+      executor.stepDecoded(0xFE059CE3);
+    }},
+    {0x301C, [](rvsim::Executor &) { calls[2]++; }},
+  };
+  rvsim::TranslatedProgram program = {"program", image.data(), image.size(), 0x2000, 0x10000,
+                                      translated, 3};
+  // Run the program with the verbose report, which ends with the cycles and
+  // the steps interpreted, returning the exit code.
+  std::string report;
+  auto run = [&](std::initializer_list<const char*> arguments) {
+    std::vector<const char*> argv = {"program", "-v"};
+    argv.insert(argv.end(), arguments);
+    std::ostringstream out;
+    auto *previous = std::cout.rdbuf(out.rdbuf());
+    int exitCode = rvsim::runTranslated(program, argv.size(), argv.data());
+    std::cout.rdbuf(previous);
+    rvsim::Config::getInstance().verbose = false;
+    report = out.str();
+    return exitCode;
+  };
+  // The loop runs translated, and the rest is interpreted from the fence.i.
+  REQUIRE(run({"--interpret"}) == 16);
+  REQUIRE(report.ends_with("Interpreted 23 steps of 23 cycles\n"));
+  REQUIRE(run({}) == 16);
+  REQUIRE(report.ends_with("Interpreted 5 steps of 23 cycles\n"));
+  REQUIRE(calls[0] == 1);
+  REQUIRE(calls[1] == 4);
+  REQUIRE(calls[2] == 0);
+  // The cycle limit stops the run in the middle of a block.
+  REQUIRE(run({"--interpret", "--max-cycles", "10"}) == 0);
+  REQUIRE(report.ends_with("Interpreted 10 steps of 10 cycles\n"));
+  REQUIRE(run({"--max-cycles", "10"}) == 0);
+  REQUIRE(report.ends_with("Interpreted 0 steps of 10 cycles\n"));
+  // A trap also leaves the block, at the trap handler.
+  auto &executor = simulator.getExecutor();
+  auto &state = simulator.getState();
+  state.pc = 0x3000;
+  state.mtvec = 0x3028;
+  [](rvsim::Executor &executor) {
+    STEP(0x3000, 0x00002383); // lw x7, 0(x0)
+    STEP(0x3004, 0x00138393); // addi x7, x7, 1
+  }(executor);
+  REQUIRE(state.pc == 0x3028);
+  REQUIRE(state.cycleCount == 1);
+  REQUIRE(state.readReg(rvsim::Register::x7) == 0);
+}
+
+#undef STEP
+
+TEST_CASE_METHOD(TestHart<0x10000>, "paging", "[mmu]") {
+  executor.setHTIFAddresses(0x10800, 0x10808);
+  // The root table at 0x11000 points to a table at 0x12000, which maps the
+  // code page for U-mode at 0x10000 and for S-mode at 0x30000, and a data
+  // page at 0x20000 to 0x13000.
+  memory.writeMemoryWord(0x11000, (0x12 << 10) | rvsim::PTE_V);
+  memory.writeMemoryWord(0x12040, (0x10 << 10) | rvsim::PTE_V | rvsim::PTE_R |
+                                  rvsim::PTE_X | rvsim::PTE_U);
+  memory.writeMemoryWord(0x120C0, (0x10 << 10) | rvsim::PTE_V | rvsim::PTE_R | rvsim::PTE_X);
+  memory.writeMemoryWord(0x12080, (0x13 << 10) | rvsim::PTE_V | rvsim::PTE_R |
+                                  rvsim::PTE_W | rvsim::PTE_U);
+  load(0x10000, {
+    0x00B52223, // sw x11, 4(x10)
+    0x00452603, // lw x12, 4(x10)
+    0x0005A683, // lw x13, 0(x11)
+  });
+  load(0x10100, {0x30200073}); // mret
+  load(0x10200, {
+    0x12000073, // sfence.vma
+    0x10200073, // sret
+  });
+  state.pc = 0x10000;
+  state.mtvec = 0x10100;
+  state.stvec = 0x30200;
+  state.satp = rvsim::SATP_MODE | 0x11;
+  state.privilege = rvsim::Privilege::USER;
+  state.writeReg(rvsim::Register::x10, 0x20000);
+  state.writeReg(rvsim::Register::x11, 0x400);
+  // The store sets the A and D bits, so that the load hits in the TLB.
+  REQUIRE(executor.step<false>());
+  REQUIRE(memory.readMemoryWord(0x13004) == 0x400);
+  REQUIRE((memory.readMemoryWord(0x12080) & (rvsim::PTE_A | rvsim::PTE_D)) ==
+          (rvsim::PTE_A | rvsim::PTE_D));
+  REQUIRE(executor.step<false>());
+  REQUIRE(state.readReg(rvsim::Register::x12) == 0x400);
+  REQUIRE(executor.mmu.walks == 2);
+  // An unmapped address raises a page fault in M-mode, which returns to U-mode.
+  REQUIRE(executor.step<false>());
+  REQUIRE(state.pc == 0x10100);
+  REQUIRE(state.mcause == static_cast<uint32_t>(rvsim::Trap::LOAD_PAGE_FAULT));
+  REQUIRE(state.mtval == 0x400);
+  REQUIRE(state.privilege == rvsim::Privilege::MACHINE);
+  REQUIRE(executor.step<false>());
+  REQUIRE(state.pc == 0x10008);
+  REQUIRE(state.privilege == rvsim::Privilege::USER);
+  // Once delegated, it is taken in S-mode, whose handler only sees a
+  // remapped page after sfence.vma.
+  state.medeleg = 1 << static_cast<uint32_t>(rvsim::Trap::LOAD_PAGE_FAULT);
+  REQUIRE(executor.step<false>());
+  REQUIRE(state.pc == 0x30200);
+  REQUIRE(state.scause == static_cast<uint32_t>(rvsim::Trap::LOAD_PAGE_FAULT));
+  REQUIRE(state.stval == 0x400);
+  REQUIRE(state.sepc == 0x10008);
+  REQUIRE(state.privilege == rvsim::Privilege::SUPERVISOR);
+  memory.writeMemoryWord(0x12080, (0x14 << 10) | rvsim::PTE_V | rvsim::PTE_R | rvsim::PTE_U);
+  memory.writeMemoryWord(0x14004, 7);
+  REQUIRE(executor.step<false>());
+  REQUIRE(executor.step<false>());
+  REQUIRE(state.pc == 0x10008);
+  REQUIRE(state.privilege == rvsim::Privilege::USER);
+  state.pc = 0x10004;
+  REQUIRE(executor.step<false>());
+  REQUIRE(state.readReg(rvsim::Register::x12) == 7);
+  // The page is now read-only.
+  state.pc = 0x10000;
+  REQUIRE(executor.step<false>());
+  REQUIRE(state.pc == 0x10100);
+  REQUIRE(state.mcause == static_cast<uint32_t>(rvsim::Trap::STORE_PAGE_FAULT));
+}
+
+TEST_CASE_METHOD(TestHart<>, "lanes", "[lanes]") {
+  // Each lane sums a data-dependent series, stores the sum to its own word
+  // and exits with it, except for one lane whose store is misaligned.
+  auto setup = [](TestHart<> &hart) {
+    hart.executor.setHTIFAddresses(0x10F00, 0x10F08);
+    hart.load(0x10000, {
+      0x00000613, // addi x12, x0, 0
+      0x00050E63, // loop: beq x10, x0, done
+      0x00157693, // andi x13, x10, 1
+      0x00068463, // beq x13, x0, even
+      0x00A60633, // add x12, x12, x10
+      0x00160613, // even: addi x12, x12, 1
+      0xFFF50513, // addi x10, x10, -1
+      0xFE9FF06F, // jal x0, loop
+      0x00C5A023, // done: sw x12, 0(x11)
+      0x00C72423, // sw x12, 8(x14)
+      0x00E7A023, // sw x14, 0(x15)
+    });
+    hart.memory.writeMemoryWord(0x10900, rvsim::Syscall::EXIT);
+    hart.state.pc = 0x10000;
+    hart.state.writeReg(rvsim::Register::x14, 0x10900);
+    hart.state.writeReg(rvsim::Register::x15, 0x10F00);
+  };
+  auto input = [](size_t lane) { return static_cast<uint32_t>(lane * 7 % 23); };
+  auto output = [](size_t lane) { return lane == 5 ? 0x10802 : 0x10800 + lane * 4; };
+  setup(*this);
+  const size_t count = 20;
+  rvsim::LaneExecutor lanes(executor, count);
+  REQUIRE(lanes.size() == count);
+  for (size_t lane = 0; lane < count; lane++) {
+    lanes.writeReg(lane, rvsim::Register::x10, input(lane));
+    lanes.writeReg(lane, rvsim::Register::x11, output(lane));
+  }
+  lanes.run();
+  uint64_t cycles = 0;
+  for (size_t lane = 0; lane < count; lane++) {
+    TestHart<> scalar;
+    setup(scalar);
+    scalar.state.writeReg(rvsim::Register::x10, input(lane));
+    scalar.state.writeReg(rvsim::Register::x11, output(lane));
+    while (scalar.executor.step<false>()) {
+    }
+    REQUIRE(lanes.getStatus(lane) == scalar.executor.status);
+    REQUIRE(lanes.getExitCode(lane) == scalar.executor.exitCode);
+    REQUIRE(lanes.getPc(lane) == scalar.state.pc);
+    REQUIRE(lanes.getCycleCount(lane) == scalar.state.cycleCount);
+    for (unsigned index = 0; index < rvsim::NUM_REGISTERS; index++) {
+      REQUIRE(lanes.readReg(lane, index) == scalar.state.readReg(index));
+    }
+    uint32_t sum;
+    lanes.readMemory(lane, 0x10800 + lane * 4, &sum, sizeof(sum));
+    REQUIRE(sum == scalar.memory.readMemoryWord(0x10800 + lane * 4));
+    REQUIRE(lanes.isScalar(lane) == (lane == 5));
+    cycles += scalar.state.cycleCount;
+  }
+  REQUIRE(lanes.getStatus(5) == rvsim::Status::TRAPPED);
+  REQUIRE(lanes.getExitCode(3) == 142);
+  // The lanes stepped together, and wrote only their own copies of memory.
+  REQUIRE(lanes.getGroupSteps() < cycles / 2);
+  REQUIRE(memory.readMemoryWord(0x10804) == 0);
+}
+
+TEST_CASE_METHOD(TestHart<0x4000>, "fuzz harness", "[fuzz]") {
+  executor.setHTIFAddresses(0x10300, 0x10308);
+  // Count the runs in memory, trap if the input begins with 'A' and
+  // otherwise exit with the count.
+  load(0x10000, {
+    0x000112B7, // lui x5, 0x11
+    0x0002A303, // lw x6, 0(x5)
+    0x00130313, // addi x6, x6, 1
+    0x0062A023, // sw x6, 0(x5)
+    0x000123B7, // lui x7, 0x12
+    0x0003C403, // lbu x8, 0(x7)
+    0x04100493, // addi x9, x0, 65
+    0x00941463, // bne x8, x9, ok
+    0x00002003, // lw x0, 0(x0)
+    0x00010537, // ok: lui x10, 0x10
+    0x20050513, // addi x10, x10, 0x200
+    0x00652423, // sw x6, 8(x10)
+    0x10050593, // addi x11, x10, 0x100
+    0x00A5A023, // sw x10, 0(x11)
+  });
+  memory.writeMemoryWord(0x10200, rvsim::Syscall::EXIT);
+  state.pc = 0x10000;
+  symbolInfo.addSymbol("main", 0x10000, 0);
+  symbolInfo.addSymbol("fuzz_input", 0x12000, 0, 16);
+  std::vector<uint8_t> bitmap(rvsim::FUZZ_MAP_SIZE);
+  rvsim::FuzzHarness harness(executor, symbolInfo, "main", "fuzz_input", 0, "", 1000,
+                             bitmap.data());
+  REQUIRE(harness.getBufferSize() == 16);
+  // Each run starts from the snapshot, having written the code's page, the
+  // counter's and the input's.
+  const uint8_t other[] = {'B'};
+  for (int run = 0; run < 2; run++) {
+    REQUIRE(harness.run(other, sizeof(other)) == rvsim::FuzzOutcome::EXITED);
+    REQUIRE(executor.exitCode == 1);
+    REQUIRE(harness.getSnapshot().getDirtyPages() == 3);
+  }
+  REQUIRE(std::count_if(bitmap.begin(), bitmap.end(), [](uint8_t count) { return count; }) == 1);
+  REQUIRE(std::accumulate(bitmap.begin(), bitmap.end(), 0) == 2);
+  const uint8_t crash[] = {'A', 'B'};
+  REQUIRE(harness.run(crash, sizeof(crash)) == rvsim::FuzzOutcome::TRAPPED);
+  REQUIRE(std::count_if(bitmap.begin(), bitmap.end(), [](uint8_t count) { return count; }) == 2);
+  REQUIRE(harness.run(other, sizeof(other)) == rvsim::FuzzOutcome::EXITED);
+  REQUIRE(executor.exitCode == 1);
+  REQUIRE(memory.readMemoryByte(0x12001) == 0);
+}